@@ -26,3 +26,13 @@ creation_unix_time_ms ubigint,
 
 );
 
+
+-- one row per keyframe (flags = 1) in log, so seeking does not need to
+-- scan log
+create table if not exists keyframes (
+
+topic varchar,
+message_id ubigint,
+this_process_time_us ubigint,
+
+);
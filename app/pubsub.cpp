@@ -1,5 +1,7 @@
 #include "pubsub.h"
 
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <thread>
@@ -27,6 +29,30 @@ SubscriberBuffer recorder_buffer_;
 std::optional<Recorder> recorder_;
 std::atomic<bool> is_recording_{false};
 
+// at most one of recorder_ and flight_recorder_ is set
+// shared with the dump thread, which reads the ring without the lock
+std::shared_ptr<FlightRecorder> flight_recorder_;
+std::string flight_recorder_log_dir_;
+std::atomic<bool> is_flight_recording_{false};
+std::thread flight_recorder_dump_thread_;
+bool flight_recorder_dump_in_progress_ = false;
+// log names of triggers that came in during a dump
+std::deque<std::string> flight_recorder_pending_dumps_;
+std::atomic<bool> flight_recorder_dump_subscribed_{false};
+
+// called from both the publisher and subscriber threads
+std::mutex recording_filter_mutex_;
+RecordingFilter recording_filter_;
+bool should_record(std::string_view topic, const MessageHeader& header) {
+    // dump triggers must reach the recorder thread regardless of the
+    // recording rules
+    if (is_flight_recording_ && topic == flight_recorder_dump_topic) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock{recording_filter_mutex_};
+    return recording_filter_.should_record(topic, header);
+}
+
 std::optional<zmq::context_t> zmq_ctx_;
 void ensure_ctx_initted() {
     if (!zmq_ctx_) {
@@ -50,13 +76,21 @@ struct PublisherRequest {
 
     // if bind_address is nonempty, then publish thread will issue publisher_socket_.bind();
     std::string bind_address;
+
+    // likewise publisher_socket_.connect()
+    std::string connect_address;
 };
 std::atomic<bool> publisher_requests_clear_ { false };
 void publisher_requests_clear() {
     publisher_requests_clear_ = true;
 };
 std::mutex publish_requests_mutex_;
-RingBuffer<PublisherRequest, 1024> publisher_requests_;
+RingBuffer<PublisherRequest, publish_queue_capacity + 1> publisher_requests_;
+static_assert(decltype(publisher_requests_)::capacity ==
+              publish_queue_capacity);
+int get_num_pending_publish_requests() {
+    return publisher_requests_.num_slots_filled();
+}
 std::thread publisher_thread_;
 void run_publisher_thread() {
     CHECK(zmq_ctx_);
@@ -85,6 +119,15 @@ void run_publisher_thread() {
                 publisher_socket.bind(request.bind_address);
             }
 
+            if (!request.connect_address.empty()) {
+                CHECK(request.topic.empty())
+                    << "connect address mutually exclusive with topic";
+                LOG_IF(INFO, debug_publisher)
+                    << "Publisher socket connecting to "
+                    << request.connect_address;
+                publisher_socket.connect(request.connect_address);
+            }
+
             if (!request.topic.empty()) {
                 // send topic
                 LOG_IF(INFO, debug_publisher)
@@ -122,7 +165,7 @@ void run_publisher_thread() {
                     publisher_socket.send(std::move(frame_copy), send_flags);
                 }
 
-                if (is_recording_) {
+                if (is_recording_ && should_record(request.topic, header)) {
                     Message message;
                     message.header = header;
                     message.topic = request.topic;
@@ -150,6 +193,7 @@ struct SubscriberRequest {
     std::optional<std::string> subscribe_topic;
 
     std::string connect_address;
+    std::string bind_address;
 
     // if subscribe_topic is nonempty, subscribe_buffer or subscribe
     // item should point to a valid buffer
@@ -165,6 +209,69 @@ struct SubscriberOutput {
     SubscriberItem* item = nullptr;
 };
 
+// the subscriber thread keeps its own copy of the subscriptions. this
+// one is for deliver_local()
+std::mutex local_subscriber_outputs_mutex_;
+std::vector<std::pair<std::string, SubscriberOutput>> local_subscriber_outputs_;
+
+// writes out the dump, then the dumps triggered while it was written
+void run_flight_recorder_dumps(std::shared_ptr<FlightRecorder> flight_recorder,
+                               FlightRecorderDump dump,
+                               std::string log_dir,
+                               std::string log_name) {
+    while (true) {
+        LOG(INFO) << "Dumping " << dump.entries.size()
+                  << " messages from flight recorder";
+        {
+            Recorder recorder(log_dir, log_name);
+            for (const auto& entry : dump.entries) {
+                recorder.append_row(dump.get_topic(entry), entry.header,
+                                    entry.this_process_time_us,
+                                    flight_recorder->get_frames_cbor(entry));
+                flight_recorder->mark_dumped(entry);
+            }
+        }
+        LOG(INFO) << "Flight recorder dump finished";
+
+        std::lock_guard<std::mutex> lock{recorder_mutex_};
+        flight_recorder->end_dump();
+        if (flight_recorder_pending_dumps_.empty()) {
+            flight_recorder_dump_in_progress_ = false;
+            return;
+        }
+        flight_recorder = flight_recorder_;
+        dump = flight_recorder->begin_dump();
+        log_dir = flight_recorder_log_dir_;
+        log_name = std::move(flight_recorder_pending_dumps_.front());
+        flight_recorder_pending_dumps_.pop_front();
+    }
+}
+
+// call with recorder_mutex_ held
+void start_flight_recorder_dump(const Message& trigger) {
+    CHECK(flight_recorder_);
+    std::string log_name;
+    if (!trigger.frames.empty()) {
+        log_name = trigger.frames[0].to_string();
+    }
+
+    // the dump thread reads the ring in place, so a second dump has to
+    // wait for it
+    if (flight_recorder_dump_in_progress_) {
+        flight_recorder_pending_dumps_.push_back(std::move(log_name));
+        return;
+    }
+    if (flight_recorder_dump_thread_.joinable()) {
+        flight_recorder_dump_thread_.join();
+    }
+
+    flight_recorder_dump_in_progress_ = true;
+    flight_recorder_dump_thread_ =
+        std::thread{run_flight_recorder_dumps, flight_recorder_,
+                    flight_recorder_->begin_dump(), flight_recorder_log_dir_,
+                    std::move(log_name)};
+}
+
 std::thread recorder_thread_;
 void run_recorder_thread() {
     FrequencyCalculator bytes_per_sec_calculator;
@@ -174,7 +281,13 @@ void run_recorder_thread() {
 
         {
             std::lock_guard<std::mutex> lock{recorder_mutex_};
-            if (!recorder_) {
+            if (flight_recorder_) {
+                if (message.topic == flight_recorder_dump_topic) {
+                    start_flight_recorder_dump(message);
+                } else {
+                    flight_recorder_->append(message, get_process_time_us());
+                }
+            } else if (!recorder_) {
                 // the recorder has not been initialized yet. drop this message
                 continue;
             } else {
@@ -195,6 +308,56 @@ void run_recorder_thread() {
     // flush
 }
 
+// copies the message to each output subscribed to a prefix of its
+// topic, and to the recorder
+void route_message(
+    std::string_view topic,
+    const MessageHeader& header,
+    std::vector<zmq::message_t>& frames,
+    const std::vector<std::pair<std::string, SubscriberOutput>>&
+        subscriber_outputs) {
+    auto MakeMessage = [&]() {
+        Message message;
+        message.header = header;
+        message.topic = topic;
+        for (auto& frame : frames) {
+            zmq::message_t frame_copy;
+            frame_copy.copy(frame);
+            message.frames.push_back(std::move(frame_copy));
+        }
+        return message;
+    };
+
+    // route the message to the correct output buffers by topic prefix
+    for (const auto& [topic_prefix, output] : subscriber_outputs) {
+        if (topic.starts_with(topic_prefix)) {
+            if (output.buffer) {
+                if (!output.buffer->move_write(MakeMessage())) {
+                    // this subscriber buffer is full. log warning?
+                    LOG(WARNING) << "subscriber buffer for topic " << topic
+                                 << " is full";
+                }
+            }
+            if (output.item) {
+                output.item->move_write(MakeMessage());
+            }
+        }
+    }
+
+    if (is_recording_) {
+        // we don't record internal messages from the
+        // subscriber side, since we already log from
+        // the publisher side.
+        if (header.sender_process_id != get_process_id() &&
+            should_record(topic, header)) {
+            std::lock_guard<std::mutex> lock{recorder_buffer_mutex_};
+            if (!recorder_buffer_.move_write(MakeMessage())) {
+                LOG(WARNING) << "recorder buffer is full";
+            };
+        }
+    }
+}
+
 void run_subscriber_thread() {
     try {
         std::vector<std::pair<std::string, SubscriberOutput>>
@@ -229,6 +392,13 @@ void run_subscriber_thread() {
                         << request.connect_address;
                     subscriber_socket.connect(request.connect_address);
                 }
+
+                if (!request.bind_address.empty()) {
+                    LOG_IF(INFO, debug_subscriber)
+                        << "Subscriber socket binding "
+                        << request.bind_address;
+                    subscriber_socket.bind(request.bind_address);
+                }
             }
 
             zmq::message_t topic_message;
@@ -268,46 +438,7 @@ void run_subscriber_thread() {
                 // todo: for MessgeHeaderV2, copy additional bytes of the header
                 // maybe use std::variant
 
-                auto MakeMessage = [&]() {
-                    Message message;
-                    message.header = header;
-                    message.topic = topic;
-                    for (auto& frame : frames) {
-                        zmq::message_t frame_copy;
-                        frame_copy.copy(frame);
-                        message.frames.push_back(std::move(frame_copy));
-                    }
-                    return message;
-                };
-
-                // route the message to the correct output buffers by topic prefix
-                for (auto& [topic_prefix, output] : subscriber_outputs) {
-                    if (topic.starts_with(topic_prefix)) {
-                        if (output.buffer) {
-                            if (!output.buffer->move_write(MakeMessage())) {
-                                // this subscriber buffer is full. log warning?
-                                LOG(WARNING) << "subscriber buffer for topic "
-                                             << topic << " is full";
-                            }
-                        }
-                        if (output.item) {
-                            output.item->move_write(MakeMessage());
-                        }
-                    }
-                }
-
-                if (is_recording_) {
-                    // we don't record internal messages from the
-                    // subscriber side, since we already log from
-                    // the publisher side.
-                    if (header.sender_process_id != get_process_id()) {
-                        std::lock_guard<std::mutex> lock{
-                            recorder_buffer_mutex_};
-                        if (!recorder_buffer_.move_write(MakeMessage())) {
-                            LOG(WARNING) << "recorder buffer is full";
-                        };
-                    }
-                }
+                route_message(topic, header, frames, subscriber_outputs);
             }
         }
     } catch (const zmq::error_t& e) {
@@ -317,15 +448,67 @@ void run_subscriber_thread() {
 }
 
 void enable_recording(std::string_view recording_dir,
-                      std::string_view recording_filename) {
+                      std::string_view recording_filename,
+                      const RecordingRules& rules) {
     std::lock_guard<std::mutex> lock{recorder_mutex_};
+    {
+        std::lock_guard<std::mutex> filter_lock{recording_filter_mutex_};
+        recording_filter_ = RecordingFilter(rules);
+    }
+    flight_recorder_ = nullptr;
+    flight_recorder_pending_dumps_.clear();
+    is_flight_recording_ = false;
     recorder_.emplace(recording_dir, recording_filename);
     is_recording_ = true;
 }
 
+void enable_flight_recording(const FlightRecorderOptions& options,
+                             const RecordingRules& rules) {
+    // listen for dump triggers from other processes, once across
+    // enables
+    if (!flight_recorder_dump_subscribed_.exchange(true)) {
+        subscribe(flight_recorder_dump_topic, /*subscriber_buffer=*/nullptr);
+    }
+
+    std::lock_guard<std::mutex> lock{recorder_mutex_};
+    {
+        std::lock_guard<std::mutex> filter_lock{recording_filter_mutex_};
+        recording_filter_ = RecordingFilter(rules);
+    }
+    recorder_ = std::nullopt;
+    flight_recorder_ = std::make_shared<FlightRecorder>(options);
+    flight_recorder_pending_dumps_.clear();
+    flight_recorder_log_dir_ = options.log_dir;
+    is_flight_recording_ = true;
+    is_recording_ = true;
+}
+
+void dump_flight_recorder(std::string_view log_name) {
+    CHECK(is_flight_recording_) << "flight recording is not enabled";
+
+    // the trigger goes through the recorder queue like any other
+    // message, so the dump includes everything queued before it
+    Message trigger;
+    trigger.topic = flight_recorder_dump_topic;
+    trigger.header = {.sender_process_id = get_process_id(),
+                      .sender_process_time_us = get_process_time_us()};
+    if (!log_name.empty()) {
+        trigger.frames.emplace_back(log_name);
+    }
+
+    std::lock_guard<std::mutex> lock{recorder_buffer_mutex_};
+    if (!recorder_buffer_.move_write(std::move(trigger))) {
+        LOG(WARNING) << "recorder buffer is full, dropping flight recorder "
+                        "dump trigger";
+    }
+}
+
 void disable_recording() {
     std::lock_guard<std::mutex> lock{recorder_mutex_};
     recorder_ = std::nullopt;
+    flight_recorder_ = nullptr;
+    flight_recorder_pending_dumps_.clear();
+    is_flight_recording_ = false;
     is_recording_ = false;
 }
 
@@ -359,6 +542,17 @@ void bind(std::string_view connection_string) {
         << "publish queue was full";
 }
 
+void connect_publisher(std::string_view connection_string) {
+    CHECK(publisher_thread_.joinable()) << "you forgot to init";
+
+    PublisherRequest request;
+    request.connect_address = connection_string;
+
+    std::lock_guard<std::mutex> lock{publish_requests_mutex_};
+    CHECK(publisher_requests_.move_write(std::move(request)))
+        << "publish queue was full";
+}
+
 void publish_topic_only(std::string_view topic) {
     MessageFrames empty;
     publish_frames(topic, 0, std::move(empty));
@@ -412,9 +606,25 @@ void connect(std::string_view connection) {
     subscriber_requests_.move_write(std::move(request));
 }
 
+void bind_subscriber(std::string_view connection_string) {
+    CHECK(subscriber_thread_.joinable()) << "you forgot to init";
+
+    SubscriberRequest request;
+    request.bind_address = connection_string;
+
+    std::lock_guard<std::mutex> lock{subscriber_requests_mutex_};
+    subscriber_requests_.move_write(std::move(request));
+}
+
 void subscribe(std::string_view topic, SubscriberBuffer* buffer) {
     CHECK(subscriber_thread_.joinable()) << "you forgot to init";
 
+    {
+        std::lock_guard<std::mutex> lock{local_subscriber_outputs_mutex_};
+        local_subscriber_outputs_.push_back(
+            {std::string(topic), {.buffer = buffer}});
+    }
+
     SubscriberRequest request;
     request.subscribe_topic = topic;
     request.subscribe_buffer = buffer;
@@ -428,6 +638,12 @@ void subscribe(std::string_view topic, SubscriberBuffer* buffer) {
 void subscribe_latest(std::string_view topic, SubscriberItem* item) {
     CHECK(subscriber_thread_.joinable()) << "you forgot to init";
 
+    {
+        std::lock_guard<std::mutex> lock{local_subscriber_outputs_mutex_};
+        local_subscriber_outputs_.push_back(
+            {std::string(topic), {.item = item}});
+    }
+
     SubscriberRequest request;
     request.subscribe_topic = topic;
     request.subscribe_item = item;
@@ -438,6 +654,12 @@ void subscribe_latest(std::string_view topic, SubscriberItem* item) {
     subscriber_requests_.move_write(std::move(request));
 }
 
+void deliver_local(Message&& message) {
+    std::lock_guard<std::mutex> lock{local_subscriber_outputs_mutex_};
+    route_message(message.topic, message.header, message.frames,
+                  local_subscriber_outputs_);
+}
+
 void cleanup() {
     stop_all();
 
@@ -452,6 +674,10 @@ void cleanup() {
 
     recorder_buffer_.stop();
     recorder_thread_.join();
+
+    if (flight_recorder_dump_thread_.joinable()) {
+        flight_recorder_dump_thread_.join();
+    }
 }
 
 }  // namespace pubsub
@@ -4,7 +4,9 @@
 #include <vector>
 #include <zmq.hpp>
 
+#include "app/pubsub_flight_recorder.h"
 #include "app/pubsub_message.h"
+#include "app/pubsub_recording_rules.h"
 #include "concurrency/ring_buffer.h"
 #include "concurrency/single_item.h"
 #include "fast_resizable_vector/fast_resizable_vector.h"
@@ -88,6 +90,10 @@ void cleanup();
 // publisher side, thread safe
 void bind(std::string_view connection_string);
 
+// for many publishers to one subscriber, which binds, see
+// bind_subscriber
+void connect_publisher(std::string_view connection_string);
+
 void publish_frames(std::string_view topic,
                     uint16_t message_version,
                     MessageFrames&& frames,
@@ -105,6 +111,13 @@ void publish_topic_only(std::string_view topic);
 // seeks
 void publisher_requests_clear();
 
+// number of publish requests queued for the publisher thread, out of
+// publish_queue_capacity. publishing check-fails when the queue is
+// full. used by playback to avoid overflowing the queue when replaying
+// as fast as possible.
+constexpr int publish_queue_capacity = 1023;
+int get_num_pending_publish_requests();
+
 template <typename T>
 void publish_simple(std::string_view topic,
                     uint16_t message_version,
@@ -129,12 +142,40 @@ void publish_cbor(std::string_view topic,
 using SubscriberBuffer = RingBuffer<Message, 120>;
 using SubscriberItem = SingleItem<Message>;
 
+// rules are applied before messages are queued for the recorder, so
+// excluded and thinned messages are never copied
 void enable_recording(std::string_view log_dir = "",
-                      std::string_view log_name = "");
+                      std::string_view log_name = "",
+                      const RecordingRules& rules = {});
 void disable_recording();
+
+// flight recorder mode keeps the last few seconds of recorded topics in
+// memory instead of writing them to disk. the window is written out
+// to a new log when dump_flight_recorder() is called, or when any
+// process publishes on flight_recorder_dump_topic. an optional first
+// frame of the trigger message is used as the log name. the trigger
+// itself is not logged. a trigger during a dump is written out once
+// the dump is done. enabling again replaces the window and the rules.
+constexpr std::string_view flight_recorder_dump_topic =
+    "pubsub/flight_recorder_dump";
+void enable_flight_recording(const FlightRecorderOptions& options = {},
+                             const RecordingRules& rules = {});
+void dump_flight_recorder(std::string_view log_name = "");
 void connect(std::string_view connection_string);
+void bind_subscriber(std::string_view connection_string);
 void subscribe(std::string_view topic, SubscriberBuffer* subscriber_buffer);
 void subscribe_latest(std::string_view topic, SubscriberItem* subscriber_item);
 
+// hands a message straight to the in-process subscribers of its topic
+// from the calling thread, skipping the publisher queue, zmq and the
+// subscriber thread. used by playback. frames are shared with
+// zmq_msg_copy, so frames that wrap external memory (zmq::message_t
+// with a deleter) reach every subscriber without copying bytes.
+//
+// subscriber buffers are single producer, so a topic delivered
+// locally must not also arrive over zmq, and must only be delivered
+// from one thread.
+void deliver_local(Message&& message);
+
 }  // namespace pubsub
 }  // namespace axby
@@ -0,0 +1,177 @@
+#include "app/pubsub_flight_recorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "app/timing.h"
+#include "debug/check.h"
+#include "debug/log.h"
+
+namespace axby {
+namespace pubsub {
+
+namespace {
+
+bool overlaps(const FlightRecorderEntry& entry, size_t begin, size_t end) {
+    return entry.offset < end && begin < entry.offset + entry.size;
+}
+
+}  // namespace
+
+FlightRecorder::FlightRecorder(const FlightRecorderOptions& options)
+    : max_duration_us_(options.max_duration_s * 1e6) {
+    CHECK_GT(options.max_bytes, 0);
+    bytes_.resize(options.max_bytes);
+    entries_.resize(std::max<size_t>(
+        options.max_duration_s * options.expected_messages_per_s, 1024));
+}
+
+uint32_t FlightRecorder::get_topic_idx(std::string_view topic,
+                                       bool is_keyframe) {
+    auto it = topic_to_idx_.find(topic);
+    if (it == topic_to_idx_.end()) {
+        it = topic_to_idx_.emplace(std::string(topic), topics_.size()).first;
+        topics_.emplace_back(topic);
+        topic_has_keyframes_.push_back(false);
+    }
+    if (is_keyframe) {
+        topic_has_keyframes_[it->second] = true;
+    }
+    return it->second;
+}
+
+bool FlightRecorder::can_pop_front() const {
+    const uint64_t id = front().id;
+    return !dumping_ || id >= dump_end_id_ ||
+           id < dumped_id_.load(std::memory_order_acquire);
+}
+
+void FlightRecorder::pop_front() {
+    CHECK_GT(num_entries_, 0);
+    num_bytes_ -= front().size;
+    head_ = (head_ + 1) % entries_.size();
+    --num_entries_;
+}
+
+void FlightRecorder::push_back(const FlightRecorderEntry& entry) {
+    if (num_entries_ == entries_.size()) {
+        std::vector<FlightRecorderEntry> grown(entries_.size() * 2);
+        for (size_t i = 0; i < num_entries_; ++i) {
+            grown[i] = entries_[(head_ + i) % entries_.size()];
+        }
+        entries_ = std::move(grown);
+        head_ = 0;
+    }
+    entries_[(head_ + num_entries_) % entries_.size()] = entry;
+    ++num_entries_;
+    num_bytes_ += entry.size;
+}
+
+void FlightRecorder::append(const Message& message,
+                            uint64_t this_process_time_us) {
+    frame_spans_.clear();
+    serialization_buf_.clear();
+    for (auto& frame : message.frames) {
+        frame_spans_.push_back(reinterpret_span<const std::byte>(frame));
+    }
+    CHECK(serialization::serialize_cbor(frame_spans_, serialization_buf_));
+
+    const size_t size = serialization_buf_.size();
+    if (size > bytes_.size()) {
+        LOG_EVERY_T(WARNING, 5)
+            << "message on " << message.topic << " of " << size
+            << " bytes does not fit in the flight recorder";
+        return;
+    }
+
+    // drop messages that have aged out of the window
+    const uint64_t cutoff_us =
+        clipped_minus(this_process_time_us, max_duration_us_);
+    while (num_entries_ > 0 && front().this_process_time_us < cutoff_us &&
+           can_pop_front()) {
+        pop_front();
+    }
+
+    // messages are stored contiguously. if this one doesn't fit before
+    // the end of the ring, leave the tail unused and wrap around. the
+    // messages stored in the tail are the oldest, so they are dropped
+    // first.
+    size_t offset = write_pos_;
+    const bool wrapped = offset + size > bytes_.size();
+    if (wrapped) {
+        offset = 0;
+    }
+    while (num_entries_ > 0 &&
+           (overlaps(front(), offset, offset + size) ||
+            (wrapped && front().offset >= write_pos_))) {
+        if (!can_pop_front()) {
+            LOG_EVERY_T(WARNING, 5)
+                << "dropping message on " << message.topic
+                << ", the flight recorder is full of messages still to "
+                   "be dumped";
+            return;
+        }
+        pop_front();
+    }
+
+    std::memcpy(bytes_.data() + offset, serialization_buf_.data(), size);
+    write_pos_ = offset + size;
+
+    const bool is_keyframe = message.header.flags == 1;
+    push_back({.id = next_id_++,
+               .topic_idx = get_topic_idx(message.topic, is_keyframe),
+               .header = message.header,
+               .this_process_time_us = this_process_time_us,
+               .offset = offset,
+               .size = size});
+}
+
+std::vector<FlightRecorderEntry> FlightRecorder::get_snapshot_entries()
+    const {
+    std::vector<FlightRecorderEntry> entries;
+    entries.reserve(num_entries_);
+
+    std::vector<bool> topic_started(topics_.size(), false);
+    for (size_t i = 0; i < num_entries_; ++i) {
+        const auto& entry = entries_[(head_ + i) % entries_.size()];
+        if (topic_has_keyframes_[entry.topic_idx] &&
+            !topic_started[entry.topic_idx]) {
+            if (entry.header.flags != 1) continue;
+            topic_started[entry.topic_idx] = true;
+        }
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+FlightRecorderSnapshot FlightRecorder::snapshot() const {
+    FlightRecorderSnapshot result;
+    result.topics = topics_;
+    result.entries = get_snapshot_entries();
+    result.bytes.reserve(num_bytes_);
+
+    for (auto& entry : result.entries) {
+        const size_t offset = result.bytes.size();
+        result.bytes.insert(result.bytes.end(), bytes_.data() + entry.offset,
+                            bytes_.data() + entry.offset + entry.size);
+        entry.offset = offset;
+    }
+
+    return result;
+}
+
+FlightRecorderDump FlightRecorder::begin_dump() {
+    CHECK(!dumping_);
+    dumping_ = true;
+    dump_end_id_ = next_id_;
+    dumped_id_.store(0, std::memory_order_relaxed);
+    return {.topics = topics_, .entries = get_snapshot_entries()};
+}
+
+void FlightRecorder::end_dump() {
+    CHECK(dumping_);
+    dumping_ = false;
+}
+
+}  // namespace pubsub
+}  // namespace axby
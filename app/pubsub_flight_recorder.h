@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "app/pubsub_message.h"
+#include "fast_resizable_vector/fast_resizable_vector.h"
+
+namespace axby {
+namespace pubsub {
+
+struct FlightRecorderOptions {
+    // the window is bounded by both duration and size, whichever is
+    // hit first
+    double max_duration_s = 30;
+    size_t max_bytes = size_t(512) << 20;
+
+    // sizes the ring of message entries up front, so append() doesn't
+    // allocate. it grows if the rate is exceeded.
+    double expected_messages_per_s = 1000;
+
+    // where dump_flight_recorder() writes logs. empty means the
+    // default log dir
+    std::string log_dir;
+};
+
+struct FlightRecorderEntry {
+    // counts up in append order
+    uint64_t id = 0;
+    uint32_t topic_idx = 0;
+    MessageHeader header;
+    uint64_t this_process_time_us = 0;
+
+    // location of the cbor serialized frames, in the same format as
+    // the frames column of the log table
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+// a self contained copy of the flight recorder window, ready to be
+// written out to a log
+struct FlightRecorderSnapshot {
+    std::vector<std::string> topics;
+    std::vector<FlightRecorderEntry> entries;
+    FastResizableVector<std::byte> bytes;
+
+    std::string_view get_topic(const FlightRecorderEntry& entry) const {
+        return topics[entry.topic_idx];
+    }
+    std::span<const std::byte> get_frames_cbor(
+        const FlightRecorderEntry& entry) const {
+        return {bytes.data() + entry.offset, entry.size};
+    }
+};
+
+// the window of a dump in progress, with offsets into the recorder's
+// ring, see FlightRecorder::begin_dump()
+struct FlightRecorderDump {
+    std::vector<std::string> topics;
+    std::vector<FlightRecorderEntry> entries;
+
+    std::string_view get_topic(const FlightRecorderEntry& entry) const {
+        return topics[entry.topic_idx];
+    }
+};
+
+// keeps the most recent messages in memory. messages are serialized
+// into a byte ring that is allocated once up front, so after warm up
+// append() does not allocate. not thread safe.
+class FlightRecorder {
+   public:
+    FlightRecorder(const FlightRecorderOptions& options);
+
+    void append(const Message& message, uint64_t this_process_time_us);
+
+    // copies out the current window. for every topic that has ever
+    // sent a keyframe (flags = 1), messages before that topic's first
+    // keyframe in the window are dropped, since they cannot be decoded
+    // without the earlier part of their GOP.
+    FlightRecorderSnapshot snapshot() const;
+
+    // a dump reads the window out of the ring in place, on another
+    // thread, so it neither copies the window nor allocates a second
+    // ring. begin_dump() returns the window like snapshot(). the
+    // dumping thread reads it with get_frames_cbor() and releases it
+    // in order with mark_dumped(). until a message is released,
+    // append() keeps it and drops new messages that would overwrite
+    // it. the window itself is not emptied, so a dump that starts
+    // right after another one still gets the full window.
+    FlightRecorderDump begin_dump();
+    void end_dump();
+    bool is_dumping() const { return dumping_; }
+
+    // thread safe, for the entries of the dump in progress
+    std::span<const std::byte> get_frames_cbor(
+        const FlightRecorderEntry& entry) const {
+        return {bytes_.data() + entry.offset, entry.size};
+    }
+    void mark_dumped(const FlightRecorderEntry& entry) {
+        dumped_id_.store(entry.id + 1, std::memory_order_release);
+    }
+
+    size_t num_messages() const { return num_entries_; }
+    size_t num_bytes() const { return num_bytes_; }
+
+   private:
+    uint32_t get_topic_idx(std::string_view topic, bool is_keyframe);
+
+    // of the snapshot, in time order, see snapshot()
+    std::vector<FlightRecorderEntry> get_snapshot_entries() const;
+
+    const FlightRecorderEntry& front() const { return entries_[head_]; }
+    // false if the front message is still to be dumped
+    bool can_pop_front() const;
+    void pop_front();
+    void push_back(const FlightRecorderEntry& entry);
+
+    uint64_t max_duration_us_ = 0;
+
+    FastResizableVector<std::byte> bytes_;
+    size_t write_pos_ = 0;
+    size_t num_bytes_ = 0;
+
+    // circular, grows by doubling if it runs out of slots, which
+    // copies it
+    std::vector<FlightRecorderEntry> entries_;
+    size_t head_ = 0;
+    size_t num_entries_ = 0;
+    uint64_t next_id_ = 0;
+
+    // messages with ids in [dumped_id_, dump_end_id_) are still to be
+    // dumped
+    bool dumping_ = false;
+    uint64_t dump_end_id_ = 0;
+    std::atomic<uint64_t> dumped_id_ = 0;
+
+    absl::flat_hash_map<std::string, uint32_t> topic_to_idx_;
+    std::vector<std::string> topics_;
+    std::vector<bool> topic_has_keyframes_;
+
+    std::vector<std::span<const std::byte>> frame_spans_;
+    FastResizableVector<std::byte> serialization_buf_;
+};
+
+}  // namespace pubsub
+}  // namespace axby
@@ -0,0 +1,169 @@
+#include "app/pubsub_flight_recorder.h"
+
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+
+using namespace axby;
+using namespace axby::pubsub;
+
+Message make_message(std::string_view topic,
+                     uint64_t time_us,
+                     size_t num_bytes,
+                     uint16_t flags = 0) {
+    Message message;
+    message.topic = topic;
+    message.header.sender_process_time_us = time_us;
+    message.header.flags = flags;
+    message.frames.emplace_back(std::string(num_bytes, 'x'));
+    return message;
+}
+
+TEST(FlightRecorder, max_duration) {
+    FlightRecorder recorder({.max_duration_s = 1, .max_bytes = 1 << 20});
+
+    // 100 messages per second for 10 seconds
+    for (int i = 0; i < 1000; ++i) {
+        const uint64_t time_us = i * 10000;
+        recorder.append(make_message("imu", time_us, 10), time_us);
+    }
+
+    const auto snapshot = recorder.snapshot();
+    ASSERT_EQ(snapshot.entries.size(), 101);
+    EXPECT_EQ(snapshot.entries.front().this_process_time_us, 8990000);
+    EXPECT_EQ(snapshot.entries.back().this_process_time_us, 9990000);
+}
+
+TEST(FlightRecorder, max_bytes) {
+    FlightRecorder recorder({.max_duration_s = 1000, .max_bytes = 10000});
+
+    for (int i = 0; i < 1000; ++i) {
+        recorder.append(make_message("imu", i, 990 + i % 20), i);
+        EXPECT_LE(recorder.num_bytes(), 10000);
+    }
+    EXPECT_GE(recorder.num_messages(), 8);
+
+    // the window is the most recent messages, in order
+    const auto snapshot = recorder.snapshot();
+    ASSERT_EQ(snapshot.entries.size(), recorder.num_messages());
+    for (int i = 0; i < snapshot.entries.size(); ++i) {
+        EXPECT_EQ(snapshot.entries[i].this_process_time_us,
+                  1000 - snapshot.entries.size() + i);
+    }
+}
+
+TEST(FlightRecorder, oversized_message_is_dropped) {
+    FlightRecorder recorder({.max_bytes = 100});
+    recorder.append(make_message("color", 0, 1000), 0);
+    EXPECT_EQ(recorder.num_messages(), 0);
+}
+
+TEST(FlightRecorder, frames_round_trip) {
+    FlightRecorder recorder({.max_bytes = 1 << 20});
+    Message message;
+    message.topic = "realsense/motion/123";
+    message.frames.emplace_back(std::string("abc"));
+    message.frames.emplace_back(std::string("defgh"));
+    recorder.append(message, 0);
+
+    const auto snapshot = recorder.snapshot();
+    ASSERT_EQ(snapshot.entries.size(), 1);
+    EXPECT_EQ(snapshot.get_topic(snapshot.entries[0]), message.topic);
+
+    FastResizableVector<std::span<const std::byte>> frames;
+    ASSERT_TRUE(serialization::deserialize_cbor(
+        frames, snapshot.get_frames_cbor(snapshot.entries[0])));
+    ASSERT_EQ(frames.size(), 2);
+    EXPECT_EQ(frames[0].size(), 3);
+    EXPECT_EQ(frames[1].size(), 5);
+}
+
+TEST(FlightRecorder, snapshot_starts_at_keyframe) {
+    FlightRecorder recorder({.max_duration_s = 1, .max_bytes = 1 << 20});
+
+    // 30 fps video with a keyframe every 20 frames, and an imu topic
+    // without keyframes
+    for (int i = 0; i < 100; ++i) {
+        const uint64_t time_us = i * 1e6 / 30;
+        const bool is_keyframe = (i % 20) == 0;
+        recorder.append(make_message("color", time_us, 100, is_keyframe),
+                        time_us);
+        recorder.append(make_message("imu", time_us, 10), time_us);
+    }
+
+    const auto snapshot = recorder.snapshot();
+    bool seen_color = false;
+    int num_imu = 0;
+    for (const auto& entry : snapshot.entries) {
+        if (snapshot.get_topic(entry) == "color" && !seen_color) {
+            EXPECT_EQ(entry.header.flags, 1);
+            seen_color = true;
+        }
+        if (snapshot.get_topic(entry) == "imu") {
+            ++num_imu;
+        }
+    }
+    EXPECT_TRUE(seen_color);
+    EXPECT_EQ(num_imu, recorder.num_messages() / 2);
+}
+
+TEST(FlightRecorder, dump_reads_ring_in_place) {
+    FlightRecorder recorder({.max_duration_s = 1000, .max_bytes = 10000});
+    for (int i = 0; i < 20; ++i) {
+        recorder.append(make_message("imu", i, 990 + i % 20), i);
+    }
+
+    const auto copied = recorder.snapshot();
+    const auto dump = recorder.begin_dump();
+    EXPECT_TRUE(recorder.is_dumping());
+
+    // the same messages, at their offsets in the ring
+    ASSERT_EQ(dump.entries.size(), copied.entries.size());
+    for (size_t i = 0; i < dump.entries.size(); ++i) {
+        const auto dumped_frames = recorder.get_frames_cbor(dump.entries[i]);
+        const auto copied_frames = copied.get_frames_cbor(copied.entries[i]);
+        EXPECT_EQ(dump.entries[i].this_process_time_us,
+                  copied.entries[i].this_process_time_us);
+        ASSERT_EQ(dumped_frames.size(), copied_frames.size());
+        EXPECT_EQ(std::memcmp(dumped_frames.data(), copied_frames.data(),
+                              dumped_frames.size()),
+                  0);
+    }
+
+    // once the ring is full of messages still to be dumped, new ones
+    // are dropped
+    for (int i = 100; i < 120; ++i) {
+        recorder.append(make_message("imu", i, 990), i);
+    }
+    auto during = recorder.snapshot();
+    EXPECT_EQ(during.entries.front().this_process_time_us,
+              copied.entries.front().this_process_time_us);
+    EXPECT_LT(during.entries.back().this_process_time_us, 119);
+
+    // once the oldest are dumped, they can be overwritten
+    recorder.mark_dumped(dump.entries[1]);
+    recorder.append(make_message("imu", 200, 990), 200);
+    during = recorder.snapshot();
+    EXPECT_EQ(during.entries.back().this_process_time_us, 200);
+    EXPECT_GE(during.entries.front().this_process_time_us,
+              copied.entries[1].this_process_time_us);
+
+    // the window is kept after the dump
+    recorder.end_dump();
+    EXPECT_FALSE(recorder.is_dumping());
+    EXPECT_EQ(recorder.snapshot().entries.size(), during.entries.size());
+}
+
+TEST(FlightRecorder, topic_without_keyframe_in_window_is_dropped) {
+    FlightRecorder recorder({.max_duration_s = 1, .max_bytes = 1 << 20});
+
+    recorder.append(make_message("color", 0, 100, /*flags=*/1), 0);
+    for (int i = 1; i < 60; ++i) {
+        const uint64_t time_us = i * 1e6 / 30;
+        recorder.append(make_message("color", time_us, 100), time_us);
+    }
+
+    EXPECT_GT(recorder.num_messages(), 0);
+    EXPECT_TRUE(recorder.snapshot().entries.empty());
+}
@@ -8,6 +8,7 @@
 #include <sstream>
 #include <string>
 
+#include "absl/strings/str_format.h"
 #include "app/create_log_table_sql.h"
 #include "app/files.h"
 #include "app/timing.h"
@@ -34,15 +35,24 @@ std::string generate_log_name() {
     return oss.str();
 }
 
-Recorder::Recorder(std::string_view log_dir, std::string_view log_name) {
+Recorder::Recorder(std::string_view log_dir,
+                   std::string_view log_name,
+                   const RecorderOptions& options) {
     std::filesystem::path actual_log_dir =
         log_dir.empty() ? get_home_path() : log_dir;
     std::string actual_log_name =
         log_name.empty() ? generate_log_name() : std::string(log_name);
     std::filesystem::create_directories(actual_log_dir);
-    std::filesystem::path final_path = actual_log_dir / actual_log_name;
+    path_ = actual_log_dir / actual_log_name;
 
-    ctx_.init(std::string(final_path));
+    ctx_.init(std::string(path_));
+    if (!options.force_compression.empty()) {
+        const std::string set_compression_sql = absl::StrFormat(
+            "SET force_compression = '%s'", options.force_compression);
+        CHECK(duckdb_query(ctx_.conn_, set_compression_sql.c_str(), nullptr) !=
+              DuckDBError)
+            << "invalid compression " << options.force_compression;
+    }
     CHECK(duckdb_query(ctx_.conn_, create_log_table_sql, nullptr) !=
           DuckDBError);
 
@@ -64,48 +74,74 @@ values ($this_process_id, $process_time_us, $unix_time_ms)
 
     CHECK(duckdb_appender_create(ctx_.conn_, nullptr, "log", &appender_) !=
           DuckDBError);
+    CHECK(duckdb_appender_create(ctx_.conn_, nullptr, "keyframes",
+                                 &keyframes_appender_) != DuckDBError);
 }
 
 void Recorder::append(const pubsub::Message& message) {
     frame_spans_.clear();
     serialization_buf_.clear();
 
+    for (auto& frame : message.frames) {
+        frame_spans_.push_back(reinterpret_span<const std::byte>(frame));
+    }
+    CHECK(serialization::serialize_cbor(frame_spans_, serialization_buf_));
+
+    append_row(message.topic, message.header, get_process_time_us(),
+               serialization_buf_);
+}
+
+void Recorder::append_row(std::string_view topic,
+                          const MessageHeader& header,
+                          uint64_t this_process_time_us,
+                          std::span<const std::byte> frames_cbor) {
     // topic
-    duckdb_append_varchar_length(appender_, message.topic.data(),
-                                 message.topic.size());
+    duckdb_append_varchar_length(appender_, topic.data(), topic.size());
     check_duckdb_appender_error(appender_);
 
     // header
-    duckdb_append_uint64(appender_, message.header.sender_process_id);
+    duckdb_append_uint64(appender_, header.sender_process_id);
     check_duckdb_appender_error(appender_);
-    duckdb_append_uint64(appender_, message.header.sender_sequence_id);
+    duckdb_append_uint64(appender_, header.sender_sequence_id);
     check_duckdb_appender_error(appender_);
-    duckdb_append_uint64(appender_, message.header.sender_process_time_us);
+    duckdb_append_uint64(appender_, header.sender_process_time_us);
     check_duckdb_appender_error(appender_);
-    duckdb_append_uint16(appender_, message.header.protocol_version);
+    duckdb_append_uint16(appender_, header.protocol_version);
     check_duckdb_appender_error(appender_);
-    duckdb_append_uint16(appender_, message.header.message_version);
+    duckdb_append_uint16(appender_, header.message_version);
     check_duckdb_appender_error(appender_);
-    duckdb_append_uint16(appender_, message.header.flags);
+    duckdb_append_uint16(appender_, header.flags);
     check_duckdb_appender_error(appender_);
 
-    duckdb_append_uint64(appender_, get_process_time_us());
+    const uint64_t message_id = message_id_++;
+    duckdb_append_uint64(appender_, this_process_time_us);
     check_duckdb_appender_error(appender_);
-    duckdb_append_uint64(appender_, message_id_++);
+    duckdb_append_uint64(appender_, message_id);
     check_duckdb_appender_error(appender_);
 
     // frames
-    for (auto& frame : message.frames) {
-        frame_spans_.push_back(reinterpret_span<const std::byte>(frame));
-    }
-    CHECK(serialization::serialize_cbor(frame_spans_, serialization_buf_));
-    duckdb_append_blob(appender_, (void*)serialization_buf_.data(),
-                       serialization_buf_.size());
+    duckdb_append_blob(appender_, (void*)frames_cbor.data(),
+                       frames_cbor.size());
     check_duckdb_appender_error(appender_);
     duckdb_appender_end_row(appender_);
+
+    // flags = 1 is the convention for marking keyframes
+    if (header.flags == 1) {
+        duckdb_append_varchar_length(keyframes_appender_, topic.data(),
+                                     topic.size());
+        check_duckdb_appender_error(keyframes_appender_);
+        duckdb_append_uint64(keyframes_appender_, message_id);
+        check_duckdb_appender_error(keyframes_appender_);
+        duckdb_append_uint64(keyframes_appender_, this_process_time_us);
+        check_duckdb_appender_error(keyframes_appender_);
+        duckdb_appender_end_row(keyframes_appender_);
+    }
 }
 
-Recorder::~Recorder() { duckdb_appender_destroy(&appender_); }
+Recorder::~Recorder() {
+    duckdb_appender_destroy(&appender_);
+    duckdb_appender_destroy(&keyframes_appender_);
+}
 
 }  // namespace pubsub
 }  // namespace axby
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <filesystem>
 #include <span>
+#include <string>
 #include "fast_resizable_vector/fast_resizable_vector.h"
 #include "app/pubsub_message.h"
 #include "wrappers/duckdb.h"
@@ -8,15 +10,34 @@
 namespace axby {
 namespace pubsub {
 
+struct RecorderOptions {
+    // passed to duckdb's force_compression setting, eg "uncompressed"
+    // or "zstd". empty lets duckdb choose per column.
+    std::string force_compression;
+};
+
 class Recorder {
 public:
-    Recorder(std::string_view log_dir, std::string_view log_name);
+    Recorder(std::string_view log_dir,
+             std::string_view log_name,
+             const RecorderOptions& options = {});
     void append(const pubsub::Message& message);
+
+    // appends a message whose frames were already serialized into the
+    // cbor format of the frames column, eg by the flight recorder.
+    void append_row(std::string_view topic,
+                    const MessageHeader& header,
+                    uint64_t this_process_time_us,
+                    std::span<const std::byte> frames_cbor);
     ~Recorder();
 
+    const std::filesystem::path& get_path() const { return path_; }
+
 private:
+    std::filesystem::path path_;
     DuckDbContext ctx_;
     duckdb_appender appender_;
+    duckdb_appender keyframes_appender_;
     uint64_t message_id_ = 0;
     std::vector<std::span<const std::byte>> frame_spans_;
     FastResizableVector<std::byte> serialization_buf_;
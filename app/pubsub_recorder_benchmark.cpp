@@ -0,0 +1,321 @@
+// drives pubsub::Recorder with a synthetic realsense-like message mix
+// and reports how much it can absorb. the producer side mimics the
+// pubsub recorder queue, dropping messages when the queue is full, so
+// the drop count here predicts "recorder buffer is full" warnings.
+//
+// rate_scale=0 measures the maximum sustained throughput. rate_scale
+// >= 1 replays the mix in (scaled) real time and counts drops. eg
+//   bazel run -c opt //app:pubsub_recorder_benchmark -- --num_cameras=4
+//   --rate_scale=2 --compressions=,uncompressed,zstd
+
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "app/flag.h"
+#include "app/main.h"
+#include "app/pubsub_message.h"
+#include "app/pubsub_recorder.h"
+#include "app/timing.h"
+#include "concurrency/ring_buffer.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "math/latency_histogram.h"
+
+APP_FLAG(double, duration_s, 10, "seconds of synthetic data per run");
+APP_FLAG(int, num_cameras, 2, "number of simulated realsense cameras");
+APP_FLAG(double,
+         rate_scale,
+         1,
+         "message rate relative to real time. 0 means produce as fast as "
+         "the recorder accepts, without drops");
+APP_FLAG(std::string,
+         compressions,
+         ",uncompressed,zstd",
+         "comma separated duckdb force_compression values to compare. the "
+         "empty value lets duckdb choose");
+APP_FLAG(std::string, log_dir, "/tmp/pubsub_recorder_benchmark", "");
+
+using namespace axby;
+
+namespace {
+
+// payload sizes are typical of the realsense server at 848x480,
+// 30fps. video is random bytes, since encoded video is close to
+// incompressible.
+struct StreamSpec {
+    std::string topic;
+    double hz = 0;
+    size_t keyframe_bytes = 0;
+    size_t delta_bytes = 0;
+    int keyframe_interval = 0;  // 0 for streams without keyframes
+    bool is_motion = false;
+    int motion_samples_per_message = 0;
+};
+
+constexpr size_t stream_meta_bytes = 256;
+
+std::vector<StreamSpec> make_stream_specs(int num_cameras) {
+    std::vector<StreamSpec> specs;
+    for (int i = 0; i < num_cameras; ++i) {
+        const std::string serial = absl::StrFormat("%012d", 100000 + i);
+        // vp9
+        specs.push_back({.topic = "realsense/color/" + serial + "/0",
+                         .hz = 30,
+                         .keyframe_bytes = 60000,
+                         .delta_bytes = 8000,
+                         .keyframe_interval = 60});
+        // zdepth
+        specs.push_back({.topic = "realsense/depth/" + serial + "/0",
+                         .hz = 30,
+                         .keyframe_bytes = 40000,
+                         .delta_bytes = 15000,
+                         .keyframe_interval = 60});
+        // imu batches, published about every 33ms
+        specs.push_back({.topic = "realsense/gyro/" + serial + "/0",
+                         .hz = 30,
+                         .is_motion = true,
+                         .motion_samples_per_message = 7});
+        specs.push_back({.topic = "realsense/accel/" + serial + "/0",
+                         .hz = 30,
+                         .is_motion = true,
+                         .motion_samples_per_message = 4});
+    }
+    specs.push_back({.topic = "time_sync", .hz = 1, .delta_bytes = 64});
+    return specs;
+}
+
+struct StreamState {
+    uint64_t next_due_us = 0;
+    uint64_t sequence_id = 0;
+};
+
+class MessageFactory {
+   public:
+    MessageFactory() {
+        std::mt19937 rng(0);
+        random_bytes_.resize(1 << 20);
+        for (auto& b : random_bytes_) {
+            b = char(rng());
+        }
+    }
+
+    pubsub::Message make(const StreamSpec& spec,
+                         StreamState& state,
+                         uint64_t time_us) {
+        const uint64_t sequence_id = state.sequence_id++;
+        const bool is_keyframe =
+            spec.keyframe_interval > 0 &&
+            (sequence_id % spec.keyframe_interval) == 0;
+
+        pubsub::Message message;
+        message.topic = spec.topic;
+        message.header.sender_process_id = 1;
+        message.header.sender_sequence_id = sequence_id;
+        message.header.sender_process_time_us = time_us;
+        message.header.flags = is_keyframe;
+
+        if (spec.is_motion) {
+            const int n = spec.motion_samples_per_message;
+            message.frames.emplace_back(&sequence_id, sizeof(sequence_id));
+            message.frames.emplace_back(get_bytes(stream_meta_bytes),
+                                        stream_meta_bytes);
+            message.frames.emplace_back(get_bytes(n * sizeof(uint64_t)),
+                                        n * sizeof(uint64_t));
+            message.frames.emplace_back(get_bytes(n * 3 * sizeof(float)),
+                                        n * 3 * sizeof(float));
+        } else if (spec.keyframe_interval > 0) {
+            const size_t packet_bytes =
+                is_keyframe ? spec.keyframe_bytes : spec.delta_bytes;
+            message.frames.emplace_back(&time_us, sizeof(time_us));
+            message.frames.emplace_back(&sequence_id, sizeof(sequence_id));
+            message.frames.emplace_back(get_bytes(stream_meta_bytes),
+                                        stream_meta_bytes);
+            message.frames.emplace_back(get_bytes(packet_bytes), packet_bytes);
+        } else {
+            message.frames.emplace_back(get_bytes(spec.delta_bytes),
+                                        spec.delta_bytes);
+        }
+        return message;
+    }
+
+   private:
+    const char* get_bytes(size_t size) {
+        CHECK_LE(size, random_bytes_.size());
+        offset_ = (offset_ + 4099) % (random_bytes_.size() - size + 1);
+        return random_bytes_.data() + offset_;
+    }
+
+    std::string random_bytes_;
+    size_t offset_ = 0;
+};
+
+size_t get_message_bytes(const pubsub::Message& message) {
+    size_t result = message.topic.size() + sizeof(message.header);
+    for (const auto& frame : message.frames) {
+        result += frame.size();
+    }
+    return result;
+}
+
+uint64_t get_log_size(const std::filesystem::path& path) {
+    uint64_t result = 0;
+    for (const auto& p : {path, std::filesystem::path(path.string() + ".wal")}) {
+        if (std::filesystem::exists(p)) {
+            result += std::filesystem::file_size(p);
+        }
+    }
+    return result;
+}
+
+struct BenchmarkResult {
+    std::string compression;
+    uint64_t num_offered = 0;
+    uint64_t num_dropped = 0;
+    uint64_t bytes_recorded = 0;
+    double elapsed_s = 0;
+    uint64_t file_bytes = 0;
+    LatencyHistogram append_latency_ns;
+};
+
+BenchmarkResult run_benchmark(const std::vector<StreamSpec>& specs,
+                              const std::string& compression,
+                              double duration_s,
+                              double rate_scale,
+                              const std::string& log_dir) {
+    BenchmarkResult result;
+    result.compression = compression.empty() ? "auto" : compression;
+
+    const std::string log_name =
+        absl::StrFormat("recorder_benchmark_%s.duckdb", result.compression);
+    std::filesystem::remove(std::filesystem::path(log_dir) / log_name);
+    std::filesystem::remove(std::filesystem::path(log_dir) /
+                            (log_name + ".wal"));
+
+    // same queue type and depth as the pubsub recorder
+    RingBuffer<pubsub::Message, 120> buffer;
+    std::filesystem::path log_path;
+
+    Stopwatch stopwatch;
+    std::thread recorder_thread{[&]() {
+        pubsub::Recorder recorder(log_dir, log_name,
+                                  {.force_compression = compression});
+        log_path = recorder.get_path();
+
+        pubsub::Message message;
+        while (buffer.move_read(message, /*blocking=*/true)) {
+            const auto start = std::chrono::steady_clock::now();
+            recorder.append(message);
+            const auto end = std::chrono::steady_clock::now();
+            result.append_latency_ns.record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end -
+                                                                     start)
+                    .count());
+            result.bytes_recorded += get_message_bytes(message);
+        }
+        // recorder destructor flushes the appender and the database
+    }};
+
+    MessageFactory factory;
+    std::vector<StreamState> states(specs.size());
+    const uint64_t duration_us = duration_s * 1e6;
+    const uint64_t start_us = get_process_time_us();
+    while (true) {
+        // emit the stream that is due next
+        int next_idx = 0;
+        for (int i = 1; i < specs.size(); ++i) {
+            if (states[i].next_due_us < states[next_idx].next_due_us) {
+                next_idx = i;
+            }
+        }
+        StreamState& state = states[next_idx];
+        const uint64_t time_us = state.next_due_us;
+        if (time_us >= duration_us) break;
+        state.next_due_us += 1e6 / specs[next_idx].hz;
+
+        if (rate_scale > 0) {
+            const uint64_t wall_due_us = start_us + time_us / rate_scale;
+            const uint64_t now_us = get_process_time_us();
+            if (wall_due_us > now_us) {
+                sleep_us(wall_due_us - now_us);
+            }
+        }
+
+        pubsub::Message message = factory.make(specs[next_idx], state, time_us);
+        ++result.num_offered;
+        if (rate_scale > 0) {
+            if (!buffer.move_write(std::move(message))) {
+                ++result.num_dropped;
+            }
+        } else {
+            while (!buffer.move_write(std::move(message))) {
+                sleep_us(100);
+            }
+        }
+    }
+
+    while (!buffer.empty()) {
+        sleep_ms(1);
+    }
+    buffer.stop();
+    recorder_thread.join();
+    result.elapsed_s = stopwatch.get_sec_since_press();
+    result.file_bytes = get_log_size(log_path);
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    __APP_MAIN_INIT__;
+
+    APP_UNPACK_FLAG(duration_s);
+    APP_UNPACK_FLAG(num_cameras);
+    APP_UNPACK_FLAG(rate_scale);
+    APP_UNPACK_FLAG(compressions);
+    APP_UNPACK_FLAG(log_dir);
+
+    const auto specs = make_stream_specs(num_cameras);
+    double offered_bytes_per_s = 0;
+    for (const auto& spec : specs) {
+        const double average_packet_bytes =
+            spec.keyframe_interval > 0
+                ? (spec.keyframe_bytes +
+                   spec.delta_bytes * (spec.keyframe_interval - 1)) /
+                      double(spec.keyframe_interval)
+                : spec.delta_bytes;
+        offered_bytes_per_s += spec.hz * average_packet_bytes;
+    }
+    LOG(INFO) << specs.size() << " topics, about "
+              << offered_bytes_per_s * std::max(rate_scale, 1.0) / 1e6
+              << " MB/s offered";
+
+    std::vector<BenchmarkResult> results;
+    for (const auto& compression : absl::StrSplit(compressions, ',')) {
+        LOG(INFO) << "Running with compression \"" << compression << "\"";
+        results.push_back(run_benchmark(specs, std::string(compression),
+                                        duration_s, rate_scale, log_dir));
+    }
+
+    LOG(INFO) << absl::StrFormat("%-14s %10s %10s %10s %12s", "compression",
+                                 "MB/s", "dropped", "file MB",
+                                 "file/input");
+    for (const auto& result : results) {
+        const double mb_per_s = result.bytes_recorded / result.elapsed_s / 1e6;
+        LOG(INFO) << absl::StrFormat(
+            "%-14s %10.1f %4d/%-5d %10.1f %12.3f", result.compression,
+            mb_per_s, result.num_dropped, result.num_offered,
+            result.file_bytes / 1e6,
+            double(result.file_bytes) / std::max<uint64_t>(
+                                            result.bytes_recorded, 1));
+        LOG(INFO) << "  append latency ns: "
+                  << result.append_latency_ns.summary();
+    }
+
+    return 0;
+}
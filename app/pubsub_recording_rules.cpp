@@ -0,0 +1,91 @@
+#include "app/pubsub_recording_rules.h"
+
+#include <utility>
+
+namespace axby {
+namespace pubsub {
+
+namespace {
+
+bool starts_with_any(std::string_view topic,
+                     const std::vector<std::string>& prefixes) {
+    for (const auto& prefix : prefixes) {
+        if (topic.starts_with(prefix)) return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+RecordingFilter::RecordingFilter(RecordingRules rules)
+    : rules_(std::move(rules)) {}
+
+RecordingFilter::TopicState RecordingFilter::make_topic_state(
+    std::string_view topic) const {
+    TopicState state;
+
+    if (!rules_.include_prefixes.empty() &&
+        !starts_with_any(topic, rules_.include_prefixes)) {
+        state.excluded = true;
+    }
+    if (starts_with_any(topic, rules_.exclude_prefixes)) {
+        state.excluded = true;
+    }
+
+    for (int i = 0; i < rules_.rate_limits.size(); ++i) {
+        const auto& rate_limit = rules_.rate_limits[i];
+        if (topic.starts_with(rate_limit.topic_prefix)) {
+            state.rate_limit_idx = i;
+            if (rate_limit.max_hz > 0) {
+                state.period_us = 1e6 / rate_limit.max_hz;
+            }
+            break;
+        }
+    }
+
+    return state;
+}
+
+bool RecordingFilter::should_record(std::string_view topic,
+                                    const MessageHeader& header) {
+    auto it = topic_to_state_.find(topic);
+    if (it == topic_to_state_.end()) {
+        it = topic_to_state_
+                 .emplace(std::string(topic), make_topic_state(topic))
+                 .first;
+    }
+    TopicState& state = it->second;
+
+    if (state.excluded) return false;
+    if (state.rate_limit_idx < 0) return true;
+
+    // flags = 1 is the convention for marking keyframes. thinning a
+    // video topic by time would record packets whose references were
+    // dropped, so it is thinned by keyframes, as if keyframes_only.
+    const bool is_keyframe = header.flags == 1;
+    state.has_keyframes |= is_keyframe;
+    const auto& rate_limit = rules_.rate_limits[state.rate_limit_idx];
+    const bool keyframes_only =
+        rate_limit.keyframes_only ||
+        (state.has_keyframes && state.period_us > 0);
+    if (keyframes_only && !is_keyframe) return false;
+
+    const uint64_t time_us = header.sender_process_time_us;
+    if (state.recorded_any && time_us < state.next_due_time_us) {
+        return false;
+    }
+
+    // schedule the next recording one period after the previous
+    // deadline instead of after this message, so that the average
+    // rate matches max_hz even when messages arrive slightly late.
+    // fall back to this message's time after a gap.
+    const uint64_t next_due_time_us = state.next_due_time_us + state.period_us;
+    state.next_due_time_us = (state.recorded_any && next_due_time_us > time_us)
+                                 ? next_due_time_us
+                                 : time_us + state.period_us;
+    state.recorded_any = true;
+    return true;
+}
+
+}  // namespace pubsub
+}  // namespace axby
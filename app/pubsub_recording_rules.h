@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "app/pubsub_message.h"
+
+namespace axby {
+namespace pubsub {
+
+struct RecordingRateLimit {
+    // applies to every topic starting with topic_prefix. each topic
+    // is limited separately, eg "realsense/color/" limits every
+    // camera's color stream to max_hz.
+    std::string topic_prefix;
+    double max_hz = 0;
+
+    // video streams (keyframes are marked with flags = 1) cannot be
+    // thinned by dropping arbitrary messages, since every packet
+    // depends on the packets before it. set this to thin by only
+    // recording keyframes, at most max_hz of them. the effective rate
+    // is then bounded by the keyframe rate of the stream. a topic that
+    // has sent a keyframe is thinned this way whenever max_hz is set,
+    // so only the packets before its first keyframe can slip through.
+    bool keyframes_only = false;
+};
+
+struct RecordingRules {
+    // if nonempty, only topics starting with one of these prefixes
+    // are recorded
+    std::vector<std::string> include_prefixes;
+
+    // topics starting with one of these prefixes are never
+    // recorded. takes precedence over include_prefixes.
+    std::vector<std::string> exclude_prefixes;
+
+    // the first rate limit whose prefix matches a topic applies
+    std::vector<RecordingRateLimit> rate_limits;
+};
+
+// decides per message whether it should go to the recorder. rules are
+// resolved once per topic and cached, so the per message cost is a
+// hash lookup. not thread safe.
+class RecordingFilter {
+   public:
+    RecordingFilter() = default;
+    RecordingFilter(RecordingRules rules);
+
+    bool should_record(std::string_view topic, const MessageHeader& header);
+
+   private:
+    struct TopicState {
+        bool excluded = false;
+        // index into rules_.rate_limits, -1 if unlimited
+        int rate_limit_idx = -1;
+        uint64_t period_us = 0;
+        bool has_keyframes = false;
+        bool recorded_any = false;
+        uint64_t next_due_time_us = 0;
+    };
+
+    TopicState make_topic_state(std::string_view topic) const;
+
+    RecordingRules rules_;
+    absl::flat_hash_map<std::string, TopicState> topic_to_state_;
+};
+
+}  // namespace pubsub
+}  // namespace axby
@@ -0,0 +1,99 @@
+#include "app/pubsub_recording_rules.h"
+
+#include "gtest/gtest.h"
+
+using namespace axby;
+using namespace axby::pubsub;
+
+MessageHeader make_header(uint64_t time_us, uint16_t flags = 0) {
+    MessageHeader header;
+    header.sender_process_time_us = time_us;
+    header.flags = flags;
+    return header;
+}
+
+TEST(RecordingFilter, default_records_everything) {
+    RecordingFilter filter;
+    EXPECT_TRUE(filter.should_record("realsense/color/123/0", make_header(0)));
+    EXPECT_TRUE(filter.should_record("time_sync", make_header(0)));
+}
+
+TEST(RecordingFilter, include_and_exclude) {
+    RecordingFilter filter(
+        {.include_prefixes = {"realsense/"},
+         .exclude_prefixes = {"realsense/color/"}});
+    EXPECT_TRUE(filter.should_record("realsense/depth/123/0", make_header(0)));
+    EXPECT_FALSE(filter.should_record("realsense/color/123/0", make_header(0)));
+    EXPECT_FALSE(filter.should_record("time_sync", make_header(0)));
+
+    // cached topic state gives the same answer
+    EXPECT_TRUE(filter.should_record("realsense/depth/123/0", make_header(1)));
+    EXPECT_FALSE(filter.should_record("time_sync", make_header(1)));
+}
+
+TEST(RecordingFilter, max_hz) {
+    RecordingFilter filter(
+        {.rate_limits = {{.topic_prefix = "realsense/color/", .max_hz = 2}}});
+
+    // 30 fps for 10 seconds
+    int num_recorded = 0;
+    for (int i = 0; i < 300; ++i) {
+        const uint64_t time_us = i * 1e6 / 30;
+        if (filter.should_record("realsense/color/123/0",
+                                 make_header(time_us))) {
+            ++num_recorded;
+        }
+    }
+    EXPECT_NEAR(num_recorded, 20, 1);
+}
+
+TEST(RecordingFilter, max_hz_is_per_topic) {
+    RecordingFilter filter(
+        {.rate_limits = {{.topic_prefix = "realsense/color/", .max_hz = 1}}});
+
+    EXPECT_TRUE(filter.should_record("realsense/color/123/0", make_header(0)));
+    EXPECT_TRUE(filter.should_record("realsense/color/456/0", make_header(0)));
+    EXPECT_FALSE(
+        filter.should_record("realsense/color/123/0", make_header(500000)));
+    EXPECT_TRUE(
+        filter.should_record("realsense/color/123/0", make_header(1000000)));
+}
+
+TEST(RecordingFilter, keyframes_only) {
+    RecordingFilter filter({.rate_limits = {{.topic_prefix = "realsense/depth/",
+                                             .max_hz = 0.25,
+                                             .keyframes_only = true}}});
+
+    // 30 fps for 20 seconds, keyframe every 2 seconds
+    int num_recorded = 0;
+    for (int i = 0; i < 600; ++i) {
+        const uint64_t time_us = i * 1e6 / 30;
+        const bool is_keyframe = (i % 60) == 0;
+        const bool recorded = filter.should_record(
+            "realsense/depth/123/0", make_header(time_us, is_keyframe));
+        if (recorded) {
+            EXPECT_TRUE(is_keyframe);
+            ++num_recorded;
+        }
+    }
+    EXPECT_EQ(num_recorded, 5);
+}
+
+TEST(RecordingFilter, max_hz_of_video_records_keyframes) {
+    RecordingFilter filter(
+        {.rate_limits = {{.topic_prefix = "realsense/color/", .max_hz = 1}}});
+
+    // 30 fps for 10 seconds, keyframe every 2 seconds
+    int num_recorded = 0;
+    for (int i = 0; i < 300; ++i) {
+        const uint64_t time_us = i * 1e6 / 30;
+        const bool is_keyframe = (i % 60) == 0;
+        const bool recorded = filter.should_record(
+            "realsense/color/123/0", make_header(time_us, is_keyframe));
+        if (recorded) {
+            EXPECT_TRUE(is_keyframe);
+            ++num_recorded;
+        }
+    }
+    EXPECT_EQ(num_recorded, 5);
+}
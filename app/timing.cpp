@@ -1,12 +1,29 @@
 #include "app/timing.h"
 
+#include <atomic>
 #include <chrono>
+#include <limits>
 #include <thread>
 
 namespace axby {
 
 const auto _PROCESS_START_TIME_ = std::chrono::steady_clock::now();
 
+constexpr uint64_t _NO_VIRTUAL_TIME_ = std::numeric_limits<uint64_t>::max();
+std::atomic<uint64_t> _VIRTUAL_PROCESS_TIME_US_ = _NO_VIRTUAL_TIME_;
+
+void set_virtual_process_time_us(uint64_t time_us) {
+    _VIRTUAL_PROCESS_TIME_US_ = time_us;
+}
+
+void clear_virtual_process_time() {
+    _VIRTUAL_PROCESS_TIME_US_ = _NO_VIRTUAL_TIME_;
+}
+
+bool is_virtual_process_time() {
+    return _VIRTUAL_PROCESS_TIME_US_ != _NO_VIRTUAL_TIME_;
+}
+
 void sleep_ms(uint32_t ms) {
     std::this_thread::sleep_for(std::chrono::milliseconds(ms));
 }
@@ -15,6 +32,8 @@ void sleep_us(uint32_t us) {
 }
 
 uint64_t get_process_time_ms() {
+    const uint64_t virtual_time_us = _VIRTUAL_PROCESS_TIME_US_;
+    if (virtual_time_us != _NO_VIRTUAL_TIME_) return virtual_time_us / 1000;
     return std::chrono::duration_cast<std::chrono::milliseconds>(
                std::chrono::steady_clock::now() - _PROCESS_START_TIME_)
         .count();
@@ -32,6 +51,8 @@ uint64_t get_system_time_ms() {
 }
 
 uint64_t get_process_time_us() {
+    const uint64_t virtual_time_us = _VIRTUAL_PROCESS_TIME_US_;
+    if (virtual_time_us != _NO_VIRTUAL_TIME_) return virtual_time_us;
     return std::chrono::duration_cast<std::chrono::microseconds>(
                std::chrono::steady_clock::now() - _PROCESS_START_TIME_)
         .count();
@@ -83,6 +104,8 @@ double ActionPeriod::get_sec_elapsed() {
 
 double ActionPeriod::get_period() { return period_; };
 
+void ActionPeriod::set_period(double seconds) { period_ = seconds; }
+
 bool ActionPeriod::should_act() {
     const uint64_t phase_ms = 1000 * phase_;
     const uint64_t period_ms = 1000 * period_;
@@ -8,6 +8,14 @@ uint64_t get_process_time_ms();  // process alive time
 uint64_t get_process_time_us();  // process alive time
 uint64_t get_system_time_ms();   // unix time
 
+// replaces the steady clock behind get_process_time_ms/us, eg so code
+// running during an as fast as possible log replay sees the recorded
+// timeline. the virtual time may jump backwards when the replay
+// seeks. sleeps still use the steady clock.
+void set_virtual_process_time_us(uint64_t time_us);
+void clear_virtual_process_time();
+bool is_virtual_process_time();
+
 void sleep_ms(uint32_t ms);
 void sleep_us(uint32_t us);
 
@@ -72,6 +80,10 @@ class ActionPeriod {
     double get_sec_elapsed();
     double get_period();
 
+    // takes effect from the next should_act(), eg to adapt a keyframe
+    // interval at runtime
+    void set_period(double seconds);
+
     // optional. this is intended to prevent action periods started at
     // the same time from all triggering around the same time, which
     // causes bursty workloads (e.g. triggering keyframe encoding for
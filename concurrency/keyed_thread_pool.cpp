@@ -0,0 +1,76 @@
+#include "keyed_thread_pool.h"
+
+#include "debug/check.h"
+
+namespace axby {
+
+KeyedThreadPool::KeyedThreadPool(int num_threads) {
+    CHECK_GT(num_threads, 0);
+    for (int i = 0; i < num_threads; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (auto& worker : workers_) {
+        worker->thread = std::thread{[this, w = worker.get()]() {
+            run_worker(*w);
+        }};
+    }
+}
+
+KeyedThreadPool::~KeyedThreadPool() {
+    for (auto& worker : workers_) {
+        {
+            std::lock_guard<std::mutex> lock{worker->mutex};
+            worker->stop = true;
+        }
+        worker->condition.notify_one();
+    }
+    for (auto& worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+void KeyedThreadPool::push(std::string_view key, std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock{idle_mutex_};
+        ++num_unfinished_;
+    }
+
+    Worker& worker =
+        *workers_[std::hash<std::string_view>{}(key) % workers_.size()];
+    {
+        std::lock_guard<std::mutex> lock{worker.mutex};
+        worker.jobs.push_back(std::move(job));
+    }
+    worker.condition.notify_one();
+}
+
+void KeyedThreadPool::wait_idle() {
+    std::unique_lock<std::mutex> lock{idle_mutex_};
+    idle_condition_.wait(lock, [this]() { return num_unfinished_ == 0; });
+}
+
+void KeyedThreadPool::run_worker(Worker& worker) {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock{worker.mutex};
+            worker.condition.wait(lock, [&]() {
+                return worker.stop || !worker.jobs.empty();
+            });
+            if (worker.jobs.empty()) return;  // stopped and drained
+            job = std::move(worker.jobs.front());
+            worker.jobs.pop_front();
+        }
+
+        job();
+
+        bool idle = false;
+        {
+            std::lock_guard<std::mutex> lock{idle_mutex_};
+            idle = --num_unfinished_ == 0;
+        }
+        if (idle) idle_condition_.notify_all();
+    }
+}
+
+}  // namespace axby
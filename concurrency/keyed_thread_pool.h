@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace axby {
+
+// thread pool where jobs pushed with the same key run one at a time,
+// in push order, while jobs with different keys may run in parallel.
+// use it to spread per-stream work, like decoding, across cores
+// without reordering any one stream.
+//
+// each key is pinned to one worker by its hash, so two busy keys can
+// end up sharing a worker.
+class KeyedThreadPool {
+   public:
+    explicit KeyedThreadPool(int num_threads);
+
+    // runs the jobs that are already queued, then joins
+    ~KeyedThreadPool();
+
+    KeyedThreadPool(const KeyedThreadPool&) = delete;
+    KeyedThreadPool& operator=(const KeyedThreadPool&) = delete;
+
+    void push(std::string_view key, std::function<void()> job);
+
+    // blocks until every job pushed so far has run
+    void wait_idle();
+
+    int num_threads() const { return workers_.size(); }
+
+   private:
+    struct Worker {
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<std::function<void()>> jobs;
+        bool stop = false;
+        std::thread thread;
+    };
+
+    void run_worker(Worker& worker);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    std::mutex idle_mutex_;
+    std::condition_variable idle_condition_;
+    size_t num_unfinished_ = 0;
+};
+
+}  // namespace axby
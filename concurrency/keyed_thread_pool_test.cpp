@@ -0,0 +1,71 @@
+#include "concurrency/keyed_thread_pool.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "app/timing.h"
+#include "gtest/gtest.h"
+
+using namespace axby;
+
+TEST(KeyedThreadPool, same_key_runs_in_order) {
+    KeyedThreadPool pool(4);
+
+    const int num_keys = 8;
+    const int num_jobs_per_key = 1000;
+    std::vector<std::vector<int>> key_to_results(num_keys);
+    for (int i = 0; i < num_jobs_per_key; ++i) {
+        for (int key = 0; key < num_keys; ++key) {
+            // only jobs of this key touch this vector, so no lock
+            pool.push(std::to_string(key),
+                      [&results = key_to_results[key], i]() {
+                          results.push_back(i);
+                      });
+        }
+    }
+    pool.wait_idle();
+
+    for (const auto& results : key_to_results) {
+        ASSERT_EQ(results.size(), num_jobs_per_key);
+        for (int i = 0; i < num_jobs_per_key; ++i) {
+            EXPECT_EQ(results[i], i);
+        }
+    }
+}
+
+TEST(KeyedThreadPool, different_keys_run_in_parallel) {
+    KeyedThreadPool pool(2);
+
+    // 16 keys over 2 workers, so both workers get jobs and some of
+    // them overlap in time
+    std::atomic<int> num_running{0};
+    std::atomic<int> max_running{0};
+    for (int key = 0; key < 16; ++key) {
+        pool.push(std::to_string(key), [&]() {
+            const int running = ++num_running;
+            int expected = max_running;
+            while (running > expected &&
+                   !max_running.compare_exchange_weak(expected, running)) {
+            }
+            sleep_ms(5);
+            --num_running;
+        });
+    }
+    pool.wait_idle();
+
+    EXPECT_EQ(max_running, 2);
+}
+
+TEST(KeyedThreadPool, destructor_drains_queue) {
+    std::atomic<int> num_run{0};
+    {
+        KeyedThreadPool pool(3);
+        for (int i = 0; i < 100; ++i) {
+            pool.push(std::to_string(i % 5), [&]() { ++num_run; });
+        }
+    }
+    EXPECT_EQ(num_run, 100);
+}
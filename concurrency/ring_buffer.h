@@ -23,6 +23,9 @@ struct RingBuffer {
     std::atomic<bool> stopped = {false};
     std::atomic<uint64_t> update_counter = {0};
 
+    // one slot is always left empty to tell full from empty
+    static constexpr int capacity = size - 1;
+
     void stop() {
         stopped = true;
         update_counter += 1;
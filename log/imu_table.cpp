@@ -0,0 +1,209 @@
+#include "log/imu_table.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "debug/check.h"
+#include "debug/log.h"
+
+namespace axby {
+
+namespace {
+
+enum Column {
+    SERIAL,
+    STREAM,
+    STREAM_INDEX,
+    TIME_US,
+    X,
+    Y,
+    Z,
+    THIS_PROCESS_TIME_US,
+    NUM_COLUMNS
+};
+
+// fills duckdb data chunks a column at a time and appends them whole,
+// instead of appending value by value
+class ImuChunkAppender {
+   public:
+    ImuChunkAppender(duckdb_connection con, const std::string& table_name) {
+        CHECK(duckdb_appender_create(con, nullptr, table_name.c_str(),
+                                     &appender_) != DuckDBError);
+
+        const duckdb_type types[NUM_COLUMNS] = {
+            DUCKDB_TYPE_VARCHAR, DUCKDB_TYPE_VARCHAR, DUCKDB_TYPE_USMALLINT,
+            DUCKDB_TYPE_UBIGINT, DUCKDB_TYPE_FLOAT,   DUCKDB_TYPE_FLOAT,
+            DUCKDB_TYPE_FLOAT,   DUCKDB_TYPE_UBIGINT};
+        duckdb_logical_type logical_types[NUM_COLUMNS];
+        for (int i = 0; i < NUM_COLUMNS; ++i) {
+            logical_types[i] = duckdb_create_logical_type(types[i]);
+        }
+        chunk_ = duckdb_create_data_chunk(logical_types, NUM_COLUMNS);
+        for (auto& logical_type : logical_types) {
+            duckdb_destroy_logical_type(&logical_type);
+        }
+        capacity_ = duckdb_vector_size();
+        reset();
+    }
+
+    ~ImuChunkAppender() {
+        flush();
+        CHECK(duckdb_appender_flush(appender_) != DuckDBError)
+            << duckdb_appender_error(appender_);
+        duckdb_appender_destroy(&appender_);
+        duckdb_destroy_data_chunk(&chunk_);
+    }
+
+    ImuChunkAppender(const ImuChunkAppender&) = delete;
+    ImuChunkAppender& operator=(const ImuChunkAppender&) = delete;
+
+    // timestamps and xyzs point into the message, so they may be
+    // unaligned
+    void append_batch(std::string_view serial,
+                      std::string_view stream,
+                      uint16_t stream_index,
+                      uint64_t this_process_time_us,
+                      const std::byte* timestamps_us,
+                      const std::byte* xyzs,
+                      size_t num_samples) {
+        size_t done = 0;
+        while (done < num_samples) {
+            const size_t n = std::min(num_samples - done, capacity_ - size_);
+
+            std::memcpy(time_us_ + size_, timestamps_us + done * sizeof(uint64_t),
+                        n * sizeof(uint64_t));
+            const std::byte* src = xyzs + done * 3 * sizeof(float);
+            for (size_t i = 0; i < n; ++i) {
+                float xyz[3];
+                std::memcpy(xyz, src + i * sizeof(xyz), sizeof(xyz));
+                x_[size_ + i] = xyz[0];
+                y_[size_ + i] = xyz[1];
+                z_[size_ + i] = xyz[2];
+            }
+            std::fill_n(stream_index_ + size_, n, stream_index);
+            std::fill_n(this_process_time_us_ + size_, n, this_process_time_us);
+
+            // serials and stream names are short enough to be inlined
+            // into the vector, without a string heap allocation
+            for (size_t i = size_; i < size_ + n; ++i) {
+                duckdb_vector_assign_string_element_len(
+                    vectors_[SERIAL], i, serial.data(), serial.size());
+                duckdb_vector_assign_string_element_len(
+                    vectors_[STREAM], i, stream.data(), stream.size());
+            }
+
+            size_ += n;
+            done += n;
+            if (size_ == capacity_) flush();
+        }
+    }
+
+   private:
+    void flush() {
+        if (size_ == 0) return;
+        duckdb_data_chunk_set_size(chunk_, size_);
+        CHECK(duckdb_append_data_chunk(appender_, chunk_) != DuckDBError)
+            << duckdb_appender_error(appender_);
+        reset();
+    }
+
+    void reset() {
+        duckdb_data_chunk_reset(chunk_);
+        for (int i = 0; i < NUM_COLUMNS; ++i) {
+            vectors_[i] = duckdb_data_chunk_get_vector(chunk_, i);
+        }
+        stream_index_ =
+            (uint16_t*)duckdb_vector_get_data(vectors_[STREAM_INDEX]);
+        time_us_ = (uint64_t*)duckdb_vector_get_data(vectors_[TIME_US]);
+        x_ = (float*)duckdb_vector_get_data(vectors_[X]);
+        y_ = (float*)duckdb_vector_get_data(vectors_[Y]);
+        z_ = (float*)duckdb_vector_get_data(vectors_[Z]);
+        this_process_time_us_ =
+            (uint64_t*)duckdb_vector_get_data(vectors_[THIS_PROCESS_TIME_US]);
+        size_ = 0;
+    }
+
+    duckdb_appender appender_;
+    duckdb_data_chunk chunk_;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+
+    // of the current chunk
+    duckdb_vector vectors_[NUM_COLUMNS];
+    uint16_t* stream_index_ = nullptr;
+    uint64_t* time_us_ = nullptr;
+    float* x_ = nullptr;
+    float* y_ = nullptr;
+    float* z_ = nullptr;
+    uint64_t* this_process_time_us_ = nullptr;
+};
+
+}  // namespace
+
+uint64_t write_imu_table(LogReader& reader,
+                         duckdb_connection out_con,
+                         const std::string& table_name) {
+    const std::string create_table_sql = absl::StrFormat(R"SQL_(
+create or replace table %s (
+serial varchar,
+stream varchar,
+stream_index usmallint,
+time_us ubigint,
+x float,
+y float,
+z float,
+this_process_time_us ubigint,
+)
+)SQL_",
+                                                         table_name);
+    DuckDbResult create_table(out_con, create_table_sql.c_str());
+
+    std::vector<std::string> topics = reader.get_topics_starting_with(
+        "realsense/accel/");
+    for (auto& topic : reader.get_topics_starting_with("realsense/gyro/")) {
+        topics.push_back(std::move(topic));
+    }
+
+    // reading no topics would read all of them
+    if (topics.empty()) {
+        LOG(INFO) << "No imu topics, wrote an empty " << table_name;
+        return 0;
+    }
+
+    uint64_t num_samples = 0;
+    ImuChunkAppender appender(out_con, table_name);
+    LogReader::Cursor cursor = reader.read({.topics = topics});
+    while (cursor.fetch_chunk()) {
+        for (const LogMessageView& message : cursor.messages()) {
+            std::vector<std::string_view> parts =
+                absl::StrSplit(message.topic, '/');
+            CHECK_EQ(parts.size(), 4) << message.topic;
+            int stream_index = 0;
+            CHECK(absl::SimpleAtoi(parts[3], &stream_index)) << message.topic;
+
+            const auto frames = unpack_frames(message.packed_frames);
+            CHECK_EQ(frames.size(), 4) << message.topic;
+            const auto& timestamps_us = frames[2];
+            const auto& xyzs = frames[3];
+            const size_t num_batch_samples =
+                timestamps_us.size() / sizeof(uint64_t);
+            CHECK_EQ(xyzs.size(), num_batch_samples * 3 * sizeof(float));
+
+            appender.append_batch(parts[2], parts[1], stream_index,
+                                  message.this_process_time_us,
+                                  timestamps_us.data(), xyzs.data(),
+                                  num_batch_samples);
+            num_samples += num_batch_samples;
+        }
+    }
+    LOG(INFO) << "Wrote " << num_samples << " imu samples of "
+              << topics.size() << " topics to " << table_name;
+    return num_samples;
+}
+
+}  // namespace axby
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "log/log_reader.h"
+#include "wrappers/duckdb.h"
+
+namespace axby {
+
+// unpacks the accel and gyro batches of a log into a typed table, one
+// row per sample, so motion data can be analysed with plain sql or
+// exported to parquet:
+//
+//   serial varchar
+//   stream varchar                 accel or gyro
+//   stream_index usmallint
+//   time_us ubigint                sample time, on the server's clock
+//   x float, y float, z float
+//   this_process_time_us ubigint   when the batch was logged
+//
+// the topics are realsense/{accel,gyro}/<serial>/<stream index> and
+// the frames are [sequence_id, stream_meta, timestamps_us, xyzs], as
+// published by the realsense server. the table is replaced if it
+// exists, and empty if the log has no imu topics. returns the number
+// of samples.
+uint64_t write_imu_table(LogReader& reader,
+                         duckdb_connection out_con,
+                         const std::string& table_name = "imu");
+
+}  // namespace axby
@@ -0,0 +1,97 @@
+#include "log/keyframe_index.h"
+
+#include <algorithm>
+
+#include "debug/check.h"
+#include "debug/log.h"
+
+namespace axby {
+
+namespace {
+
+bool have_keyframes_table(duckdb_connection con) {
+    const char* sql = R"SQL_(
+select count(*) from information_schema.tables where table_name = 'keyframes'
+)SQL_";
+
+    DuckDbResult result(con, sql);
+    CHECK(result.fetch_chunk());
+    return result.get_column<int64_t>(0).row(0) > 0;
+}
+
+}  // namespace
+
+void KeyframeIndex::load(duckdb_connection con) {
+    // the log scan only touches the small columns, but it still reads
+    // every row group of a large log
+    const char* keyframes_table_sql = R"SQL_(
+select topic, message_id, this_process_time_us from keyframes
+)SQL_";
+    const char* log_scan_sql = R"SQL_(
+select topic, message_id, this_process_time_us from log
+where flags = 1 -- this flag is used to indicate keyframe
+)SQL_";
+
+    const bool use_keyframes_table = have_keyframes_table(con);
+    if (!use_keyframes_table) {
+        LOG(INFO) << "Log has no keyframes table, scanning log for keyframes";
+    }
+
+    DuckDbResult result(con, use_keyframes_table ? keyframes_table_sql
+                                                 : log_scan_sql);
+    while (result.fetch_chunk()) {
+        auto topics = result.get_column<duckdb_string_t>(0);
+        auto message_ids = result.get_column<uint64_t>(1);
+        auto times_us = result.get_column<uint64_t>(2);
+        for (int row = 0; row < result.get_num_rows(); ++row) {
+            add(duckdb_string_to_string_view(topics.row(row)),
+                {.time_us = times_us.row(row),
+                 .message_id = message_ids.row(row)});
+        }
+    }
+
+    LOG(INFO) << "Loaded " << num_keyframes_ << " keyframes";
+}
+
+void KeyframeIndex::add(std::string_view topic, const Keyframe& keyframe) {
+    auto& keyframes = topic_to_keyframes_[topic];
+
+    // rows almost always arrive in time order, so this is usually an
+    // append
+    auto it = std::upper_bound(
+        keyframes.begin(), keyframes.end(), keyframe.time_us,
+        [](uint64_t time_us, const Keyframe& k) { return time_us < k.time_us; });
+    keyframes.insert(it, keyframe);
+    ++num_keyframes_;
+}
+
+std::optional<KeyframeIndex::Keyframe> KeyframeIndex::find_before(
+    std::string_view topic, uint64_t time_us) const {
+    auto topic_it = topic_to_keyframes_.find(topic);
+    if (topic_it == topic_to_keyframes_.end()) return std::nullopt;
+
+    const auto& keyframes = topic_it->second;
+    auto it = std::lower_bound(
+        keyframes.begin(), keyframes.end(), time_us,
+        [](const Keyframe& k, uint64_t time_us) { return k.time_us < time_us; });
+    if (it == keyframes.begin()) return std::nullopt;
+    return *(it - 1);
+}
+
+std::span<const KeyframeIndex::Keyframe> KeyframeIndex::get_keyframes(
+    std::string_view topic) const {
+    auto topic_it = topic_to_keyframes_.find(topic);
+    if (topic_it == topic_to_keyframes_.end()) return {};
+    return topic_it->second;
+}
+
+std::vector<std::string> KeyframeIndex::get_topics() const {
+    std::vector<std::string> topics;
+    for (const auto& [topic, keyframes] : topic_to_keyframes_) {
+        topics.push_back(topic);
+    }
+    std::sort(topics.begin(), topics.end());
+    return topics;
+}
+
+}  // namespace axby
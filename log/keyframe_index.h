@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "wrappers/duckdb.h"
+
+namespace axby {
+
+// in-memory copy of a log's keyframes, sorted by time per topic, so
+// finding the keyframe to start decoding from is a binary search
+// instead of a query over the log.
+class KeyframeIndex {
+   public:
+    struct Keyframe {
+        uint64_t time_us = 0;
+        uint64_t message_id = 0;
+    };
+
+    // reads the keyframes table. logs recorded before the recorder
+    // wrote that table are scanned once instead.
+    void load(duckdb_connection con);
+
+    void add(std::string_view topic, const Keyframe& keyframe);
+
+    // the last keyframe of topic strictly before time_us
+    std::optional<Keyframe> find_before(std::string_view topic,
+                                        uint64_t time_us) const;
+
+    // in time order, empty if the topic has none
+    std::span<const Keyframe> get_keyframes(std::string_view topic) const;
+
+    std::vector<std::string> get_topics() const;
+    size_t size() const { return num_keyframes_; }
+
+   private:
+    absl::flat_hash_map<std::string, std::vector<Keyframe>>
+        topic_to_keyframes_;
+    size_t num_keyframes_ = 0;
+};
+
+}  // namespace axby
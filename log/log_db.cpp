@@ -0,0 +1,225 @@
+#include "log/log_db.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <span>
+#include <thread>
+
+#include "app/timing.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "fast_resizable_vector/fast_resizable_vector.h"
+#include "seq/seq.h"
+#include "serialization/make_serializable.hpp"
+#include "serialization/serialization.h"
+#include "time_sync/time_sync.h"
+
+namespace axby {
+
+void open_log(const char* log_path, duckdb_database& db, bool read_only) {
+    duckdb_config db_config;
+    duckdb_create_config(&db_config);
+    if (read_only) {
+        duckdb_set_config(db_config, "access_mode", "READ_ONLY");
+    }
+    duckdb_set_config(db_config, "memory_limit", "500MB");
+    // scans decompress row groups in parallel. results still come back
+    // in insertion order, which playback relies on.
+    const std::string num_threads =
+        std::to_string(std::max<int>(std::thread::hardware_concurrency(), 1));
+    duckdb_set_config(db_config, "threads", num_threads.c_str());
+    char* open_error = nullptr;
+    if (duckdb_open_ext(log_path, &db, db_config, &open_error) !=
+        DuckDBSuccess) {
+        LOG(FATAL) << open_error;
+    };
+    duckdb_free(open_error);
+    duckdb_destroy_config(&db_config);
+}
+
+std::pair<uint64_t, uint64_t> get_time_bounds_us(duckdb_connection con) {
+    const char* sql = R"SQL_(
+select min(this_process_time_us), max(this_process_time_us) from log
+)SQL_";
+
+    DuckDbPreparedStatement prepared_statement(con, sql);
+    prepared_statement.execute();
+
+    auto& result = prepared_statement.result();
+    while (result.fetch_chunk()) {
+        idx_t num_rows = result.get_num_rows();
+        CHECK_EQ(num_rows, 1);
+        auto min_time_us = result.get_column<uint64_t>(0).row(0);
+        auto max_time_us = result.get_column<uint64_t>(1).row(0);
+        return {min_time_us, max_time_us};
+    }
+
+    LOG(FATAL) << "No records in log";
+    return {0, 0};
+}
+
+std::vector<std::string> get_topics_starting_with(
+    duckdb_connection con, std::string_view topic_prefix) {
+    const char* sql = R"SQL_(
+select distinct topic from log
+where topic like $topic_prefix || '%'
+order by topic asc
+)SQL_";
+
+    DuckDbPreparedStatement prepared_statement(con, sql);
+    prepared_statement.bind_param_string("topic_prefix", topic_prefix);
+    prepared_statement.execute();
+
+    std::vector<std::string> topics;
+
+    auto& result = prepared_statement.result();
+    while (result.fetch_chunk()) {
+        idx_t num_rows = result.get_num_rows();
+        auto topics_column = result.get_column<duckdb_string_t>(0);
+        for (int row = 0; row < num_rows; ++row) {
+            topics.push_back(duckdb_string_to_string(topics_column.row(row)));
+        }
+    }
+
+    return topics;
+}
+
+namespace {
+
+struct LogClock {
+    // the recorder process
+    uint64_t process_id = 0;
+
+    // offsets from the process clock of the recorder, which
+    // this_process_time_us is on
+    std::optional<int64_t> time_server_offset_us;
+    std::optional<int64_t> unix_offset_us;
+};
+
+LogClock read_log_clock(duckdb_connection con) {
+    LogClock clock;
+    {
+        const char* sql = R"SQL_(
+select this_process_id, creation_process_time_us, creation_unix_time_ms
+from metadata limit 1
+)SQL_";
+        DuckDbPreparedStatement prepared_statement(con, sql);
+        prepared_statement.execute();
+        auto& result = prepared_statement.result();
+        if (!result.fetch_chunk()) return clock;
+        clock.process_id = result.get_column<uint64_t>(0).row(0);
+        const uint64_t process_time_us = result.get_column<uint64_t>(1).row(0);
+        const uint64_t unix_time_ms = result.get_column<uint64_t>(2).row(0);
+        clock.unix_offset_us = safe_minus(unix_time_ms * 1000, process_time_us);
+    }
+
+    // the recorder records its own time_sync messages from the
+    // publisher side. the estimate with the tightest round trip is the
+    // most accurate.
+    const char* sql = R"SQL_(
+select frames from log
+where topic = 'time_sync' and sender_process_id = $process_id
+)SQL_";
+    DuckDbPreparedStatement prepared_statement(con, sql);
+    prepared_statement.bind_param_uint64("process_id", clock.process_id);
+    prepared_statement.execute();
+
+    uint64_t best_round_trip_time_us = std::numeric_limits<uint64_t>::max();
+    auto& result = prepared_statement.result();
+    while (result.fetch_chunk()) {
+        auto framess = result.get_column<duckdb_string_t>(0);
+        for (int row = 0; row < result.get_num_rows(); ++row) {
+            FastResizableVector<std::span<const std::byte>> frames;
+            serialization::deserialize_cbor(
+                frames, duckdb_string_to_string_view(framess.row(row)));
+            if (frames.size() != 1 ||
+                frames[0].size() != sizeof(time_sync::TimeSyncState)) {
+                continue;
+            }
+            const auto state =
+                seq_bit_cast<time_sync::TimeSyncState>(frames[0]);
+            if (state.observed_round_trip_time_us < best_round_trip_time_us) {
+                best_round_trip_time_us = state.observed_round_trip_time_us;
+                clock.time_server_offset_us = state.offset_estimate_us;
+            }
+        }
+    }
+    return clock;
+}
+
+}  // namespace
+
+std::vector<LogSource> open_logs(const std::vector<std::string>& log_paths) {
+    CHECK(!log_paths.empty());
+
+    std::vector<LogSource> sources;
+    std::vector<LogClock> clocks;
+    for (const auto& log_path : log_paths) {
+        LogSource& source = sources.emplace_back();
+        source.path = log_path;
+        open_log(log_path.c_str(), source.db, /*read_only=*/true);
+
+        DuckDbConnection con(source.db);
+        clocks.push_back(read_log_clock(con));
+    }
+    if (sources.size() == 1) return sources;
+
+    const bool time_synced =
+        std::all_of(clocks.begin(), clocks.end(), [](const LogClock& clock) {
+            return bool(clock.time_server_offset_us);
+        });
+    const bool has_unix_time =
+        std::all_of(clocks.begin(), clocks.end(), [](const LogClock& clock) {
+            return bool(clock.unix_offset_us);
+        });
+    if (!time_synced && !has_unix_time) {
+        LOG(WARNING) << "Logs have no common clock, playing them unaligned";
+        return sources;
+    }
+    if (!time_synced) {
+        LOG(WARNING) << "Not every recorder was time synced, aligning logs "
+                        "by their unix creation times";
+    }
+
+    std::vector<int64_t> offsets_us;
+    for (const auto& clock : clocks) {
+        offsets_us.push_back(time_synced ? *clock.time_server_offset_us
+                                         : *clock.unix_offset_us);
+    }
+    // the log with the smallest offset stays on its own clock
+    const int64_t min_offset_us =
+        *std::min_element(offsets_us.begin(), offsets_us.end());
+    for (int i = 0; i < sources.size(); ++i) {
+        sources[i].time_shift_us = offsets_us[i] - min_offset_us;
+        LOG(INFO) << "Shifting " << sources[i].path << " (process "
+                  << clocks[i].process_id << ") by "
+                  << sources[i].time_shift_us << "us";
+    }
+    return sources;
+}
+
+void close_logs(std::vector<LogSource>& sources) {
+    for (auto& source : sources) {
+        duckdb_close(&source.db);
+    }
+    sources.clear();
+}
+
+std::pair<uint64_t, uint64_t> get_time_bounds_us(
+    const std::vector<LogSource>& sources) {
+    uint64_t min_time_us = std::numeric_limits<uint64_t>::max();
+    uint64_t max_time_us = 0;
+    for (const auto& source : sources) {
+        DuckDbConnection con(source.db);
+        const auto [log_min_time_us, log_max_time_us] =
+            get_time_bounds_us(con);
+        min_time_us =
+            std::min(min_time_us, log_min_time_us + source.time_shift_us);
+        max_time_us =
+            std::max(max_time_us, log_max_time_us + source.time_shift_us);
+    }
+    return {min_time_us, max_time_us};
+}
+
+}  // namespace axby
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "wrappers/duckdb.h"
+
+namespace axby {
+
+// shared by the log viewer and the headless log tools
+
+void open_log(const char* log_path, duckdb_database& db, bool read_only);
+
+// min and max this_process_time_us of the log
+std::pair<uint64_t, uint64_t> get_time_bounds_us(duckdb_connection con);
+
+std::vector<std::string> get_topics_starting_with(
+    duckdb_connection con, std::string_view topic_prefix);
+
+// one of several logs recorded at the same time, eg by a recorder on
+// each camera host, replayed on a merged timeline
+struct LogSource {
+    std::string path;
+    duckdb_database db = nullptr;
+
+    // added to this_process_time_us of the log to get the merged
+    // timeline
+    uint64_t time_shift_us = 0;
+};
+
+// opens the logs read only and aligns their timelines. each log is
+// recorded on the process clock of its recorder, so logs are aligned
+// by the time server offsets their recorders published on time_sync,
+// or by the unix creation times in their metadata if any recorder
+// was not synced.
+std::vector<LogSource> open_logs(const std::vector<std::string>& log_paths);
+void close_logs(std::vector<LogSource>& sources);
+
+// bounds of the merged timeline
+std::pair<uint64_t, uint64_t> get_time_bounds_us(
+    const std::vector<LogSource>& sources);
+
+}  // namespace axby
@@ -0,0 +1,175 @@
+#include "log/log_reader.h"
+
+#include "debug/check.h"
+#include "debug/log.h"
+#include "log/log_db.h"
+#include "serialization/make_serializable.hpp"
+#include "serialization/serialization.h"
+
+namespace axby {
+
+namespace {
+
+// no order by, which would make duckdb materialize and sort the whole
+// range before returning the first row. the recorder appends messages
+// as they arrive, so message_id order is this_process_time_us order,
+// and duckdb preserves insertion order for scans.
+const char* read_sql = R"SQL_(
+select
+message_id, this_process_time_us, topic, sender_process_id,
+sender_sequence_id, sender_process_time_us, protocol_version,
+message_version, flags, frames
+from log
+where message_id >= $begin_message_id and message_id < $end_message_id
+and (len($topics::varchar[]) = 0 or list_contains($topics::varchar[], topic))
+)SQL_";
+
+}  // namespace
+
+FastResizableVector<std::span<const std::byte>> unpack_frames(
+    std::string_view packed_frames) {
+    FastResizableVector<std::span<const std::byte>> frames;
+    serialization::deserialize_cbor(frames, packed_frames);
+    return frames;
+}
+
+LogReader::LogReader(duckdb_database db) : con_(db) {}
+
+std::pair<uint64_t, uint64_t> LogReader::get_time_bounds_us() {
+    return axby::get_time_bounds_us(con_);
+}
+
+std::vector<std::string> LogReader::get_topics_starting_with(
+    std::string_view topic_prefix) {
+    return axby::get_topics_starting_with(con_, topic_prefix);
+}
+
+const KeyframeIndex& LogReader::get_keyframe_index() {
+    if (!keyframe_index_) {
+        keyframe_index_.emplace();
+        keyframe_index_->load(con_);
+    }
+    return *keyframe_index_;
+}
+
+std::optional<KeyframeIndex::Keyframe> LogReader::find_keyframe_before(
+    std::string_view topic, uint64_t time_us) {
+    return get_keyframe_index().find_before(topic, time_us);
+}
+
+std::optional<uint64_t> LogReader::find_first_message_id(uint64_t time_us) {
+    // the first row in insertion order, which is time order, see
+    // read_sql. min(message_id) would scan every row group from
+    // time_us to the end of the log, limit 1 stops at the first match
+    // and zonemaps skip the row groups before it.
+    const char* sql = R"SQL_(
+select message_id from log where this_process_time_us >= $time_us limit 1
+)SQL_";
+
+    if (!first_message_id_statement_) {
+        first_message_id_statement_.emplace(con_, sql);
+    }
+    auto& prepared_statement = *first_message_id_statement_;
+    prepared_statement.reset();
+    prepared_statement.bind_param_uint64("time_us", time_us);
+    prepared_statement.execute();
+
+    auto& result = prepared_statement.result();
+    if (!result.fetch_chunk()) return std::nullopt;
+    auto message_ids = result.get_column<uint64_t>(0);
+    if (!message_ids.is_valid(0)) return std::nullopt;
+    return message_ids.row(0);
+}
+
+LogReader::Cursor LogReader::read(const LogQuery& query) {
+    const std::optional<uint64_t> begin_message_id =
+        find_first_message_id(query.start_us);
+    if (!begin_message_id) return {};
+
+    uint64_t end_message_id = std::numeric_limits<uint64_t>::max();
+    if (query.end_us != std::numeric_limits<uint64_t>::max()) {
+        end_message_id =
+            find_first_message_id(query.end_us).value_or(end_message_id);
+    }
+    return read_message_ids(query.topics, *begin_message_id, end_message_id);
+}
+
+LogReader::Cursor LogReader::read_message_ids(
+    std::span<const std::string> topics,
+    uint64_t begin_message_id,
+    uint64_t end_message_id) {
+    ++read_id_;
+    if (!read_statement_) read_statement_.emplace(con_, read_sql);
+
+    auto& prepared_statement = *read_statement_;
+    prepared_statement.reset();
+    prepared_statement.bind_param_uint64("begin_message_id", begin_message_id);
+    prepared_statement.bind_param_uint64("end_message_id", end_message_id);
+    prepared_statement.bind_param_string_list("topics", topics);
+    prepared_statement.execute_streaming();
+
+    Cursor cursor;
+    cursor.reader_ = this;
+    cursor.read_id_ = read_id_;
+    return cursor;
+}
+
+LogReader::Cursor LogReader::read_from_keyframe(
+    std::string_view topic,
+    const KeyframeIndex::Keyframe& keyframe,
+    uint64_t end_us) {
+    if (keyframe.time_us >= end_us) return {};
+    uint64_t end_message_id = std::numeric_limits<uint64_t>::max();
+    if (end_us != std::numeric_limits<uint64_t>::max()) {
+        end_message_id = find_first_message_id(end_us).value_or(end_message_id);
+    }
+    const std::string topics[] = {std::string(topic)};
+    return read_message_ids(topics, keyframe.message_id, end_message_id);
+}
+
+bool LogReader::Cursor::fetch_chunk() {
+    messages_.clear();
+    chunk_.reset();
+    if (!reader_) return false;
+    CHECK_EQ(read_id_, reader_->read_id_)
+        << "another read was started on the reader";
+
+    auto& result = reader_->read_statement_->result();
+    if (!result.fetch_chunk()) {
+        reader_ = nullptr;
+        return false;
+    }
+
+    // expects the columns of read_sql
+    auto message_ids = result.get_column<uint64_t>(0);
+    auto this_process_times_us = result.get_column<uint64_t>(1);
+    auto topics = result.get_column<duckdb_string_t>(2);
+    auto sender_process_ids = result.get_column<uint64_t>(3);
+    auto sender_sequence_ids = result.get_column<uint64_t>(4);
+    auto sender_process_times_us = result.get_column<uint64_t>(5);
+    auto protocol_versions = result.get_column<uint16_t>(6);
+    auto message_versions = result.get_column<uint16_t>(7);
+    auto flagss = result.get_column<uint16_t>(8);
+    auto framess = result.get_column<duckdb_string_t>(9);
+
+    const int num_rows = result.get_num_rows();
+    messages_.resize(num_rows);
+    for (int row = 0; row < num_rows; ++row) {
+        messages_[row] = {
+            .message_id = message_ids.row(row),
+            .this_process_time_us = this_process_times_us.row(row),
+            .topic = duckdb_string_to_string_view(topics.row(row)),
+            .header = {.sender_process_id = sender_process_ids.row(row),
+                       .sender_sequence_id = sender_sequence_ids.row(row),
+                       .sender_process_time_us =
+                           sender_process_times_us.row(row),
+                       .protocol_version = protocol_versions.row(row),
+                       .message_version = message_versions.row(row),
+                       .flags = flagss.row(row)},
+            .packed_frames = duckdb_string_to_string_view(framess.row(row))};
+    }
+    chunk_ = result.share_chunk();
+    return true;
+}
+
+}  // namespace axby
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "app/pubsub_message.h"
+#include "fast_resizable_vector/fast_resizable_vector.h"
+#include "log/keyframe_index.h"
+#include "wrappers/duckdb.h"
+
+namespace axby {
+
+// a row of the log table. the views point into the chunk of query
+// results the message was read from.
+struct LogMessageView {
+    uint64_t message_id = 0;
+    uint64_t this_process_time_us = 0;
+    std::string_view topic;
+    pubsub::MessageHeader header;
+    std::string_view packed_frames;  // see unpack_frames
+};
+
+// the frames column holds the frames of a message as a cbor list. the
+// spans point into packed_frames.
+FastResizableVector<std::span<const std::byte>> unpack_frames(
+    std::string_view packed_frames);
+
+struct LogQuery {
+    // empty for all topics
+    std::vector<std::string> topics;
+
+    // this_process_time_us range, end exclusive
+    uint64_t start_us = 0;
+    uint64_t end_us = std::numeric_limits<uint64_t>::max();
+};
+
+// read access to a log written by pubsub::Recorder, for the log viewer
+// and analysis tools.
+//
+// messages are streamed a chunk at a time in message_id order, which
+// is time order, and handed out as views into duckdb's chunk memory
+// instead of copies. the reader owns a connection and keeps its
+// statements prepared across reads. not thread safe, use a reader per
+// thread.
+class LogReader {
+   public:
+    class Cursor;
+
+    explicit LogReader(duckdb_database db);
+
+    LogReader(const LogReader&) = delete;
+    LogReader& operator=(const LogReader&) = delete;
+
+    // for queries not covered here
+    duckdb_connection connection() { return con_; }
+
+    // min and max this_process_time_us of the log
+    std::pair<uint64_t, uint64_t> get_time_bounds_us();
+
+    std::vector<std::string> get_topics_starting_with(
+        std::string_view topic_prefix);
+
+    // loaded on first use
+    const KeyframeIndex& get_keyframe_index();
+
+    // the last keyframe of topic strictly before time_us. decoding a
+    // video topic at time_us has to start there.
+    std::optional<KeyframeIndex::Keyframe> find_keyframe_before(
+        std::string_view topic, uint64_t time_us);
+
+    // the first message at or after time_us
+    std::optional<uint64_t> find_first_message_id(uint64_t time_us);
+
+    // starting a read ends the cursor of the previous read
+    Cursor read(const LogQuery& query);
+
+    // message_id range, end exclusive
+    Cursor read_message_ids(std::span<const std::string> topics,
+                            uint64_t begin_message_id,
+                            uint64_t end_message_id);
+
+    // reads topic from keyframe up to end_us, eg from
+    // find_keyframe_before up to a seek target
+    Cursor read_from_keyframe(std::string_view topic,
+                              const KeyframeIndex::Keyframe& keyframe,
+                              uint64_t end_us);
+
+   private:
+    DuckDbConnection con_;
+    std::optional<KeyframeIndex> keyframe_index_;
+
+    // prepared on first use
+    std::optional<DuckDbPreparedStatement> first_message_id_statement_;
+    std::optional<DuckDbPreparedStatement> read_statement_;
+
+    // identifies the read whose cursor may fetch from read_statement_
+    uint64_t read_id_ = 0;
+};
+
+// must not outlive its reader
+class LogReader::Cursor {
+   public:
+    Cursor() = default;
+    Cursor(Cursor&&) = default;
+    Cursor& operator=(Cursor&&) = default;
+
+    // moves to the next chunk of messages. returns false at the end.
+    bool fetch_chunk();
+
+    // of the current chunk, valid until the next fetch_chunk(). the
+    // views stay valid for as long as share_chunk() is held.
+    std::span<const LogMessageView> messages() const { return messages_; }
+    std::shared_ptr<const void> share_chunk() const { return chunk_; }
+
+   private:
+    friend class LogReader;
+
+    // nullptr for an empty read
+    LogReader* reader_ = nullptr;
+    uint64_t read_id_ = 0;
+
+    std::vector<LogMessageView> messages_;
+    std::shared_ptr<const void> chunk_;
+};
+
+}  // namespace axby
@@ -0,0 +1,200 @@
+#include "log/log_reader.h"
+
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "app/pubsub_recorder.h"
+#include "debug/check.h"
+#include "gtest/gtest.h"
+#include "log/imu_table.h"
+#include "log/keyframe_index.h"
+#include "log/log_db.h"
+#include "serialization/make_serializable.hpp"
+#include "serialization/serialization.h"
+
+using namespace axby;
+
+namespace {
+
+constexpr uint64_t start_us = 1000000;
+constexpr int num_messages = 10;
+constexpr uint64_t period_us = 100000;
+constexpr int keyframe_interval = 5;
+constexpr int samples_per_batch = 2;
+
+std::string as_string(std::span<const std::byte> bytes) {
+    return std::string((const char*)bytes.data(), bytes.size());
+}
+
+template <typename T>
+std::string as_string(const std::vector<T>& values) {
+    return std::string((const char*)values.data(), values.size() * sizeof(T));
+}
+
+// as the recorder stores them, see pubsub::Recorder::append
+FastResizableVector<std::byte> pack_frames(
+    const std::vector<std::string>& frames) {
+    std::vector<std::span<const std::byte>> frame_spans;
+    for (const auto& frame : frames) {
+        frame_spans.push_back(
+            {(const std::byte*)frame.data(), frame.size()});
+    }
+    FastResizableVector<std::byte> packed;
+    CHECK(serialization::serialize_cbor(frame_spans, packed));
+    return packed;
+}
+
+// a color topic with a keyframe every keyframe_interval messages and a
+// gyro topic, interleaved, a message of each every period_us
+class LogReaderTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        dir_ = std::filesystem::temp_directory_path() /
+               ("log_reader_test_" + std::to_string(::getpid()));
+        {
+            pubsub::Recorder recorder(dir_.string(), "test.duckdb");
+            for (int i = 0; i < num_messages; ++i) {
+                const uint64_t time_us = start_us + i * period_us;
+
+                const uint16_t flags = i % keyframe_interval == 0;
+                const auto color = pack_frames({"color " + std::to_string(i)});
+                recorder.append_row(color_topic, {.flags = flags}, time_us,
+                                    color);
+
+                std::vector<uint64_t> timestamps_us;
+                std::vector<float> xyzs;
+                for (int j = 0; j < samples_per_batch; ++j) {
+                    timestamps_us.push_back(time_us + j);
+                    xyzs.insert(xyzs.end(), {float(i), float(j), 1.0f});
+                }
+                const auto gyro =
+                    pack_frames({"sequence id", "stream meta",
+                                 as_string(timestamps_us), as_string(xyzs)});
+                recorder.append_row(gyro_topic, {}, time_us + 1, gyro);
+            }
+        }
+        open_log((dir_ / "test.duckdb").c_str(), db_, /*read_only=*/true);
+    }
+
+    void TearDown() override {
+        duckdb_close(&db_);
+        std::filesystem::remove_all(dir_);
+    }
+
+    const std::string color_topic = "realsense/color/123/0";
+    const std::string gyro_topic = "realsense/gyro/123/1";
+
+    std::filesystem::path dir_;
+    duckdb_database db_ = nullptr;
+};
+
+}  // namespace
+
+TEST_F(LogReaderTest, time_bounds_and_topics) {
+    LogReader reader(db_);
+    const auto [min_us, max_us] = reader.get_time_bounds_us();
+    EXPECT_EQ(min_us, start_us);
+    EXPECT_EQ(max_us, start_us + (num_messages - 1) * period_us + 1);
+    EXPECT_EQ(reader.get_topics_starting_with("realsense/color/"),
+              std::vector<std::string>{color_topic});
+}
+
+TEST_F(LogReaderTest, find_first_message_id) {
+    LogReader reader(db_);
+    EXPECT_EQ(reader.find_first_message_id(0), 0);
+    EXPECT_EQ(reader.find_first_message_id(start_us), 0);
+    EXPECT_EQ(reader.find_first_message_id(start_us + 1), 1);
+    EXPECT_EQ(reader.find_first_message_id(start_us + 2), 2);
+    EXPECT_EQ(reader.find_first_message_id(start_us + 3 * period_us), 6);
+    EXPECT_EQ(reader.find_first_message_id(start_us + num_messages * period_us),
+              std::nullopt);
+}
+
+TEST_F(LogReaderTest, read_time_range_of_topic) {
+    LogReader reader(db_);
+    auto cursor = reader.read(
+        {.topics = {color_topic},
+         .start_us = start_us + 2 * period_us,
+         .end_us = start_us + 5 * period_us});
+
+    std::vector<std::string> frames;
+    while (cursor.fetch_chunk()) {
+        for (const LogMessageView& message : cursor.messages()) {
+            EXPECT_EQ(message.topic, color_topic);
+            const auto message_frames = unpack_frames(message.packed_frames);
+            ASSERT_EQ(message_frames.size(), 1);
+            frames.push_back(as_string(message_frames[0]));
+        }
+    }
+    EXPECT_EQ(frames,
+              (std::vector<std::string>{"color 2", "color 3", "color 4"}));
+}
+
+TEST_F(LogReaderTest, keyframe_index) {
+    LogReader reader(db_);
+    const KeyframeIndex& index = reader.get_keyframe_index();
+    EXPECT_EQ(index.size(), num_messages / keyframe_interval);
+    EXPECT_EQ(index.get_keyframes(gyro_topic).size(), 0);
+
+    EXPECT_EQ(reader.find_keyframe_before(color_topic, start_us), std::nullopt);
+    const auto keyframe =
+        reader.find_keyframe_before(color_topic, start_us + 7 * period_us);
+    ASSERT_TRUE(keyframe);
+    EXPECT_EQ(keyframe->time_us, start_us + 5 * period_us);
+    EXPECT_EQ(keyframe->message_id, 10);
+
+    // decoding at 7 starts at the keyframe 5
+    auto cursor = reader.read_from_keyframe(color_topic, *keyframe,
+                                            start_us + 7 * period_us);
+    int num_read = 0;
+    while (cursor.fetch_chunk()) num_read += cursor.messages().size();
+    EXPECT_EQ(num_read, 2);
+}
+
+TEST_F(LogReaderTest, imu_table) {
+    LogReader reader(db_);
+    DuckDbContext out;
+    out.init(":memory:");
+    EXPECT_EQ(write_imu_table(reader, out.conn_),
+              num_messages * samples_per_batch);
+
+    DuckDbResult result(out.conn_, R"SQL_(
+select serial, stream, stream_index, time_us, x, y, z, this_process_time_us
+from imu order by time_us limit 1 offset 3
+)SQL_");
+    ASSERT_TRUE(result.fetch_chunk());
+    EXPECT_EQ(duckdb_string_to_string_view(
+                  result.get_column<duckdb_string_t>(0).row(0)),
+              "123");
+    EXPECT_EQ(duckdb_string_to_string_view(
+                  result.get_column<duckdb_string_t>(1).row(0)),
+              "gyro");
+    EXPECT_EQ(result.get_column<uint16_t>(2).row(0), 1);
+    EXPECT_EQ(result.get_column<uint64_t>(3).row(0), start_us + period_us + 1);
+    EXPECT_EQ(result.get_column<float>(4).row(0), 1);
+    EXPECT_EQ(result.get_column<float>(5).row(0), 1);
+    EXPECT_EQ(result.get_column<float>(6).row(0), 1);
+    EXPECT_EQ(result.get_column<uint64_t>(7).row(0), start_us + period_us + 1);
+}
+
+TEST_F(LogReaderTest, imu_table_of_log_without_imu) {
+    DuckDbContext in;
+    in.init(":memory:");
+    DuckDbResult create(in.conn_, R"SQL_(
+create table log (topic varchar, this_process_time_us ubigint)
+)SQL_");
+
+    LogReader reader(in.db_);
+    DuckDbContext out;
+    out.init(":memory:");
+    EXPECT_EQ(write_imu_table(reader, out.conn_), 0);
+
+    DuckDbResult result(out.conn_, "select count(*) from imu");
+    ASSERT_TRUE(result.fetch_chunk());
+    EXPECT_EQ(result.get_column<int64_t>(0).row(0), 0);
+}
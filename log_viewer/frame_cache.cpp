@@ -0,0 +1,365 @@
+#include "log_viewer/frame_cache.h"
+
+#include <algorithm>
+#include <span>
+#include <utility>
+
+#include "absl/strings/match.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "fast_resizable_vector/fast_resizable_vector.h"
+#include "seq/seq.h"
+#include "serialization/make_serializable.hpp"
+#include "serialization/serialization.h"
+
+namespace axby {
+
+namespace rss = realsense_streaming;
+
+namespace {
+
+// only reads the small columns, but still scans every row group of
+// the log once per topic
+const char* frames_sql = R"SQL_(
+select message_id, this_process_time_us, flags from log
+where topic = $topic
+order by message_id asc
+)SQL_";
+
+const char* packets_sql = R"SQL_(
+select message_id, sender_process_id, frames from log
+where topic = $topic
+and message_id >= $first_message_id and message_id <= $last_message_id
+order by message_id asc
+)SQL_";
+
+}  // namespace
+
+size_t DecodedFrame::get_bytes() const {
+    size_t result = sizeof(DecodedFrame);
+    if (color) result += color->data.size() * sizeof(uint8_t);
+    if (depth) result += depth->data.size() * sizeof(uint16_t);
+    return result;
+}
+
+FrameCache::FrameCache(duckdb_database db, const FrameCacheOptions& options)
+    : options_(options),
+      con_(db),
+      frames_statement_(con_, frames_sql),
+      worker_con_(db),
+      packets_statement_(worker_con_, packets_sql) {
+    worker_thread_ = std::thread{[this]() { run_worker(); }};
+}
+
+FrameCache::~FrameCache() {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stop_ = true;
+    }
+    work_cv_.notify_one();
+    worker_thread_.join();
+}
+
+size_t FrameCache::get_cached_bytes() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return cached_bytes_;
+}
+
+FrameCache::TopicState& FrameCache::get_topic_state(std::string_view topic) {
+    auto it = topic_to_state_.find(topic);
+    if (it != topic_to_state_.end()) return *it->second;
+
+    const bool is_color = absl::StartsWith(topic, "realsense/color/");
+    CHECK(is_color || absl::StartsWith(topic, "realsense/depth/"))
+        << "Not a video topic " << topic;
+
+    auto state = std::make_unique<TopicState>();
+    state->topic = topic;
+    state->is_color = is_color;
+
+    frames_statement_.reset();
+    frames_statement_.bind_param_string("topic", topic);
+    frames_statement_.execute();
+    auto& result = frames_statement_.result();
+    while (result.fetch_chunk()) {
+        auto message_ids = result.get_column<uint64_t>(0);
+        auto times_us = result.get_column<uint64_t>(1);
+        auto flagss = result.get_column<uint16_t>(2);
+        for (int row = 0; row < result.get_num_rows(); ++row) {
+            state->frames.push_back(
+                {.time_us = times_us.row(row) + options_.time_shift_us,
+                 .message_id = message_ids.row(row),
+                 // this flag is used to indicate keyframe
+                 .is_keyframe = flagss.row(row) == 1});
+        }
+    }
+    state->undecodable.resize(state->frames.size());
+    LOG(INFO) << "Indexed " << state->frames.size() << " frames of " << topic;
+
+    TopicState& state_ref = *state;
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        topics_.push_back(&state_ref);
+    }
+    topic_to_state_[std::string(topic)] = std::move(state);
+    return state_ref;
+}
+
+int64_t FrameCache::find_frame_idx(const TopicState& state, uint64_t time_us) {
+    auto it = std::upper_bound(
+        state.frames.begin(), state.frames.end(), time_us,
+        [](uint64_t time_us, const FrameInfo& f) { return time_us < f.time_us; });
+    return int64_t(it - state.frames.begin()) - 1;
+}
+
+int64_t FrameCache::find_keyframe_idx(const TopicState& state, int64_t idx) {
+    while (idx >= 0 && !state.frames[idx].is_keyframe) --idx;
+    return idx;
+}
+
+std::shared_ptr<const DecodedFrame> FrameCache::get_decoded_frame(
+    std::string_view topic,
+    uint64_t time_us) {
+    TopicState& state = get_topic_state(topic);
+    int64_t idx = find_frame_idx(state, time_us);
+    if (idx < 0) return nullptr;
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (idx < state.last_requested_idx) request_prefetch(state, idx);
+    state.last_requested_idx = idx;
+
+    // the last frame before a gap, instead of decoding up to the gap
+    // again on every call
+    while (idx >= 0 && state.undecodable[idx]) --idx;
+    if (idx < 0) return nullptr;
+
+    if (auto frame = lookup(state.frames[idx].message_id)) {
+        return frame;
+    }
+    state.requested_idx = idx;
+    work_cv_.notify_one();
+    return nullptr;
+}
+
+void FrameCache::request_prefetch(TopicState& state, int64_t idx) {
+    // the last frame of the previous gop, which decodes all of it
+    const int64_t keyframe_idx = find_keyframe_idx(state, idx);
+    if (keyframe_idx <= 0) return;
+    const int64_t prefetch_idx = keyframe_idx - 1;
+    if (state.undecodable[prefetch_idx] ||
+        message_id_to_entry_.count(state.frames[prefetch_idx].message_id)) {
+        return;
+    }
+    state.prefetch_idx = prefetch_idx;
+    work_cv_.notify_one();
+}
+
+bool FrameCache::take_work(TopicState*& state, int64_t& idx) {
+    // what is shown goes before what is prefetched
+    for (TopicState* topic_state : topics_) {
+        if (topic_state->requested_idx >= 0) {
+            state = topic_state;
+            idx = std::exchange(topic_state->requested_idx, -1);
+            return true;
+        }
+    }
+    for (TopicState* topic_state : topics_) {
+        if (topic_state->prefetch_idx >= 0) {
+            state = topic_state;
+            idx = std::exchange(topic_state->prefetch_idx, -1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void FrameCache::run_worker() {
+    while (true) {
+        TopicState* state = nullptr;
+        int64_t idx = -1;
+        {
+            std::unique_lock<std::mutex> lock{mutex_};
+            work_cv_.wait(lock,
+                          [&]() { return stop_ || take_work(state, idx); });
+            if (stop_) return;
+
+            // requested again while it was being decoded
+            if (state->undecodable[idx] ||
+                message_id_to_entry_.count(state->frames[idx].message_id)) {
+                continue;
+            }
+        }
+        decode_to(*state, idx);
+    }
+}
+
+void FrameCache::decode_to(TopicState& state, int64_t idx) {
+    const int64_t keyframe_idx = find_keyframe_idx(state, idx);
+    if (keyframe_idx < 0) {
+        mark_undecodable(state, 0);
+        return;
+    }
+
+    // continue with the current decoder state if it is in the same gop
+    // and behind the requested frame. otherwise start over from the
+    // keyframe.
+    int64_t begin_idx = keyframe_idx;
+    if (state.last_decoded_idx >= keyframe_idx &&
+        state.last_decoded_idx < idx) {
+        begin_idx = state.last_decoded_idx + 1;
+    } else {
+        reset_decoder(state);
+    }
+    decode_range(state, begin_idx, idx);
+}
+
+std::optional<uint64_t> FrameCache::step_frame_time_us(std::string_view topic,
+                                                       uint64_t time_us,
+                                                       int num_steps) {
+    const TopicState& state = get_topic_state(topic);
+    if (state.frames.empty()) return std::nullopt;
+
+    const int64_t idx = find_frame_idx(state, time_us);
+    const int64_t stepped_idx = std::clamp<int64_t>(
+        idx + num_steps, 0, int64_t(state.frames.size()) - 1);
+    return state.frames[stepped_idx].time_us;
+}
+
+void FrameCache::reset_decoder(TopicState& state) {
+    if (state.is_color) {
+        if (state.color_decoder) {
+            state.color_decoder->reset();
+        } else {
+            state.color_decoder.emplace();
+        }
+    } else {
+        if (state.depth_decoder) {
+            state.depth_decoder->reset();
+        } else {
+            state.depth_decoder.emplace();
+        }
+    }
+    state.last_decoded_idx = -1;
+}
+
+// up to the next keyframe, which the decoder can start over from
+void FrameCache::mark_undecodable(TopicState& state, int64_t begin_idx) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    for (int64_t idx = begin_idx; idx < int64_t(state.frames.size()); ++idx) {
+        if (idx > begin_idx && state.frames[idx].is_keyframe) break;
+        state.undecodable[idx] = true;
+    }
+}
+
+// frames are [creation_us, sequence_id, stream_meta, packet], as
+// published by the realsense server
+void FrameCache::decode_range(TopicState& state,
+                              int64_t begin_idx,
+                              int64_t end_idx) {
+    packets_statement_.reset();
+    packets_statement_.bind_param_string("topic", state.topic);
+    packets_statement_.bind_param_uint64("first_message_id",
+                                         state.frames[begin_idx].message_id);
+    packets_statement_.bind_param_uint64("last_message_id",
+                                         state.frames[end_idx].message_id);
+    packets_statement_.execute();
+
+    auto& result = packets_statement_.result();
+    int64_t idx = begin_idx;
+    while (result.fetch_chunk()) {
+        auto message_ids = result.get_column<uint64_t>(0);
+        auto sender_process_ids = result.get_column<uint64_t>(1);
+        auto framess = result.get_column<duckdb_string_t>(2);
+        for (int row = 0; row < result.get_num_rows(); ++row, ++idx) {
+            const FrameInfo& info = state.frames[idx];
+            CHECK_EQ(message_ids.row(row), info.message_id);
+
+            FastResizableVector<std::span<const std::byte>> frames;
+            serialization::deserialize_cbor(
+                frames, duckdb_string_to_string_view(framess.row(row)));
+            CHECK_EQ(frames.size(), 4);
+            const auto creation_us = seq_bit_cast<uint64_t>(frames[0]);
+            const auto sequence_id = seq_bit_cast<uint64_t>(frames[1]);
+            const auto stream_meta = rss::parse_stream_meta(frames[2]);
+            const auto packet = frames[3];
+
+            const bool continues = state.last_decoded_idx >= 0 &&
+                                   state.last_sequence_id + 1 == sequence_id;
+            if (!info.is_keyframe && !continues) {
+                // dropped while recording. nothing until the next
+                // keyframe can be decoded.
+                LOG_EVERY_T(WARNING, 1)
+                    << state.topic << " sequence gap at message "
+                    << info.message_id;
+                reset_decoder(state);
+                mark_undecodable(state, idx);
+                return;
+            }
+
+            auto frame = std::make_shared<DecodedFrame>();
+            frame->time_us = info.time_us;
+            frame->message_id = info.message_id;
+            bool decoded = false;
+            if (state.is_color) {
+                auto& color = frame->color.emplace();
+                color.topic = state.topic;
+                color.process_id = sender_process_ids.row(row);
+                color.creation_timestamp_us = creation_us;
+                color.sequence_id = sequence_id;
+                color.stream_meta = stream_meta;
+                decoded = state.color_decoder->decode(packet, color.data);
+            } else {
+                auto& depth = frame->depth.emplace();
+                depth.topic = state.topic;
+                depth.process_id = sender_process_ids.row(row);
+                depth.creation_timestamp_us = creation_us;
+                depth.sequence_id = sequence_id;
+                depth.stream_meta = stream_meta;
+                decoded = state.depth_decoder->decode(packet, stream_meta,
+                                                      depth.data);
+            }
+            if (!decoded) {
+                reset_decoder(state);
+                mark_undecodable(state, idx);
+                return;
+            }
+
+            state.last_decoded_idx = idx;
+            state.last_sequence_id = sequence_id;
+            std::lock_guard<std::mutex> lock{mutex_};
+            insert(std::move(frame));
+        }
+    }
+}
+
+std::shared_ptr<const DecodedFrame> FrameCache::lookup(uint64_t message_id) {
+    auto it = message_id_to_entry_.find(message_id);
+    if (it == message_id_to_entry_.end()) return nullptr;
+
+    // move to the front of the lru list
+    lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+    return it->second.frame;
+}
+
+void FrameCache::insert(std::shared_ptr<const DecodedFrame> frame) {
+    const uint64_t message_id = frame->message_id;
+    if (message_id_to_entry_.count(message_id)) {
+        lookup(message_id);
+        return;
+    }
+
+    cached_bytes_ += frame->get_bytes();
+    lru_.push_front(message_id);
+    message_id_to_entry_[message_id] = {.frame = std::move(frame),
+                                        .lru_it = lru_.begin()};
+
+    // the newest frame always stays, even if it alone is over budget
+    while (cached_bytes_ > options_.max_bytes && lru_.size() > 1) {
+        auto evict_it = message_id_to_entry_.find(lru_.back());
+        cached_bytes_ -= evict_it->second.frame->get_bytes();
+        message_id_to_entry_.erase(evict_it);
+        lru_.pop_back();
+    }
+}
+
+}  // namespace axby
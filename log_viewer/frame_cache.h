@@ -0,0 +1,163 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "realsense_streaming/decoders.h"
+#include "realsense_streaming/realsense_state.h"
+#include "wrappers/duckdb.h"
+
+namespace axby {
+
+struct FrameCacheOptions {
+    // least recently used frames are evicted past this. a gop of one
+    // 848x480 color stream is about 70MB decoded.
+    size_t max_bytes = size_t(1) << 30;
+
+    // added to the times of the log, to put its frames on the merged
+    // timeline of several logs. see LogSource.
+    uint64_t time_shift_us = 0;
+};
+
+struct DecodedFrame {
+    uint64_t time_us = 0;  // this_process_time_us of the message, shifted
+    uint64_t message_id = 0;
+
+    // exactly one is set, depending on the topic
+    std::optional<realsense_streaming::client::ColorData> color;
+    std::optional<realsense_streaming::client::DepthData> depth;
+
+    size_t get_bytes() const;
+};
+
+// random access to the decoded realsense video frames of a log, for
+// scrubbing, frame stepping and reverse playback.
+//
+// a frame is decoded forward from the last keyframe before it, and
+// every frame decoded on the way is cached, so stepping backwards
+// within a gop is a cache hit. the decoder of each topic is kept
+// after a request, so stepping forwards continues from where it
+// stopped instead of going back to the keyframe.
+//
+// decoding runs on a worker thread of the cache, so a request never
+// holds up the gui for a gop. while going backwards, the worker
+// decodes the previous gop ahead of the playhead. frames after a
+// sequence gap or a failed decode are remembered as undecodable up
+// to the next keyframe, so they are not decoded again.
+//
+// call from one thread.
+class FrameCache {
+   public:
+    FrameCache(duckdb_database db, const FrameCacheOptions& options = {});
+    ~FrameCache();
+
+    FrameCache(const FrameCache&) = delete;
+    FrameCache& operator=(const FrameCache&) = delete;
+
+    // the last frame of a realsense color or depth topic at or before
+    // time_us. if it cannot be decoded, eg because messages were
+    // dropped while recording, the last frame before it that can.
+    // nullptr if there is no such frame, or if it is not decoded yet,
+    // in which case it is requested from the worker and returned by a
+    // later call.
+    std::shared_ptr<const DecodedFrame> get_decoded_frame(
+        std::string_view topic,
+        uint64_t time_us);
+
+    // time of the frame num_steps frames after (or before, if
+    // negative) the frame shown at time_us, clamped to the first and
+    // last frame of the topic. for frame stepping.
+    std::optional<uint64_t> step_frame_time_us(std::string_view topic,
+                                               uint64_t time_us,
+                                               int num_steps);
+
+    size_t get_cached_bytes() const;
+
+   private:
+    struct FrameInfo {
+        uint64_t time_us = 0;
+        uint64_t message_id = 0;
+        bool is_keyframe = false;
+    };
+
+    struct TopicState {
+        std::string topic;
+        bool is_color = false;
+        std::vector<FrameInfo> frames;  // in message_id order
+
+        // guarded by mutex_. indices into frames, -1 if none.
+        std::vector<bool> undecodable;
+        int64_t requested_idx = -1;
+        int64_t prefetch_idx = -1;
+        int64_t last_requested_idx = -1;
+
+        // of the worker
+        std::optional<realsense_streaming::ColorDecoder> color_decoder;
+        std::optional<realsense_streaming::DepthDecoder> depth_decoder;
+        // index into frames of the last frame fed to the decoder, or
+        // -1 if the decoder has to start from a keyframe
+        int64_t last_decoded_idx = -1;
+        uint64_t last_sequence_id = 0;
+    };
+
+    struct CacheEntry {
+        std::shared_ptr<const DecodedFrame> frame;
+        std::list<uint64_t>::iterator lru_it;
+    };
+
+    TopicState& get_topic_state(std::string_view topic);
+
+    // the last frame at or before time_us, or -1
+    static int64_t find_frame_idx(const TopicState& state, uint64_t time_us);
+
+    // the keyframe of the gop of idx, or -1
+    static int64_t find_keyframe_idx(const TopicState& state, int64_t idx);
+
+    // call with mutex_ held
+    void request_prefetch(TopicState& state, int64_t idx);
+    bool take_work(TopicState*& state, int64_t& idx);
+
+    // of the worker
+    void run_worker();
+    void decode_to(TopicState& state, int64_t idx);
+    void decode_range(TopicState& state, int64_t begin_idx, int64_t end_idx);
+    void reset_decoder(TopicState& state);
+    void mark_undecodable(TopicState& state, int64_t begin_idx);
+
+    // call with mutex_ held
+    std::shared_ptr<const DecodedFrame> lookup(uint64_t message_id);
+    void insert(std::shared_ptr<const DecodedFrame> frame);
+
+    FrameCacheOptions options_;
+    DuckDbConnection con_;
+    DuckDbPreparedStatement frames_statement_;
+
+    absl::flat_hash_map<std::string, std::unique_ptr<TopicState>>
+        topic_to_state_;
+
+    // of the worker
+    DuckDbConnection worker_con_;
+    DuckDbPreparedStatement packets_statement_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_cv_;
+    bool stop_ = false;
+    std::vector<TopicState*> topics_;
+
+    absl::flat_hash_map<uint64_t, CacheEntry> message_id_to_entry_;
+    std::list<uint64_t> lru_;  // message ids, most recently used first
+    size_t cached_bytes_ = 0;
+
+    std::thread worker_thread_;
+};
+
+}  // namespace axby
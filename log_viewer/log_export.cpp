@@ -0,0 +1,656 @@
+// exports the realsense streams of a log to point clouds and images,
+// without a display.
+//
+// depth is split into gops, which are decoded independently on a
+// thread pool. every depth frame is paired with the last color frame
+// of the same camera at or before it, like the live viewer does.
+//
+// writes into out_dir/<serial>/
+//   depth_<time_us>.ply  binary little endian, float xyz, uchar rgb
+//   color_<time_us>.ppm  rgb8 (--images)
+//   depth_<time_us>.pgm  16 bit depth in device units (--images)
+// where time_us is this_process_time_us of the message in the log.
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_split.h"
+#include "app/flag.h"
+#include "app/main.h"
+#include "app/timing.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "fast_resizable_vector/fast_resizable_vector.h"
+#include "log/log_db.h"
+#include "log/log_reader.h"
+#include "realsense_streaming/decoders.h"
+#include "realsense_streaming/pointcloud_job.h"
+#include "realsense_streaming/realsense_state.h"
+#include "simple_thread_pool.h"
+#include "wrappers/duckdb.h"
+
+APP_FLAG(std::string, log_path, "", "path to the log to export");
+APP_FLAG(std::string, out_dir, "/tmp/log_export", "output directory");
+APP_FLAG(std::string,
+         serials,
+         "",
+         "comma separated serial numbers of the cameras to export, all if "
+         "empty");
+APP_FLAG(double, start_s, 0, "start of the export, from the start of the log");
+APP_FLAG(double, duration_s, 0, "length of the export, to the end if 0");
+APP_FLAG(bool, pointclouds, true, "write a point cloud per depth frame");
+APP_FLAG(bool, images, false, "write the decoded color and depth images");
+APP_FLAG(int, num_threads, 0, "number of export threads, all cores if 0");
+
+using namespace axby;
+namespace rss = realsense_streaming;
+
+namespace {
+
+struct ExportOptions {
+    std::filesystem::path out_dir;
+    bool pointclouds = true;
+    bool images = false;
+};
+
+struct FrameInfo {
+    uint64_t time_us = 0;
+    uint64_t message_id = 0;
+    bool is_keyframe = false;
+};
+
+struct TopicIndex {
+    std::string topic;
+    bool is_color = false;
+    std::vector<FrameInfo> frames;  // in message_id order
+};
+
+struct Camera {
+    std::string serial;
+    std::unique_ptr<TopicIndex> color;
+    std::unique_ptr<TopicIndex> depth;
+};
+
+// frames [begin, end) of a topic, decoded starting from begin
+struct FrameRange {
+    const TopicIndex* index = nullptr;
+    int64_t begin = 0;
+    int64_t end = 0;
+};
+
+// one unit of work. only frames within [start_us, end_us) are written.
+struct Segment {
+    std::string serial;
+    FrameRange depth;
+    FrameRange color;
+    uint64_t start_us = 0;
+    uint64_t end_us = 0;
+
+    // of the color frames it writes. the segments of a camera decode
+    // overlapping color frames, and each is written by one of them,
+    // the segment of the depth frames that follow it.
+    uint64_t color_start_us = 0;
+    uint64_t color_end_us = 0;
+};
+
+struct Packet {
+    uint64_t time_us = 0;
+    uint64_t sender_process_id = 0;
+    bool is_keyframe = false;
+    // points into chunk
+    std::string_view frames_cbor;
+    std::shared_ptr<const void> chunk;
+};
+
+// topics are realsense/{color,depth}/<serial>/<stream index>. only the
+// first stream of each type is exported per camera.
+std::vector<Camera> get_cameras(duckdb_connection con,
+                                const std::vector<std::string>& serials) {
+    const char* sql = R"SQL_(
+select distinct topic from log
+where topic like 'realsense/color/%' or topic like 'realsense/depth/%'
+order by topic
+)SQL_";
+
+    DuckDbPreparedStatement prepared_statement(con, sql);
+    prepared_statement.execute();
+
+    std::map<std::string, Camera> serial_to_camera;
+    auto& result = prepared_statement.result();
+    while (result.fetch_chunk()) {
+        auto topics = result.get_column<duckdb_string_t>(0);
+        for (int row = 0; row < result.get_num_rows(); ++row) {
+            const std::string topic(
+                duckdb_string_to_string_view(topics.row(row)));
+            std::vector<std::string> parts = absl::StrSplit(topic, '/');
+            if (parts.size() != 4) continue;
+            const std::string& serial = parts[2];
+            if (!serials.empty() &&
+                std::find(serials.begin(), serials.end(), serial) ==
+                    serials.end()) {
+                continue;
+            }
+
+            Camera& camera = serial_to_camera[serial];
+            camera.serial = serial;
+            const bool is_color = parts[1] == "color";
+            auto& index = is_color ? camera.color : camera.depth;
+            if (index) continue;
+            index = std::make_unique<TopicIndex>();
+            index->topic = topic;
+            index->is_color = is_color;
+        }
+    }
+
+    std::vector<Camera> cameras;
+    for (auto& [serial, camera] : serial_to_camera) {
+        cameras.push_back(std::move(camera));
+    }
+    return cameras;
+}
+
+void read_index(duckdb_connection con, TopicIndex& index) {
+    const char* sql = R"SQL_(
+select message_id, this_process_time_us, flags from log
+where topic = $topic
+order by message_id asc
+)SQL_";
+
+    DuckDbPreparedStatement prepared_statement(con, sql);
+    prepared_statement.bind_param_string("topic", index.topic);
+    prepared_statement.execute();
+
+    auto& result = prepared_statement.result();
+    while (result.fetch_chunk()) {
+        auto message_ids = result.get_column<uint64_t>(0);
+        auto times_us = result.get_column<uint64_t>(1);
+        auto flagss = result.get_column<uint16_t>(2);
+        for (int row = 0; row < result.get_num_rows(); ++row) {
+            index.frames.push_back(
+                {.time_us = times_us.row(row),
+                 .message_id = message_ids.row(row),
+                 // this flag is used to indicate keyframe
+                 .is_keyframe = flagss.row(row) == 1});
+        }
+    }
+    LOG(INFO) << "Indexed " << index.frames.size() << " frames of "
+              << index.topic;
+}
+
+// the last keyframe at or before time_us, or -1
+int64_t find_keyframe_idx(const TopicIndex& index, uint64_t time_us) {
+    auto it = std::upper_bound(
+        index.frames.begin(), index.frames.end(), time_us,
+        [](uint64_t time_us, const FrameInfo& f) { return time_us < f.time_us; });
+    int64_t idx = int64_t(it - index.frames.begin()) - 1;
+    while (idx >= 0 && !index.frames[idx].is_keyframe) --idx;
+    return idx;
+}
+
+// the first frame after time_us
+int64_t find_end_idx(const TopicIndex& index, uint64_t time_us) {
+    auto it = std::upper_bound(
+        index.frames.begin(), index.frames.end(), time_us,
+        [](uint64_t time_us, const FrameInfo& f) { return time_us < f.time_us; });
+    return it - index.frames.begin();
+}
+
+// splits the export window of a topic at its keyframes. frames before
+// the first keyframe can not be decoded and are not part of any gop.
+std::vector<FrameRange> split_gops(const TopicIndex& index,
+                                   uint64_t start_us,
+                                   uint64_t end_us) {
+    std::vector<FrameRange> gops;
+    int64_t begin = find_keyframe_idx(index, start_us);
+    if (begin < 0) begin = 0;
+    const int64_t num_frames = index.frames.size();
+    while (begin < num_frames && index.frames[begin].time_us < end_us) {
+        if (!index.frames[begin].is_keyframe) {
+            ++begin;
+            continue;
+        }
+        int64_t end = begin + 1;
+        while (end < num_frames && !index.frames[end].is_keyframe) ++end;
+        gops.push_back({.index = &index, .begin = begin, .end = end});
+        begin = end;
+    }
+    return gops;
+}
+
+std::vector<Segment> make_segments(const Camera& camera,
+                                   uint64_t start_us,
+                                   uint64_t end_us) {
+    std::vector<Segment> segments;
+    if (!camera.depth) {
+        // images only
+        for (const auto& gop : split_gops(*camera.color, start_us, end_us)) {
+            segments.push_back({.serial = camera.serial,
+                                .color = gop,
+                                .start_us = start_us,
+                                .end_us = end_us,
+                                .color_start_us = start_us,
+                                .color_end_us = end_us});
+        }
+        return segments;
+    }
+
+    const auto& depth_frames = camera.depth->frames;
+    const std::vector<FrameRange> gops =
+        split_gops(*camera.depth, start_us, end_us);
+    for (size_t i = 0; i < gops.size(); ++i) {
+        const FrameRange& gop = gops[i];
+        Segment segment{
+            .serial = camera.serial,
+            .depth = gop,
+            .start_us = start_us,
+            .end_us = end_us,
+            .color_start_us =
+                i == 0 ? start_us : depth_frames[gop.begin].time_us,
+            .color_end_us = i + 1 == gops.size()
+                                ? end_us
+                                : depth_frames[gops[i + 1].begin].time_us};
+        if (camera.color) {
+            // color frames from the gop of the first one it writes,
+            // which the first depth frame pairs with, to the last one
+            const int64_t color_begin = find_keyframe_idx(
+                *camera.color, std::max(segment.color_start_us,
+                                        depth_frames[gop.begin].time_us));
+            if (color_begin >= 0) {
+                segment.color = {.index = camera.color.get(),
+                                 .begin = color_begin,
+                                 .end = find_end_idx(*camera.color,
+                                                     segment.color_end_us - 1)};
+            }
+        }
+        segments.push_back(std::move(segment));
+    }
+    return segments;
+}
+
+std::vector<Packet> read_packets(LogReader& reader, const FrameRange& range) {
+    std::vector<Packet> packets;
+    if (range.begin >= range.end) return packets;
+
+    const std::string topics[] = {range.index->topic};
+    LogReader::Cursor cursor = reader.read_message_ids(
+        topics, range.index->frames[range.begin].message_id,
+        range.index->frames[range.end - 1].message_id + 1);
+
+    int64_t idx = range.begin;
+    while (cursor.fetch_chunk()) {
+        for (const LogMessageView& message : cursor.messages()) {
+            const FrameInfo& info = range.index->frames[idx++];
+            CHECK_EQ(message.message_id, info.message_id);
+            packets.push_back(
+                {.time_us = info.time_us,
+                 .sender_process_id = message.header.sender_process_id,
+                 .is_keyframe = info.is_keyframe,
+                 .frames_cbor = message.packed_frames,
+                 .chunk = cursor.share_chunk()});
+        }
+    }
+    return packets;
+}
+
+// decodes the packets of one topic in order. after a sequence gap or
+// a decode failure, nothing is decoded until the next keyframe.
+class TopicDecoder {
+   public:
+    TopicDecoder(std::string topic, bool is_color)
+        : topic_(std::move(topic)), is_color_(is_color) {}
+
+    // frames are [creation_us, sequence_id, stream_meta, packet], as
+    // published by the realsense server
+    bool decode(const Packet& packet,
+                rss::client::ColorData* color_out,
+                rss::client::DepthData* depth_out) {
+        const auto frames = unpack_frames(packet.frames_cbor);
+        CHECK_EQ(frames.size(), 4);
+        const auto creation_us = seq_bit_cast<uint64_t>(frames[0]);
+        const auto sequence_id = seq_bit_cast<uint64_t>(frames[1]);
+        const auto stream_meta = rss::parse_stream_meta(frames[2]);
+
+        const bool continues =
+            !needs_keyframe_ && last_sequence_id_ + 1 == sequence_id;
+        if (!packet.is_keyframe && !continues) {
+            if (!needs_keyframe_) {
+                LOG(WARNING) << topic_ << " sequence gap before "
+                             << sequence_id;
+            }
+            needs_keyframe_ = true;
+            return false;
+        }
+
+        bool decoded = false;
+        if (is_color_) {
+            CHECK(color_out);
+            color_out->topic = topic_;
+            color_out->process_id = packet.sender_process_id;
+            color_out->creation_timestamp_us = creation_us;
+            color_out->sequence_id = sequence_id;
+            color_out->stream_meta = stream_meta;
+            if (needs_keyframe_) color_decoder_.reset();
+            decoded = color_decoder_.decode(frames[3], color_out->data);
+        } else {
+            CHECK(depth_out);
+            depth_out->topic = topic_;
+            depth_out->process_id = packet.sender_process_id;
+            depth_out->creation_timestamp_us = creation_us;
+            depth_out->sequence_id = sequence_id;
+            depth_out->stream_meta = stream_meta;
+            if (needs_keyframe_) depth_decoder_.reset();
+            decoded = depth_decoder_.decode(frames[3], stream_meta,
+                                            depth_out->data);
+        }
+
+        needs_keyframe_ = !decoded;
+        last_sequence_id_ = sequence_id;
+        return decoded;
+    }
+
+   private:
+    std::string topic_;
+    bool is_color_ = false;
+    rss::ColorDecoder color_decoder_;
+    rss::DepthDecoder depth_decoder_;
+    bool needs_keyframe_ = true;
+    uint64_t last_sequence_id_ = 0;
+};
+
+void write_ply(const std::filesystem::path& path,
+               const FastResizableVector<float>& xyzs,
+               const FastResizableVector<uint8_t>& rgbs) {
+    const size_t num_points = xyzs.size() / 3;
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << "ply\n"
+         << "format binary_little_endian 1.0\n"
+         << "element vertex " << num_points << "\n"
+         << "property float x\n"
+         << "property float y\n"
+         << "property float z\n"
+         << "property uchar red\n"
+         << "property uchar green\n"
+         << "property uchar blue\n"
+         << "end_header\n";
+
+    static_assert(std::endian::native == std::endian::little);
+    std::vector<char> buf(num_points * (3 * sizeof(float) + 3));
+    char* out = buf.data();
+    for (size_t i = 0; i < num_points; ++i) {
+        std::memcpy(out, &xyzs[3 * i], 3 * sizeof(float));
+        out += 3 * sizeof(float);
+        std::memcpy(out, &rgbs[3 * i], 3);
+        out += 3;
+    }
+    file.write(buf.data(), buf.size());
+    CHECK(file) << "Could not write " << path;
+}
+
+void write_ppm(const std::filesystem::path& path,
+               const rss::client::ColorData& color) {
+    const auto& intrinsics = color.stream_meta.intrinsics;
+    CHECK_EQ(color.data.size(), size_t(3 * intrinsics.width * intrinsics.height));
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << "P6\n"
+         << intrinsics.width << " " << intrinsics.height << "\n255\n";
+    file.write((const char*)color.data.data(), color.data.size());
+    CHECK(file) << "Could not write " << path;
+}
+
+void write_pgm(const std::filesystem::path& path,
+               const rss::client::DepthData& depth) {
+    const auto& intrinsics = depth.stream_meta.intrinsics;
+    CHECK_EQ(depth.data.size(), size_t(intrinsics.width * intrinsics.height));
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << "P5\n"
+         << intrinsics.width << " " << intrinsics.height << "\n65535\n";
+
+    // 16 bit pgm is big endian
+    std::vector<uint8_t> buf(2 * depth.data.size());
+    for (size_t i = 0; i < depth.data.size(); ++i) {
+        buf[2 * i] = depth.data[i] >> 8;
+        buf[2 * i + 1] = depth.data[i] & 0xff;
+    }
+    file.write((const char*)buf.data(), buf.size());
+    CHECK(file) << "Could not write " << path;
+}
+
+std::filesystem::path get_output_path(const ExportOptions& options,
+                                      const std::string& serial,
+                                      const char* prefix,
+                                      uint64_t time_us,
+                                      const char* extension) {
+    return options.out_dir / serial /
+           (prefix + std::to_string(time_us) + extension);
+}
+
+bool in_window(const Segment& segment, uint64_t time_us) {
+    return time_us >= segment.start_us && time_us < segment.end_us;
+}
+
+bool owns_color(const Segment& segment, uint64_t time_us) {
+    return in_window(segment, time_us) && time_us >= segment.color_start_us &&
+           time_us < segment.color_end_us;
+}
+
+void export_color_segment(const Segment& segment,
+                          const ExportOptions& options,
+                          const std::vector<Packet>& color_packets) {
+    TopicDecoder color_decoder(segment.color.index->topic, /*is_color=*/true);
+    rss::client::ColorData color;
+    for (const auto& packet : color_packets) {
+        if (!color_decoder.decode(packet, &color, nullptr)) continue;
+        if (!owns_color(segment, packet.time_us)) continue;
+        write_ppm(get_output_path(options, segment.serial, "color_",
+                                  packet.time_us, ".ppm"),
+                  color);
+    }
+}
+
+struct SegmentExportCounts {
+    // depth frames with an image or point cloud written
+    int num_written = 0;
+    // depth frames whose point cloud was skipped, since there was no
+    // decoded color frame to color it with
+    int num_without_color = 0;
+};
+
+SegmentExportCounts export_segment(duckdb_database db,
+                   const Segment& segment,
+                   const ExportOptions& options) {
+    LogReader reader(db);
+    std::vector<Packet> color_packets;
+    if (segment.color.index) {
+        color_packets = read_packets(reader, segment.color);
+    }
+
+    if (!segment.depth.index) {
+        export_color_segment(segment, options, color_packets);
+        return {};
+    }
+
+    const std::vector<Packet> depth_packets =
+        read_packets(reader, segment.depth);
+
+    TopicDecoder depth_decoder(segment.depth.index->topic,
+                               /*is_color=*/false);
+    std::optional<TopicDecoder> color_decoder;
+    if (segment.color.index) {
+        color_decoder.emplace(segment.color.index->topic, /*is_color=*/true);
+    }
+
+    rss::client::DepthData depth;
+    rss::client::ColorData color;
+    bool has_color = false;
+    size_t color_idx = 0;
+    // decodes the color frames up to time_us
+    const auto decode_color_until = [&](uint64_t time_us) {
+        while (color_idx < color_packets.size() &&
+               color_packets[color_idx].time_us <= time_us) {
+            const auto& color_packet = color_packets[color_idx++];
+            has_color = color_decoder->decode(color_packet, &color, nullptr);
+            if (has_color && options.images &&
+                owns_color(segment, color_packet.time_us)) {
+                write_ppm(get_output_path(options, segment.serial, "color_",
+                                          color_packet.time_us, ".ppm"),
+                          color);
+            }
+        }
+    };
+
+    FastResizableVector<float> xyzs;
+    FastResizableVector<uint8_t> rgbs;
+
+    SegmentExportCounts counts;
+    for (const auto& depth_packet : depth_packets) {
+        // the whole gop has to go through the decoder, even the frames
+        // outside of the export window
+        const bool decoded = depth_decoder.decode(depth_packet, nullptr, &depth);
+
+        if (color_decoder) decode_color_until(depth_packet.time_us);
+
+        if (!decoded || !in_window(segment, depth_packet.time_us)) continue;
+
+        bool written = false;
+        if (options.images) {
+            write_pgm(get_output_path(options, segment.serial, "depth_",
+                                      depth_packet.time_us, ".pgm"),
+                      depth);
+            written = true;
+        }
+        if (options.pointclouds && !has_color) {
+            ++counts.num_without_color;
+        } else if (options.pointclouds) {
+            rss::make_rgb_pointcloud(color, depth, xyzs, rgbs);
+            write_ply(get_output_path(options, segment.serial, "depth_",
+                                      depth_packet.time_us, ".ply"),
+                      xyzs, rgbs);
+            written = true;
+        }
+        if (written) ++counts.num_written;
+    }
+    // the color frames after the last depth frame, up to the next gop
+    if (color_decoder) decode_color_until(UINT64_MAX);
+    return counts;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    __APP_MAIN_INIT__;
+
+    APP_UNPACK_FLAG(log_path);
+    APP_UNPACK_FLAG(out_dir);
+    APP_UNPACK_FLAG(serials);
+    APP_UNPACK_FLAG(start_s);
+    APP_UNPACK_FLAG(duration_s);
+    APP_UNPACK_FLAG(pointclouds);
+    APP_UNPACK_FLAG(images);
+    APP_UNPACK_FLAG(num_threads);
+
+    CHECK(!log_path.empty()) << "--log_path is required";
+    CHECK(std::filesystem::exists(log_path)) << "No such log " << log_path;
+    if (num_threads <= 0) {
+        num_threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+    }
+
+    const ExportOptions options{.out_dir = out_dir,
+                                .pointclouds = pointclouds,
+                                .images = images};
+
+    duckdb_database db;
+    open_log(log_path.c_str(), db, /*read_only=*/true);
+
+    std::vector<Camera> cameras;
+    std::vector<Segment> segments;
+    {
+        DuckDbConnection con(db);
+        const auto [min_time_us, max_time_us] = get_time_bounds_us(con);
+        const uint64_t start_us = min_time_us + uint64_t(start_s * 1e6);
+        const uint64_t end_us =
+            duration_s > 0 ? start_us + uint64_t(duration_s * 1e6)
+                           : max_time_us + 1;
+
+        std::vector<std::string> serials_list;
+        if (!serials.empty()) serials_list = absl::StrSplit(serials, ',');
+        cameras = get_cameras(con, serials_list);
+        CHECK(!cameras.empty()) << "No realsense video topics to export";
+
+        for (auto& camera : cameras) {
+            if (!camera.depth && !options.images) {
+                LOG(INFO) << "Skipping " << camera.serial
+                          << ", it has no depth and --images is off";
+                continue;
+            }
+            if (camera.color) read_index(con, *camera.color);
+            if (camera.depth) read_index(con, *camera.depth);
+            std::filesystem::create_directories(
+                options.out_dir / camera.serial);
+            for (auto& segment : make_segments(camera, start_us, end_us)) {
+                segments.push_back(std::move(segment));
+            }
+        }
+    }
+    LOG(INFO) << "Exporting " << segments.size() << " gops of "
+              << cameras.size() << " cameras with " << num_threads
+              << " threads";
+
+    Stopwatch stopwatch;
+    std::atomic<int> num_frames_written = 0;
+    std::atomic<int> num_frames_without_color = 0;
+    {
+        std::mutex done_mutex;
+        std::condition_variable done_condition;
+        size_t num_segments_done = 0;
+
+        SimpleThreadPool thread_pool(num_threads);
+        for (const auto& segment : segments) {
+            thread_pool.Push([&]() {
+                const SegmentExportCounts counts =
+                    export_segment(db, segment, options);
+                num_frames_written += counts.num_written;
+                num_frames_without_color += counts.num_without_color;
+                {
+                    std::lock_guard<std::mutex> lock{done_mutex};
+                    ++num_segments_done;
+                }
+                done_condition.notify_one();
+            });
+        }
+
+        // the pool does not finish queued work when destructed
+        std::unique_lock<std::mutex> lock{done_mutex};
+        while (!done_condition.wait_for(lock, std::chrono::seconds(5), [&]() {
+            return num_segments_done == segments.size();
+        })) {
+            LOG(INFO) << num_segments_done << "/" << segments.size()
+                      << " gops";
+        }
+    }
+
+    if (num_frames_without_color > 0) {
+        LOG(WARNING) << "Skipped the point clouds of "
+                     << num_frames_without_color
+                     << " depth frames without a decoded color frame";
+    }
+    LOG(INFO) << "Exported " << num_frames_written << " depth frames to "
+              << options.out_dir << " in " << stopwatch.get_sec_since_press()
+              << "s";
+
+    duckdb_close(&db);
+    return 0;
+}
@@ -0,0 +1,86 @@
+// exports the accel and gyro samples of a log as a typed table, see
+// log/imu_table.h. the samples are batched per message in the log,
+// which makes them awkward to query.
+//
+//   --out_path=imu.parquet  writes a parquet file
+//   --out_path=imu.duckdb   writes the imu table into a new database
+//   no --out_path           adds the imu table to the log itself, next
+//                           to the log table
+//
+// eg, the gyro rate of every camera:
+//   select serial, count(*) / ((max(time_us) - min(time_us)) / 1e6)
+//   from imu where stream = 'gyro' group by serial
+
+#include <filesystem>
+#include <string>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_format.h"
+#include "app/flag.h"
+#include "app/main.h"
+#include "app/timing.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "log/imu_table.h"
+#include "log/log_db.h"
+#include "log/log_reader.h"
+#include "wrappers/duckdb.h"
+
+using namespace axby;
+
+APP_FLAG(std::string, log_path, "", "path to the log to export");
+APP_FLAG(std::string,
+         out_path,
+         "",
+         "a .parquet or duckdb file, or empty to add the imu table to the log");
+APP_FLAG(std::string, table_name, "imu", "name of the table");
+
+int main(int argc, char* argv[]) {
+    __APP_MAIN_INIT__;
+
+    APP_UNPACK_FLAG(log_path);
+    APP_UNPACK_FLAG(out_path);
+    APP_UNPACK_FLAG(table_name);
+
+    CHECK(!log_path.empty()) << "--log_path is required";
+    CHECK(std::filesystem::exists(log_path)) << "No such log " << log_path;
+
+    const bool in_place = out_path.empty();
+    const bool parquet = absl::EndsWith(out_path, ".parquet");
+    if (!in_place) {
+        CHECK(!std::filesystem::exists(out_path)) << out_path << " exists";
+    }
+
+    Stopwatch stopwatch;
+    duckdb_database in_db;
+    open_log(log_path.c_str(), in_db, /*read_only=*/!in_place);
+
+    // parquet files are written by duckdb from an in memory table
+    duckdb_database out_db = in_db;
+    if (!in_place) {
+        const char* path = parquet ? nullptr : out_path.c_str();
+        CHECK(duckdb_open(path, &out_db) != DuckDBError)
+            << "Could not open " << out_path;
+    }
+
+    uint64_t num_samples = 0;
+    {
+        LogReader reader(in_db);
+        DuckDbConnection out_con(out_db);
+        num_samples = write_imu_table(reader, out_con, table_name);
+
+        if (parquet) {
+            const std::string copy_sql = absl::StrFormat(
+                "copy %s to '%s' (format parquet)", table_name, out_path);
+            DuckDbResult copy(out_con, copy_sql.c_str());
+        }
+    }
+
+    if (out_db != in_db) duckdb_close(&out_db);
+    duckdb_close(&in_db);
+
+    LOG(INFO) << "Exported " << num_samples << " samples to "
+              << (in_place ? log_path : out_path) << " in "
+              << stopwatch.press() << "s";
+    return 0;
+}
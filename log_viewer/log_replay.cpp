@@ -0,0 +1,114 @@
+// replays a log over pubsub without a display, for batch reprocessing
+// and regression tests.
+//
+// by default the log is replayed at --speed times real time. with
+// --as_fast_as_possible, messages are published as soon as the publish
+// queue has room, and the process time follows the recorded timeline,
+// so a replay runs at machine speed and sees the same times on every
+// run. subscribers in other processes can't push back on it though,
+// and zmq drops what they don't keep up with, so it is only lossless
+// for consumers that are faster than the replay.
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_split.h"
+#include "app/flag.h"
+#include "app/main.h"
+#include "app/pubsub.h"
+#include "app/stop_all.h"
+#include "app/timing.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "log/log_db.h"
+#include "log_viewer/playback.h"
+#include "network_config/config.h"
+#include "time_sync/time_sync.h"
+#include "wrappers/duckdb.h"
+
+APP_FLAG(std::string,
+         log_path,
+         "",
+         "path to the log to replay, or comma separated paths of logs "
+         "recorded at the same time");
+APP_FLAG(double, start_s, 0, "start of the replay, from the start of the log");
+APP_FLAG(bool,
+         as_fast_as_possible,
+         false,
+         "replay as fast as possible on a virtual clock. lossy for "
+         "subscribers that are slower than the replay");
+APP_FLAG(double, speed, 1, "replay speed, without --as_fast_as_possible");
+APP_FLAG(std::string,
+         bind,
+         "",
+         "additional pubsub address to publish on, eg tcp://*:5556");
+
+using namespace axby;
+
+int main(int argc, char* argv[]) {
+    __APP_MAIN_INIT__;
+
+    APP_UNPACK_FLAG(log_path);
+    APP_UNPACK_FLAG(start_s);
+    APP_UNPACK_FLAG(as_fast_as_possible);
+    APP_UNPACK_FLAG(speed);
+    APP_UNPACK_FLAG(bind);
+
+    CHECK(!log_path.empty()) << "--log_path is required";
+    CHECK_GT(speed, 0);
+
+    const std::vector<std::string> log_paths = absl::StrSplit(log_path, ',');
+    std::vector<LogSource> logs = open_logs(log_paths);
+    const auto [min_time_us, max_time_us] = get_time_bounds_us(logs);
+    const uint64_t start_us =
+        std::min<uint64_t>(min_time_us + start_s * 1e6, max_time_us);
+
+    network_config::Config playback_config{"playback"};
+    pubsub::init();
+    if (!bind.empty()) pubsub::bind(bind);
+    time_sync::init(playback_config);
+
+    {
+        // the replay is consumed by other processes
+        Playback playback(logs, {.publish = true,
+                                 .as_fast_as_possible = as_fast_as_possible});
+
+        // the process time is virtual in as fast as possible mode, so
+        // measure the replay with the steady clock
+        const auto start_time = std::chrono::steady_clock::now();
+        const auto get_elapsed_s = [&]() {
+            return std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start_time)
+                .count();
+        };
+
+        LOG(INFO) << "Replaying " << log_path << " from " << start_us << "us";
+        LOG_IF(WARNING, as_fast_as_possible)
+            << "Subscribers that fall behind the replay drop messages";
+        while (!should_stop_all()) {
+            uint64_t playhead_us = start_us;
+            if (!as_fast_as_possible) {
+                playhead_us += speed * get_elapsed_s() * 1e6;
+            }
+            playback.update(playhead_us / 1000, /*playing=*/true, speed);
+
+            if (playback.is_finished()) break;
+            LOG_EVERY_T(INFO, 5)
+                << "Replayed to " << get_process_time_us() << "us";
+            sleep_ms(10);
+        }
+
+        const double elapsed_s = get_elapsed_s();
+        LOG(INFO) << "Replayed " << (max_time_us - start_us) * 1e-6
+                  << "s of log in " << elapsed_s << "s";
+    }
+
+    stop_all();
+    time_sync::cleanup();
+    pubsub::cleanup();
+
+    close_logs(logs);
+    return 0;
+}
@@ -0,0 +1,580 @@
+// rewrites a log into a smaller copy for archiving. topics can be
+// dropped, color video re-encoded at a lower bitrate and depth
+// recompressed with a different keyframe interval. everything else is
+// copied as is.
+//
+// topics, headers, this_process_time_us and message_ids are kept, so
+// the copy plays back and seeks like the original and other logs
+// recorded alongside it stay aligned. re-encoded messages keep their
+// creation time, sequence id and stream meta frames, only the packet
+// and the keyframe flag change.
+//
+// each topic is split into segments starting at keyframes, which are
+// transcoded independently on a thread pool into a staging log next to
+// the output. the staging log is then copied into the output in
+// message_id order, since playback relies on the insertion order being
+// the time order.
+
+#include <vpx/vp8cx.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zdepth.hpp>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "app/create_log_table_sql.h"
+#include "app/flag.h"
+#include "app/main.h"
+#include "app/timing.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "fast_resizable_vector/fast_resizable_vector.h"
+#include "log/log_db.h"
+#include "log/log_reader.h"
+#include "realsense_streaming/decoders.h"
+#include "realsense_streaming/messages.h"
+#include "serialization/make_serializable.hpp"
+#include "serialization/serialization.h"
+#include "simple_thread_pool.h"
+#include "wrappers/duckdb.h"
+#include "wrappers/vpx.h"
+
+APP_FLAG(std::string, log_path, "", "path to the log to transcode");
+APP_FLAG(std::string, out_path, "", "path of the new log");
+APP_FLAG(std::string,
+         drop_topics,
+         "",
+         "comma separated topic prefixes to leave out, eg "
+         "realsense/accel/,realsense/gyro/");
+APP_FLAG(int,
+         color_bitrate,
+         0,
+         "kbps target to re-encode color video at, 0 copies it as is");
+APP_FLAG(double,
+         depth_keyframe_interval_s,
+         0,
+         "seconds between depth keyframes after recompressing, 0 copies "
+         "depth as is");
+APP_FLAG(double,
+         segment_s,
+         10,
+         "topics are transcoded in segments of at least this long. "
+         "re-encoded segments start with a keyframe, so recompressed depth "
+         "segments are at least --depth_keyframe_interval_s long.");
+APP_FLAG(int, num_threads, 0, "number of transcoding threads, all cores if 0");
+
+using namespace axby;
+namespace rss = realsense_streaming;
+
+namespace {
+
+enum class Transcode { COPY, COLOR, DEPTH };
+
+struct TranscodeOptions {
+    unsigned int color_bitrate = 0;  // kbps
+    uint64_t depth_keyframe_interval_us = 0;
+};
+
+// messages [begin_message_id, end_message_id) of a topic
+struct Segment {
+    std::string topic;
+    Transcode transcode = Transcode::COPY;
+    uint64_t begin_message_id = 0;
+    uint64_t end_message_id = std::numeric_limits<uint64_t>::max();
+};
+
+Transcode get_transcode(std::string_view topic,
+                        const TranscodeOptions& options) {
+    if (options.color_bitrate > 0 &&
+        absl::StartsWith(topic, "realsense/color/")) {
+        return Transcode::COLOR;
+    }
+    if (options.depth_keyframe_interval_us > 0 &&
+        absl::StartsWith(topic, "realsense/depth/")) {
+        return Transcode::DEPTH;
+    }
+    return Transcode::COPY;
+}
+
+// splits at keyframes, so each segment can be decoded on its own
+std::vector<Segment> make_segments(
+    const std::string& topic,
+    Transcode transcode,
+    std::span<const KeyframeIndex::Keyframe> keyframes,
+    uint64_t segment_us) {
+    if (keyframes.empty()) {
+        if (transcode != Transcode::COPY) {
+            LOG(WARNING) << "Dropping " << topic
+                         << ", it has no keyframes to decode from";
+            return {};
+        }
+        return {{.topic = topic, .transcode = transcode}};
+    }
+
+    // messages before the first keyframe can only be copied
+    uint64_t begin_message_id =
+        transcode == Transcode::COPY ? 0 : keyframes[0].message_id;
+    uint64_t begin_us = keyframes[0].time_us;
+
+    std::vector<Segment> segments;
+    for (const auto& keyframe : keyframes.subspan(1)) {
+        if (keyframe.time_us < begin_us + segment_us) continue;
+        segments.push_back({.topic = topic,
+                            .transcode = transcode,
+                            .begin_message_id = begin_message_id,
+                            .end_message_id = keyframe.message_id});
+        begin_message_id = keyframe.message_id;
+        begin_us = keyframe.time_us;
+    }
+    segments.push_back({.topic = topic,
+                        .transcode = transcode,
+                        .begin_message_id = begin_message_id});
+    return segments;
+}
+
+// appends rows to the log table of the staging log. appenders on
+// separate connections can append concurrently.
+class StagingAppender {
+   public:
+    StagingAppender(duckdb_database db) : con_(db) {
+        CHECK(duckdb_appender_create(con_, nullptr, "log", &appender_) !=
+              DuckDBError);
+    }
+    ~StagingAppender() { duckdb_appender_destroy(&appender_); }
+
+    StagingAppender(const StagingAppender&) = delete;
+    StagingAppender& operator=(const StagingAppender&) = delete;
+
+    // the columns of the log table, in order
+    void append(const LogMessageView& message,
+                uint16_t flags,
+                std::span<const std::byte> frames_cbor) {
+        duckdb_append_varchar_length(appender_, message.topic.data(),
+                                     message.topic.size());
+        check_duckdb_appender_error(appender_);
+
+        duckdb_append_uint64(appender_, message.header.sender_process_id);
+        check_duckdb_appender_error(appender_);
+        duckdb_append_uint64(appender_, message.header.sender_sequence_id);
+        check_duckdb_appender_error(appender_);
+        duckdb_append_uint64(appender_, message.header.sender_process_time_us);
+        check_duckdb_appender_error(appender_);
+        duckdb_append_uint16(appender_, message.header.protocol_version);
+        check_duckdb_appender_error(appender_);
+        duckdb_append_uint16(appender_, message.header.message_version);
+        check_duckdb_appender_error(appender_);
+        duckdb_append_uint16(appender_, flags);
+        check_duckdb_appender_error(appender_);
+
+        duckdb_append_uint64(appender_, message.this_process_time_us);
+        check_duckdb_appender_error(appender_);
+        duckdb_append_uint64(appender_, message.message_id);
+        check_duckdb_appender_error(appender_);
+
+        duckdb_append_blob(appender_, (const void*)frames_cbor.data(),
+                           frames_cbor.size());
+        check_duckdb_appender_error(appender_);
+        duckdb_appender_end_row(appender_);
+    }
+
+   private:
+    DuckDbConnection con_;
+    duckdb_appender appender_;
+};
+
+// decodes vp9 and encodes it again. the decoded i420 images go
+// straight into the encoder without converting to rgb.
+class ColorTranscoder {
+   public:
+    explicit ColorTranscoder(unsigned int bitrate)
+        : bitrate_(bitrate), decoder_(init_vpx_decoder()) {
+        CHECK(decoder_);
+    }
+
+    // returns false if the packet did not produce a frame
+    bool transcode(std::span<const std::byte> packet,
+                   const rss::StreamMeta& stream_meta,
+                   bool force_keyframe,
+                   FastResizableVector<std::byte>& packet_out,
+                   bool& is_keyframe_out) {
+        if (vpx_codec_decode(decoder_.get(), (const uint8_t*)packet.data(),
+                             packet.size(), /*user_priv=*/nullptr,
+                             /*deadline=*/0) != VPX_CODEC_OK) {
+            LOG(WARNING) << "Could not decode color frame because "
+                         << vpx_codec_error(decoder_.get());
+            return false;
+        }
+
+        // the server sends one frame per packet
+        vpx_image_t* img = nullptr;
+        vpx_codec_iter_t iter = nullptr;
+        while (vpx_image_t* next = vpx_codec_get_frame(decoder_.get(), &iter)) {
+            img = next;
+        }
+        if (!img) return false;
+
+        if (!encoder_) init_encoder(img->d_w, img->d_h, stream_meta.fps);
+        const vpx_codec_err_t res = vpx_codec_encode(
+            encoder_.get(), img, /*pts=*/pts_++, /*duration=*/1,
+            force_keyframe ? VPX_EFLAG_FORCE_KF : 0, VPX_DL_GOOD_QUALITY);
+        CHECK(res == VPX_CODEC_OK) << vpx_codec_error(encoder_.get());
+
+        packet_out.clear();
+        is_keyframe_out = false;
+        iter = nullptr;
+        while (const vpx_codec_cx_pkt_t* pkt =
+                   vpx_codec_get_cx_data(encoder_.get(), &iter)) {
+            if (pkt->kind != VPX_CODEC_CX_FRAME_PKT) continue;
+            const auto bytes = to_span(pkt);
+            packet_out.insert(packet_out.end(), bytes.begin(), bytes.end());
+            is_keyframe_out |= (pkt->data.frame.flags & VPX_FRAME_IS_KEY) != 0;
+        }
+        return !packet_out.empty();
+    }
+
+   private:
+    void init_encoder(unsigned int width, unsigned int height, int fps) {
+        encoder_ = init_vpx_encoder(/*profile=*/0, width, height,
+                                    std::max(fps, 1), bitrate_,
+                                    /*lossless=*/false);
+        CHECK(encoder_);
+
+        // the live settings drop frames to hold the bitrate. every
+        // message has to keep a packet here.
+        vpx_codec_enc_cfg_t cfg = *encoder_->config.enc;
+        cfg.rc_dropframe_thresh = 0;
+        CHECK(vpx_codec_enc_config_set(encoder_.get(), &cfg) == VPX_CODEC_OK)
+            << vpx_codec_error(encoder_.get());
+    }
+
+    unsigned int bitrate_ = 0;
+    std::shared_ptr<vpx_codec_ctx> decoder_;
+    std::shared_ptr<vpx_codec_ctx> encoder_;
+    int64_t pts_ = 0;
+};
+
+class DepthTranscoder {
+   public:
+    // returns false if the packet could not be decoded
+    bool transcode(std::span<const std::byte> packet,
+                   const rss::StreamMeta& stream_meta,
+                   bool force_keyframe,
+                   FastResizableVector<std::byte>& packet_out,
+                   bool& is_keyframe_out) {
+        if (!decoder_.decode(packet, stream_meta, depth_)) return false;
+
+        CHECK(compressor_.Compress(stream_meta.intrinsics.width,
+                                   stream_meta.intrinsics.height,
+                                   depth_.data(), compressed_,
+                                   force_keyframe) ==
+              zdepth::DepthResult::Success);
+        is_keyframe_out =
+            zdepth::IsKeyFrame(compressed_.data(), compressed_.size());
+
+        const auto bytes = std::as_bytes(std::span(compressed_));
+        packet_out.assign(bytes.begin(), bytes.end());
+        return true;
+    }
+
+   private:
+    rss::DepthDecoder decoder_;
+    zdepth::DepthCompressor compressor_;
+    FastResizableVector<uint16_t> depth_;
+    std::vector<uint8_t> compressed_;
+};
+
+// the frames of a video message are [creation_us, sequence_id,
+// stream_meta, packet], as published by the realsense server
+template <typename Transcoder>
+void transcode_video_segment(LogReader::Cursor& cursor,
+                             Transcoder& transcoder,
+                             uint64_t keyframe_interval_us,
+                             StagingAppender& appender) {
+    // nothing is encoded until the input has a keyframe to decode
+    // from, and the output starts again with a keyframe after anything
+    // was dropped
+    bool needs_keyframe = true;
+    uint64_t last_sequence_id = 0;
+    uint64_t last_keyframe_us = 0;
+
+    FastResizableVector<std::byte> packet;
+    FastResizableVector<std::byte> frames_cbor;
+    std::vector<std::span<const std::byte>> out_frames;
+    int num_dropped = 0;
+    while (cursor.fetch_chunk()) {
+        for (const LogMessageView& message : cursor.messages()) {
+            const auto frames = unpack_frames(message.packed_frames);
+            CHECK_EQ(frames.size(), 4);
+            const auto sequence_id = seq_bit_cast<uint64_t>(frames[1]);
+            const auto stream_meta = rss::parse_stream_meta(frames[2]);
+
+            // flags = 1 is the convention for marking keyframes
+            const bool is_input_keyframe = message.header.flags == 1;
+            const bool continues =
+                !needs_keyframe && last_sequence_id + 1 == sequence_id;
+            if (!is_input_keyframe && !continues) {
+                needs_keyframe = true;
+                ++num_dropped;
+                continue;
+            }
+
+            // color keeps the keyframes of the input, depth gets them
+            // at the new interval
+            const bool force_keyframe =
+                needs_keyframe ||
+                (keyframe_interval_us == 0
+                     ? is_input_keyframe
+                     : message.this_process_time_us >=
+                           last_keyframe_us + keyframe_interval_us);
+            bool is_keyframe = false;
+            if (!transcoder.transcode(frames[3], stream_meta, force_keyframe,
+                                      packet, is_keyframe)) {
+                needs_keyframe = true;
+                ++num_dropped;
+                continue;
+            }
+            needs_keyframe = false;
+            last_sequence_id = sequence_id;
+            if (is_keyframe) last_keyframe_us = message.this_process_time_us;
+
+            out_frames.assign(frames.begin(), frames.begin() + 3);
+            out_frames.push_back(packet);
+            frames_cbor.clear();
+            CHECK(serialization::serialize_cbor(out_frames, frames_cbor));
+            appender.append(message, is_keyframe, frames_cbor);
+        }
+    }
+    LOG_IF(WARNING, num_dropped > 0)
+        << "Dropped " << num_dropped << " undecodable messages";
+}
+
+void transcode_segment(duckdb_database in_db,
+                       duckdb_database staging_db,
+                       const Segment& segment,
+                       const TranscodeOptions& options) {
+    LogReader reader(in_db);
+    StagingAppender appender(staging_db);
+
+    const std::string topics[] = {segment.topic};
+    LogReader::Cursor cursor = reader.read_message_ids(
+        topics, segment.begin_message_id, segment.end_message_id);
+
+    switch (segment.transcode) {
+        case Transcode::COPY: {
+            while (cursor.fetch_chunk()) {
+                for (const LogMessageView& message : cursor.messages()) {
+                    appender.append(message, message.header.flags,
+                                    std::as_bytes(std::span(
+                                        message.packed_frames.data(),
+                                        message.packed_frames.size())));
+                }
+            }
+            return;
+        }
+        case Transcode::COLOR: {
+            ColorTranscoder transcoder(options.color_bitrate);
+            transcode_video_segment(cursor, transcoder,
+                                    /*keyframe_interval_us=*/0, appender);
+            return;
+        }
+        case Transcode::DEPTH: {
+            DepthTranscoder transcoder;
+            transcode_video_segment(cursor, transcoder,
+                                    options.depth_keyframe_interval_us,
+                                    appender);
+            return;
+        }
+    }
+}
+
+void copy_metadata(duckdb_connection in_con, duckdb_connection out_con) {
+    DuckDbResult result(in_con, R"SQL_(
+select this_process_id, creation_process_time_us, creation_unix_time_ms
+from metadata
+)SQL_");
+
+    const char* insert_sql = R"SQL_(
+insert into metadata
+values ($this_process_id, $process_time_us, $unix_time_ms)
+)SQL_";
+    DuckDbPreparedStatement prepared_statement(out_con, insert_sql);
+    while (result.fetch_chunk()) {
+        auto process_ids = result.get_column<uint64_t>(0);
+        auto process_times_us = result.get_column<uint64_t>(1);
+        auto unix_times_ms = result.get_column<uint64_t>(2);
+        for (int row = 0; row < result.get_num_rows(); ++row) {
+            prepared_statement.reset();
+            prepared_statement.bind_param_uint64("this_process_id",
+                                                 process_ids.row(row));
+            prepared_statement.bind_param_uint64("process_time_us",
+                                                 process_times_us.row(row));
+            prepared_statement.bind_param_uint64("unix_time_ms",
+                                                 unix_times_ms.row(row));
+            prepared_statement.execute();
+        }
+    }
+}
+
+void create_log_tables(duckdb_connection con) {
+    CHECK(duckdb_query(con, create_log_table_sql, nullptr) != DuckDBError);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    __APP_MAIN_INIT__;
+
+    APP_UNPACK_FLAG(log_path);
+    APP_UNPACK_FLAG(out_path);
+    APP_UNPACK_FLAG(drop_topics);
+    APP_UNPACK_FLAG(color_bitrate);
+    APP_UNPACK_FLAG(depth_keyframe_interval_s);
+    APP_UNPACK_FLAG(segment_s);
+    APP_UNPACK_FLAG(num_threads);
+
+    CHECK(!log_path.empty()) << "--log_path is required";
+    CHECK(!out_path.empty()) << "--out_path is required";
+    CHECK(std::filesystem::exists(log_path)) << "No such log " << log_path;
+    CHECK(!std::filesystem::exists(out_path)) << out_path << " exists";
+    CHECK_GE(color_bitrate, 0);
+    CHECK_GE(depth_keyframe_interval_s, 0);
+    if (num_threads <= 0) {
+        num_threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+    }
+
+    const TranscodeOptions options{
+        .color_bitrate = (unsigned int)color_bitrate,
+        .depth_keyframe_interval_us =
+            uint64_t(depth_keyframe_interval_s * 1e6)};
+    std::vector<std::string> drop_prefixes;
+    if (!drop_topics.empty()) drop_prefixes = absl::StrSplit(drop_topics, ',');
+
+    duckdb_database in_db;
+    open_log(log_path.c_str(), in_db, /*read_only=*/true);
+
+    std::vector<Segment> segments;
+    {
+        LogReader reader(in_db);
+        for (const auto& topic : reader.get_topics_starting_with("")) {
+            const bool dropped = std::any_of(
+                drop_prefixes.begin(), drop_prefixes.end(),
+                [&](const std::string& prefix) {
+                    return absl::StartsWith(topic, prefix);
+                });
+            if (dropped) {
+                LOG(INFO) << "Dropping " << topic;
+                continue;
+            }
+            const Transcode transcode = get_transcode(topic, options);
+            // each segment starts with a keyframe, which would cut the
+            // keyframe interval short
+            uint64_t segment_us = segment_s * 1e6;
+            if (transcode == Transcode::DEPTH) {
+                segment_us = std::max(segment_us,
+                                      options.depth_keyframe_interval_us);
+            }
+            for (auto& segment : make_segments(
+                     topic, transcode,
+                     reader.get_keyframe_index().get_keyframes(topic),
+                     segment_us)) {
+                segments.push_back(std::move(segment));
+            }
+        }
+    }
+
+    const std::string staging_path = out_path + ".staging";
+    std::filesystem::remove(staging_path);
+    std::filesystem::remove(staging_path + ".wal");
+
+    LOG(INFO) << "Transcoding " << segments.size() << " segments with "
+              << num_threads << " threads";
+    Stopwatch stopwatch;
+    {
+        duckdb_database staging_db;
+        open_log(staging_path.c_str(), staging_db, /*read_only=*/false);
+        {
+            DuckDbConnection con(staging_db);
+            create_log_tables(con);
+        }
+
+        {
+            std::mutex done_mutex;
+            std::condition_variable done_condition;
+            size_t num_segments_done = 0;
+
+            SimpleThreadPool thread_pool(num_threads);
+            for (const auto& segment : segments) {
+                thread_pool.Push([&]() {
+                    transcode_segment(in_db, staging_db, segment, options);
+                    {
+                        std::lock_guard<std::mutex> lock{done_mutex};
+                        ++num_segments_done;
+                    }
+                    done_condition.notify_one();
+                });
+            }
+
+            // the pool does not finish queued work when destructed
+            std::unique_lock<std::mutex> lock{done_mutex};
+            while (!done_condition.wait_for(
+                lock, std::chrono::seconds(5),
+                [&]() { return num_segments_done == segments.size(); })) {
+                LOG(INFO) << num_segments_done << "/" << segments.size()
+                          << " segments";
+            }
+        }
+        duckdb_close(&staging_db);
+    }
+    LOG(INFO) << "Transcoded in " << stopwatch.press() << "s";
+
+    // a single sorted copy puts the rows back in message_id order
+    {
+        duckdb_database out_db;
+        open_log(out_path.c_str(), out_db, /*read_only=*/false);
+        {
+            DuckDbConnection con(out_db);
+            create_log_tables(con);
+            {
+                DuckDbConnection in_con(in_db);
+                copy_metadata(in_con, con);
+            }
+
+            const std::string attach_sql = absl::StrFormat(
+                "attach '%s' as staging (read_only)", staging_path);
+            DuckDbResult attach(con, attach_sql.c_str());
+            DuckDbResult copy_log(con, R"SQL_(
+insert into log select * from staging.log order by message_id
+)SQL_");
+            DuckDbResult copy_keyframes(con, R"SQL_(
+insert into keyframes
+select topic, message_id, this_process_time_us from log where flags = 1
+)SQL_");
+            DuckDbResult detach(con, "detach staging");
+        }
+        duckdb_close(&out_db);
+    }
+    std::filesystem::remove(staging_path);
+    std::filesystem::remove(staging_path + ".wal");
+
+    const auto get_bytes = [](const std::string& path) {
+        return std::filesystem::file_size(path);
+    };
+    LOG(INFO) << "Wrote " << out_path << " in " << stopwatch.press() << "s, "
+              << get_bytes(log_path) / 1e6 << "MB -> "
+              << get_bytes(out_path) / 1e6 << "MB";
+
+    duckdb_close(&in_db);
+    return 0;
+}
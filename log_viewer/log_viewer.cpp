@@ -1,5 +1,9 @@
 #include <imgui.h>
 
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "absl/container/flat_hash_map.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_split.h"
@@ -14,9 +18,13 @@
 #include "debug/check.h"
 #include "debug/log.h"
 #include "fast_resizable_vector/fast_resizable_vector.h"
+#include "log/log_db.h"
 #include "network_config/config.h"
 #include "realsense_streaming/client.h"
 #include "realsense_streaming/pointcloud_job.h"
+#include "log_viewer/frame_cache.h"
+#include "log_viewer/playback.h"
+#include "log_viewer/timeline_density.h"
 #include "seekbar.h"
 #include "serialization/make_serializable.hpp"
 #include "serialization/serialization.h"
@@ -26,105 +34,21 @@
 #include "wrappers/duckdb.h"
 #include "wrappers/imgui.h"
 
-APP_FLAG(std::string, log_path, "", "path to log file");
+APP_FLAG(std::string,
+         log_path,
+         "",
+         "path to log file, or comma separated paths of logs recorded at the "
+         "same time, eg one per camera host");
+APP_FLAG(bool,
+         rebroadcast,
+         false,
+         "publish the replayed messages over pubsub, so other processes "
+         "receive them too");
 
 using namespace axby;
 namespace rss = realsense_streaming;
 
-void open_log(const char* log_path, duckdb_database& db, bool read_only) {
-    duckdb_config db_config;
-    duckdb_create_config(&db_config);
-    if (read_only) {
-        duckdb_set_config(db_config, "access_mode", "READ_ONLY");
-    }
-    duckdb_set_config(db_config, "memory_limit", "500MB");
-    duckdb_set_config(db_config, "threads", "1");
-    char* open_error = nullptr;
-    if (duckdb_open_ext(log_path, &db, db_config, &open_error) !=
-        DuckDBSuccess) {
-        LOG(FATAL) << open_error;
-    };
-    duckdb_free(open_error);
-    duckdb_destroy_config(&db_config);
-}
-
-std::pair<uint64_t, uint64_t> get_time_bounds_us(duckdb_connection con) {
-    const char* sql = R"SQL_(
-select min(this_process_time_us), max(this_process_time_us) from log
-)SQL_";
-
-    DuckDbPreparedStatement prepared_statement(con, sql);
-    prepared_statement.execute();
-
-    auto& result = prepared_statement.result();
-    while (result.fetch_chunk()) {
-        idx_t num_rows = result.get_num_rows();
-        CHECK_EQ(num_rows, 1);
-        auto min_time_us = result.get_column<uint64_t>(0).row(0);
-        auto max_time_us = result.get_column<uint64_t>(1).row(0);
-        return {min_time_us, max_time_us};
-    }
-
-    LOG(FATAL) << "No records in log";
-    return {0, 0};
-}
-
-std::vector<std::string> get_topics_starting_with(
-    duckdb_connection con, std::string_view topic_prefix) {
-    const char* sql = R"SQL_(
-select distinct topic from log
-where topic like $topic_prefix || '%'
-order by topic asc
-)SQL_";
-
-    DuckDbPreparedStatement prepared_statement(con, sql);
-    prepared_statement.bind_param_string("topic_prefix", topic_prefix);
-    prepared_statement.execute();
-
-    std::vector<std::string> topics;
-
-    auto& result = prepared_statement.result();
-    while (result.fetch_chunk()) {
-        idx_t num_rows = result.get_num_rows();
-        auto topics_column = result.get_column<duckdb_string_t>(0);
-        for (int row = 0; row < num_rows; ++row) {
-            topics.push_back(duckdb_string_to_string(topics_column.row(row)));
-        }
-    }
-
-    return topics;
-}
-
-std::optional<uint64_t> find_keyframe_message_id(duckdb_connection con,
-                                                 std::string_view topic,
-                                                 uint64_t timestamp_us) {
-    const char* video_packet_get_closest_keyframe_sql = R"SQL_(
-select message_id from log
-where
-    (topic = $topic) and
-    (this_process_time_us <= $time_us) and
-    ($time_us + 10000000 >= this_process_time_us) and -- limit the search to recent packets
-    (flags = 1) -- we use this condition to mark keyframes
-order by message_id desc limit 1
-)SQL_";
-
-    DuckDbPreparedStatement prepared_statement(
-        con, video_packet_get_closest_keyframe_sql);
-    prepared_statement.bind_param_string("topic", topic);
-    prepared_statement.bind_param_uint64("time_us", timestamp_us);
-    prepared_statement.execute();
-
-    auto& result = prepared_statement.result();
-    result.fetch_chunk();
-    if (!result.is_done()) {
-        uint64_t keyframe_message_id = result.get_column<uint64_t>(0).row(0);
-        return keyframe_message_id;
-    }
-    return std::nullopt;
-}
-
 std::atomic<uint64_t> _frame_load_timestamp_ms{0};
-std::atomic<uint64_t> _playback_timestamp_ms{0};
 
 struct VideoPacket {
     uint64_t timestamp_ms = 0;
@@ -135,182 +59,126 @@ struct VideoPacket {
 
 using VideoPacketBuffer = RingBuffer<VideoPacket, 256>;
 
-FastResizableVector<std::span<const std::byte>> unpack_frames(
-    std::string_view packed_frames) {
-    FastResizableVector<std::span<const std::byte>> frames;
-    serialization::deserialize_cbor(frames, packed_frames);
-    return frames;
-}
+struct Context {
+    std::vector<LogSource> logs;
+    Seekbar seekbar;
 
-FastResizableVector<std::span<const std::byte>> unpack_frames(
-    const duckdb_string_t& s) {
-    return unpack_frames(duckdb_string_to_string_view(s));
-}
+    std::set<std::string> realsense_serials;
+    absl::flat_hash_map<std::string, rss::client::RealsenseState>
+        serial_to_realsense_state;
+    std::string selected_serial;
 
-std::vector<std::pair<std::string, uint64_t>> find_keyframe_message_ids(
-    duckdb_connection con, uint64_t before_time_us) {
-    const char* find_realsense_keyframes_sql = R"SQL_(
-SELECT 
-    topic,
-    MAX(message_id)
-FROM log
-WHERE flags = 1 -- this flag is used to indicate keyframe
-    AND (topic LIKE 'realsense/depth/%' OR topic LIKE 'realsense/color/%')
-    AND this_process_time_us + 2e6 > $time_us
-    AND this_process_time_us < $time_us
-GROUP BY topic
-)SQL_";
-
-    DuckDbPreparedStatement prepared_statement(con,
-                                               find_realsense_keyframes_sql);
-    prepared_statement.bind_param_uint64("time_us", before_time_us * 1e3);
-    prepared_statement.execute();
-
-    std::vector<std::pair<std::string, uint64_t>> keyframe_message_ids;
-
-    auto& result = prepared_statement.result();
-    while (result.fetch_chunk()) {
-        auto topics = result.get_column<duckdb_string_t>(0);
-        auto message_ids = result.get_column<uint64_t>(1);
-        for (int row = 0; row < result.get_num_rows(); ++row) {
-            auto topic = duckdb_string_to_string_view(topics.row(row));
-            auto message_id = message_ids.row(row);
-            keyframe_message_ids.push_back({std::string(topic), message_id});
-        }
-    }
+    absl::flat_hash_map<std::string, std::string> serial_to_color_topic;
+    absl::flat_hash_map<std::string, std::string> serial_to_depth_topic;
+    // one frame cache per log
+    std::vector<std::unique_ptr<FrameCache>> frame_caches;
+    absl::flat_hash_map<std::string, int> topic_to_log_idx;
+    // frames last taken from the frame cache
+    absl::flat_hash_map<std::string, uint64_t> topic_to_shown_message_id;
+
+    std::optional<TimelineDensity> timeline_density;
+    // selected serial the seekbar keyframe marks were made for
+    std::string timeline_density_serial;
+
+    float point_size = 1.0f;
+};
 
-    return keyframe_message_ids;
+FrameCache& get_frame_cache(Context& ctx, const std::string& topic) {
+    return *ctx.frame_caches[ctx.topic_to_log_idx.at(topic)];
 }
 
-void run_playback_thread(std::string log_path) {
-    duckdb_database db;
-    open_log(log_path.c_str(), db, /*read_only=*/true);
-
-    const auto PublishResults = [](DuckDbResult& result) {
-        while (result.fetch_chunk()) {
-            auto sender_process_ids = result.get_column<uint64_t>(0);
-            auto sender_sequence_ids = result.get_column<uint64_t>(1);
-            auto sender_process_times_us = result.get_column<uint16_t>(2);
-            auto message_versions = result.get_column<uint16_t>(3);
-            auto flagss = result.get_column<uint16_t>(4);
-            auto framess = result.get_column<duckdb_string_t>(6);
-            auto topics = result.get_column<duckdb_string_t>(7);
-
-            for (int row = 0; row < result.get_num_rows(); ++row) {
-                const auto unpacked_frames = unpack_frames(framess.row(row));
-                pubsub::MessageHeader header{
-                    .sender_process_id = sender_process_ids.row(row),
-                    .sender_sequence_id = sender_sequence_ids.row(row),
-                    .sender_process_time_us = sender_process_times_us.row(row),
-                    .message_version = message_versions.row(row),
-                    .flags = flagss.row(row)};
-                pubsub::MessageFrames frames;
-                for (const auto& frame : unpacked_frames) {
-                    frames.add_bytes(frame);
-                }
-                std::string_view topic =
-                    duckdb_string_to_string_view(topics.row(row));
-                pubsub::publish_frames_with_manual_header(topic, header,
-                                                          std::move(frames));
-
-                // // DEBUG
-                // if (absl::StrContains(topic, "color/246322304238")) {
-                //     auto seq_id = seq_bit_cast<uint64_t>(unpacked_frames[1]);
-                //     LOG(INFO) << "Publishing " << topic << ": "
-                //               << header.sender_sequence_id << " / " << seq_id;
-                // }
-            }
+// while paused or playing in reverse, frames come from the frame cache
+// instead of being replayed through the realsense client
+rss::client::RealsenseStateDidUpdate update_realsense_state_from_cache(
+    Context& ctx,
+    const std::string& serial,
+    rss::client::RealsenseState& state) {
+    const uint64_t time_us = uint64_t(ctx.seekbar.current_timestamp_ms) * 1000;
+
+    rss::client::RealsenseStateDidUpdate did_update;
+    if (auto it = ctx.serial_to_color_topic.find(serial);
+        it != ctx.serial_to_color_topic.end()) {
+        auto frame =
+            get_frame_cache(ctx, it->second).get_decoded_frame(it->second,
+                                                               time_us);
+        auto& shown_message_id = ctx.topic_to_shown_message_id[it->second];
+        if (frame && frame->message_id != shown_message_id) {
+            state.color = *frame->color;
+            shown_message_id = frame->message_id;
+            did_update.color = true;
         }
-    };
-
-    uint64_t playback_timestamp_ms = 0;
-    while (!should_stop_all()) {
-        uint64_t new_playback_timestamp_ms = _playback_timestamp_ms;
-        if (new_playback_timestamp_ms == playback_timestamp_ms) {
-            // playback is paused. wait until playback starts again.
-            sleep_ms(100);
+    }
+    if (auto it = ctx.serial_to_depth_topic.find(serial);
+        it != ctx.serial_to_depth_topic.end()) {
+        auto frame =
+            get_frame_cache(ctx, it->second).get_decoded_frame(it->second,
+                                                               time_us);
+        auto& shown_message_id = ctx.topic_to_shown_message_id[it->second];
+        if (frame && frame->message_id != shown_message_id) {
+            state.depth = *frame->depth;
+            shown_message_id = frame->message_id;
+            did_update.depth = true;
         }
+    }
+    return did_update;
+}
 
-        bool need_initialize = false;
-        if (new_playback_timestamp_ms < playback_timestamp_ms) {
-            // jump backwards in time
-            need_initialize = true;
-        }
-        if (new_playback_timestamp_ms > playback_timestamp_ms + 1000) {
-            // large jump forward in time
-            need_initialize = true;
-        }
-        if (need_initialize) {
-            LOG(INFO) << "Running initialize";
-            pubsub::publisher_requests_clear();
-            // need to do a backward-search for keyframes
-            const std::vector<std::pair<std::string, uint64_t>>
-                keyframe_message_ids = find_keyframe_message_ids(
-                    DuckDbConnection(db), new_playback_timestamp_ms);
-
-            // for each keyframe, publish segment from keyframe up
-            // until the current playback time
-            for (const auto& [topic, message_id] : keyframe_message_ids) {
-                const char* retreive_messages_sql = R"SQL_(
-select
-sender_process_id, sender_sequence_id, sender_process_time_us, message_version, flags,
-this_process_time_us, frames, topic
-from log
-where message_id >= $message_id and this_process_time_us < $time_us
-and topic = $topic
-order by this_process_time_us asc
-)SQL_";
-                DuckDbConnection con(db);
-                DuckDbPreparedStatement prepared_statement(
-                    con, retreive_messages_sql);
-                prepared_statement.bind_param_uint64(
-                    "time_us", new_playback_timestamp_ms * 1e3);
-                prepared_statement.bind_param_uint64("message_id", message_id);
-                prepared_statement.bind_param_string("topic", topic);
-                prepared_statement.execute();
-
-                PublishResults(prepared_statement.result());
-            }
+// the strip shows the bytes of all topics, with the keyframes of the
+// selected camera
+void update_seekbar_density(Context& ctx) {
+    const TimelineDensity& density = *ctx.timeline_density;
+    ctx.timeline_density_serial = ctx.selected_serial;
 
-            playback_timestamp_ms = new_playback_timestamp_ms - 1;
+    std::vector<uint64_t> bytes(density.num_bins);
+    for (const auto& topic_density : density.topics) {
+        for (int bin = 0; bin < density.num_bins; ++bin) {
+            bytes[bin] += topic_density.bytes[bin];
         }
-
-        const char* retreive_messages_sql = R"SQL_(
-select
-sender_process_id, sender_sequence_id, sender_process_time_us, message_version, flags,
-this_process_time_us, frames, topic
-from log
-where this_process_time_us > $min_time_us and this_process_time_us <= $max_time_us
-order by this_process_time_us asc
-)SQL_";
-
-        DuckDbConnection con(db);
-        DuckDbPreparedStatement prepared_statement(con, retreive_messages_sql);
-        prepared_statement.bind_param_uint64("min_time_us",
-                                             playback_timestamp_ms * 1e3);
-        prepared_statement.bind_param_uint64("max_time_us",
-                                             new_playback_timestamp_ms * 1e3);
-        prepared_statement.execute();
-        PublishResults(prepared_statement.result());
-
-        playback_timestamp_ms = new_playback_timestamp_ms;
+    }
+    const uint64_t max_bytes =
+        std::max<uint64_t>(*std::max_element(bytes.begin(), bytes.end()), 1);
+    ctx.seekbar.density.resize(density.num_bins);
+    for (int bin = 0; bin < density.num_bins; ++bin) {
+        ctx.seekbar.density[bin] = float(bytes[bin]) / max_bytes;
     }
 
-    duckdb_close(&db);
+    ctx.seekbar.keyframe_marks.clear();
+    const TopicDensity* keyframe_topic = nullptr;
+    if (ctx.serial_to_color_topic.count(ctx.selected_serial)) {
+        keyframe_topic = density.get_topic(
+            ctx.serial_to_color_topic.at(ctx.selected_serial));
+    }
+    if (keyframe_topic) {
+        ctx.seekbar.keyframe_marks.resize(density.num_bins);
+        for (int bin = 0; bin < density.num_bins; ++bin) {
+            ctx.seekbar.keyframe_marks[bin] =
+                keyframe_topic->keyframe_counts[bin] > 0;
+        }
+    }
 }
 
-struct Context {
-    std::string log_path;
-    duckdb_database db;
-    Seekbar seekbar;
+void handle_frame_step(Context& ctx) {
+    const int num_steps = ctx.seekbar.frame_step_request;
+    ctx.seekbar.frame_step_request = 0;
+    if (num_steps == 0 || ctx.selected_serial.empty()) return;
+
+    // step through the frames of the selected camera
+    const std::string* topic = nullptr;
+    if (ctx.serial_to_color_topic.count(ctx.selected_serial)) {
+        topic = &ctx.serial_to_color_topic.at(ctx.selected_serial);
+    } else if (ctx.serial_to_depth_topic.count(ctx.selected_serial)) {
+        topic = &ctx.serial_to_depth_topic.at(ctx.selected_serial);
+    }
+    if (!topic) return;
 
-    std::set<std::string> realsense_serials;
-    absl::flat_hash_map<std::string, rss::client::RealsenseState>
-        serial_to_realsense_state;
-    std::string selected_serial;
+    const auto time_us = get_frame_cache(ctx, *topic).step_frame_time_us(
+        *topic, uint64_t(ctx.seekbar.current_timestamp_ms) * 1000, num_steps);
+    if (!time_us) return;
 
-    float point_size = 1.0f;
-};
+    // round up, so the frame is at or before the new playhead
+    stop_playing(ctx.seekbar);
+    jump_playing_time(ctx.seekbar, (*time_us + 999) / 1000);
+}
 
 void make_gui(Context& ctx) {
     ImVec2 displaySize = ImGui::GetIO().DisplaySize;
@@ -424,16 +292,16 @@ int main(int argc, char* argv[]) {
     __APP_MAIN_INIT__;
 
     APP_UNPACK_FLAG(log_path);
+    APP_UNPACK_FLAG(rebroadcast);
 
     LOG(INFO) << "Opening " << log_path;
 
     Context ctx;
-    ctx.log_path = log_path;
-    open_log(log_path.c_str(), ctx.db, /*read_only=*/true);
+    const std::vector<std::string> log_paths = absl::StrSplit(log_path, ',');
+    ctx.logs = open_logs(log_paths);
 
     {
-        DuckDbConnection con(ctx.db);
-        auto [min_time_us, max_time_us] = get_time_bounds_us(con);
+        auto [min_time_us, max_time_us] = get_time_bounds_us(ctx.logs);
         LOG(INFO) << "Time bounds " << min_time_us << ", " << max_time_us;
         ctx.seekbar.min_timestamp_ms = min_time_us / 1e3;
         ctx.seekbar.max_timestamp_ms = max_time_us / 1e3;
@@ -445,26 +313,52 @@ int main(int argc, char* argv[]) {
     time_sync::init(playback_config);
     rss::client::init(playback_config);
 
-    {
-        DuckDbConnection con(ctx.db);
+    for (int log_idx = 0; log_idx < ctx.logs.size(); ++log_idx) {
+        DuckDbConnection con(ctx.logs[log_idx].db);
         std::vector<std::string> realsense_topics =
             get_topics_starting_with(con, "realsense/");
         for (const auto& topic : realsense_topics) {
+            ctx.topic_to_log_idx[topic] = log_idx;
             std::vector<std::string_view> parts = absl::StrSplit(topic, '/');
             CHECK_GE(parts.size(), 3);  // "realsense/depth/serial/idx"
             std::string_view serial_number = parts[2];
+            if (parts[1] == "color") {
+                ctx.serial_to_color_topic[serial_number] = topic;
+            } else if (parts[1] == "depth") {
+                ctx.serial_to_depth_topic[serial_number] = topic;
+            }
             ctx.realsense_serials.emplace(serial_number);
             ctx.serial_to_realsense_state[serial_number] = {.serial_number =
                                                                 serial_number};
         }
     }
 
-    std::thread playback_thread{[=]() { run_playback_thread(log_path); }};
+    std::optional<Playback> playback;
+    playback.emplace(ctx.logs, PlaybackOptions{.publish = rebroadcast});
+    for (const auto& log : ctx.logs) {
+        FrameCacheOptions options;
+        options.max_bytes /= ctx.logs.size();
+        options.time_shift_us = log.time_shift_us;
+        ctx.frame_caches.push_back(
+            std::make_unique<FrameCache>(log.db, options));
+    }
 
     gui_init("Log Viewer");
     viewer::init();
     viewer::enable_auto_orbit();
 
+    // long running scans over the log, kept off the pointcloud thread
+    auto log_thread_pool =
+        std::make_shared<SimpleThreadPool>(/*num_threads=*/1);
+    std::vector<std::unique_ptr<TimelineDensityJob>> timeline_density_jobs;
+    std::vector<TimelineDensity> timeline_densities;
+    for (const auto& log : ctx.logs) {
+        auto& job = timeline_density_jobs.emplace_back(
+            std::make_unique<TimelineDensityJob>(log_thread_pool));
+        job->start(log.db, log.path, ctx.seekbar.min_timestamp_ms * 1000,
+                   ctx.seekbar.max_timestamp_ms * 1000, log.time_shift_us);
+    }
+
     auto thread_pool = std::make_shared<SimpleThreadPool>(/*num_threads=*/1);
     realsense_streaming::PointCloudJob pointcloud_job{thread_pool};
     FastResizableVector<float> pointcloud_xyzs;
@@ -475,13 +369,40 @@ int main(int argc, char* argv[]) {
         viewer::new_frame(ImGui::GetIO());
 
         handle_playback_control(ctx.seekbar);
+        handle_frame_step(ctx);
         update_playing(ctx.seekbar);
 
+        for (auto& job : timeline_density_jobs) {
+            if (job->is_complete()) {
+                job->read_results(timeline_densities.emplace_back());
+                if (timeline_densities.size() == ctx.logs.size()) {
+                    ctx.timeline_density =
+                        merge_timeline_densities(std::move(timeline_densities));
+                }
+            }
+        }
+        if (ctx.timeline_density &&
+            ctx.timeline_density_serial != ctx.selected_serial) {
+            update_seekbar_density(ctx);
+        }
+
+        // playback only replays forwards. it stays paused at the
+        // playhead otherwise, ready to resume.
+        const bool use_frame_cache =
+            !ctx.seekbar.playing || ctx.seekbar.playback_speed < 0;
+        if (!use_frame_cache) {
+            ctx.topic_to_shown_message_id.clear();
+        }
+
         _frame_load_timestamp_ms = ctx.seekbar.current_timestamp_ms;
-        _playback_timestamp_ms = ctx.seekbar.current_timestamp_ms;
+        playback->update(ctx.seekbar.current_timestamp_ms, !use_frame_cache,
+                         ctx.seekbar.playback_speed);
 
         for (auto& [serial, state] : ctx.serial_to_realsense_state) {
-            const auto did_update = rss::client::update_realsense_state(state);
+            const auto did_update =
+                use_frame_cache
+                    ? update_realsense_state_from_cache(ctx, serial, state)
+                    : rss::client::update_realsense_state(state);
             if (did_update.color) {
                 viewer::update_image(absl::StrFormat("color_%s", serial),
                                      state.color.stream_meta.intrinsics.width,
@@ -546,13 +467,16 @@ int main(int argc, char* argv[]) {
 
     stop_all();
 
-    playback_thread.join();
+    playback.reset();
+    ctx.frame_caches.clear();
+    // waits for running scans, which need the dbs
+    timeline_density_jobs.clear();
 
     rss::client::cleanup();
     time_sync::cleanup();
     pubsub::cleanup();
 
-    duckdb_close(&ctx.db);
+    close_logs(ctx.logs);
 
     return 0;
 }
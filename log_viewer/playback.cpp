@@ -0,0 +1,378 @@
+#include "log_viewer/playback.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "app/stop_all.h"
+#include "app/timing.h"
+#include "debug/check.h"
+#include "debug/log.h"
+
+namespace axby {
+
+namespace {
+
+// wraps a frame that points into a result chunk without copying it.
+// the chunk stays alive until the last copy of the message is gone.
+zmq::message_t share_frame(std::span<const std::byte> frame,
+                           const std::shared_ptr<const void>& chunk) {
+    auto* chunk_ref = new std::shared_ptr<const void>(chunk);
+    const auto Deleter = [](void* data, void* hint) {
+        delete static_cast<std::shared_ptr<const void>*>(hint);
+    };
+    return zmq::message_t{(void*)frame.data(), frame.size(), Deleter,
+                          chunk_ref};
+}
+
+}  // namespace
+
+uint64_t Playback::Clock::get_playhead_us(uint64_t process_us) const {
+    if (!playing) return anchor_log_us;
+    return anchor_log_us +
+           speed * clipped_minus(process_us, anchor_process_us);
+}
+
+Playback::Playback(std::vector<LogSource> sources,
+                   const PlaybackOptions& options)
+    : options_(options) {
+    CHECK(!sources.empty());
+    for (auto& log : sources) {
+        sources_.push_back({.log = std::move(log)});
+    }
+    reader_thread_ = std::thread{[this]() { run_reader_thread(); }};
+    publisher_thread_ = std::thread{[this]() { run_publisher_thread(); }};
+}
+
+Playback::~Playback() {
+    stopped_ = true;
+    buffer_.stop();
+    reader_thread_.join();
+    publisher_thread_.join();
+    if (options_.as_fast_as_possible) clear_virtual_process_time();
+}
+
+Playback::Clock Playback::get_clock() {
+    std::lock_guard<std::mutex> lock{clock_mutex_};
+    return clock_;
+}
+
+void Playback::update(uint64_t playhead_ms, bool playing, double speed) {
+    const uint64_t target_us = playhead_ms * 1000;
+    const uint64_t now_us = get_process_time_us();
+
+    std::lock_guard<std::mutex> lock{clock_mutex_};
+    if (options_.as_fast_as_possible) {
+        // the playhead is wherever publishing got to
+        if (!initialized_ || target_us != clock_.anchor_log_us) {
+            ++clock_.generation;
+            pubsub::publisher_requests_clear();
+            clock_.anchor_log_us = target_us;
+        }
+        clock_.playing = playing;
+        initialized_ = true;
+        return;
+    }
+
+    const int64_t drift_us =
+        safe_minus(target_us, clock_.get_playhead_us(now_us));
+
+    // seek when jumping backwards, or when jumping far enough forward
+    // that streaming through the gap would take too long
+    const bool seek =
+        !initialized_ || drift_us < -250000 || drift_us > 1000000;
+    if (seek) {
+        ++clock_.generation;
+        pubsub::publisher_requests_clear();
+    }
+
+    // while playing, the gui playhead advances in whole milliseconds
+    // per frame, so only re-anchor once it has drifted noticeably.
+    // otherwise publish times would jitter with the gui frame rate.
+    const bool reanchor = seek || playing != clock_.playing ||
+                          speed != clock_.speed || !playing ||
+                          std::abs(drift_us) > 50000;
+    if (reanchor) {
+        clock_.playing = playing;
+        clock_.speed = speed;
+        clock_.anchor_log_us = target_us;
+        clock_.anchor_process_us = now_us;
+    }
+    initialized_ = true;
+}
+
+bool Playback::is_finished() {
+    const uint64_t generation = get_clock().generation;
+    // publishing_ is set before a message leaves the buffer, so check
+    // it after the buffer
+    return finished_generation_ == generation && buffer_.empty() &&
+           !publishing_;
+}
+
+bool Playback::wait_until_prefetchable(uint64_t generation,
+                                       uint64_t time_us) {
+    const uint64_t prefetch_us = options_.prefetch_s * 1e6;
+    while (!stopped_ && !should_stop_all()) {
+        const Clock clock = get_clock();
+        if (clock.generation != generation) return false;
+        // only the bounded buffer holds the reader back
+        if (options_.as_fast_as_possible) return true;
+        if (time_us <=
+            clock.get_playhead_us(get_process_time_us()) + prefetch_us) {
+            return true;
+        }
+        sleep_ms(5);
+    }
+    return false;
+}
+
+bool Playback::push(PlaybackMessage&& message) {
+    while (!buffer_.move_write(std::move(message))) {
+        if (stopped_ || should_stop_all()) return false;
+        if (get_clock().generation != message.generation) return false;
+        sleep_ms(1);
+    }
+    return true;
+}
+
+void Playback::send(PlaybackMessage&& message) {
+    if (options_.publish) {
+        pubsub::publish_frames_with_manual_header(
+            message.topic, message.header, std::move(message.frames));
+        return;
+    }
+    pubsub::deliver_local({.topic = std::move(message.topic),
+                           .header = message.header,
+                           .frames = std::move(message.frames.frames)});
+}
+
+bool Playback::has_backpressure() {
+    // the publish queue check-fails when full. leave room for the
+    // other publishers of this process
+    constexpr int max_pending_publish_requests =
+        pubsub::publish_queue_capacity / 4;
+    if (options_.publish && pubsub::get_num_pending_publish_requests() >
+                                max_pending_publish_requests) {
+        return true;
+    }
+    for (const auto* buffer : options_.backpressure_buffers) {
+        const int max_filled =
+            options_.max_subscriber_fill * pubsub::SubscriberBuffer::capacity;
+        if (buffer->num_slots_filled() > max_filled) return true;
+    }
+    return false;
+}
+
+void Playback::unpack_chunk(const LogReader::Cursor& cursor,
+                            uint64_t generation,
+                            uint64_t time_shift_us,
+                            std::vector<PlaybackMessage>& messages_out) {
+    // unpacked on the reader thread. the frames only point into the
+    // chunk, so this is cheap next to fetching the chunk, and decoding
+    // is spread over the decode pool of the client anyway.
+    const std::shared_ptr<const void> chunk = cursor.share_chunk();
+    const auto rows = cursor.messages();
+    messages_out.clear();
+    messages_out.resize(rows.size());
+    for (size_t row = 0; row < rows.size(); ++row) {
+        const LogMessageView& view = rows[row];
+        PlaybackMessage& message = messages_out[row];
+        message.generation = generation;
+        message.time_us = view.this_process_time_us + time_shift_us;
+        message.topic = view.topic;
+        message.header = view.header;
+        for (const auto& frame : unpack_frames(view.packed_frames)) {
+            message.frames.add_message(share_frame(frame, chunk));
+        }
+    }
+}
+
+bool Playback::push_all(LogReader::Cursor& cursor,
+                        uint64_t generation,
+                        uint64_t time_shift_us) {
+    std::vector<PlaybackMessage> messages;
+    while (cursor.fetch_chunk()) {
+        unpack_chunk(cursor, generation, time_shift_us, messages);
+        for (auto& message : messages) {
+            if (!wait_until_prefetchable(generation, message.time_us)) {
+                return false;
+            }
+            if (!push(std::move(message))) return false;
+        }
+    }
+    return true;
+}
+
+void Playback::read_preroll(Source& source,
+                            uint64_t generation,
+                            uint64_t start_us) {
+    // video can only be decoded starting from a keyframe, so publish
+    // each video topic from its last keyframe up to the start time.
+    // these messages are all due immediately.
+    //
+    // on the clock of the log
+    const uint64_t log_start_us =
+        clipped_minus(start_us, source.log.time_shift_us);
+
+    LogReader& reader = *source.reader;
+    const uint64_t max_lookback_us = options_.max_keyframe_lookback_s * 1e6;
+    for (const auto& topic : reader.get_keyframe_index().get_topics()) {
+        const auto keyframe = reader.find_keyframe_before(topic, log_start_us);
+        if (!keyframe || keyframe->time_us + max_lookback_us < log_start_us) {
+            continue;
+        }
+
+        LogReader::Cursor cursor =
+            reader.read_from_keyframe(topic, *keyframe, log_start_us);
+        if (!push_all(cursor, generation, source.log.time_shift_us)) {
+            return;
+        }
+    }
+}
+
+// streams the messages of one log from a start time, a chunk at a time
+class Playback::Cursor {
+   public:
+    Cursor(Playback& playback,
+           Source& source,
+           uint64_t generation,
+           uint64_t start_us)
+        : playback_(playback),
+          generation_(generation),
+          time_shift_us_(source.log.time_shift_us),
+          cursor_(source.reader->read(
+              {.start_us = clipped_minus(start_us, time_shift_us_)})) {}
+
+    // the next message, or nullptr at the end of the log
+    PlaybackMessage* peek() {
+        while (next_idx_ >= messages_.size()) {
+            if (!cursor_.fetch_chunk()) return nullptr;
+            playback_.unpack_chunk(cursor_, generation_, time_shift_us_,
+                                   messages_);
+            next_idx_ = 0;
+        }
+        return &messages_[next_idx_];
+    }
+
+    void pop() { ++next_idx_; }
+
+   private:
+    Playback& playback_;
+    uint64_t generation_ = 0;
+    uint64_t time_shift_us_ = 0;
+
+    LogReader::Cursor cursor_;
+    std::vector<PlaybackMessage> messages_;
+    size_t next_idx_ = 0;
+};
+
+bool Playback::read_from(uint64_t generation, uint64_t start_us) {
+    std::vector<std::unique_ptr<Cursor>> cursors;
+    for (auto& source : sources_) {
+        cursors.push_back(
+            std::make_unique<Cursor>(*this, source, generation, start_us));
+    }
+
+    // k-way merge by time. there are only a few logs, so scanning the
+    // cursors for the earliest message is cheaper than keeping a heap.
+    // ties go to the earlier log.
+    while (true) {
+        Cursor* earliest = nullptr;
+        uint64_t earliest_time_us = 0;
+        for (auto& cursor : cursors) {
+            const PlaybackMessage* message = cursor->peek();
+            if (message && (!earliest || message->time_us < earliest_time_us)) {
+                earliest = cursor.get();
+                earliest_time_us = message->time_us;
+            }
+        }
+        if (!earliest) return true;
+
+        if (!wait_until_prefetchable(generation, earliest_time_us)) {
+            return false;
+        }
+        if (!push(std::move(*earliest->peek()))) return false;
+        earliest->pop();
+    }
+}
+
+void Playback::run_reader_thread() {
+    for (auto& source : sources_) {
+        source.reader = std::make_unique<LogReader>(source.log.db);
+        // load now rather than on the first seek
+        source.reader->get_keyframe_index();
+    }
+
+    uint64_t generation = 0;
+    while (!stopped_ && !should_stop_all()) {
+        const Clock clock = get_clock();
+        if (clock.generation == generation) {
+            // reached the end of the log. wait for the next seek.
+            sleep_ms(5);
+            continue;
+        }
+        generation = clock.generation;
+
+        LOG(INFO) << "Starting playback at " << clock.anchor_log_us << "us";
+        for (auto& source : sources_) {
+            read_preroll(source, generation, clock.anchor_log_us);
+        }
+        if (read_from(generation, clock.anchor_log_us)) {
+            finished_generation_ = generation;
+        }
+    }
+}
+
+void Playback::run_publisher_thread() {
+    while (!stopped_ && !should_stop_all()) {
+        buffer_.block_until_stopped_or_nonempty();
+        if (stopped_) return;
+
+        const PlaybackMessage* next = buffer_.peek_front();
+        if (!next) continue;
+
+        const Clock clock = get_clock();
+        PlaybackMessage message;
+        if (next->generation != clock.generation) {
+            // left over from before a seek
+            buffer_.move_read(message, /*blocking=*/false);
+            continue;
+        }
+
+        if (options_.as_fast_as_possible) {
+            if (!clock.playing || has_backpressure()) {
+                sleep_us(100);
+                continue;
+            }
+            publishing_ = true;
+            buffer_.move_read(message, /*blocking=*/false);
+            set_virtual_process_time_us(message.time_us);
+            send(std::move(message));
+            publishing_ = false;
+            continue;
+        }
+
+        const uint64_t playhead_us =
+            clock.get_playhead_us(get_process_time_us());
+        if (next->time_us > playhead_us) {
+            // sleep until the message is due, but wake up regularly to
+            // notice seeks and pauses
+            uint64_t wait_us = 5000;
+            if (clock.playing && clock.speed > 0) {
+                wait_us = std::min<uint64_t>(
+                    wait_us, (next->time_us - playhead_us) / clock.speed);
+            }
+            sleep_us(std::max<uint64_t>(wait_us, 100));
+            continue;
+        }
+
+        buffer_.move_read(message, /*blocking=*/false);
+        send(std::move(message));
+    }
+}
+
+}  // namespace axby
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "app/pubsub.h"
+#include "concurrency/ring_buffer.h"
+#include "log/log_db.h"
+#include "log/log_reader.h"
+#include "wrappers/duckdb.h"
+
+namespace axby {
+
+struct PlaybackOptions {
+    // the reader stays at most this far ahead of the playhead
+    double prefetch_s = 3;
+
+    // on seek, video topics are published from their last keyframe
+    // if it is at most this old
+    double max_keyframe_lookback_s = 10;
+
+    // by default messages are handed straight to the in-process
+    // subscribers (see pubsub::deliver_local), with frames pointing
+    // into the query results instead of copies. publishing goes
+    // through pubsub and zmq instead, which also reaches subscribers in
+    // other processes.
+    bool publish = false;
+
+    // publish each message as soon as the backpressure below allows,
+    // instead of following the playhead. the process time is driven by
+    // the recorded timeline (see set_virtual_process_time_us), so time
+    // dependent code sees the timing of the log, and a replay runs at
+    // full machine speed. only the subscribers in backpressure_buffers
+    // are guaranteed every message.
+    bool as_fast_as_possible = false;
+
+    // as fast as possible mode waits while any of these in-process
+    // subscriber buffers is more than max_subscriber_fill full.
+    // subscribers in other processes can not push back when
+    // publishing, and zmq drops the messages they don't keep up with.
+    std::vector<const pubsub::SubscriberBuffer*> backpressure_buffers;
+    double max_subscriber_fill = 0.5;
+};
+
+struct PlaybackMessage {
+    // messages from an earlier seek are dropped by the publisher
+    uint64_t generation = 0;
+    uint64_t time_us = 0;  // on the merged timeline
+    std::string topic;
+    pubsub::MessageHeader header;
+    pubsub::MessageFrames frames;
+};
+
+// replays one or more logs over pubsub, following a playhead driven
+// by the gui.
+//
+// a reader thread keeps one streaming cursor per log open per playback
+// run (a run starts at each seek), merges them by time on the merged
+// timeline of the logs, and prefetches messages into a bounded
+// buffer. a publisher thread paces publishing from that buffer with
+// its own clock, interpolated between gui updates, so publish times
+// do not depend on the gui frame rate or on query latency.
+class Playback {
+   public:
+    Playback(std::vector<LogSource> sources,
+             const PlaybackOptions& options = {});
+    ~Playback();
+
+    Playback(const Playback&) = delete;
+    Playback& operator=(const Playback&) = delete;
+
+    // call once per gui frame with the seekbar state. in as fast as
+    // possible mode, the playhead only seeks when it changes, and the
+    // speed is ignored.
+    void update(uint64_t playhead_ms, bool playing, double speed);
+
+    // true once every message from the last seek to the end of the log
+    // has been handed to pubsub
+    bool is_finished();
+
+   private:
+    struct Clock {
+        // incremented on each seek
+        uint64_t generation = 0;
+        bool playing = false;
+        double speed = 1;
+        uint64_t anchor_log_us = 0;
+        uint64_t anchor_process_us = 0;
+
+        uint64_t get_playhead_us(uint64_t process_us) const;
+    };
+    Clock get_clock();
+
+    // one per log. only used by the reader thread.
+    struct Source {
+        LogSource log;
+        std::unique_ptr<LogReader> reader;
+    };
+    class Cursor;
+
+    void run_reader_thread();
+    void run_publisher_thread();
+
+    // both return false if playback stopped or a new seek happened
+    // while waiting
+    bool wait_until_prefetchable(uint64_t generation, uint64_t time_us);
+    bool push(PlaybackMessage&& message);
+    void send(PlaybackMessage&& message);
+
+    // as fast as possible mode only
+    bool has_backpressure();
+
+    void read_preroll(Source& source, uint64_t generation, uint64_t start_us);
+    // returns false if interrupted before the end of the logs
+    bool read_from(uint64_t generation, uint64_t start_us);
+    bool push_all(LogReader::Cursor& cursor,
+                  uint64_t generation,
+                  uint64_t time_shift_us);
+    // unpacks the current chunk of cursor
+    void unpack_chunk(const LogReader::Cursor& cursor,
+                      uint64_t generation,
+                      uint64_t time_shift_us,
+                      std::vector<PlaybackMessage>& messages_out);
+
+    PlaybackOptions options_;
+
+    // only used by the reader thread
+    std::vector<Source> sources_;
+
+    std::mutex clock_mutex_;
+    Clock clock_;
+    bool initialized_ = false;
+
+    std::atomic<bool> stopped_{false};
+    std::atomic<uint64_t> finished_generation_{0};
+    std::atomic<bool> publishing_{false};
+    RingBuffer<PlaybackMessage, 1024> buffer_;
+    std::thread reader_thread_;
+    std::thread publisher_thread_;
+};
+
+}  // namespace axby
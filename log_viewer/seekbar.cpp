@@ -40,6 +40,11 @@ void update_playing(Seekbar& ctx) {
         ctx.current_timestamp_ms = ctx.max_timestamp_ms;
         stop_playing(ctx);
     }
+    if (ctx.current_timestamp_ms < ctx.min_timestamp_ms) {
+        // prevent playing past the start of the log in reverse
+        ctx.current_timestamp_ms = ctx.min_timestamp_ms;
+        stop_playing(ctx);
+    }
     if (ctx.auto_playback_stop_ms.has_value() &&
         (ctx.current_timestamp_ms >= *ctx.auto_playback_stop_ms)) {
         // stop playing if there is an auto-stop set
@@ -49,6 +54,38 @@ void update_playing(Seekbar& ctx) {
     }
 }
 
+namespace {
+
+// spans the width of the last item, which is the slider
+void draw_density_strip(const Seekbar& ctx) {
+    const float strip_height = 10.0f;
+    const float tick_height = 3.0f;
+    const float x_begin = ImGui::GetItemRectMin().x;
+    const float width = ImGui::GetItemRectSize().x;
+    const ImVec2 top_left = ImGui::GetCursorScreenPos();
+    const float bin_width = width / ctx.density.size();
+
+    ImDrawList* draw_list = ImGui::GetWindowDrawList();
+    for (size_t bin = 0; bin < ctx.density.size(); ++bin) {
+        const float x0 = x_begin + bin * bin_width;
+        const float x1 = x0 + std::max(bin_width, 1.0f);
+        const float bottom = top_left.y + strip_height;
+        if (ctx.density[bin] > 0) {
+            draw_list->AddRectFilled(
+                ImVec2(x0, bottom - strip_height * ctx.density[bin]),
+                ImVec2(x1, bottom), IM_COL32(90, 160, 255, 200));
+        }
+        if (bin < ctx.keyframe_marks.size() && ctx.keyframe_marks[bin]) {
+            draw_list->AddRectFilled(ImVec2(x0, bottom + 1),
+                                     ImVec2(x1, bottom + 1 + tick_height),
+                                     IM_COL32(255, 200, 0, 255));
+        }
+    }
+    ImGui::Dummy(ImVec2(width, strip_height + 1 + tick_height));
+}
+
+}  // namespace
+
 void make_seekbar(Seekbar& ctx) {
     if (ctx.current_timestamp_ms < ctx.min_timestamp_ms) {
         ctx.current_timestamp_ms = ctx.min_timestamp_ms;
@@ -76,6 +113,10 @@ void make_seekbar(Seekbar& ctx) {
                          ctx.max_timestamp_ms);
     ImGui::PopItemWidth();
 
+    if (!ctx.density.empty()) {
+        draw_density_strip(ctx);
+    }
+
     if (user_seeked) {
         jump_playing_time(ctx, ctx.current_timestamp_ms);
     }
@@ -87,6 +128,8 @@ void handle_playback_control(Seekbar& ctx) {
         // space: toggle playback
         // left: jump back
         // right: jump forward
+        // comma, period: step one frame back, forward
+        // r: reverse playback direction
         if (ImGui::IsKeyPressed(ImGuiKey_Space)) {
             if (ctx.playing) {
                 stop_playing(ctx);
@@ -108,6 +151,16 @@ void handle_playback_control(Seekbar& ctx) {
             }
             jump_playing_time(ctx, earlier_timestamp_ms);
         }
+        if (ImGui::IsKeyPressed(ImGuiKey_Comma)) {
+            ctx.frame_step_request -= 1;
+        }
+        if (ImGui::IsKeyPressed(ImGuiKey_Period)) {
+            ctx.frame_step_request += 1;
+        }
+        if (ImGui::IsKeyPressed(ImGuiKey_R)) {
+            ctx.playback_speed = -ctx.playback_speed;
+            ctx.last_play_time_ms = std::nullopt;
+        }
     }
 }
 
@@ -2,13 +2,14 @@
 
 #include <cstdint>
 #include <optional>
+#include <vector>
 
 namespace axby {
 
 struct Seekbar {
     uint64_t min_timestamp_ms = 0;
     uint64_t max_timestamp_ms = 0;
-    float playback_speed = 1.0f;
+    float playback_speed = 1.0f;  // negative plays in reverse
 
     // if this is set, playback will stop when this timestamp is hit
     std::optional<int> auto_playback_stop_ms = std::nullopt;
@@ -17,6 +18,17 @@ struct Seekbar {
     int current_timestamp_ms = 0;
     bool playing = false;
     std::optional<int> last_play_time_ms = std::nullopt;
+
+    // frames to step forward (or back, if negative), requested from the
+    // keyboard. the owner knows where frames are, so it consumes this
+    // and jumps to the frame.
+    int frame_step_request = 0;
+
+    // optional activity strip drawn under the slider. one value in
+    // [0, 1] per time bin, with bins evenly spanning min to max
+    // timestamp. keyframe_marks flags bins to draw a tick for.
+    std::vector<float> density;
+    std::vector<bool> keyframe_marks;
 };
 
 
@@ -26,7 +38,8 @@ void stop_playing(Seekbar& ctx);
 void update_playing(Seekbar& ctx);
 void make_seekbar(Seekbar& ctx);
 
-// imgui keyboard integration for spacebar, left, right jumping
+// imgui keyboard integration for spacebar, left, right jumping,
+// frame stepping and reversing
 void handle_playback_control(Seekbar& ctx);
 
 
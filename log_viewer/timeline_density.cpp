@@ -0,0 +1,265 @@
+#include "log_viewer/timeline_density.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "app/timing.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "fast_resizable_vector/fast_resizable_vector.h"
+#include "serialization/make_serializable.hpp"
+#include "serialization/serialization.h"
+
+namespace axby {
+
+namespace {
+
+// bump when the meaning of TimelineDensity changes, so old cache files
+// are recomputed
+constexpr uint32_t timeline_density_format_version = 2;
+
+constexpr uint32_t default_num_bins = 1000;
+
+uint64_t get_log_bytes(const std::filesystem::path& log_path) {
+    uint64_t result = 0;
+    for (const auto& p :
+         {log_path, std::filesystem::path(log_path.string() + ".wal")}) {
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(p, ec);
+        if (!ec) result += size;
+    }
+    return result;
+}
+
+std::optional<TimelineDensity> load_cached(
+    const std::filesystem::path& log_path,
+    const TimelineDensity& expected) {
+    const auto path = get_timeline_density_path(log_path);
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return std::nullopt;
+    const std::string contents{std::istreambuf_iterator<char>(file),
+                               std::istreambuf_iterator<char>()};
+
+    TimelineDensity density;
+    const char* error = nullptr;
+    if (!serialization::deserialize_cbor(density, std::string_view(contents),
+                                         &error)) {
+        LOG(WARNING) << "Ignoring unreadable " << path << ": " << error;
+        return std::nullopt;
+    }
+
+    const bool matches =
+        density.format_version == expected.format_version &&
+        density.log_bytes == expected.log_bytes &&
+        density.min_time_us == expected.min_time_us &&
+        density.max_time_us == expected.max_time_us &&
+        density.num_bins == expected.num_bins &&
+        density.time_shift_us == expected.time_shift_us;
+    if (!matches) {
+        LOG(INFO) << "Ignoring outdated " << path;
+        return std::nullopt;
+    }
+    return density;
+}
+
+void save_cached(const std::filesystem::path& log_path,
+                 const TimelineDensity& density) {
+    const auto path = get_timeline_density_path(log_path);
+
+    FastResizableVector<std::byte> buf;
+    const char* error = nullptr;
+    CHECK(serialization::serialize_cbor(density, buf, &error)) << error;
+
+    // the log may be in a read only location. the density is only a
+    // cache, so carry on without it.
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write((const char*)buf.data(), buf.size());
+    if (!file) {
+        LOG(WARNING) << "Could not write " << path;
+        return;
+    }
+    LOG(INFO) << "Wrote " << path;
+}
+
+}  // namespace
+
+const TopicDensity* TimelineDensity::get_topic(std::string_view topic) const {
+    auto it = std::lower_bound(
+        topics.begin(), topics.end(), topic,
+        [](const TopicDensity& t, std::string_view topic) {
+            return t.topic < topic;
+        });
+    if (it == topics.end() || it->topic != topic) return nullptr;
+    return &*it;
+}
+
+TimelineDensity compute_timeline_density(duckdb_connection con,
+                                         uint64_t min_time_us,
+                                         uint64_t max_time_us,
+                                         uint32_t num_bins,
+                                         uint64_t time_shift_us) {
+    CHECK_GT(num_bins, 0);
+    CHECK_LE(min_time_us, max_time_us);
+
+    const char* sql = R"SQL_(
+select
+topic,
+least((this_process_time_us + $time_shift_us - $min_time_us) // $bin_width_us, $last_bin) as bin,
+count(*)::ubigint,
+sum(octet_length(frames))::ubigint,
+(count(*) filter (where flags = 1))::ubigint -- this flag is used to indicate keyframe
+from log
+where this_process_time_us + $time_shift_us >= $min_time_us
+group by topic, bin
+)SQL_";
+
+    TimelineDensity density;
+    density.format_version = timeline_density_format_version;
+    density.min_time_us = min_time_us;
+    density.max_time_us = max_time_us;
+    density.num_bins = num_bins;
+    density.time_shift_us = time_shift_us;
+
+    const uint64_t bin_width_us =
+        std::max<uint64_t>((max_time_us - min_time_us) / num_bins, 1);
+
+    DuckDbPreparedStatement prepared_statement(con, sql);
+    prepared_statement.bind_param_uint64("min_time_us", min_time_us);
+    prepared_statement.bind_param_uint64("bin_width_us", bin_width_us);
+    prepared_statement.bind_param_uint64("last_bin", num_bins - 1);
+    prepared_statement.bind_param_uint64("time_shift_us", time_shift_us);
+    prepared_statement.execute();
+
+    absl::flat_hash_map<std::string, TopicDensity> topic_to_density;
+    auto& result = prepared_statement.result();
+    while (result.fetch_chunk()) {
+        auto topics = result.get_column<duckdb_string_t>(0);
+        auto bins = result.get_column<uint64_t>(1);
+        auto message_counts = result.get_column<uint64_t>(2);
+        auto bytess = result.get_column<uint64_t>(3);
+        auto keyframe_counts = result.get_column<uint64_t>(4);
+        for (int row = 0; row < result.get_num_rows(); ++row) {
+            auto& topic_density = topic_to_density[duckdb_string_to_string_view(
+                topics.row(row))];
+            if (topic_density.message_counts.empty()) {
+                topic_density.topic =
+                    duckdb_string_to_string_view(topics.row(row));
+                topic_density.message_counts.resize(num_bins);
+                topic_density.bytes.resize(num_bins);
+                topic_density.keyframe_counts.resize(num_bins);
+            }
+
+            const uint64_t bin = bins.row(row);
+            topic_density.message_counts[bin] = message_counts.row(row);
+            topic_density.bytes[bin] = bytess.row(row);
+            topic_density.keyframe_counts[bin] = keyframe_counts.row(row);
+        }
+    }
+
+    for (auto& [topic, topic_density] : topic_to_density) {
+        density.topics.push_back(std::move(topic_density));
+    }
+    std::sort(density.topics.begin(), density.topics.end(),
+              [](const TopicDensity& a, const TopicDensity& b) {
+                  return a.topic < b.topic;
+              });
+    return density;
+}
+
+TimelineDensity merge_timeline_densities(
+    std::vector<TimelineDensity> densities) {
+    CHECK(!densities.empty());
+    TimelineDensity merged = std::move(densities[0]);
+    merged.log_bytes = 0;
+    merged.time_shift_us = 0;
+
+    for (int i = 1; i < densities.size(); ++i) {
+        TimelineDensity& density = densities[i];
+        CHECK_EQ(density.min_time_us, merged.min_time_us);
+        CHECK_EQ(density.max_time_us, merged.max_time_us);
+        CHECK_EQ(density.num_bins, merged.num_bins);
+        for (auto& topic_density : density.topics) {
+            // usually each log has its own topics. if not, add up.
+            auto it = std::lower_bound(
+                merged.topics.begin(), merged.topics.end(),
+                topic_density.topic,
+                [](const TopicDensity& t, const std::string& topic) {
+                    return t.topic < topic;
+                });
+            if (it == merged.topics.end() || it->topic != topic_density.topic) {
+                merged.topics.insert(it, std::move(topic_density));
+                continue;
+            }
+            for (int bin = 0; bin < merged.num_bins; ++bin) {
+                it->message_counts[bin] += topic_density.message_counts[bin];
+                it->bytes[bin] += topic_density.bytes[bin];
+                it->keyframe_counts[bin] += topic_density.keyframe_counts[bin];
+            }
+        }
+    }
+    return merged;
+}
+
+std::filesystem::path get_timeline_density_path(
+    const std::filesystem::path& log_path) {
+    return log_path.string() + ".timeline.cbor";
+}
+
+TimelineDensityJob::TimelineDensityJob(
+    std::shared_ptr<SimpleThreadPool> thread_pool)
+    : thread_pool_(std::move(thread_pool)) {}
+
+void TimelineDensityJob::start(duckdb_database db,
+                               const std::filesystem::path& log_path,
+                               uint64_t min_time_us,
+                               uint64_t max_time_us,
+                               uint64_t time_shift_us) {
+    CHECK(job_state_.is_none());
+    job_state_.start();
+
+    thread_pool_->Push([this, db, log_path, min_time_us, max_time_us,
+                        time_shift_us]() {
+        TimelineDensity expected;
+        expected.format_version = timeline_density_format_version;
+        expected.log_bytes = get_log_bytes(log_path);
+        expected.min_time_us = min_time_us;
+        expected.max_time_us = max_time_us;
+        expected.num_bins = default_num_bins;
+        expected.time_shift_us = time_shift_us;
+
+        if (auto cached = load_cached(log_path, expected)) {
+            LOG(INFO) << "Loaded timeline density from "
+                      << get_timeline_density_path(log_path);
+            density_ = std::move(*cached);
+        } else {
+            Stopwatch stopwatch;
+            DuckDbConnection con(db);
+            density_ = compute_timeline_density(con, min_time_us, max_time_us,
+                                                default_num_bins,
+                                                time_shift_us);
+            density_.log_bytes = expected.log_bytes;
+            LOG(INFO) << "Computed timeline density of "
+                      << density_.topics.size() << " topics in "
+                      << stopwatch.get_sec_since_press() << "s";
+            save_cached(log_path, density_);
+        }
+
+        job_state_.complete();
+    });
+}
+
+bool TimelineDensityJob::read_results(TimelineDensity& density_out) {
+    CHECK(!job_state_.is_none());
+    if (!job_state_.is_complete()) return false;
+
+    density_out = std::move(density_);
+    density_ = {};
+    job_state_.reset();
+
+    return true;
+}
+
+}  // namespace axby
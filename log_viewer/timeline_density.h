@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "concurrency/job_state.h"
+#include "simple_thread_pool.h"
+#include "wrappers/duckdb.h"
+
+namespace axby {
+
+struct TopicDensity {
+    std::string topic;
+
+    // one entry per bin
+    std::vector<uint32_t> message_counts;
+    std::vector<uint64_t> bytes;  // of the frames column
+    std::vector<uint32_t> keyframe_counts;
+};
+
+// per-topic activity of a log in fixed time bins, for drawing an
+// overview under the seekbar
+struct TimelineDensity {
+    // identify the log and settings the density was computed for. a
+    // cache file that does not match is recomputed.
+    uint32_t format_version = 0;
+    uint64_t log_bytes = 0;
+    uint64_t min_time_us = 0;
+    uint64_t max_time_us = 0;
+    uint32_t num_bins = 0;
+    // see LogSource
+    uint64_t time_shift_us = 0;
+
+    std::vector<TopicDensity> topics;  // sorted by topic
+
+    const TopicDensity* get_topic(std::string_view topic) const;
+};
+
+// one aggregated scan over the log. the last bin includes
+// max_time_us. times are on the merged timeline, ie the log's
+// this_process_time_us plus time_shift_us.
+TimelineDensity compute_timeline_density(duckdb_connection con,
+                                         uint64_t min_time_us,
+                                         uint64_t max_time_us,
+                                         uint32_t num_bins,
+                                         uint64_t time_shift_us = 0);
+
+// combines the densities of logs played together. they must have
+// been computed over the same bins.
+TimelineDensity merge_timeline_densities(
+    std::vector<TimelineDensity> densities);
+
+// the density is cached as cbor next to the log
+std::filesystem::path get_timeline_density_path(
+    const std::filesystem::path& log_path);
+
+// computes the density of a log in the background, or loads it from
+// the cache if one was written for the same log
+class TimelineDensityJob {
+   public:
+    TimelineDensityJob(std::shared_ptr<SimpleThreadPool> thread_pool);
+
+    void start(duckdb_database db,
+               const std::filesystem::path& log_path,
+               uint64_t min_time_us,
+               uint64_t max_time_us,
+               uint64_t time_shift_us = 0);
+
+    // returns true if the job was complete and the result was moved
+    // out. if return value was true, automatically resets job state
+    bool read_results(TimelineDensity& density_out);
+
+    bool is_started() { return job_state_.is_started(); }
+    bool is_complete() { return job_state_.is_complete(); }
+    bool is_none() { return job_state_.is_none(); }
+
+   private:
+    TimelineDensity density_;
+    std::shared_ptr<SimpleThreadPool> thread_pool_;
+
+    // listed last, destructed first
+    JobState job_state_;
+};
+
+}  // namespace axby
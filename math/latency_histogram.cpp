@@ -0,0 +1,70 @@
+#include "math/latency_histogram.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "absl/strings/str_format.h"
+
+namespace axby {
+
+int LatencyHistogram::get_bucket_idx(uint64_t value) {
+    if (value < num_sub_buckets_) {
+        return value;
+    }
+    // the top sub_bucket_bits_ bits below the most significant bit
+    // select the sub bucket
+    const int msb = std::bit_width(value) - 1;
+    const int shift = msb - sub_bucket_bits_;
+    const int sub_bucket = (value >> shift) & (num_sub_buckets_ - 1);
+    return (shift + 1) * num_sub_buckets_ + sub_bucket;
+}
+
+uint64_t LatencyHistogram::get_bucket_upper(int bucket_idx) {
+    if (bucket_idx < num_sub_buckets_) {
+        return bucket_idx;
+    }
+    const int shift = bucket_idx / num_sub_buckets_ - 1;
+    const uint64_t sub_bucket = bucket_idx % num_sub_buckets_;
+    const uint64_t lower = (num_sub_buckets_ + sub_bucket) << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    ++counts_[get_bucket_idx(value)];
+    ++count_;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+    sum_ += value;
+}
+
+void LatencyHistogram::reset() { *this = LatencyHistogram(); }
+
+double LatencyHistogram::get_mean() const {
+    if (count_ == 0) return 0;
+    return sum_ / count_;
+}
+
+uint64_t LatencyHistogram::get_quantile(double q) const {
+    if (count_ == 0) return 0;
+
+    const uint64_t rank =
+        std::clamp<uint64_t>(std::ceil(q * count_), 1, count_);
+    uint64_t cumulative = 0;
+    for (int i = 0; i < num_buckets_; ++i) {
+        cumulative += counts_[i];
+        if (cumulative >= rank) {
+            return std::clamp(get_bucket_upper(i), get_min(), max_);
+        }
+    }
+    return max_;
+}
+
+std::string LatencyHistogram::summary() const {
+    return absl::StrFormat(
+        "n=%d mean=%.1f p50=%d p90=%d p99=%d p99.9=%d max=%d", count_,
+        get_mean(), get_quantile(0.5), get_quantile(0.9), get_quantile(0.99),
+        get_quantile(0.999), max_);
+}
+
+}  // namespace axby
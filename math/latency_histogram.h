@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace axby {
+
+// log-linear histogram for latency measurements. values below 16 are
+// counted exactly, larger values land in one of 16 buckets per power
+// of two, so quantiles are accurate to about 6%. recording is a
+// couple of bit operations and an increment, cheap enough to use in
+// the loop being measured.
+class LatencyHistogram {
+   public:
+    void record(uint64_t value);
+    void reset();
+
+    uint64_t get_count() const { return count_; }
+    uint64_t get_min() const { return count_ ? min_ : 0; }
+    uint64_t get_max() const { return max_; }
+    double get_mean() const;
+
+    // q in [0, 1]. returns the upper edge of the bucket holding the
+    // value of rank ceil(q * count), clipped to the max
+    uint64_t get_quantile(double q) const;
+
+    // eg "n=1000 mean=12.3 p50=11 p90=15 p99=40 p99.9=80 max=95"
+    std::string summary() const;
+
+   private:
+    static constexpr int sub_bucket_bits_ = 4;
+    static constexpr int num_sub_buckets_ = 1 << sub_bucket_bits_;
+    static constexpr int num_buckets_ = 64 * num_sub_buckets_;
+
+    static int get_bucket_idx(uint64_t value);
+    static uint64_t get_bucket_upper(int bucket_idx);
+
+    std::array<uint64_t, num_buckets_> counts_ = {0};
+    uint64_t count_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+    double sum_ = 0;
+};
+
+}  // namespace axby
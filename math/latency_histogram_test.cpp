@@ -0,0 +1,53 @@
+#include "math/latency_histogram.h"
+
+#include "gtest/gtest.h"
+
+using namespace axby;
+
+TEST(LatencyHistogram, empty) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(histogram.get_count(), 0);
+    EXPECT_EQ(histogram.get_quantile(0.5), 0);
+    EXPECT_EQ(histogram.get_mean(), 0);
+}
+
+TEST(LatencyHistogram, small_values_are_exact) {
+    LatencyHistogram histogram;
+    for (int i = 0; i < 10; ++i) {
+        histogram.record(i);
+    }
+    EXPECT_EQ(histogram.get_min(), 0);
+    EXPECT_EQ(histogram.get_max(), 9);
+    EXPECT_EQ(histogram.get_quantile(0.5), 4);
+    EXPECT_EQ(histogram.get_quantile(1), 9);
+    EXPECT_DOUBLE_EQ(histogram.get_mean(), 4.5);
+}
+
+TEST(LatencyHistogram, quantiles_within_relative_error) {
+    LatencyHistogram histogram;
+    for (uint64_t i = 1; i <= 100000; ++i) {
+        histogram.record(i);
+    }
+    for (double q : {0.1, 0.5, 0.9, 0.99, 0.999}) {
+        const double expected = q * 100000;
+        EXPECT_NEAR(histogram.get_quantile(q), expected, expected / 16) << q;
+    }
+    EXPECT_EQ(histogram.get_quantile(1), 100000);
+}
+
+TEST(LatencyHistogram, large_values) {
+    LatencyHistogram histogram;
+    histogram.record(UINT64_MAX);
+    histogram.record(uint64_t(1) << 40);
+    EXPECT_EQ(histogram.get_quantile(1), UINT64_MAX);
+    EXPECT_NEAR(histogram.get_quantile(0.5), double(uint64_t(1) << 40),
+                double(uint64_t(1) << 40) / 16);
+}
+
+TEST(LatencyHistogram, reset) {
+    LatencyHistogram histogram;
+    histogram.record(100);
+    histogram.reset();
+    EXPECT_EQ(histogram.get_count(), 0);
+    EXPECT_EQ(histogram.get_max(), 0);
+}
@@ -77,6 +77,9 @@ Config::Config(std::string_view config_name) {
 
 SystemConfig Config::get(std::string_view key) const {
     SystemConfig result;
+    // a default constructed config has no systems, eg to run the
+    // systems of a process within it
+    if (!impl_.impl) return result;
     auto& system = impl_.as<ConfigImpl>().j[key];
     if (system.contains("bind")) {
         result.bind = system["bind"].get<std::string>();
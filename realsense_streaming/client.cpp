@@ -1,15 +1,13 @@
 #include "client.h"
 
-#include <yuv_rgb.h>
-
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <future>
-#include <magic_enum.hpp>
 #include <mutex>
 #include <thread>
 #include <vector>
-#include <zdepth.hpp>
 
 #include "absl/strings/str_format.h"
 #include "absl/container/flat_hash_map.h"
@@ -17,15 +15,16 @@
 #include "app/pubsub.h"
 #include "app/stop_all.h"
 #include "app/timing.h"
+#include "concurrency/keyed_thread_pool.h"
 #include "concurrency/single_item.h"
 #include "debug/log.h"
+#include "decoders.h"
 #include "fast_resizable_vector/fast_resizable_vector.h"
 #include "messages.h"
 #include "network_config/config.h"
 
 #include "seq/seq.h"
 #include "time_sync/time_sync.h"
-#include "wrappers/vpx.h"
 #include "absl/strings/match.h"
 
 namespace axby {
@@ -48,6 +47,7 @@ pubsub::SubscriberBuffer _motion_buffer;
 std::jthread _depth_thread;
 std::jthread _color_thread;
 std::jthread _motion_thread;
+std::jthread _feedback_thread;
 
 std::mutex _depth_items_mutex;
 std::mutex _color_items_mutex;
@@ -65,135 +65,283 @@ absl::flat_hash_map<SerialNumber, std::shared_ptr<SingleItem<MotionData>>>
 std::mutex _serial_numbers_mutex;
 absl::flat_hash_set<SerialNumber> _serial_numbers;
 
-void run_depth_thread() {
-    struct DepthProcessingContext {
-        zdepth::DepthCompressor decompressor;
-        uint64_t last_sequence_id = INVALID_SEQUENCE_ID;
-        bool need_keyframe = true;
-        std::shared_ptr<SingleItem<DepthData>> output_item = nullptr;
-    };
-
-    absl::flat_hash_map<std::string, DepthProcessingContext> serial_to_context;
-    FastResizableVector<uint16_t> depth_out;
+// decoding is spread over this pool, keyed by topic, so each stream
+// decodes in order on one worker while different cameras decode in
+// parallel
+std::unique_ptr<KeyedThreadPool> _decode_pool;
+
+// a stream with this many packets waiting to decode holds up the
+// receive thread until one is decoded, see queue_decode
+constexpr int max_queued_decodes_per_stream = 4;
+
+// whether to tell the server what we get of each video stream, which
+// needs realsense_feedback in the network config
+bool _send_feedback = false;
+constexpr uint64_t feedback_window_us = 500000;
+
+// counts what we get of a stream into its StreamFeedback. the receive
+// thread and the decode pool both count.
+class FeedbackCounter {
+   public:
+    void count_received(const StreamId& id,
+                        uint64_t sequence_id,
+                        size_t num_bytes) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        feedback_.id = id;
+        ++feedback_.num_received;
+        feedback_.num_received_bytes += num_bytes;
+        if (last_sequence_id_ != INVALID_SEQUENCE_ID &&
+            sequence_id > last_sequence_id_ + 1) {
+            feedback_.num_missed += sequence_id - last_sequence_id_ - 1;
+        }
+        last_sequence_id_ = sequence_id;
+    }
 
-    while (!should_stop_all()) {
-        pubsub::Message message;
-        if (!_depth_buffer.move_read(message, /*blocking=*/true)) return;
-        CHECK_EQ(message.header.message_version, 0) << "Unsupported version";
+    void count_decoded(uint64_t latency_us) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        ++num_decoded_;
+        decode_latency_sum_us_ += latency_us;
+        feedback_.max_decode_latency_us =
+            std::max<uint64_t>(feedback_.max_decode_latency_us, latency_us);
+    }
 
-        const bool is_keyframe = message.header.flags > 0;
-        const auto creation_us = message.get_simple<uint64_t>(0);
-        const auto sequence_id = message.get_simple<uint64_t>(1);
-        const auto stream_meta = message.get_simple<StreamMeta>(2);
-        const auto& packet = message.frames[3];
+    void count_not_decoded() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        ++feedback_.num_not_decoded;
+    }
 
-        if (!serial_to_context.count(stream_meta.id.serial_number)) {
-            auto& context = serial_to_context[stream_meta.id.serial_number];
-            context.output_item = std::make_shared<SingleItem<DepthData>>();
+    // publishes the feedback once a window is over and starts the
+    // next one. called on a timer, so a stream that stalls still
+    // reports its empty windows.
+    void maybe_publish() {
+        const uint64_t now_us = get_process_time_us();
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (window_start_us_ == 0) {
+            window_start_us_ = now_us;
+            return;
+        }
+        if (now_us < window_start_us_ + feedback_window_us) return;
 
-            {
-                std::lock_guard<std::mutex> lock{_depth_items_mutex};
-                CHECK(
-                    !_serial_to_depth_item.count(stream_meta.id.serial_number));
-                _serial_to_depth_item[stream_meta.id.serial_number] =
-                    context.output_item;
-            }
-            {
-                std::lock_guard<std::mutex> lock{_serial_numbers_mutex};
-                _serial_numbers.insert(stream_meta.id.serial_number);
-            }
+        feedback_.window_ms = (now_us - window_start_us_) / 1000;
+        if (num_decoded_ > 0) {
+            feedback_.mean_decode_latency_us =
+                decode_latency_sum_us_ / num_decoded_;
         }
+        pubsub::publish_simple(feedback_topic, 0, feedback_);
 
-        auto& context = serial_to_context.at(stream_meta.id.serial_number);
+        feedback_ = {.id = feedback_.id};
+        num_decoded_ = 0;
+        decode_latency_sum_us_ = 0;
+        window_start_us_ = now_us;
+    }
 
-        if (context.last_sequence_id != INVALID_SEQUENCE_ID) {
-            if (context.last_sequence_id + 1 != sequence_id) {
-                LOG(INFO) << stream_meta.id << " frame drop, sequence id "
-                          << sequence_id << " and last squence id "
-                          << context.last_sequence_id;
-                context.need_keyframe = true;
-                context.last_sequence_id = INVALID_SEQUENCE_ID;
-                context.decompressor = {};  // re-init
-            }
-        }
+   private:
+    std::mutex mutex_;
+    StreamFeedback feedback_;
+    uint32_t num_decoded_ = 0;
+    uint64_t decode_latency_sum_us_ = 0;
+    uint64_t last_sequence_id_ = INVALID_SEQUENCE_ID;
+    uint64_t window_start_us_ = 0;
+};
 
-        if (context.need_keyframe && !is_keyframe) {
-            LOG_EVERY_T(INFO, 1) << stream_meta.id << " waiting for keyframe";
-            // we have not gotten a keyframe yet
-            // cannot ingest this packet
-            continue;
-        }
+// of every stream received so far, for the feedback thread
+std::mutex _feedback_counters_mutex;
+std::vector<std::shared_ptr<FeedbackCounter>> _feedback_counters;
 
-        if (context.need_keyframe) {
-            CHECK(is_keyframe);
-            CHECK(zdepth::IsKeyFrame((const uint8_t*)packet.data(),
-                                     packet.size()));
-            LOG(INFO) << stream_meta.id << " got keyframe";
+std::shared_ptr<FeedbackCounter> make_feedback_counter() {
+    auto counter = std::make_shared<FeedbackCounter>();
+    std::lock_guard<std::mutex> lock{_feedback_counters_mutex};
+    _feedback_counters.push_back(counter);
+    return counter;
+}
+
+struct DepthProcessingContext {
+    DepthDecoder decoder;
+    uint64_t last_sequence_id = INVALID_SEQUENCE_ID;
+    bool need_keyframe = true;
+    std::shared_ptr<SingleItem<DepthData>> output_item = nullptr;
+    FastResizableVector<uint16_t> depth_out;
+    std::atomic<int> num_queued{0};
+    std::shared_ptr<FeedbackCounter> feedback = make_feedback_counter();
+};
+
+struct ColorProcessingContext {
+    ColorDecoder decoder;
+    uint64_t last_sequence_id = INVALID_SEQUENCE_ID;
+    bool need_keyframe = true;
+    std::shared_ptr<SingleItem<ColorData>> output_item = nullptr;
+    FastResizableVector<uint8_t> color_out;
+    std::atomic<int> num_queued{0};
+    std::shared_ptr<FeedbackCounter> feedback = make_feedback_counter();
+};
+
+// runs on the decode pool. returns whether the packet was decoded.
+bool decode_depth(DepthProcessingContext& context, pubsub::Message& message) {
+    const bool is_keyframe = message.header.flags > 0;
+    const auto creation_us = message.get_simple<uint64_t>(0);
+    const auto sequence_id = message.get_simple<uint64_t>(1);
+    const auto stream_meta = parse_stream_meta(message.frames[2]);
+    const auto& packet = message.frames[3];
+
+    if (context.last_sequence_id != INVALID_SEQUENCE_ID) {
+        if (context.last_sequence_id + 1 != sequence_id) {
+            LOG(INFO) << stream_meta.id << " frame drop, sequence id "
+                      << sequence_id << " and last squence id "
+                      << context.last_sequence_id;
+            context.need_keyframe = true;
+            context.last_sequence_id = INVALID_SEQUENCE_ID;
+            context.decoder.reset();
         }
+    }
+
+    if (context.need_keyframe && !is_keyframe) {
+        LOG_EVERY_T(INFO, 1) << stream_meta.id << " waiting for keyframe";
+        // we have not gotten a keyframe yet
+        // cannot ingest this packet
+        return false;
+    }
+
+    if (context.need_keyframe) {
+        CHECK(is_keyframe);
+        CHECK(zdepth::IsKeyFrame((const uint8_t*)packet.data(),
+                                 packet.size()));
+        LOG(INFO) << stream_meta.id << " got keyframe";
+    }
+
+    context.need_keyframe = false;
+    context.last_sequence_id = sequence_id;
+
+    if (!context.decoder.decode(packet, stream_meta, context.depth_out)) {
+        // possible frame drop?
+        context.need_keyframe = true;
+        context.decoder.reset();
+        context.last_sequence_id = INVALID_SEQUENCE_ID;
+        LOG(WARNING) << stream_meta.id << " waiting for next keyframe";
+        return false;
+    }
+
+    context.output_item->write_func([&](DepthData& depth) {
+        depth.topic = message.topic;
+        depth.process_id = message.header.sender_process_id;
+        depth.creation_timestamp_us = creation_us;
+        depth.stream_meta = stream_meta;
+        depth.sequence_id = sequence_id;
+        std::swap(depth.data, context.depth_out);
+    });
+    return true;
+}
 
-        context.need_keyframe = false;
-        context.last_sequence_id = sequence_id;
+// runs on the decode pool. returns whether the packet was decoded.
+bool decode_color(ColorProcessingContext& context, pubsub::Message& message) {
+    const bool is_keyframe = message.header.flags > 0;
+    const auto creation_us = message.get_simple<uint64_t>(0);
+    const auto sequence_id = message.get_simple<uint64_t>(1);
+    const auto stream_meta = parse_stream_meta(message.frames[2]);
+    const auto& packet = message.frames[3];
 
-        depth_out.resize(stream_meta.intrinsics.width *
-                         stream_meta.intrinsics.height);
-        auto result = context.decompressor.Decompress(
-            (uint8_t*)packet.data(), packet.size(),
-            stream_meta.intrinsics.width, stream_meta.intrinsics.height,
-            depth_out);
+    if (context.last_sequence_id != INVALID_SEQUENCE_ID) {
+        if (context.last_sequence_id + 1 != sequence_id) {
+            LOG(INFO) << stream_meta.id << " frame drop, sequence id "
+                      << sequence_id << " and last squence id "
+                      << context.last_sequence_id;
 
-        if (result != zdepth::DepthResult::Success) {
-            // possible frame drop?
             context.need_keyframe = true;
-            context.decompressor = {};  // re-init
             context.last_sequence_id = INVALID_SEQUENCE_ID;
-            LOG(WARNING) << "Could not decode depth frame because "
-                         << magic_enum::enum_name(result)
-                         << ". Waiting for next keyframe";
-            continue;
+            context.decoder.reset();
         }
+    }
 
-        context.output_item->write_func([&](DepthData& depth) {
-            depth.topic = message.topic;
-            depth.process_id = message.header.sender_process_id;
-            depth.creation_timestamp_us = creation_us;
-            depth.stream_meta = stream_meta;
-            depth.sequence_id = sequence_id;
-            std::swap(depth.data, depth_out);
-        });
+    if (context.need_keyframe && !is_keyframe) {
+        LOG_EVERY_T(INFO, 1) << stream_meta.id << " waiting for keyframe";
+        // we have not gotten a keyframe yet
+        // cannot ingest this packet
+        return false;
     }
+
+    if (context.need_keyframe) {
+        CHECK(is_keyframe);
+        LOG(INFO) << stream_meta.id << " got keyframe";
+    }
+
+    context.need_keyframe = false;
+    context.last_sequence_id = sequence_id;
+
+    if (!context.decoder.decode(packet, context.color_out)) {
+        context.need_keyframe = true;
+        context.decoder.reset();
+        context.last_sequence_id = INVALID_SEQUENCE_ID;
+        LOG(WARNING) << stream_meta.id << " waiting for next keyframe";
+        return false;
+    }
+
+    context.output_item->write_func([&](ColorData& color) {
+        color.topic = message.topic;
+        color.process_id = message.header.sender_process_id;
+        color.creation_timestamp_us = creation_us;
+        color.stream_meta = stream_meta;
+        color.sequence_id = sequence_id;
+        std::swap(context.color_out, color.data);
+    });
+    return true;
 }
 
-void run_color_thread() {
-    struct ColorProcessingContext {
-        std::shared_ptr<vpx_codec_ctx> decoder;
-        uint64_t last_sequence_id = INVALID_SEQUENCE_ID;
-        bool need_keyframe = true;
-        std::shared_ptr<SingleItem<ColorData>> output_item = nullptr;
-    };
+// hands each packet to the decode pool. a stream that is too far
+// behind blocks until it catches up, so its packets wait in the
+// subscriber buffer, which has room for seconds of them, instead of
+// being dropped, which would cost a wait for the next keyframe.
+template <typename Context>
+void queue_decode(Context& context,
+                  std::shared_ptr<pubsub::Message> message,
+                  bool (*decode)(Context&, pubsub::Message&)) {
+    const auto stream_meta = parse_stream_meta(message->frames[2]);
+    context.feedback->count_received(stream_meta.id,
+                                     message->get_simple<uint64_t>(1),
+                                     message->frames[3].size());
+
+    int num_queued = context.num_queued;
+    while (num_queued >= max_queued_decodes_per_stream) {
+        context.num_queued.wait(num_queued);
+        num_queued = context.num_queued;
+    }
+    ++context.num_queued;
+    const std::string topic = message->topic;
+    const uint64_t received_us = get_process_time_us();
+    _decode_pool->push(topic, [&context, message, decode, received_us]() {
+        if (decode(context, *message)) {
+            context.feedback->count_decoded(get_process_time_us() -
+                                            received_us);
+        } else {
+            context.feedback->count_not_decoded();
+        }
+        --context.num_queued;
+        context.num_queued.notify_one();
+    });
+}
 
-    absl::flat_hash_map<std::string, ColorProcessingContext> serial_to_context;
-    FastResizableVector<uint8_t> color_out;
+void run_depth_thread() {
+    // contexts are referenced by queued decodes, so they need stable
+    // addresses
+    absl::flat_hash_map<std::string, std::unique_ptr<DepthProcessingContext>>
+        serial_to_context;
 
     while (!should_stop_all()) {
-        pubsub::Message message;
-        if (!_color_buffer.move_read(message, /*blocking=*/true)) return;
-        CHECK_EQ(message.header.message_version, 0) << "Unsupported version";
-
-        const bool is_keyframe = message.header.flags > 0;
-        const auto creation_us = message.get_simple<uint64_t>(0);
-        const auto sequence_id = message.get_simple<uint64_t>(1);
-        const auto stream_meta = message.get_simple<StreamMeta>(2);
-        const auto& packet = message.frames[3];
+        auto message = std::make_shared<pubsub::Message>();
+        if (!_depth_buffer.move_read(*message, /*blocking=*/true)) break;
+        CHECK_LE(message->header.message_version, stream_message_version)
+            << "Unsupported version";
 
+        const auto stream_meta = parse_stream_meta(message->frames[2]);
         if (!serial_to_context.count(stream_meta.id.serial_number)) {
             auto& context = serial_to_context[stream_meta.id.serial_number];
-            context.output_item = std::make_shared<SingleItem<ColorData>>();
-            context.decoder = init_vpx_decoder();
+            context = std::make_unique<DepthProcessingContext>();
+            context->output_item = std::make_shared<SingleItem<DepthData>>();
 
             {
-                std::lock_guard<std::mutex> lock{_color_items_mutex};
-                _serial_to_color_item[stream_meta.id.serial_number] =
-                    context.output_item;
+                std::lock_guard<std::mutex> lock{_depth_items_mutex};
+                CHECK(
+                    !_serial_to_depth_item.count(stream_meta.id.serial_number));
+                _serial_to_depth_item[stream_meta.id.serial_number] =
+                    context->output_item;
             }
             {
                 std::lock_guard<std::mutex> lock{_serial_numbers_mutex};
@@ -201,72 +349,56 @@ void run_color_thread() {
             }
         }
 
-        auto& context = serial_to_context.at(stream_meta.id.serial_number);
+        auto& context = *serial_to_context.at(stream_meta.id.serial_number);
+        queue_decode(context, std::move(message), decode_depth);
+    }
+
+    _decode_pool->wait_idle();
+}
 
-        if (context.last_sequence_id != INVALID_SEQUENCE_ID) {
-            if (context.last_sequence_id + 1 != sequence_id) {
-                LOG(INFO) << stream_meta.id << " frame drop, sequence id "
-                          << sequence_id << " and last squence id "
-                          << context.last_sequence_id;
+void run_color_thread() {
+    // contexts are referenced by queued decodes, so they need stable
+    // addresses
+    absl::flat_hash_map<std::string, std::unique_ptr<ColorProcessingContext>>
+        serial_to_context;
+
+    while (!should_stop_all()) {
+        auto message = std::make_shared<pubsub::Message>();
+        if (!_color_buffer.move_read(*message, /*blocking=*/true)) break;
+        CHECK_LE(message->header.message_version, stream_message_version)
+            << "Unsupported version";
 
-                context.need_keyframe = true;
-                context.last_sequence_id = INVALID_SEQUENCE_ID;
-                context.decoder = init_vpx_decoder();
+        const auto stream_meta = parse_stream_meta(message->frames[2]);
+        if (!serial_to_context.count(stream_meta.id.serial_number)) {
+            auto& context = serial_to_context[stream_meta.id.serial_number];
+            context = std::make_unique<ColorProcessingContext>();
+            context->output_item = std::make_shared<SingleItem<ColorData>>();
+
+            {
+                std::lock_guard<std::mutex> lock{_color_items_mutex};
+                _serial_to_color_item[stream_meta.id.serial_number] =
+                    context->output_item;
+            }
+            {
+                std::lock_guard<std::mutex> lock{_serial_numbers_mutex};
+                _serial_numbers.insert(stream_meta.id.serial_number);
             }
         }
 
-        if (context.need_keyframe && !is_keyframe) {
-            LOG_EVERY_T(INFO, 1) << stream_meta.id << " waiting for keyframe";
-            // we have not gotten a keyframe yet
-            // cannot ingest this packet
-            continue;
-        }
+        auto& context = *serial_to_context.at(stream_meta.id.serial_number);
+        queue_decode(context, std::move(message), decode_color);
+    }
 
-        if (context.need_keyframe) {
-            CHECK(is_keyframe);
-            LOG(INFO) << stream_meta.id << " got keyframe";
-        }
+    _decode_pool->wait_idle();
+}
 
-        context.need_keyframe = false;
-        context.last_sequence_id = sequence_id;
-
-        // decode
-        const vpx_codec_err_t err = vpx_codec_decode(
-            context.decoder.get(), (const uint8_t*)packet.data(), packet.size(),
-            /*user_priv=*/nullptr,
-            /*deadline=*/0);
-
-        CHECK(err == VPX_CODEC_OK) << vpx_codec_error(context.decoder.get());
-
-        vpx_image_t* img = nullptr;
-        vpx_codec_iter_t iter = nullptr;
-        while ((img = vpx_codec_get_frame(context.decoder.get(), &iter)) !=
-               nullptr) {
-            // check frame size
-            const int width = img->d_w;
-            const int height = img->d_h;
-            CHECK(img->fmt == VPX_IMG_FMT_I420);
-
-            // const int y_stride = img->stride[VPX_PLANE_Y];
-            // const int u_stride = img->stride[VPX_PLANE_U];
-            // const int v_stride = img->stride[VPX_PLANE_V];
-
-            color_out.resize(3 * width * height);
-            yuv420_rgb24_sseu(width, height, img->planes[VPX_PLANE_Y],
-                              img->planes[VPX_PLANE_U],
-                              img->planes[VPX_PLANE_V],
-                              img->stride[VPX_PLANE_Y],
-                              img->stride[VPX_PLANE_U] /* = v stride */,
-                              color_out.data(), 3 * width, YCBCR_601);
-
-            context.output_item->write_func([&](ColorData& color) {
-                color.topic = message.topic;
-                color.process_id = message.header.sender_process_id;
-                color.creation_timestamp_us = creation_us;
-                color.stream_meta = stream_meta;
-                color.sequence_id = sequence_id;
-                std::swap(color_out, color.data);
-            });
+void run_feedback_thread() {
+    while (!should_stop_all()) {
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(feedback_window_us / 5));
+        std::lock_guard<std::mutex> lock{_feedback_counters_mutex};
+        for (auto& counter : _feedback_counters) {
+            counter->maybe_publish();
         }
     }
 }
@@ -285,10 +417,11 @@ void run_motion_thread() {
     while (!should_stop_all()) {
         pubsub::Message message;
         if (!_motion_buffer.move_read(message, /*blocking=*/true)) return;
-        CHECK_EQ(message.header.message_version, 0) << "Unsupported version";
+        CHECK_LE(message.header.message_version, stream_message_version)
+            << "Unsupported version";
 
         const auto sequence_id = message.get_simple<uint64_t>(0);
-        const auto stream_meta = message.get_simple<StreamMeta>(1);
+        const auto stream_meta = parse_stream_meta(message.frames[1]);
         const auto& timestamps_us_bytes = message.frames[2];
         const auto& xyz_bytes = message.frames[3];
 
@@ -385,7 +518,8 @@ RealsenseStateDidUpdate update_realsense_state(RealsenseState& state) {
     return did_update;
 }
 
-void init(const network_config::Config& network_config) {
+void init(const network_config::Config& network_config,
+          const ClientOptions& options) {
     CHECK(!_initted);
 
     auto system_config = network_config.get("realsense");
@@ -393,14 +527,30 @@ void init(const network_config::Config& network_config) {
         pubsub::connect(system_config.connect);
     }
 
-    pubsub::subscribe("realsense/color/", &_color_buffer);
-    pubsub::subscribe("realsense/depth/", &_depth_buffer);
+    // the server binds this, for the feedback of all its clients, to
+    // adapt its encoders to what they get
+    auto feedback_config = network_config.get("realsense_feedback");
+    if (!feedback_config.connect.empty()) {
+        pubsub::connect_publisher(feedback_config.connect);
+        _send_feedback = true;
+    }
+
+    if (options.preview) {
+        pubsub::subscribe("realsense_preview/color/", &_color_buffer);
+        pubsub::subscribe("realsense_preview/depth/", &_depth_buffer);
+    } else {
+        pubsub::subscribe("realsense/color/", &_color_buffer);
+        pubsub::subscribe("realsense/depth/", &_depth_buffer);
+    }
     pubsub::subscribe("realsense/gyro/", &_motion_buffer);
     pubsub::subscribe("realsense/accel/", &_motion_buffer);
 
+    _decode_pool = std::make_unique<KeyedThreadPool>(
+        std::max<int>(std::thread::hardware_concurrency(), 1));
     _depth_thread = std::jthread{run_depth_thread};
     _color_thread = std::jthread{run_color_thread};
     _motion_thread = std::jthread{run_motion_thread};
+    if (_send_feedback) _feedback_thread = std::jthread{run_feedback_thread};
     _initted = true;
 }
 
@@ -415,6 +565,8 @@ void cleanup() {
     if (_depth_thread.joinable()) _depth_thread.join();
     if (_color_thread.joinable()) _color_thread.join();
     if (_motion_thread.joinable()) _motion_thread.join();
+    if (_feedback_thread.joinable()) _feedback_thread.join();
+    _decode_pool.reset();
 
     for (auto& [_, item] : _serial_to_depth_item) {
         item->stop();
@@ -25,7 +25,14 @@ struct RealsenseStateDidUpdate {
     bool gyro = false;
 };
 
-void init(const network_config::Config& network_config);
+struct ClientOptions {
+    // get the downscaled preview streams of the server instead of the
+    // full ones, eg for thumbnails. see EncodePipelineOptions.
+    bool preview = false;
+};
+
+void init(const network_config::Config& network_config,
+          const ClientOptions& options = {});
 void update_realsense_list(absl::flat_hash_map<SerialNumber, RealsenseState>&
                            serial_to_realsense_state);
 RealsenseStateDidUpdate update_realsense_state(RealsenseState& state);
@@ -0,0 +1,74 @@
+#include "decoders.h"
+
+#include <yuv_rgb.h>
+
+#include <magic_enum.hpp>
+
+#include "debug/check.h"
+#include "debug/log.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+void DepthDecoder::reset() {
+    decompressor_ = {};  // re-init
+}
+
+bool DepthDecoder::decode(Seq<const std::byte> packet,
+                          const StreamMeta& stream_meta,
+                          FastResizableVector<uint16_t>& depth_out) {
+    depth_out.resize(stream_meta.intrinsics.width *
+                     stream_meta.intrinsics.height);
+    auto result = decompressor_.Decompress(
+        (const uint8_t*)packet.data(), packet.size(),
+        stream_meta.intrinsics.width, stream_meta.intrinsics.height, depth_out);
+    if (result != zdepth::DepthResult::Success) {
+        LOG(WARNING) << "Could not decode depth frame because "
+                     << magic_enum::enum_name(result);
+        return false;
+    }
+    return true;
+}
+
+ColorDecoder::ColorDecoder() { reset(); }
+
+void ColorDecoder::reset() {
+    decoder_ = init_vpx_decoder();
+    CHECK(decoder_);
+}
+
+bool ColorDecoder::decode(Seq<const std::byte> packet,
+                          FastResizableVector<uint8_t>& rgb_out) {
+    const vpx_codec_err_t err =
+        vpx_codec_decode(decoder_.get(), (const uint8_t*)packet.data(),
+                         packet.size(), /*user_priv=*/nullptr,
+                         /*deadline=*/0);
+    if (err != VPX_CODEC_OK) {
+        LOG(WARNING) << "Could not decode color frame because "
+                     << vpx_codec_error(decoder_.get());
+        return false;
+    }
+
+    // the server sends one frame per packet. if there are more, the
+    // last one wins.
+    bool got_frame = false;
+    vpx_image_t* img = nullptr;
+    vpx_codec_iter_t iter = nullptr;
+    while ((img = vpx_codec_get_frame(decoder_.get(), &iter)) != nullptr) {
+        const int width = img->d_w;
+        const int height = img->d_h;
+        CHECK(img->fmt == VPX_IMG_FMT_I420);
+
+        rgb_out.resize(3 * width * height);
+        yuv420_rgb24_sseu(width, height, img->planes[VPX_PLANE_Y],
+                          img->planes[VPX_PLANE_U], img->planes[VPX_PLANE_V],
+                          img->stride[VPX_PLANE_Y],
+                          img->stride[VPX_PLANE_U] /* = v stride */,
+                          rgb_out.data(), 3 * width, YCBCR_601);
+        got_frame = true;
+    }
+    return got_frame;
+}
+
+}  // namespace realsense_streaming
+}  // namespace axby
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <zdepth.hpp>
+
+#include "fast_resizable_vector/fast_resizable_vector.h"
+#include "messages.h"
+#include "seq/seq.h"
+#include "wrappers/vpx.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+// stateful decoders for the video streams published by the server.
+// packets must be fed in order, starting from a keyframe. after a
+// decode failure or a gap in the sequence, call reset() and start
+// again from the next keyframe.
+
+class DepthDecoder {
+   public:
+    void reset();
+
+    // returns false if the packet could not be decoded
+    bool decode(Seq<const std::byte> packet,
+                const StreamMeta& stream_meta,
+                FastResizableVector<uint16_t>& depth_out);
+
+   private:
+    zdepth::DepthCompressor decompressor_;
+};
+
+class ColorDecoder {
+   public:
+    ColorDecoder();
+
+    void reset();
+
+    // decodes into rgb24. returns false if the packet could not be
+    // decoded or did not produce a frame.
+    bool decode(Seq<const std::byte> packet,
+                FastResizableVector<uint8_t>& rgb_out);
+
+   private:
+    std::shared_ptr<vpx_codec_ctx> decoder_;
+};
+
+}  // namespace realsense_streaming
+}  // namespace axby
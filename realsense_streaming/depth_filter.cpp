@@ -0,0 +1,396 @@
+#include "depth_filter.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DEPTH_FILTER_SSE2
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+#include "debug/check.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+namespace {
+
+uint16_t to_depth_units(float meters, float depth_scale, int max_units) {
+    return uint16_t(
+        std::clamp<double>(std::round(meters / depth_scale), 0, max_units));
+}
+
+uint16_t abs_diff(uint16_t a, uint16_t b) { return a > b ? a - b : b - a; }
+
+// [x, end) of a row
+void clamp_range_scalar(int x,
+                        int end,
+                        const uint16_t* in,
+                        uint16_t min_depth,
+                        uint16_t max_depth,
+                        uint16_t* out) {
+    for (; x < end; ++x) {
+        out[x] = in[x] >= min_depth && in[x] <= max_depth ? in[x] : 0;
+    }
+}
+
+// one pixel, whose neighbours are 0 where they are outside the image
+uint16_t spatial_pixel(uint16_t center,
+                       uint16_t left,
+                       uint16_t right,
+                       uint16_t up,
+                       uint16_t down,
+                       uint16_t delta) {
+    if (center == 0) return 0;
+    uint32_t sum = center;
+    uint32_t count = 1;
+    for (const uint16_t neighbour : {left, right, up, down}) {
+        if (neighbour != 0 && abs_diff(neighbour, center) <= delta) {
+            sum += neighbour;
+            ++count;
+        }
+    }
+    return uint16_t((sum + count / 2) / count);
+}
+
+// [x, end) of a frame. prev is updated to the output.
+void temporal_scalar(int x,
+                     int end,
+                     const uint16_t* in,
+                     uint16_t* prev,
+                     uint16_t* age,
+                     uint16_t delta,
+                     int16_t alpha,
+                     uint16_t persistence) {
+    for (; x < end; ++x) {
+        const uint16_t c = in[x];
+        const uint16_t p = prev[x];
+        if (c != 0) {
+            age[x] = 0;
+            if (p != 0 && abs_diff(c, p) <= delta) {
+                const int32_t d = int32_t(c) - int32_t(p);
+                prev[x] = uint16_t(p + ((2 * d * alpha) >> 16));
+            } else {
+                prev[x] = c;
+            }
+        } else {
+            if (age[x] >= persistence) prev[x] = 0;
+            age[x] = std::min<uint16_t>(age[x] + 1, persistence);
+        }
+    }
+}
+
+#ifdef DEPTH_FILTER_SSE2
+
+// returns the first pixel left for the scalar loop
+int clamp_range_simd(int end,
+                     const uint16_t* in,
+                     uint16_t min_depth,
+                     uint16_t max_depth,
+                     uint16_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i min_v = _mm_set1_epi16(min_depth);
+    const __m128i max_v = _mm_set1_epi16(max_depth);
+    int x = 0;
+    for (; x + 8 <= end; x += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(in + x));
+        // no unsigned compares in sse2, saturating subtraction is 0
+        // iff in bounds
+        const __m128i keep = _mm_and_si128(
+            _mm_cmpeq_epi16(_mm_subs_epu16(min_v, v), zero),
+            _mm_cmpeq_epi16(_mm_subs_epu16(v, max_v), zero));
+        _mm_storeu_si128((__m128i*)(out + x), _mm_and_si128(v, keep));
+    }
+    return x;
+}
+
+__m128i abs_diff_epu16(__m128i a, __m128i b) {
+    return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+}
+
+// pixels [1, width - 1) of a row that has rows above and below.
+// returns the first pixel left for the scalar loop.
+int spatial_row_simd(int width,
+                     const uint16_t* up,
+                     const uint16_t* row,
+                     const uint16_t* down,
+                     uint16_t delta,
+                     uint16_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i delta_v = _mm_set1_epi16(delta);
+    const __m128 half_v = _mm_set1_ps(0.5f);
+    const __m128i bias_32 = _mm_set1_epi32(0x8000);
+    const __m128i bias_16 = _mm_set1_epi16(-0x8000);
+    int x = 1;
+    for (; x + 8 <= width - 1; x += 8) {
+        const __m128i center = _mm_loadu_si128((const __m128i*)(row + x));
+        const __m128i neighbours[4] = {
+            _mm_loadu_si128((const __m128i*)(row + x - 1)),
+            _mm_loadu_si128((const __m128i*)(row + x + 1)),
+            _mm_loadu_si128((const __m128i*)(up + x)),
+            _mm_loadu_si128((const __m128i*)(down + x))};
+
+        __m128i sum_lo = _mm_unpacklo_epi16(center, zero);
+        __m128i sum_hi = _mm_unpackhi_epi16(center, zero);
+        __m128i count = _mm_set1_epi16(1);
+        for (const __m128i& neighbour : neighbours) {
+            const __m128i close = _mm_cmpeq_epi16(
+                _mm_subs_epu16(abs_diff_epu16(neighbour, center), delta_v),
+                zero);
+            const __m128i use =
+                _mm_andnot_si128(_mm_cmpeq_epi16(neighbour, zero), close);
+            const __m128i used = _mm_and_si128(neighbour, use);
+            sum_lo = _mm_add_epi32(sum_lo, _mm_unpacklo_epi16(used, zero));
+            sum_hi = _mm_add_epi32(sum_hi, _mm_unpackhi_epi16(used, zero));
+            count = _mm_sub_epi16(count, use);  // use is -1
+        }
+
+        // the sums fit a float exactly, and with at most 5 terms a
+        // mean is never close enough to .5 for the rounding to differ
+        // from the scalar integer division
+        const __m128 mean_lo = _mm_add_ps(
+            _mm_div_ps(_mm_cvtepi32_ps(sum_lo),
+                       _mm_cvtepi32_ps(_mm_unpacklo_epi16(count, zero))),
+            half_v);
+        const __m128 mean_hi = _mm_add_ps(
+            _mm_div_ps(_mm_cvtepi32_ps(sum_hi),
+                       _mm_cvtepi32_ps(_mm_unpackhi_epi16(count, zero))),
+            half_v);
+
+        // no unsigned 32 to 16 bit pack in sse2, so pack signed around
+        // 0x8000 and shift back
+        const __m128i mean = _mm_xor_si128(
+            _mm_packs_epi32(
+                _mm_sub_epi32(_mm_cvttps_epi32(mean_lo), bias_32),
+                _mm_sub_epi32(_mm_cvttps_epi32(mean_hi), bias_32)),
+            bias_16);
+        const __m128i valid =
+            _mm_xor_si128(_mm_cmpeq_epi16(center, zero), _mm_set1_epi16(-1));
+        _mm_storeu_si128((__m128i*)(out + x), _mm_and_si128(mean, valid));
+    }
+    return x;
+}
+
+// returns the first pixel left for the scalar loop
+int temporal_simd(int end,
+                  const uint16_t* in,
+                  uint16_t* prev,
+                  uint16_t* age,
+                  uint16_t delta,
+                  int16_t alpha,
+                  uint16_t persistence) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i delta_v = _mm_set1_epi16(delta);
+    const __m128i alpha_v = _mm_set1_epi16(alpha);
+    const __m128i persistence_v = _mm_set1_epi16(persistence);
+    int x = 0;
+    for (; x + 8 <= end; x += 8) {
+        const __m128i c = _mm_loadu_si128((const __m128i*)(in + x));
+        const __m128i p = _mm_loadu_si128((__m128i*)(prev + x));
+        const __m128i a = _mm_loadu_si128((__m128i*)(age + x));
+
+        const __m128i c_valid =
+            _mm_xor_si128(_mm_cmpeq_epi16(c, zero), _mm_set1_epi16(-1));
+        const __m128i p_valid =
+            _mm_xor_si128(_mm_cmpeq_epi16(p, zero), _mm_set1_epi16(-1));
+        const __m128i close = _mm_and_si128(
+            _mm_and_si128(c_valid, p_valid),
+            _mm_cmpeq_epi16(_mm_subs_epu16(abs_diff_epu16(c, p), delta_v),
+                            zero));
+
+        // delta is below 2^14, so 2 * (c - p) fits 16 bits where
+        // the pixel is close, and mulhi by alpha in q15 is the step
+        const __m128i step = _mm_mulhi_epi16(
+            _mm_slli_epi16(_mm_sub_epi16(c, p), 1), alpha_v);
+        const __m128i smoothed = _mm_add_epi16(p, step);
+        const __m128i updated = _mm_or_si128(
+            _mm_and_si128(close, smoothed), _mm_andnot_si128(close, c));
+
+        // ages are at most persistence, which fits a signed lane
+        const __m128i persist = _mm_cmplt_epi16(a, persistence_v);
+        const __m128i held = _mm_and_si128(p, persist);
+        const __m128i out = _mm_or_si128(_mm_and_si128(c_valid, updated),
+                                         _mm_andnot_si128(c_valid, held));
+        const __m128i next_age = _mm_andnot_si128(
+            c_valid, _mm_min_epi16(_mm_add_epi16(a, one), persistence_v));
+
+        _mm_storeu_si128((__m128i*)(prev + x), out);
+        _mm_storeu_si128((__m128i*)(age + x), next_age);
+    }
+    return x;
+}
+
+#else
+
+int clamp_range_simd(int end,
+                     const uint16_t* in,
+                     uint16_t min_depth,
+                     uint16_t max_depth,
+                     uint16_t* out) {
+    return 0;
+}
+
+int spatial_row_simd(int width,
+                     const uint16_t* up,
+                     const uint16_t* row,
+                     const uint16_t* down,
+                     uint16_t delta,
+                     uint16_t* out) {
+    return 1;
+}
+
+int temporal_simd(int end,
+                  const uint16_t* in,
+                  uint16_t* prev,
+                  uint16_t* age,
+                  uint16_t delta,
+                  int16_t alpha,
+                  uint16_t persistence) {
+    return 0;
+}
+
+#endif
+
+}  // namespace
+
+DepthFilter::DepthFilter(const DepthFilterOptions& options,
+                         const Intrinsics& intrinsics,
+                         float depth_scale)
+    : options_(options),
+      input_intrinsics_(intrinsics),
+      output_intrinsics_(intrinsics) {
+    CHECK_GT(depth_scale, 0);
+    CHECK_GE(options_.decimation, 1);
+    CHECK(options_.temporal_alpha >= 0 && options_.temporal_alpha <= 1)
+        << "temporal_alpha " << options_.temporal_alpha;
+    CHECK_GE(options_.hole_persistence, 0);
+
+    if (options_.min_depth > 0) {
+        min_depth_ = to_depth_units(options_.min_depth, depth_scale,
+                                    UINT16_MAX);
+    }
+    if (options_.max_depth > 0) {
+        max_depth_ = to_depth_units(options_.max_depth, depth_scale,
+                                    UINT16_MAX);
+    }
+    spatial_delta_ =
+        to_depth_units(options_.spatial_delta, depth_scale, UINT16_MAX);
+    // see temporal_simd
+    temporal_delta_ =
+        to_depth_units(options_.temporal_delta, depth_scale, (1 << 14) - 1);
+    temporal_alpha_ = int16_t(
+        std::min<double>(std::round(options_.temporal_alpha * 32768), 32767));
+
+    // the centers of the pixels of a block average to the center of
+    // the decimated pixel
+    const int factor = options_.decimation;
+    output_intrinsics_.width = intrinsics.width / factor;
+    output_intrinsics_.height = intrinsics.height / factor;
+    output_intrinsics_.ppx = (intrinsics.ppx + 0.5f) / factor - 0.5f;
+    output_intrinsics_.ppy = (intrinsics.ppy + 0.5f) / factor - 0.5f;
+    output_intrinsics_.fx = intrinsics.fx / factor;
+    output_intrinsics_.fy = intrinsics.fy / factor;
+    CHECK(output_intrinsics_.width > 0 && output_intrinsics_.height > 0)
+        << "Decimation " << factor << " of " << intrinsics.width << "x"
+        << intrinsics.height;
+
+    const size_t input_size = intrinsics.width * intrinsics.height;
+    const size_t output_size =
+        output_intrinsics_.width * output_intrinsics_.height;
+    clamped_.resize(input_size);
+    if (factor > 1) decimated_.resize(output_size);
+    spatial_.resize(output_size);
+    temporal_.resize(output_size);
+    hole_age_.resize(output_size);
+}
+
+void DepthFilter::reset() { have_previous_ = false; }
+
+const uint16_t* DepthFilter::process(const uint16_t* depth) {
+    const uint16_t* current = depth;
+
+    if (options_.min_depth > 0 || options_.max_depth > 0) {
+        const int size = input_intrinsics_.width * input_intrinsics_.height;
+        const int x = clamp_range_simd(size, current, min_depth_, max_depth_,
+                                       clamped_.data());
+        clamp_range_scalar(x, size, current, min_depth_, max_depth_,
+                           clamped_.data());
+        current = clamped_.data();
+    }
+
+    const int width = output_intrinsics_.width;
+    const int height = output_intrinsics_.height;
+
+    if (options_.decimation > 1) {
+        // the mean of the valid pixels, 0 if there are none, so holes
+        // don't pull the depth of an edge towards the camera
+        const int factor = options_.decimation;
+        const int input_width = input_intrinsics_.width;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                uint32_t sum = 0;
+                uint32_t count = 0;
+                for (int dy = 0; dy < factor; ++dy) {
+                    const uint16_t* block =
+                        current + (y * factor + dy) * input_width + x * factor;
+                    for (int dx = 0; dx < factor; ++dx) {
+                        sum += block[dx];
+                        count += block[dx] != 0;
+                    }
+                }
+                decimated_[y * width + x] =
+                    count ? uint16_t((sum + count / 2) / count) : 0;
+            }
+        }
+        current = decimated_.data();
+    }
+
+    if (options_.spatial_delta > 0) {
+        for (int y = 0; y < height; ++y) {
+            const uint16_t* row = current + y * width;
+            const uint16_t* up = y > 0 ? row - width : nullptr;
+            const uint16_t* down = y + 1 < height ? row + width : nullptr;
+            uint16_t* out = spatial_.data() + y * width;
+            const auto scalar = [&](int x) {
+                out[x] = spatial_pixel(row[x], x > 0 ? row[x - 1] : 0,
+                                       x + 1 < width ? row[x + 1] : 0,
+                                       up ? up[x] : 0, down ? down[x] : 0,
+                                       spatial_delta_);
+            };
+            if (!up || !down) {
+                for (int x = 0; x < width; ++x) scalar(x);
+                continue;
+            }
+            scalar(0);
+            const int x_end =
+                spatial_row_simd(width, up, row, down, spatial_delta_, out);
+            for (int x = std::max(x_end, 1); x < width; ++x) scalar(x);
+        }
+        current = spatial_.data();
+    }
+
+    if (options_.temporal_alpha > 0) {
+        const int size = width * height;
+        if (!have_previous_) {
+            std::copy(current, current + size, temporal_.begin());
+            std::fill(hole_age_.begin(), hole_age_.end(), 0);
+            have_previous_ = true;
+        } else {
+            const uint16_t persistence =
+                std::min(options_.hole_persistence, INT16_MAX);
+            const int x = temporal_simd(size, current, temporal_.data(),
+                                        hole_age_.data(), temporal_delta_,
+                                        temporal_alpha_, persistence);
+            temporal_scalar(x, size, current, temporal_.data(),
+                            hole_age_.data(), temporal_delta_, temporal_alpha_,
+                            persistence);
+        }
+        current = temporal_.data();
+    }
+
+    return current;
+}
+
+}  // namespace realsense_streaming
+}  // namespace axby
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "messages.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+// distances are in meters, and converted to depth units of the stream
+struct DepthFilterOptions {
+    // depth outside [min_depth, max_depth] is set to 0, ie no depth.
+    // 0 for no bound.
+    float min_depth = 0;
+    float max_depth = 0;
+
+    // 1 to keep the resolution, else each factor x factor block is
+    // replaced by the mean of its valid pixels
+    int decimation = 1;
+
+    // edge preserving: a pixel is averaged with those of its 4
+    // neighbours that are within spatial_delta of it, so depth
+    // discontinuities stay sharp. 0 to disable.
+    float spatial_delta = 0;
+
+    // exponential smoothing over frames, out = prev + alpha * (in -
+    // prev), of the pixels that moved less than temporal_delta. 0 to
+    // disable.
+    float temporal_alpha = 0;
+    float temporal_delta = 0.05;
+
+    // a pixel that loses its depth keeps its last value for up to this
+    // many frames, so dropouts don't flicker. only with temporal_alpha.
+    int hole_persistence = 0;
+
+    bool enabled() const {
+        return min_depth > 0 || max_depth > 0 || decimation > 1 ||
+               spatial_delta > 0 || temporal_alpha > 0;
+    }
+};
+
+// cleans up z16 depth before it is compressed, since speckle noise and
+// pixels that flicker between valid and invalid cost most of the
+// compressed size. the stages run in order range clamp, decimation,
+// spatial, temporal. the per pixel stages use sse2 on x86.
+class DepthFilter {
+   public:
+    DepthFilter(const DepthFilterOptions& options,
+                const Intrinsics& intrinsics,
+                float depth_scale);
+
+    const Intrinsics& get_input_intrinsics() const {
+        return input_intrinsics_;
+    }
+
+    // of the filtered frames, which the decimation scales down
+    const Intrinsics& get_output_intrinsics() const {
+        return output_intrinsics_;
+    }
+
+    // returns the filtered frame, output width * height, valid until
+    // the next call. depth is input width * height.
+    const uint16_t* process(const uint16_t* depth);
+
+    // forgets the previous frames of the temporal filter
+    void reset();
+
+   private:
+    const DepthFilterOptions options_;
+    const Intrinsics input_intrinsics_;
+    Intrinsics output_intrinsics_;
+
+    // in depth units
+    uint16_t min_depth_ = 0;
+    uint16_t max_depth_ = UINT16_MAX;
+    uint16_t spatial_delta_ = 0;
+    uint16_t temporal_delta_ = 0;
+    int16_t temporal_alpha_ = 0;  // q15
+
+    std::vector<uint16_t> clamped_;
+    std::vector<uint16_t> decimated_;
+    std::vector<uint16_t> spatial_;
+
+    // temporal state, the last output and the frames since each
+    // pixel was last valid
+    std::vector<uint16_t> temporal_;
+    std::vector<uint16_t> hole_age_;
+    bool have_previous_ = false;
+};
+
+}  // namespace realsense_streaming
+}  // namespace axby
@@ -0,0 +1,158 @@
+// measures what the depth filter of the realsense server costs and
+// what it saves: the cpu time of filtering and compressing a frame,
+// and the compressed size, for a few filter settings over the same
+// synthetic depth sequence. keyframes every 2s like the server. eg
+//   bazel run -c opt //realsense_streaming:depth_filter_benchmark --
+//   --size=848x480 --num_frames=300
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "app/flag.h"
+#include "app/main.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "math/latency_histogram.h"
+#include "realsense_streaming/depth_filter.h"
+#include "realsense_streaming/synthetic_scene.h"
+#include "zdepth.hpp"
+
+APP_FLAG(std::string, size, "848x480", "wxh of the depth stream");
+APP_FLAG(int, num_frames, 300, "frames per setting");
+APP_FLAG(int, fps, 30, "");
+APP_FLAG(double, motion, 1, "speed of the synthetic scene");
+
+using namespace axby;
+using namespace realsense_streaming;
+
+namespace {
+
+constexpr float depth_scale = 0.001;
+
+struct Setting {
+    std::string name;
+    DepthFilterOptions options;
+};
+
+struct BenchmarkResult {
+    LatencyHistogram filter_time_us;
+    LatencyHistogram compress_time_us;
+    uint64_t num_bytes = 0;
+};
+
+uint64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+BenchmarkResult run_benchmark(const std::vector<std::vector<uint16_t>>& frames,
+                              const Intrinsics& intrinsics,
+                              const DepthFilterOptions& options,
+                              int fps) {
+    BenchmarkResult result;
+    DepthFilter filter(options, intrinsics, depth_scale);
+    const Intrinsics& output_intrinsics = filter.get_output_intrinsics();
+    zdepth::DepthCompressor compressor;
+    std::vector<uint8_t> buffer;
+
+    const int keyframe_interval = 2 * fps;
+    for (size_t frame_idx = 0; frame_idx < frames.size(); ++frame_idx) {
+        auto start = std::chrono::steady_clock::now();
+        const uint16_t* depth = options.enabled()
+                                    ? filter.process(frames[frame_idx].data())
+                                    : frames[frame_idx].data();
+        result.filter_time_us.record(elapsed_us(start));
+
+        start = std::chrono::steady_clock::now();
+        compressor.Compress(output_intrinsics.width, output_intrinsics.height,
+                            depth, buffer,
+                            frame_idx % keyframe_interval == 0);
+        result.compress_time_us.record(elapsed_us(start));
+        result.num_bytes += buffer.size();
+    }
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    __APP_MAIN_INIT__;
+
+    APP_UNPACK_FLAG(size);
+    APP_UNPACK_FLAG(num_frames);
+    APP_UNPACK_FLAG(fps);
+    APP_UNPACK_FLAG(motion);
+
+    CHECK_GT(num_frames, 0);
+    CHECK_GT(fps, 0);
+
+    std::vector<std::string> wh = absl::StrSplit(size, 'x');
+    int width = 0;
+    int height = 0;
+    CHECK(wh.size() == 2 && absl::SimpleAtoi(wh[0], &width) &&
+          absl::SimpleAtoi(wh[1], &height))
+        << "Bad size " << size;
+
+    // roughly a d435 at 848x480
+    const Intrinsics intrinsics{.width = width,
+                                .height = height,
+                                .ppx = width / 2.0f,
+                                .ppy = height / 2.0f,
+                                .fx = 0.5f * width,
+                                .fy = 0.5f * width};
+
+    LOG(INFO) << "Rendering " << num_frames << " frames of " << size;
+    SyntheticScene scene(motion);
+    std::vector<std::vector<uint16_t>> frames(num_frames);
+    for (int i = 0; i < num_frames; ++i) {
+        frames[i].resize(width * height);
+        scene.render_depth(double(i) / fps, intrinsics, depth_scale,
+                           {-0.015, 0, 0}, frames[i].data());
+    }
+
+    const DepthFilterOptions clamp{.min_depth = 0.3, .max_depth = 4};
+    DepthFilterOptions decimate = clamp;
+    decimate.decimation = 2;
+    DepthFilterOptions spatial = clamp;
+    spatial.spatial_delta = 0.02;
+    DepthFilterOptions temporal = clamp;
+    temporal.temporal_alpha = 0.4;
+    temporal.hole_persistence = 3;
+    DepthFilterOptions all = temporal;
+    all.spatial_delta = 0.02;
+    DepthFilterOptions all_decimated = all;
+    all_decimated.decimation = 2;
+
+    const std::vector<Setting> settings = {
+        {"none", {}},
+        {"clamp", clamp},
+        {"decimate 2", decimate},
+        {"spatial", spatial},
+        {"temporal", temporal},
+        {"all", all},
+        {"all, decimate 2", all_decimated},
+    };
+
+    LOG(INFO) << absl::StrFormat("%-16s %9s %9s %9s %9s %10s %8s", "filter",
+                                 "filter ms", "p99 ms", "zdepth ms", "p99 ms",
+                                 "bytes", "kbps");
+    for (const auto& setting : settings) {
+        const BenchmarkResult result =
+            run_benchmark(frames, intrinsics, setting.options, fps);
+        const double kbps =
+            result.num_bytes * 8 / (double(num_frames) / fps) / 1000;
+        LOG(INFO) << absl::StrFormat(
+            "%-16s %9.2f %9.2f %9.2f %9.2f %10.0f %8.0f", setting.name,
+            result.filter_time_us.get_mean() / 1e3,
+            result.filter_time_us.get_quantile(0.99) / 1e3,
+            result.compress_time_us.get_mean() / 1e3,
+            result.compress_time_us.get_quantile(0.99) / 1e3,
+            double(result.num_bytes) / num_frames, kbps);
+    }
+    return 0;
+}
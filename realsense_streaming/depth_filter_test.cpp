@@ -0,0 +1,193 @@
+#include "realsense_streaming/depth_filter.h"
+
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using namespace axby;
+using namespace realsense_streaming;
+
+namespace {
+
+constexpr float depth_scale = 0.001;
+
+Intrinsics make_intrinsics(int width, int height) {
+    return {.width = width,
+            .height = height,
+            .ppx = width / 2.0f,
+            .ppy = height / 2.0f,
+            .fx = 400,
+            .fy = 400};
+}
+
+// a plane with noise, a step and dropouts, so every branch is taken
+std::vector<uint16_t> make_depth(int width, int height, std::mt19937& rng) {
+    std::vector<uint16_t> depth(width * height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const int base = x < width / 2 ? 1000 : 2500;
+            depth[y * width + x] =
+                rng() % 11 == 0 ? 0 : base + int(rng() % 41) - 20;
+        }
+    }
+    return depth;
+}
+
+// straightforward versions of the stages
+
+std::vector<uint16_t> reference_spatial(const std::vector<uint16_t>& in,
+                                        int width,
+                                        int height,
+                                        int delta) {
+    std::vector<uint16_t> out(in.size());
+    const auto at = [&](int x, int y) -> int {
+        if (x < 0 || y < 0 || x >= width || y >= height) return 0;
+        return in[y * width + x];
+    };
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const int center = at(x, y);
+            if (center == 0) continue;
+            int sum = center;
+            int count = 1;
+            for (const int neighbour :
+                 {at(x - 1, y), at(x + 1, y), at(x, y - 1), at(x, y + 1)}) {
+                if (neighbour != 0 && std::abs(neighbour - center) <= delta) {
+                    sum += neighbour;
+                    ++count;
+                }
+            }
+            out[y * width + x] = (sum + count / 2) / count;
+        }
+    }
+    return out;
+}
+
+}  // namespace
+
+TEST(DepthFilterTest, ClampsRange) {
+    const DepthFilterOptions options{.min_depth = 1.0, .max_depth = 2.0};
+    DepthFilter filter(options, make_intrinsics(37, 3), depth_scale);
+
+    std::vector<uint16_t> depth(37 * 3);
+    for (size_t i = 0; i < depth.size(); ++i) depth[i] = 900 + 25 * i;
+    const uint16_t* out = filter.process(depth.data());
+    for (size_t i = 0; i < depth.size(); ++i) {
+        const bool in_range = depth[i] >= 1000 && depth[i] <= 2000;
+        EXPECT_EQ(out[i], in_range ? depth[i] : 0) << i;
+    }
+}
+
+TEST(DepthFilterTest, DecimatesValidPixels) {
+    const DepthFilterOptions options{.decimation = 2};
+    const Intrinsics intrinsics = make_intrinsics(5, 4);
+    DepthFilter filter(options, intrinsics, depth_scale);
+
+    const Intrinsics& decimated = filter.get_output_intrinsics();
+    EXPECT_EQ(decimated.width, 2);
+    EXPECT_EQ(decimated.height, 2);
+    EXPECT_FLOAT_EQ(decimated.fx, intrinsics.fx / 2);
+    EXPECT_FLOAT_EQ(decimated.ppx, (intrinsics.ppx + 0.5f) / 2 - 0.5f);
+
+    // clang-format off
+    const std::vector<uint16_t> depth = {
+        100, 0,   300, 300, 9,
+        0,   0,   300, 301, 9,
+        0,   0,   500, 500, 9,
+        0,   200, 500, 500, 9,
+    };
+    // clang-format on
+    const uint16_t* out = filter.process(depth.data());
+    EXPECT_EQ(out[0], 100);
+    EXPECT_EQ(out[1], 300);
+    EXPECT_EQ(out[2], 200);
+    EXPECT_EQ(out[3], 500);
+}
+
+TEST(DepthFilterTest, SpatialMatchesReference) {
+    std::mt19937 rng(1);
+    // widths around the 8 pixel vectors and their tails
+    for (const int width : {1, 2, 9, 10, 17, 64, 101}) {
+        const int height = 7;
+        const DepthFilterOptions options{.spatial_delta = 0.015};
+        DepthFilter filter(options, make_intrinsics(width, height),
+                           depth_scale);
+        const auto depth = make_depth(width, height, rng);
+        const uint16_t* out = filter.process(depth.data());
+        const auto expected = reference_spatial(depth, width, height, 15);
+        for (int i = 0; i < width * height; ++i) {
+            ASSERT_EQ(out[i], expected[i]) << "width " << width << " at " << i;
+        }
+    }
+}
+
+TEST(DepthFilterTest, SpatialKeepsEdges) {
+    const int width = 32;
+    const DepthFilterOptions options{.spatial_delta = 0.05};
+    DepthFilter filter(options, make_intrinsics(width, 3), depth_scale);
+
+    std::vector<uint16_t> depth(width * 3);
+    for (int i = 0; i < width * 3; ++i) {
+        depth[i] = i % width < width / 2 ? 1000 : 3000;
+    }
+    const uint16_t* out = filter.process(depth.data());
+    for (int i = 0; i < width * 3; ++i) EXPECT_EQ(out[i], depth[i]) << i;
+}
+
+TEST(DepthFilterTest, TemporalMatchesReference) {
+    std::mt19937 rng(2);
+    const int width = 45;
+    const int height = 5;
+    const int persistence = 2;
+    const DepthFilterOptions options{.temporal_alpha = 0.4,
+                                     .temporal_delta = 0.03,
+                                     .hole_persistence = persistence};
+    DepthFilter filter(options, make_intrinsics(width, height), depth_scale);
+
+    const int alpha_q15 = 13107;  // round(0.4 * 32768)
+    std::vector<uint16_t> prev;
+    std::vector<int> age(width * height, 0);
+    for (int frame = 0; frame < 10; ++frame) {
+        const auto depth = make_depth(width, height, rng);
+        const uint16_t* out = filter.process(depth.data());
+        if (frame == 0) {
+            prev = depth;
+        } else {
+            for (int i = 0; i < width * height; ++i) {
+                const int c = depth[i];
+                const int p = prev[i];
+                if (c != 0) {
+                    age[i] = 0;
+                    prev[i] = p != 0 && std::abs(c - p) <= 30
+                                  ? p + ((2 * (c - p) * alpha_q15) >> 16)
+                                  : c;
+                } else {
+                    if (age[i] >= persistence) prev[i] = 0;
+                    age[i] = std::min(age[i] + 1, persistence);
+                }
+            }
+        }
+        for (int i = 0; i < width * height; ++i) {
+            ASSERT_EQ(out[i], prev[i]) << "frame " << frame << " at " << i;
+        }
+    }
+}
+
+TEST(DepthFilterTest, TemporalHoldsHoles) {
+    const int width = 16;
+    const DepthFilterOptions options{.temporal_alpha = 0.5,
+                                     .hole_persistence = 2};
+    DepthFilter filter(options, make_intrinsics(width, 1), depth_scale);
+
+    std::vector<uint16_t> depth(width, 1500);
+    filter.process(depth.data());
+    std::fill(depth.begin(), depth.end(), 0);
+    EXPECT_EQ(filter.process(depth.data())[3], 1500);
+    EXPECT_EQ(filter.process(depth.data())[3], 1500);
+    EXPECT_EQ(filter.process(depth.data())[3], 0);
+
+    filter.reset();
+    EXPECT_EQ(filter.process(depth.data())[3], 0);
+}
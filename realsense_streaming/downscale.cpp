@@ -0,0 +1,128 @@
+#include "downscale.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "debug/check.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+namespace {
+
+// the first source pixel covered by each destination pixel, and one
+// past the end
+std::vector<int> get_bounds(int src_size, int dst_size) {
+    std::vector<int> bounds(dst_size + 1);
+    for (int i = 0; i <= dst_size; ++i) {
+        bounds[i] = int(int64_t(i) * src_size / dst_size);
+    }
+    return bounds;
+}
+
+}  // namespace
+
+Intrinsics get_downscaled_intrinsics(const Intrinsics& intrinsics,
+                                     int width) {
+    CHECK_GT(width, 0);
+    CHECK(intrinsics.width > 0 && intrinsics.height > 0);
+    Intrinsics result;
+    result.width = std::max(2, width / 2 * 2);
+    result.height = std::max(
+        2, int(std::round(double(result.width) * intrinsics.height /
+                          intrinsics.width / 2)) *
+               2);
+    const float scale_x = float(result.width) / intrinsics.width;
+    const float scale_y = float(result.height) / intrinsics.height;
+    // the centers of the pixels of a block average to the center of
+    // the downscaled pixel
+    result.ppx = (intrinsics.ppx + 0.5f) * scale_x - 0.5f;
+    result.ppy = (intrinsics.ppy + 0.5f) * scale_y - 0.5f;
+    result.fx = intrinsics.fx * scale_x;
+    result.fy = intrinsics.fy * scale_y;
+    return result;
+}
+
+void downscale_box(int src_width,
+                   int src_height,
+                   const uint8_t* src,
+                   int src_stride,
+                   int channels,
+                   int dst_width,
+                   int dst_height,
+                   uint8_t* dst,
+                   int dst_stride) {
+    CHECK(dst_width <= src_width && dst_height <= src_height)
+        << "Can't upscale " << src_width << "x" << src_height << " to "
+        << dst_width << "x" << dst_height;
+    CHECK(channels >= 1 && channels <= 4);
+    const std::vector<int> x_bounds = get_bounds(src_width, dst_width);
+    const std::vector<int> y_bounds = get_bounds(src_height, dst_height);
+
+    // sums of the source rows of a destination row, then of their
+    // columns
+    std::vector<uint32_t> column_sums(src_width * channels);
+    for (int y = 0; y < dst_height; ++y) {
+        std::fill(column_sums.begin(), column_sums.end(), 0);
+        for (int src_y = y_bounds[y]; src_y < y_bounds[y + 1]; ++src_y) {
+            const uint8_t* row = src + src_y * src_stride;
+            for (int i = 0; i < src_width * channels; ++i) {
+                column_sums[i] += row[i];
+            }
+        }
+        const int num_rows = y_bounds[y + 1] - y_bounds[y];
+        uint8_t* out = dst + y * dst_stride;
+        for (int x = 0; x < dst_width; ++x) {
+            const int count = num_rows * (x_bounds[x + 1] - x_bounds[x]);
+            for (int c = 0; c < channels; ++c) {
+                uint32_t sum = 0;
+                for (int src_x = x_bounds[x]; src_x < x_bounds[x + 1];
+                     ++src_x) {
+                    sum += column_sums[src_x * channels + c];
+                }
+                out[x * channels + c] = uint8_t((sum + count / 2) / count);
+            }
+        }
+    }
+}
+
+void downscale_depth(int src_width,
+                     int src_height,
+                     const uint16_t* src,
+                     int dst_width,
+                     int dst_height,
+                     uint16_t* dst) {
+    CHECK(dst_width <= src_width && dst_height <= src_height)
+        << "Can't upscale " << src_width << "x" << src_height << " to "
+        << dst_width << "x" << dst_height;
+    const std::vector<int> x_bounds = get_bounds(src_width, dst_width);
+    const std::vector<int> y_bounds = get_bounds(src_height, dst_height);
+
+    std::vector<uint32_t> column_sums(src_width);
+    std::vector<uint32_t> column_counts(src_width);
+    for (int y = 0; y < dst_height; ++y) {
+        std::fill(column_sums.begin(), column_sums.end(), 0);
+        std::fill(column_counts.begin(), column_counts.end(), 0);
+        for (int src_y = y_bounds[y]; src_y < y_bounds[y + 1]; ++src_y) {
+            const uint16_t* row = src + src_y * src_width;
+            for (int i = 0; i < src_width; ++i) {
+                column_sums[i] += row[i];
+                column_counts[i] += row[i] != 0;
+            }
+        }
+        uint16_t* out = dst + y * dst_width;
+        for (int x = 0; x < dst_width; ++x) {
+            uint32_t sum = 0;
+            uint32_t count = 0;
+            for (int src_x = x_bounds[x]; src_x < x_bounds[x + 1]; ++src_x) {
+                sum += column_sums[src_x];
+                count += column_counts[src_x];
+            }
+            out[x] = count ? uint16_t((sum + count / 2) / count) : 0;
+        }
+    }
+}
+
+}  // namespace realsense_streaming
+}  // namespace axby
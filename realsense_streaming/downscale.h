@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+#include "messages.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+// of a preview of width, with the aspect ratio of intrinsics, and its
+// pixels scaled to match. width and height are even, for 4:2:0.
+Intrinsics get_downscaled_intrinsics(const Intrinsics& intrinsics,
+                                     int width);
+
+// each destination pixel is the mean of the source pixels it covers,
+// per channel, for any ratio. the channels of a pixel are interleaved,
+// eg 3 for rgb8, or 4 for yuyv, whose pairs of pixels then count as
+// one pixel of half the width.
+void downscale_box(int src_width,
+                   int src_height,
+                   const uint8_t* src,
+                   int src_stride,
+                   int channels,
+                   int dst_width,
+                   int dst_height,
+                   uint8_t* dst,
+                   int dst_stride);
+
+// like downscale_box, of the valid pixels of z16 depth, 0 where none
+// are, so holes don't pull the depth of an edge towards the camera
+void downscale_depth(int src_width,
+                     int src_height,
+                     const uint16_t* src,
+                     int dst_width,
+                     int dst_height,
+                     uint16_t* dst);
+
+}  // namespace realsense_streaming
+}  // namespace axby
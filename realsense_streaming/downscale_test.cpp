@@ -0,0 +1,51 @@
+#include "realsense_streaming/downscale.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using namespace axby;
+using namespace realsense_streaming;
+
+TEST(DownscaleTest, Intrinsics) {
+    const Intrinsics intrinsics{
+        .width = 640, .height = 480, .ppx = 319.5, .ppy = 239.5,
+        .fx = 600, .fy = 600};
+    const Intrinsics preview = get_downscaled_intrinsics(intrinsics, 160);
+    EXPECT_EQ(preview.width, 160);
+    EXPECT_EQ(preview.height, 120);
+    EXPECT_FLOAT_EQ(preview.ppx, 79.5);
+    EXPECT_FLOAT_EQ(preview.ppy, 59.5);
+    EXPECT_FLOAT_EQ(preview.fx, 150);
+
+    // 16:9 rounds to an even height
+    const Intrinsics wide = get_downscaled_intrinsics(
+        {.width = 1280, .height = 720, .fx = 900, .fy = 900}, 160);
+    EXPECT_EQ(wide.height, 90);
+}
+
+TEST(DownscaleTest, BoxAveragesChannels) {
+    // 3x2 rgb to 2x1, whose second pixel covers two columns
+    // clang-format off
+    const std::vector<uint8_t> src = {
+        10, 0, 1,   20, 0, 2,   30, 0, 3,
+        30, 0, 5,   40, 0, 6,   50, 0, 7,
+    };
+    // clang-format on
+    std::vector<uint8_t> dst(2 * 3);
+    downscale_box(3, 2, src.data(), 9, 3, 2, 1, dst.data(), 6);
+    EXPECT_EQ(dst, (std::vector<uint8_t>{20, 0, 3, 35, 0, 5}));
+}
+
+TEST(DownscaleTest, DepthIgnoresHoles) {
+    // clang-format off
+    const std::vector<uint16_t> src = {
+        1000, 0,    0, 0,
+        0,    1002, 0, 0,
+    };
+    // clang-format on
+    std::vector<uint16_t> dst(2);
+    downscale_depth(4, 2, src.data(), 2, 1, dst.data());
+    EXPECT_EQ(dst[0], 1001);
+    EXPECT_EQ(dst[1], 0);
+}
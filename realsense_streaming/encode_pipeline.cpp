@@ -0,0 +1,757 @@
+#include "encode_pipeline.h"
+
+#include <yuv_rgb.h>
+
+#include <algorithm>
+#include <magic_enum.hpp>
+#include <thread>
+
+#include "absl/strings/str_format.h"
+#include "app/pubsub.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "downscale.h"
+#include "roi.h"
+#include "wrappers/vpx.h"
+#include "yuyv.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+std::string get_topic(const StreamId& stream_id) {
+    const char* prefix =
+        stream_id.preview ? "realsense_preview" : "realsense";
+    if (stream_id.type == StreamType::COLOR) {
+        return absl::StrFormat("%s/color/%s/%d", prefix,
+                               std::string(stream_id.serial_number),
+                               stream_id.index);
+    }
+    if (stream_id.type == StreamType::DEPTH) {
+        return absl::StrFormat("%s/depth/%s/%d", prefix,
+                               std::string(stream_id.serial_number),
+                               stream_id.index);
+    }
+    if (stream_id.type == StreamType::GYRO) {
+        return absl::StrFormat("%s/gyro/%s/%d", prefix,
+                               std::string(stream_id.serial_number),
+                               stream_id.index);
+    }
+    if (stream_id.type == StreamType::ACCEL) {
+        return absl::StrFormat("%s/accel/%s/%d", prefix,
+                               std::string(stream_id.serial_number),
+                               stream_id.index);
+    }
+    LOG(FATAL) << "Unhandled stream type "
+               << magic_enum::enum_name(stream_id.type);
+    return "";
+    // unreachable not supported by gcc11
+    // std::unreachable();
+}
+
+EncodePipeline::EncodePipeline(
+    const absl::flat_hash_map<int, StreamMeta>& uid_to_stream_meta,
+    const EncodePipelineOptions& options)
+    : options_(options) {
+    const int num_cores = std::max<int>(std::thread::hardware_concurrency(), 1);
+    int num_color_streams = 0;
+    for (const auto& [uid, stream_meta] : uid_to_stream_meta) {
+        if (stream_meta.is_color()) ++num_color_streams;
+    }
+    const int color_encoder_threads =
+        options_.color_encoder_threads > 0
+            ? options_.color_encoder_threads
+            : std::max(num_cores / std::max(num_color_streams, 1), 1);
+
+    // initialize encoders for streams which need to be compressed
+    for (const auto& [uid, stream_meta] : uid_to_stream_meta) {
+        auto stream = std::make_unique<Stream>();
+        stream->stream_meta = stream_meta;
+        stream->topic = get_topic(stream_meta.id);
+        stream->frame_width = stream_meta.intrinsics.width;
+        stream->frame_height = stream_meta.intrinsics.height;
+        if (stream_meta.is_color() || stream_meta.is_depth()) {
+            stream->rate_controller.emplace(options_.color_bitrate,
+                                            options_.rate_control);
+
+            const auto it = options_.stream_to_roi.find(stream_meta.id);
+            const Roi& roi = it != options_.stream_to_roi.end()
+                                 ? it->second
+                                 : stream_meta.is_color() ? options_.color_roi
+                                                          : options_.depth_roi;
+            stream->roi = get_roi_rect(roi, stream_meta);
+        }
+        if (stream->roi) {
+            const RoiRect& rect = *stream->roi;
+            stream->stream_meta.intrinsics =
+                crop_intrinsics(stream_meta.intrinsics, rect);
+            stream->stream_meta.roi_offset = {rect.x, rect.y};
+            if (stream_meta.is_depth()) {
+                stream->roi_depth.resize(rect.width * rect.height);
+            }
+            LOG_IF(INFO, options_.verbose)
+                << "Cropping " << stream->topic << " to " << rect.width << "x"
+                << rect.height << " at " << rect.x << ", " << rect.y;
+        }
+        if (stream_meta.is_color()) {
+            const int width = stream->stream_meta.intrinsics.width;
+            const int height = stream->stream_meta.intrinsics.height;
+            const VpxEncoderPreset preset =
+                get_vpx_encoder_preset(width, color_encoder_threads);
+            LOG_IF(INFO, options_.verbose)
+                << "Encoding " << stream->topic << " with " << preset.threads
+                << " threads, " << (1 << preset.log2_tile_columns)
+                << " tile columns, row_mt " << preset.row_mt;
+            const RateControl& rate_control =
+                stream->rate_controller->get_control();
+            stream->color_encoder =
+                ColorEncoder(width, height, options_.color_fps,
+                             rate_control.bitrate, /*lossless=*/false, preset);
+            stream->color_encoder.keyframe_period.set_period(
+                rate_control.keyframe_period);
+        }
+        if (stream_meta.is_depth()) {
+            const auto it = options_.serial_to_depth_filter.find(
+                std::string_view(stream_meta.id.serial_number));
+            const DepthFilterOptions& filter_options =
+                it != options_.serial_to_depth_filter.end()
+                    ? it->second
+                    : options_.depth_filter;
+            if (filter_options.enabled()) {
+                stream->depth_filter.emplace(filter_options,
+                                             stream->stream_meta.intrinsics,
+                                             stream_meta.depth_scale);
+                stream->stream_meta.intrinsics =
+                    stream->depth_filter->get_output_intrinsics();
+                LOG_IF(INFO, options_.verbose)
+                    << "Filtering " << stream->topic << ", published as "
+                    << stream->stream_meta.intrinsics;
+            }
+            stream->depth_encoder.keyframe_period.set_period(
+                stream->rate_controller->get_control().keyframe_period);
+        }
+
+        // a video frame that waits behind a few others is already too
+        // late to be worth encoding. motion samples are tiny and
+        // batched, so their queue is deeper.
+        stream->max_queued =
+            stream_meta.is_accel() || stream_meta.is_gyro() ? 31 : 3;
+        CHECK(id_to_stream_.emplace(stream_meta.id, stream.get()).second);
+        stream->stats.id = stream_meta.id;
+        stream->stats.queue_capacity = stream->max_queued;
+        CHECK(uid_to_stream_.emplace(uid, stream.get()).second);
+
+        // of the unfiltered frames, which the preview gets
+        if (options_.preview_width > 0 &&
+            (stream_meta.is_color() || stream_meta.is_depth())) {
+            auto preview = make_preview(stream_meta);
+            stream->preview = preview.get();
+            LOG_IF(INFO, options_.verbose)
+                << "Previewing " << stream->topic << " on " << preview->topic
+                << " at " << preview->stream_meta.intrinsics.width << "x"
+                << preview->stream_meta.intrinsics.height;
+            CHECK(id_to_stream_.emplace(preview->stream_meta.id, preview.get())
+                      .second);
+            streams_.push_back(std::move(preview));
+        }
+        streams_.push_back(std::move(stream));
+    }
+
+    // set phases of the encoders so that they don't all make
+    // keyframes at the same time
+    std::vector<ColorEncoder*> color_encoders;
+    std::vector<DepthEncoder*> depth_encoders;
+    for (auto& stream : streams_) {
+        if (stream->stream_meta.is_color()) {
+            color_encoders.push_back(&stream->color_encoder);
+        }
+        if (stream->stream_meta.is_depth()) {
+            depth_encoders.push_back(&stream->depth_encoder);
+        }
+    }
+    double color_encoder_base_phase = 0;
+    for (size_t i = 0; i < color_encoders.size(); ++i) {
+        auto& keyframe_period = color_encoders[i]->keyframe_period;
+        const double phase =
+            i * keyframe_period.get_period() / color_encoders.size();
+        if (i == 1) {
+            // save the base phase so we can use it during the depth
+            // encoder phase calcuation
+            color_encoder_base_phase = phase;
+        }
+        keyframe_period.set_phase(phase);
+    }
+    for (size_t i = 0; i < depth_encoders.size(); ++i) {
+        auto& keyframe_period = depth_encoders[i]->keyframe_period;
+        double phase = i * keyframe_period.get_period() / depth_encoders.size();
+        // perturb the phase so it doesn't line up with the color encoder phase
+        phase += color_encoder_base_phase / 2;
+        keyframe_period.set_phase(phase);
+    }
+
+    int num_threads = options_.num_threads;
+    if (num_threads <= 0) num_threads = num_cores;
+    // more workers than streams would never have work
+    num_threads =
+        std::min<int>(num_threads, std::max<int>(streams_.size(), 1));
+    LOG_IF(INFO, options_.verbose)
+        << "Encoding " << streams_.size() << " streams on "
+        << num_threads << " threads";
+    thread_pool_ = std::make_unique<SimpleThreadPool>(num_threads);
+    stats_window_start_us_ = get_process_time_us();
+}
+
+EncodePipeline::~EncodePipeline() {
+    stop();
+    thread_pool_.reset();
+}
+
+std::unique_ptr<EncodePipeline::Stream> EncodePipeline::make_preview(
+    const StreamMeta& stream_meta) {
+    auto preview = std::make_unique<Stream>();
+    preview->is_preview = true;
+    preview->stream_meta = stream_meta;
+    preview->stream_meta.id.preview = true;
+    preview->stream_meta.intrinsics = get_downscaled_intrinsics(
+        stream_meta.intrinsics, options_.preview_width);
+    preview->topic = get_topic(preview->stream_meta.id);
+
+    // previews get no feedback, their keyframes are small enough to
+    // send often, so a thumbnail recovers quickly
+    const Intrinsics& intrinsics = preview->stream_meta.intrinsics;
+    if (stream_meta.is_color()) {
+        preview->color_encoder = ColorEncoder(
+            intrinsics.width, intrinsics.height, options_.color_fps,
+            options_.preview_bitrate, /*lossless=*/false,
+            get_vpx_encoder_preset(intrinsics.width, /*num_threads=*/1));
+        preview->color_encoder.keyframe_period.set_period(1.0);
+        const int pixels_per_row = stream_meta.format == StreamFormat::YUYV
+                                       ? 2 * intrinsics.width
+                                       : 3 * intrinsics.width;
+        preview->preview_pixels.resize(pixels_per_row * intrinsics.height);
+    } else {
+        preview->depth_encoder.keyframe_period.set_period(1.0);
+        preview->preview_depth.resize(intrinsics.width * intrinsics.height);
+    }
+    preview->max_queued = 3;
+    preview->stats.id = preview->stream_meta.id;
+    preview->stats.queue_capacity = preview->max_queued;
+    return preview;
+}
+
+bool EncodePipeline::push(FrameData frame_data) {
+    if (stopped_) return false;
+    Stream& stream = *uid_to_stream_.at(frame_data.uid);
+    // rs2::frames are reference counted, so the copy shares the pixels
+    if (stream.preview) push(*stream.preview, frame_data);
+    return push(stream, std::move(frame_data));
+}
+
+bool EncodePipeline::push(Stream& stream, FrameData frame_data) {
+    {
+        std::lock_guard<std::mutex> lock{stream.mutex};
+        ++stream.stats.num_frames;
+        const int queue_size = stream.queue.num_slots_filled();
+        if (queue_size >= stream.max_queued) {
+            ++stream.stats.num_dropped;
+            LOG_IF(INFO, options_.verbose)
+                << "Dropping a frame of " << stream.topic;
+            return false;
+        }
+        CHECK(stream.queue.move_write(std::move(frame_data)));
+        stream.stats.max_queue_size =
+            std::max<int>(stream.stats.max_queue_size, queue_size + 1);
+        if (stream.draining) return true;
+        stream.draining = true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{drain_mutex_};
+        ++num_drain_jobs_;
+    }
+    thread_pool_->Push([this, &stream]() { drain(stream); });
+    return true;
+}
+
+void EncodePipeline::apply_feedback(const StreamFeedback& feedback) {
+    auto it = id_to_stream_.find(feedback.id);
+    if (it == id_to_stream_.end()) return;
+    Stream& stream = *it->second;
+
+    std::lock_guard<std::mutex> lock{stream.mutex};
+    if (!stream.rate_controller) return;
+    if (!stream.rate_controller->update(feedback, get_process_time_us())) {
+        return;
+    }
+    RateControl rate_control = stream.rate_controller->get_control();
+    if (stream.pending_rate_control) {
+        // a keyframe the drain job hasn't picked up yet is still owed
+        rate_control.force_keyframe |=
+            stream.pending_rate_control->force_keyframe;
+    }
+    stream.pending_rate_control = rate_control;
+    LOG_IF(INFO, options_.verbose)
+        << stream.topic << " bitrate " << rate_control.bitrate
+        << "kbps, keyframe period " << rate_control.keyframe_period
+        << "s, force keyframe " << rate_control.force_keyframe << " (missed "
+        << feedback.num_missed << ", decode latency "
+        << feedback.mean_decode_latency_us << "us)";
+}
+
+void EncodePipeline::stop() {
+    stopped_ = true;
+    std::unique_lock<std::mutex> lock{drain_mutex_};
+    drain_condition_.wait(lock, [this]() { return num_drain_jobs_ == 0; });
+}
+
+void EncodePipeline::drain(Stream& stream) {
+    while (!stopped_) {
+        FrameData frame_data;
+        std::optional<RateControl> rate_control;
+        {
+            std::lock_guard<std::mutex> lock{stream.mutex};
+            if (!stream.queue.move_read(frame_data, /*blocking=*/false)) {
+                stream.draining = false;
+                break;
+            }
+            std::swap(rate_control, stream.pending_rate_control);
+        }
+        if (rate_control) apply_rate_control(stream, *rate_control);
+
+        const uint64_t encode_start_us = get_process_time_us();
+        EncodeResult result;
+        const StreamType type = stream.stream_meta.id.type;
+        if (type == StreamType::COLOR) {
+            result = encode_color(stream, frame_data);
+        } else if (type == StreamType::DEPTH) {
+            result = encode_depth(stream, frame_data);
+        } else if (type == StreamType::ACCEL || type == StreamType::GYRO) {
+            result = encode_motion(stream, frame_data);
+        }
+        count_frame(stream, frame_data, encode_start_us, result);
+    }
+
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lock{drain_mutex_};
+        done = --num_drain_jobs_ == 0;
+    }
+    if (done) drain_condition_.notify_all();
+}
+
+void EncodePipeline::apply_rate_control(Stream& stream,
+                                        const RateControl& rate_control) {
+    if (stream.stream_meta.is_color()) {
+        auto& encoder = stream.color_encoder;
+        encoder.keyframe_period.set_period(rate_control.keyframe_period);
+        set_vpx_encoder_bitrate(encoder.encoder.get(), rate_control.bitrate);
+    } else if (stream.stream_meta.is_depth()) {
+        // depth is compressed losslessly, its keyframes are the only
+        // thing to adapt
+        stream.depth_encoder.keyframe_period.set_period(
+            rate_control.keyframe_period);
+    }
+    stream.force_keyframe |= rate_control.force_keyframe;
+}
+
+void EncodePipeline::downscale_color(Stream& stream, const rs2::frame& frame) {
+    auto& image = stream.color_encoder.buffer;
+    const int width = image->d_w;
+    const int height = image->d_h;
+    auto video_frame = frame.as<rs2::video_frame>();
+    const int frame_width = video_frame.get_width();
+    const int frame_height = video_frame.get_height();
+    const int frame_stride = video_frame.get_stride_in_bytes();
+    const uint8_t* data = (const uint8_t*)frame.get_data();
+    CHECK(frame.get_data_size() >= frame_stride * frame_height);
+
+    if (stream.stream_meta.format == StreamFormat::RGB8) {
+        downscale_box(frame_width, frame_height, data, frame_stride,
+                      /*channels=*/3, width, height,
+                      stream.preview_pixels.data(), 3 * width);
+        rgb24_yuv420_sseu(width, height, stream.preview_pixels.data(),
+                          3 * width, image->planes[VPX_PLANE_Y],
+                          image->planes[VPX_PLANE_U],
+                          image->planes[VPX_PLANE_V],
+                          image->stride[VPX_PLANE_Y],
+                          image->stride[VPX_PLANE_U], YCBCR_601);
+    } else if (stream.stream_meta.format == StreamFormat::YUYV) {
+        // a yuyv pair of pixels is one 4 channel pixel of half the
+        // width, so the pairs are averaged and stay yuyv
+        downscale_box(frame_width / 2, frame_height, data, frame_stride,
+                      /*channels=*/4, width / 2, height,
+                      stream.preview_pixels.data(), 2 * width);
+        yuyv_to_i420(width, height, stream.preview_pixels.data(), 2 * width,
+                     image->planes[VPX_PLANE_Y], image->planes[VPX_PLANE_U],
+                     image->planes[VPX_PLANE_V], image->stride[VPX_PLANE_Y],
+                     image->stride[VPX_PLANE_U]);
+    } else {
+        LOG(FATAL) << "Unsupported image format "
+                   << magic_enum::enum_name(stream.stream_meta.format);
+    }
+}
+
+EncodePipeline::EncodeResult EncodePipeline::encode_color(
+    Stream& stream, const FrameData& frame_data) {
+    const auto& frame = frame_data.frame;
+    const auto creation_timestamp_us = frame_data.creation_timestamp_us;
+
+    const StreamMeta& stream_meta = stream.stream_meta;
+    ColorEncoder& encoder = stream.color_encoder;
+
+    // unpack encoder variables
+    auto& encoder_image_buffer = encoder.buffer;
+    auto& video_encoder = encoder.encoder;
+    auto& keyframe_period = encoder.keyframe_period;
+
+    // encode this packet
+    const auto width = stream_meta.intrinsics.width;
+    const auto height = stream_meta.intrinsics.height;
+    CHECK(encoder_image_buffer->d_w == width);
+    CHECK(encoder_image_buffer->d_h == height);
+    CHECK(encoder_image_buffer->fmt == VPX_IMG_FMT_I420);
+
+    const uint8_t* rs_data = (const uint8_t*)frame.get_data();
+    const size_t rs_data_size = frame.get_data_size();
+    const int frame_width = stream.frame_width;
+    const int frame_height = stream.frame_height;
+
+    if (stream.is_preview) {
+        downscale_color(stream, frame);
+    } else if (stream_meta.format == StreamFormat::RGB8) {
+        auto video_frame = frame.as<rs2::video_frame>();
+        const int actual_width = video_frame.get_width();
+        const int actual_height = video_frame.get_height();
+        CHECK(actual_width == frame_width)
+            << "expected " << frame_width << "and got " << actual_width;
+        CHECK(actual_height == frame_height)
+            << "expected " << frame_height << " and got " << actual_height;
+
+        CHECK(rs_data_size == frame_width * frame_height * 3)
+            << "rs_data_size was " << rs_data_size << " and expected "
+            << frame_width * frame_height * 3;  // 3 bytes per pixel
+        // convert rgb8 into I420, the crop is only an offset into it
+        if (stream.roi) {
+            rs_data += (stream.roi->y * frame_width + stream.roi->x) * 3;
+        }
+        rgb24_yuv420_sseu(
+            width, height, rs_data,
+            /*rgb_stride=*/3 * frame_width,
+            encoder_image_buffer->planes[VPX_PLANE_Y],
+            encoder_image_buffer->planes[VPX_PLANE_U],
+            encoder_image_buffer->planes[VPX_PLANE_V],
+            encoder_image_buffer->stride[VPX_PLANE_Y],
+            /*uv_stride=*/
+            encoder_image_buffer->stride[VPX_PLANE_U], /*u stride == v_stride*/
+            YCBCR_601);
+    } else if (stream_meta.format == StreamFormat::YUYV) {
+        auto video_frame = frame.as<rs2::video_frame>();
+        CHECK(video_frame.get_width() == frame_width);
+        CHECK(video_frame.get_height() == frame_height);
+        const int yuyv_stride = video_frame.get_stride_in_bytes();
+        CHECK(rs_data_size >= yuyv_stride * frame_height)
+            << "rs_data_size was " << rs_data_size << " and expected "
+            << yuyv_stride * frame_height;
+        // the roi starts on an even pixel, ie a yuyv pair
+        if (stream.roi) {
+            rs_data += stream.roi->y * yuyv_stride + stream.roi->x * 2;
+        }
+        // the camera's own yuv only needs its chroma subsampled
+        yuyv_to_i420(width, height, rs_data, yuyv_stride,
+                     encoder_image_buffer->planes[VPX_PLANE_Y],
+                     encoder_image_buffer->planes[VPX_PLANE_U],
+                     encoder_image_buffer->planes[VPX_PLANE_V],
+                     encoder_image_buffer->stride[VPX_PLANE_Y],
+                     encoder_image_buffer->stride[VPX_PLANE_U]);
+    } else {
+        LOG(FATAL) << "Unsupported image format "
+                   << magic_enum::enum_name(stream_meta.format);
+    }
+
+    vpx_codec_iter_t iter = nullptr;
+    const vpx_codec_cx_pkt_t* pkt = nullptr;
+
+    // copied from google udpsample project
+    const unsigned int RECOVERY_FLAGS[] = {
+        0,                   //   NORMAL,
+        VPX_EFLAG_FORCE_KF,  //   KEY,
+        VP8_EFLAG_FORCE_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_REF_LAST |
+            VP8_EFLAG_NO_REF_ARF,  //   GOLD = 2,
+        VP8_EFLAG_FORCE_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_REF_LAST |
+            VP8_EFLAG_NO_REF_GF  //   ALTREF = 3
+    };
+    // const int NORMAL = 0;
+    const int KEY = 1;
+    // const int GOLD = 2;
+    // const int ALTREF = 3;
+
+    int flags = 0;
+    bool using_keyframe = keyframe_period.should_act();
+    if (stream.force_keyframe) {
+        using_keyframe = true;
+        stream.force_keyframe = false;
+    }
+    if (using_keyframe) {
+        flags = RECOVERY_FLAGS[KEY];
+        LOG_IF(INFO, options_.verbose)
+            << "Sending color keyframe for " << stream_meta.id;
+    }
+
+    // Quality arguments
+    // - VPX_DL_REALTIME
+    // - VPX_DL_GOOD_QUALITY
+    // - VPX_DL_BEST_QUALITY
+    const vpx_codec_err_t res =
+        vpx_codec_encode(video_encoder.get(), encoder_image_buffer.get(),
+                         /*pts=*/encoder.num_frames++,
+                         /*duration=*/1,
+                         /*flags=*/flags, VPX_DL_REALTIME);
+
+    CHECK(res == VPX_CODEC_OK) << vpx_codec_error(video_encoder.get());
+
+    while ((pkt = vpx_codec_get_cx_data(video_encoder.get(), &iter)) !=
+           nullptr) {
+        if (pkt->kind != VPX_CODEC_CX_FRAME_PKT) {
+            // the other packet kinds are irrelevant
+            // VPX_CODEC_CX_FRAME_PKT: Compressed video
+            // VPX_CODEC_STATS_PKT: Two-pass statistics
+            // VPX_CODEC_FPMB_STATS_PKT: first pass mb
+            // statistics VPX_CODEC_PSNR_PKT: PSNR statistics
+            // VPX_CODEC_CUSTOM_PKT = 256:  Algorithm extensions
+            continue;
+        }
+
+        // found the first VPX_CODEC_CX_FRAME_PKT
+        break;
+    }
+
+    // we break out of the previous loop since it seems like in realtime
+    // mode, every frame corresponds to exactly one packet. if the CHECK
+    // below triggers, it means the assumption is violated and we update the
+    // code to keep a vector of serialized messages
+    {
+        const vpx_codec_cx_pkt_t* next_pkt = nullptr;
+        next_pkt = vpx_codec_get_cx_data(video_encoder.get(), &iter);
+        CHECK(next_pkt == nullptr);
+    }
+    EncodeResult result;
+    result.encode_end_us = get_process_time_us();
+
+    if (pkt == nullptr) {
+        // the rate control dropped the frame to hold the bitrate. it
+        // takes no sequence id, so the client sees no gap, and a
+        // keyframe is still owed.
+        stream.force_keyframe |= using_keyframe;
+        result.dropped = true;
+        return result;
+    }
+
+    const auto sequence_id = encoder.sequence_id++;
+    pubsub::MessageFrames message_frames;
+    message_frames.add_simple(creation_timestamp_us);
+    message_frames.add_simple(sequence_id);
+    message_frames.add_simple(stream_meta);
+    message_frames.add_bytes(pkt);
+    result.message_size = message_frames.size();
+
+    pubsub::publish_frames(stream.topic, stream_message_version,
+                           std::move(message_frames), using_keyframe);
+    return result;
+}
+
+EncodePipeline::EncodeResult EncodePipeline::encode_depth(
+    Stream& stream, const FrameData& frame_data) {
+    const StreamMeta& stream_meta = stream.stream_meta;
+    const auto creation_timestamp_us = frame_data.creation_timestamp_us;
+    auto& encoder = stream.depth_encoder;
+    auto& depth_encoder = encoder.encoder;
+    const auto sequence_id = encoder.sequence_id++;
+    auto& buffer = encoder.buffer;
+    auto& keyframe_period = encoder.keyframe_period;
+
+    bool request_keyframe = keyframe_period.should_act();
+    if (stream.force_keyframe) {
+        request_keyframe = true;
+        stream.force_keyframe = false;
+    }
+    const int width = stream_meta.intrinsics.width;
+    const int height = stream_meta.intrinsics.height;
+
+    const uint16_t* depth = (const uint16_t*)frame_data.frame.get_data();
+    if (stream.is_preview) {
+        auto video_frame = frame_data.frame.as<rs2::video_frame>();
+        const int frame_width = video_frame.get_width();
+        const int frame_height = video_frame.get_height();
+        CHECK(frame_data.frame.get_data_size() ==
+              frame_width * frame_height * sizeof(uint16_t));
+        downscale_depth(frame_width, frame_height, depth, width, height,
+                        stream.preview_depth.data());
+        depth = stream.preview_depth.data();
+    } else {
+        const int expected_data_size =
+            stream.frame_width * stream.frame_height * sizeof(uint16_t);
+        if (expected_data_size != frame_data.frame.get_data_size()) {
+            LOG(INFO) << "Expected data size " << expected_data_size
+                      << ", actual " << frame_data.frame.get_data_size();
+            CHECK(!stream.depth_filter && !stream.roi)
+                << "Can't filter or crop " << stream.topic;
+        }
+        if (stream.roi) {
+            const RoiRect& rect = *stream.roi;
+            for (int y = 0; y < rect.height; ++y) {
+                const uint16_t* row =
+                    depth + (rect.y + y) * stream.frame_width + rect.x;
+                std::copy(row, row + rect.width,
+                          stream.roi_depth.begin() + y * rect.width);
+            }
+            depth = stream.roi_depth.data();
+        }
+        if (stream.depth_filter) depth = stream.depth_filter->process(depth);
+    }
+    depth_encoder.Compress(width, height, depth, buffer, request_keyframe);
+
+    const bool have_keyframe = zdepth::IsKeyFrame(buffer.data(), buffer.size());
+    if (request_keyframe) {
+        // sanity check
+        CHECK(have_keyframe);
+    }
+    EncodeResult result;
+    result.encode_end_us = get_process_time_us();
+
+    pubsub::MessageFrames message_frames;
+    message_frames.add_simple(creation_timestamp_us);
+    message_frames.add_simple(sequence_id);
+    message_frames.add_simple(stream_meta);
+    message_frames.add_bytes(buffer);
+    result.message_size = message_frames.size();
+
+    pubsub::publish_frames(stream.topic, stream_message_version,
+                           std::move(message_frames), have_keyframe);
+    return result;
+}
+
+EncodePipeline::EncodeResult EncodePipeline::encode_motion(
+    Stream& stream, const FrameData& frame_data) {
+    const auto creation_timestamp_us = frame_data.creation_timestamp_us;
+    const rs2_vector motion_data =
+        frame_data.frame.as<rs2::motion_frame>().get_motion_data();
+
+    auto& motion_encoder = stream.motion_encoder;
+    motion_encoder.timestamps_us.push_back(creation_timestamp_us);
+    motion_encoder.xyzs.push_back(motion_data.x);
+    motion_encoder.xyzs.push_back(motion_data.y);
+    motion_encoder.xyzs.push_back(motion_data.z);
+
+    EncodeResult result;
+    result.encode_end_us = get_process_time_us();
+    const auto first_timestamp_us = motion_encoder.timestamps_us.front();
+    if (creation_timestamp_us > first_timestamp_us + 1e6 * 0.033) {
+        pubsub::MessageFrames message_frames;
+        message_frames.add_simple(motion_encoder.sequence_id++);
+        message_frames.add_simple(stream.stream_meta);
+        message_frames.add_bytes(
+            reinterpret_span<std::byte>(motion_encoder.timestamps_us));
+        message_frames.add_bytes(
+            reinterpret_span<std::byte>(motion_encoder.xyzs));
+        result.message_size = message_frames.size();
+        pubsub::publish_frames(stream.topic, stream_message_version,
+                               std::move(message_frames));
+
+        motion_encoder.timestamps_us.clear();
+        motion_encoder.xyzs.clear();
+    }
+    return result;
+}
+
+void EncodePipeline::count_frame(Stream& stream,
+                                 const FrameData& frame_data,
+                                 uint64_t encode_start_us,
+                                 const EncodeResult& result) {
+    const uint64_t published_us = get_process_time_us();
+    {
+        std::lock_guard<std::mutex> lock(report_mutex_);
+        stream.fps_report.count();
+        if (result.message_size) bandwidth_report_.count(result.message_size);
+    }
+
+    std::lock_guard<std::mutex> lock(stream.mutex);
+    if (result.dropped) {
+        ++stream.stats.num_dropped;
+    } else {
+        ++stream.stats.num_encoded;
+    }
+    stream.queue_us.record(
+        clipped_minus(encode_start_us, frame_data.creation_timestamp_us));
+    stream.encode_us.record(
+        clipped_minus(result.encode_end_us, encode_start_us));
+    if (result.message_size) {
+        ++stream.stats.num_published;
+        stream.stats.num_published_bytes += result.message_size;
+        stream.publish_us.record(
+            clipped_minus(published_us, result.encode_end_us));
+        stream.total_us.record(
+            clipped_minus(published_us, frame_data.creation_timestamp_us));
+    }
+}
+
+namespace {
+
+StageLatency summarize(const LatencyHistogram& histogram) {
+    const auto to_us = [](uint64_t us) {
+        return uint32_t(std::min<uint64_t>(us, UINT32_MAX));
+    };
+    return {.p50_us = to_us(histogram.get_quantile(0.5)),
+            .p99_us = to_us(histogram.get_quantile(0.99)),
+            .max_us = to_us(histogram.get_max())};
+}
+
+}  // namespace
+
+std::vector<StreamStats> EncodePipeline::take_stats() {
+    std::lock_guard<std::mutex> stats_lock{stats_mutex_};
+    const uint64_t now_us = get_process_time_us();
+    const uint32_t window_ms = (now_us - stats_window_start_us_) / 1000;
+    stats_window_start_us_ = now_us;
+
+    std::vector<StreamStats> result;
+    for (auto& stream : streams_) {
+        std::lock_guard<std::mutex> lock{stream->mutex};
+        StreamStats stats = stream->stats;
+        stats.window_ms = window_ms;
+        stats.queue_size = stream->queue.num_slots_filled();
+        stats.queue = summarize(stream->queue_us);
+        stats.encode = summarize(stream->encode_us);
+        stats.publish = summarize(stream->publish_us);
+        stats.total = summarize(stream->total_us);
+        result.push_back(stats);
+
+        stream->stats = {.id = stats.id,
+                         .queue_size = stats.queue_size,
+                         .max_queue_size = stats.queue_size,
+                         .queue_capacity = stats.queue_capacity};
+        stream->queue_us.reset();
+        stream->encode_us.reset();
+        stream->publish_us.reset();
+        stream->total_us.reset();
+    }
+    return result;
+}
+
+void EncodePipeline::print_report(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(report_mutex_);
+    out << "\r\n";
+    out << "Bandwidth " << bandwidth_report_.get_frequency() / 1e6
+        << "MB/sec \n";
+    for (auto& stream : streams_) {
+        out << stream->stream_meta.id << "["
+            << stream->fps_report.get_frequency() << " fps";
+        if (stream->rate_controller && stream->stream_meta.is_color()) {
+            std::lock_guard<std::mutex> stream_lock{stream->mutex};
+            out << ", " << stream->rate_controller->get_control().bitrate
+                << " kbps";
+        }
+        out << " ]\n, ";
+    }
+}
+
+}  // namespace realsense_streaming
+}  // namespace axby
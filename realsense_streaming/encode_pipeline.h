@@ -0,0 +1,229 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "app/timing.h"
+#include "concurrency/ring_buffer.h"
+#include "depth_filter.h"
+#include "fast_resizable_vector/fast_resizable_vector.h"
+#include "math/latency_histogram.h"
+#include "messages.h"
+#include "rate_controller.h"
+#include "roi.h"
+#include "simple_thread_pool.h"
+#include "util.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+struct FrameData {
+    int uid = 0;
+    uint64_t creation_timestamp_us = 0;
+    rs2::frame frame;
+};
+
+struct MotionEncoder {
+    uint64_t sequence_id = 0;
+    FastResizableVector<uint64_t> timestamps_us;
+    FastResizableVector<float> xyzs;
+};
+
+// realsense/<type>/<serial>/<index>, or realsense_preview/.. for a
+// preview, so subscribing to the one prefix doesn't get the other
+std::string get_topic(const StreamId& stream_id);
+
+struct EncodePipelineOptions {
+    int color_fps = 30;
+    unsigned int color_bitrate = 72;  // kbps, the initial target
+
+    // adapts the bitrate and keyframe interval of the video streams
+    // to the StreamFeedback of their clients, see apply_feedback
+    RateControllerOptions rate_control;
+
+    // of the depth streams before they are compressed, by serial
+    // number of the camera, else depth_filter. a decimated stream is
+    // published with the intrinsics of the decimated frames.
+    DepthFilterOptions depth_filter;
+    absl::flat_hash_map<std::string, DepthFilterOptions>
+        serial_to_depth_filter;
+
+    // crops the color and depth streams to a part of the view, by
+    // stream id, else color_roi or depth_roi. depth is cropped before
+    // it is filtered. previews show the whole view.
+    Roi color_roi;
+    Roi depth_roi;
+    absl::flat_hash_map<StreamId, Roi> stream_to_roi;
+
+    // simulcast: if > 0, every color and depth stream also gets a copy
+    // downscaled to this width, eg 160 for 160x120 of 640x480, with
+    // its own encoder. for thumbnails, which then decode a fraction
+    // of the pixels and bytes.
+    int preview_width = 0;
+    unsigned int preview_bitrate = 24;  // kbps
+
+    // threads of each vp9 encoder, with tile columns and row based
+    // multithreading to match, see get_vpx_encoder_preset. if 0, the
+    // cores are split between the color streams.
+    int color_encoder_threads = 0;
+
+    // all cores if 0
+    int num_threads = 0;
+
+    bool verbose = false;
+};
+
+// compresses the frames of every stream of the server and publishes
+// them.
+//
+// each stream has its own small queue and encoder. a stream with
+// queued frames is drained by one job at a time on a shared thread
+// pool, so the frames of a stream are encoded in order, while
+// different streams, eg the color streams of four cameras, encode in
+// parallel on as many cores as there are.
+class EncodePipeline {
+   public:
+    EncodePipeline(
+        const absl::flat_hash_map<int, StreamMeta>& uid_to_stream_meta,
+        const EncodePipelineOptions& options);
+
+    // stops
+    ~EncodePipeline();
+
+    EncodePipeline(const EncodePipeline&) = delete;
+    EncodePipeline& operator=(const EncodePipeline&) = delete;
+
+    // called from the sensor callbacks. returns false if the frame was
+    // dropped, because the encoder of its stream is behind or the
+    // pipeline is stopped.
+    bool push(FrameData frame_data);
+
+    // thread safe. adapts the encoders of the stream to what its
+    // client gets, from the next frame. feedback on unknown streams
+    // is ignored.
+    void apply_feedback(const StreamFeedback& feedback);
+
+    // drops the queued frames and blocks until the frames being
+    // encoded are published. later pushes are dropped.
+    void stop();
+
+    // fps of every stream and the total bandwidth
+    void print_report(std::ostream& out);
+
+    // thread safe. counts and stage latencies of every stream since
+    // the last call, which starts the next window.
+    std::vector<StreamStats> take_stats();
+
+   private:
+    struct Stream {
+        StreamMeta stream_meta;
+        std::string topic;
+
+        // one of them, by stream type
+        ColorEncoder color_encoder;
+        DepthEncoder depth_encoder;
+        MotionEncoder motion_encoder;
+        std::optional<DepthFilter> depth_filter;
+
+        // the frames pushed, of frame_width x frame_height, are
+        // cropped to roi before they are encoded. depth through
+        // roi_depth.
+        std::optional<RoiRect> roi;
+        int frame_width = 0;
+        int frame_height = 0;
+        std::vector<uint16_t> roi_depth;
+
+        // of a full stream, which pushes a copy of its frames to it
+        Stream* preview = nullptr;
+
+        // a preview downscales the frames of the stream it previews,
+        // through these for color and depth
+        bool is_preview = false;
+        std::vector<uint8_t> preview_pixels;
+        std::vector<uint16_t> preview_depth;
+
+        std::mutex mutex;
+        RingBuffer<FrameData, 32> queue;
+        int max_queued = 0;
+
+        // whether a drain job is pushed or running. there is never
+        // more than one, which keeps the frames in order.
+        bool draining = false;
+
+        // of the video streams. the control is handed to the drain
+        // job, since only it may touch the encoder.
+        std::optional<RateController> rate_controller;
+        std::optional<RateControl> pending_rate_control;
+
+        // drain job only
+        bool force_keyframe = false;
+
+        // under mutex, since the last take_stats
+        StreamStats stats;
+        LatencyHistogram queue_us;
+        LatencyHistogram encode_us;
+        LatencyHistogram publish_us;
+        LatencyHistogram total_us;
+
+        // under report_mutex_
+        FrequencyCalculator fps_report;
+    };
+
+    // of a frame in the drain job
+    struct EncodeResult {
+        uint64_t encode_end_us = 0;
+
+        // 0 if nothing was published, eg motion samples that wait for
+        // the rest of their batch
+        size_t message_size = 0;
+
+        // by the rate control of the video encoder
+        bool dropped = false;
+    };
+
+    std::unique_ptr<Stream> make_preview(const StreamMeta& stream_meta);
+    bool push(Stream& stream, FrameData frame_data);
+    void drain(Stream& stream);
+    void apply_rate_control(Stream& stream, const RateControl& rate_control);
+    void downscale_color(Stream& stream, const rs2::frame& frame);
+    EncodeResult encode_color(Stream& stream, const FrameData& frame_data);
+    EncodeResult encode_depth(Stream& stream, const FrameData& frame_data);
+    EncodeResult encode_motion(Stream& stream, const FrameData& frame_data);
+    void count_frame(Stream& stream,
+                     const FrameData& frame_data,
+                     uint64_t encode_start_us,
+                     const EncodeResult& result);
+
+    const EncodePipelineOptions options_;
+    // the streams of the cameras and their previews
+    std::vector<std::unique_ptr<Stream>> streams_;
+    absl::flat_hash_map<int, Stream*> uid_to_stream_;
+    absl::flat_hash_map<StreamId, Stream*> id_to_stream_;
+
+    std::atomic<bool> stopped_ = false;
+
+    std::mutex drain_mutex_;
+    std::condition_variable drain_condition_;
+    int num_drain_jobs_ = 0;
+
+    std::mutex report_mutex_;
+    FrequencyCalculator bandwidth_report_;
+
+    std::mutex stats_mutex_;
+    uint64_t stats_window_start_us_ = 0;
+
+    // last, so the workers are joined before the streams are destroyed
+    std::unique_ptr<SimpleThreadPool> thread_pool_;
+};
+
+}  // namespace realsense_streaming
+}  // namespace axby
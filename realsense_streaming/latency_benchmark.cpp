@@ -0,0 +1,350 @@
+// measures the latency of the realsense streaming pipeline from
+// capture to a colored point cloud, ie what a viewer would show: the
+// server stages of the encode pipeline, the time until a frame is
+// decoded by the client, the point cloud, and the total. the server,
+// with synthetic cameras, and the client run in this process and talk
+// over the inproc transport of pubsub, so every stage is timed on the
+// same clock, through creation_timestamp_us. runs every combination
+// of the camera counts, sizes and color bitrates, eg
+//   bazel run -c opt //realsense_streaming:latency_benchmark --
+//   --cameras=1,4 --sizes=small --bitrates=72,500
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "app/flag.h"
+#include "app/main.h"
+#include "app/pubsub.h"
+#include "app/timing.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "math/latency_histogram.h"
+#include "network_config/config.h"
+#include "realsense_streaming/client.h"
+#include "realsense_streaming/encode_pipeline.h"
+#include "realsense_streaming/pointcloud_job.h"
+#include "realsense_streaming/synthetic_device.h"
+#include "realsense_streaming/util.h"
+
+APP_FLAG(std::string, cameras, "1,2,4", "numbers of synthetic cameras");
+APP_FLAG(std::string,
+         sizes,
+         "small,large",
+         "of the color and depth streams, small=640x480, large=1280x720");
+APP_FLAG(std::string, bitrates, "72,500", "kbps of the color streams");
+APP_FLAG(std::string, color_format, "rgb8", "rgb8 or yuyv");
+APP_FLAG(int, fps, 30, "of the color and depth streams");
+APP_FLAG(double, seconds, 10, "measured per run");
+APP_FLAG(double,
+         warmup_seconds,
+         2,
+         "per run before measuring, for the first keyframes and the "
+         "encoders to settle");
+APP_FLAG(double, motion, 1, "speed of the synthetic scene");
+APP_FLAG(int, num_encode_threads, 0, "all cores if 0");
+
+using namespace axby;
+using namespace realsense_streaming;
+
+namespace {
+
+// of every run
+struct BenchmarkOptions {
+    double seconds = 10;
+    double warmup_seconds = 2;
+    double motion = 1;
+    int num_encode_threads = 0;
+};
+
+struct RunConfig {
+    int num_cameras = 1;
+    std::string size;
+    int bitrate = 72;
+};
+
+struct RunResult {
+    // worst of the streams of a type, from the stats of the encode
+    // pipeline
+    StageLatency color_encode;
+    StageLatency depth_encode;
+    StageLatency server_total;
+    uint64_t num_frames = 0;
+    uint64_t num_dropped = 0;
+
+    // from capture until the client has decoded the frame
+    LatencyHistogram color_decoded_us;
+    LatencyHistogram depth_decoded_us;
+
+    // of the point cloud of each new depth frame with the latest color
+    // frame, and from the capture of the older of the two until the
+    // point cloud is done
+    LatencyHistogram pointcloud_us;
+    LatencyHistogram total_us;
+};
+
+std::vector<int> parse_ints(const std::string& flag) {
+    std::vector<int> values;
+    for (const auto& part : absl::StrSplit(flag, ',')) {
+        int value = 0;
+        CHECK(absl::SimpleAtoi(part, &value)) << "Bad number " << part
+                                              << " in " << flag;
+        values.push_back(value);
+    }
+    return values;
+}
+
+void set_size(const std::string& size, DesiredSettings& settings) {
+    if (size == "small") {
+        settings.color_width = settings.depth_width = 640;
+        settings.color_height = settings.depth_height = 480;
+    } else if (size == "large") {
+        settings.color_width = settings.depth_width = 1280;
+        settings.color_height = settings.depth_height = 720;
+    } else {
+        LOG(FATAL) << "Unsupported size " << size;
+    }
+}
+
+void take_worst(const StageLatency& latency, StageLatency& worst) {
+    worst.p50_us = std::max(worst.p50_us, latency.p50_us);
+    worst.p99_us = std::max(worst.p99_us, latency.p99_us);
+    worst.max_us = std::max(worst.max_us, latency.max_us);
+}
+
+void add_server_stats(const std::vector<StreamStats>& all_stats,
+                      RunResult& result) {
+    for (const StreamStats& stats : all_stats) {
+        if (stats.id.type == StreamType::COLOR) {
+            take_worst(stats.encode, result.color_encode);
+        } else if (stats.id.type == StreamType::DEPTH) {
+            take_worst(stats.encode, result.depth_encode);
+        } else {
+            continue;
+        }
+        take_worst(stats.total, result.server_total);
+        result.num_frames += stats.num_frames;
+        result.num_dropped += stats.num_dropped;
+    }
+}
+
+// the client outlives the runs. the streams of a run restart their
+// sequence ids, which the client decodes from the next keyframe, and
+// frames of earlier runs are told apart by their creation time.
+RunResult run_benchmark(
+    const BenchmarkOptions& options,
+    const RunConfig& run_config,
+    const DesiredSettings& settings,
+    absl::flat_hash_map<SerialNumber, client::RealsenseState>&
+        serial_to_realsense_state) {
+    RunResult result;
+    SyntheticCameras synthetic(
+        settings, SyntheticCameraOptions{.num_cameras = run_config.num_cameras,
+                                         .motion = options.motion});
+    const std::vector<DeviceConfiguration>& configs =
+        synthetic.get_device_configurations();
+
+    absl::flat_hash_map<int, StreamMeta> uid_to_stream_meta;
+    for (const DeviceConfiguration& config : configs) {
+        uid_to_stream_meta[config.accel_profile.unique_id()] =
+            config.accel_stream_meta;
+        uid_to_stream_meta[config.color_profile.unique_id()] =
+            config.color_stream_meta;
+        uid_to_stream_meta[config.depth_profile.unique_id()] =
+            config.depth_stream_meta;
+        uid_to_stream_meta[config.gyro_profile.unique_id()] =
+            config.gyro_stream_meta;
+    }
+
+    EncodePipeline encode_pipeline(
+        uid_to_stream_meta,
+        {.color_fps = settings.color_fps,
+         .color_bitrate = (unsigned int)run_config.bitrate,
+         .num_threads = options.num_encode_threads});
+
+    std::vector<OpenSensor> open_sensors;
+    for (const DeviceConfiguration& config : configs) {
+        const auto sensor_idx_to_profiles =
+            config.make_sensor_idx_to_profiles();
+        for (uint16_t sensor_idx = 0; sensor_idx < config.sensors.size();
+             ++sensor_idx) {
+            open_sensors.emplace_back(config.sensors[sensor_idx],
+                                      sensor_idx_to_profiles.at(sensor_idx));
+        }
+    }
+    for (auto& open_sensor : open_sensors) {
+        open_sensor.start([&encode_pipeline](rs2::frame frame) {
+            const int uid = get_profile_uid_from_frame(frame.get());
+            encode_pipeline.push(
+                {.uid = uid,
+                 .creation_timestamp_us = get_process_time_us(),
+                 .frame = std::move(frame)});
+        });
+    }
+
+    const uint64_t start_us = get_process_time_us();
+    const uint64_t measure_start_us =
+        start_us + uint64_t(options.warmup_seconds * 1e6);
+    const uint64_t end_us = measure_start_us + uint64_t(options.seconds * 1e6);
+    synthetic.start();
+
+    FastResizableVector<float> xyzs;
+    FastResizableVector<uint8_t> rgbs;
+    ActionPeriod refresh_list_period{0.25};
+    bool measuring = false;
+    uint64_t now_us = start_us;
+    while (now_us < end_us) {
+        if (!measuring && now_us >= measure_start_us) {
+            // starts the window of the server stats
+            encode_pipeline.take_stats();
+            measuring = true;
+        }
+        if (refresh_list_period.should_act()) {
+            client::update_realsense_list(serial_to_realsense_state);
+        }
+
+        for (auto& [serial, state] : serial_to_realsense_state) {
+            const auto did_update = client::update_realsense_state(state);
+            now_us = get_process_time_us();
+            const uint64_t color_us = state.color.creation_timestamp_us;
+            const uint64_t depth_us = state.depth.creation_timestamp_us;
+            if (did_update.color && color_us >= measure_start_us) {
+                result.color_decoded_us.record(now_us - color_us);
+            }
+            if (!did_update.depth || depth_us < measure_start_us) continue;
+            result.depth_decoded_us.record(now_us - depth_us);
+
+            // the color frame has to be of this run too
+            if (color_us < start_us) continue;
+            make_rgb_pointcloud(state.color, state.depth, xyzs, rgbs);
+            const uint64_t done_us = get_process_time_us();
+            result.pointcloud_us.record(done_us - now_us);
+            result.total_us.record(done_us - std::min(color_us, depth_us));
+        }
+
+        // polls, like a render loop, at a small fraction of a frame
+        sleep_us(250);
+        now_us = get_process_time_us();
+    }
+
+    add_server_stats(encode_pipeline.take_stats(), result);
+
+    synthetic.stop();
+    encode_pipeline.stop();
+    return result;
+}
+
+std::string format_ms(uint64_t p50_us, uint64_t p99_us) {
+    return absl::StrFormat("%5.1f %5.1f", p50_us / 1e3, p99_us / 1e3);
+}
+
+std::string format_ms(const StageLatency& latency) {
+    return format_ms(latency.p50_us, latency.p99_us);
+}
+
+std::string format_ms(const LatencyHistogram& histogram) {
+    return format_ms(histogram.get_quantile(0.5),
+                     histogram.get_quantile(0.99));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    __APP_MAIN_INIT__;
+
+    APP_UNPACK_FLAG(cameras);
+    APP_UNPACK_FLAG(sizes);
+    APP_UNPACK_FLAG(bitrates);
+    APP_UNPACK_FLAG(color_format);
+    APP_UNPACK_FLAG(fps);
+    APP_UNPACK_FLAG(seconds);
+    APP_UNPACK_FLAG(warmup_seconds);
+    APP_UNPACK_FLAG(motion);
+    APP_UNPACK_FLAG(num_encode_threads);
+
+    CHECK_GT(seconds, 0);
+    CHECK_GE(warmup_seconds, 0);
+    const BenchmarkOptions options{.seconds = seconds,
+                                   .warmup_seconds = warmup_seconds,
+                                   .motion = motion,
+                                   .num_encode_threads = num_encode_threads};
+
+    DesiredSettings settings;
+    settings.color_fps = fps;
+    settings.depth_fps = fps;
+    if (color_format == "rgb8") {
+        settings.color_format = StreamFormat::RGB8;
+    } else if (color_format == "yuyv") {
+        settings.color_format = StreamFormat::YUYV;
+    } else {
+        LOG(FATAL) << "Unsupported color format " << color_format;
+    }
+
+    std::vector<RunConfig> run_configs;
+    for (int num_cameras : parse_ints(cameras)) {
+        for (const auto& size : absl::StrSplit(sizes, ',')) {
+            for (int bitrate : parse_ints(bitrates)) {
+                CHECK_GT(num_cameras, 0);
+                run_configs.push_back({.num_cameras = num_cameras,
+                                       .size = std::string(size),
+                                       .bitrate = bitrate});
+            }
+        }
+    }
+
+    // inproc only, the client connects to no server and sends no
+    // feedback, so the encoders keep their bitrate. at the low
+    // bitrates the vp9 rate control drops frames, which count in the
+    // drop % but are never published.
+    pubsub::init();
+    client::init(network_config::Config{});
+    absl::flat_hash_map<SerialNumber, client::RealsenseState>
+        serial_to_realsense_state;
+
+    std::vector<RunResult> results;
+    for (const RunConfig& run_config : run_configs) {
+        LOG(INFO) << "Running " << run_config.num_cameras << " cameras, "
+                  << run_config.size << ", " << run_config.bitrate
+                  << " kbps";
+        set_size(run_config.size, settings);
+        results.push_back(
+            run_benchmark(options, run_config, settings,
+                          serial_to_realsense_state));
+    }
+
+    // p50 and p99 in ms
+    LOG(INFO) << absl::StrFormat(
+        "%4s %-5s %5s | %-11s | %-11s | %-11s | %-11s | %-11s | %-11s | "
+        "%-11s | %6s",
+        "cams", "size", "kbps", "color enc", "depth enc", "server",
+        "color dec", "depth dec", "cloud", "total", "drop %");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const RunConfig& run_config = run_configs[i];
+        const RunResult& result = results[i];
+        const double drop_percent =
+            result.num_frames
+                ? 100.0 * result.num_dropped / result.num_frames
+                : 0;
+        LOG(INFO) << absl::StrFormat(
+            "%4d %-5s %5d | %s | %s | %s | %s | %s | %s | %s | %6.2f",
+            run_config.num_cameras, run_config.size, run_config.bitrate,
+            format_ms(result.color_encode), format_ms(result.depth_encode),
+            format_ms(result.server_total),
+            format_ms(result.color_decoded_us),
+            format_ms(result.depth_decoded_us),
+            format_ms(result.pointcloud_us), format_ms(result.total_us),
+            drop_percent);
+        LOG_IF(WARNING, result.total_us.get_count() == 0)
+            << "No point clouds were made in the run, is the client "
+               "getting frames?";
+    }
+
+    client::cleanup();
+    pubsub::cleanup();
+    return 0;
+}
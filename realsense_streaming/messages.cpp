@@ -1,9 +1,29 @@
 #include "messages.h"
 
+#include <cstddef>
+#include <cstring>
 #include <magic_enum.hpp>
 
+#include "debug/check.h"
+
 namespace axby {
 namespace realsense_streaming {
+
+StreamMeta parse_stream_meta(Seq<const std::byte> bytes) {
+    // version 0 ended before roi_offset
+    constexpr size_t version_0_size = offsetof(StreamMeta, roi_offset);
+    if (bytes.size() == sizeof(StreamMeta)) {
+        return seq_bit_cast<StreamMeta>(bytes);
+    }
+    CHECK_EQ(bytes.size(), version_0_size) << "Unsupported StreamMeta";
+    StreamMeta stream_meta;
+    std::memcpy((void*)&stream_meta, bytes.data(), version_0_size);
+    // StreamId::preview is where version 0 had padding, so whatever
+    // the sender left there
+    stream_meta.id.preview = false;
+    return stream_meta;
+}
+
 std::ostream& operator<<(std::ostream& os, const StreamMeta& streamMeta) {
     os << "Stream ID: " << streamMeta.id << ", "
        << "Name: " << streamMeta.device_name << ", "
@@ -13,6 +33,10 @@ std::ostream& operator<<(std::ostream& os, const StreamMeta& streamMeta) {
     if (streamMeta.id.type == StreamType::DEPTH ||
         streamMeta.id.type == StreamType::COLOR) {
         os << "\n\tIntrinsics: " << streamMeta.intrinsics;
+        if (streamMeta.roi_offset != std::array<int32_t, 2>{0, 0}) {
+            os << "\n\tRoi offset: " << streamMeta.roi_offset[0] << ", "
+               << streamMeta.roi_offset[1];
+        }
     }
 
     return os;
@@ -21,7 +45,26 @@ std::ostream& operator<<(std::ostream& os, const StreamMeta& streamMeta) {
 std::ostream& operator<<(std::ostream& os, const StreamId& streamId) {
     os << "(Serial: " << streamId.serial_number << ", "
        << "Index: " << streamId.index << ", "
-       << "Type: " << magic_enum::enum_name(streamId.type) << ")";
+       << "Type: " << magic_enum::enum_name(streamId.type)
+       << (streamId.preview ? ", Preview" : "") << ")";
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const StreamStats& stats) {
+    const auto print_stage = [&os](const char* name,
+                                   const StageLatency& latency) {
+        os << ", " << name << " " << latency.p50_us / 1e3 << "/"
+           << latency.p99_us / 1e3 << "/" << latency.max_us / 1e3;
+    };
+    os << stats.id << " " << stats.num_frames << " frames, "
+       << stats.num_dropped << " dropped, " << stats.num_published
+       << " published, queue " << stats.queue_size << " (max "
+       << stats.max_queue_size << " of " << stats.queue_capacity
+       << "), p50/p99/max ms";
+    print_stage("queue", stats.queue);
+    print_stage("encode", stats.encode);
+    print_stage("publish", stats.publish);
+    print_stage("total", stats.total);
     return os;
 }
 
@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "fast_resizable_vector/fast_resizable_vector.h"
+#include "seq/seq.h"
 #include "serialization/small_string.h"
 
 namespace axby {
@@ -26,6 +27,7 @@ enum class StreamFormat : uint8_t {
     Z16,
     RGB8,
     MOTION_XYZ32F,
+    YUYV,
 };
 
 using SerialNumber = SmallString<24>;
@@ -34,6 +36,8 @@ using DeviceName = SmallString<24>;
 struct StreamId {
     SerialNumber serial_number;
     StreamType type = StreamType::INVALID;
+    // a downscaled copy of the stream, see EncodePipelineOptions
+    bool preview = false;
     int index = 0;
 
     bool is_depth() const { return type == StreamType::DEPTH; }
@@ -43,14 +47,14 @@ struct StreamId {
 };
 
 inline bool operator==(const StreamId& a, const StreamId& b) {
-    return std::tuple(a.serial_number, a.type, a.index) ==
-           std::tuple(b.serial_number, b.type, b.index);
+    return std::tuple(a.serial_number, a.type, a.preview, a.index) ==
+           std::tuple(b.serial_number, b.type, b.preview, b.index);
 }
 
 template <typename H>
 H AbslHashValue(H h, const StreamId& m) {
     return H::combine(std::move(h), std::string_view(m.serial_number), m.type,
-                      m.index);
+                      m.preview, m.index);
 };
 
 struct Intrinsics {
@@ -77,12 +81,26 @@ struct StreamMeta {
                                              // matrix, column major
     float depth_scale = 0;
 
+    // where the frames are in the frames of the sensor, in its pixels,
+    // if they are cropped to a region of interest. the intrinsics are
+    // of the cropped frames.
+    std::array<int32_t, 2> roi_offset = {0, 0};
+
     bool is_depth() const { return id.is_depth(); }
     bool is_color() const { return id.is_color(); }
     bool is_gyro() const { return id.is_gyro(); }
     bool is_accel() const { return id.is_accel(); }
 };
 
+// of the color, depth and motion messages, which carry a StreamMeta.
+// 1 added StreamMeta::roi_offset.
+constexpr uint16_t stream_message_version = 1;
+
+// of the StreamMeta of a message or log of any version, so older
+// recordings and servers still work. the fields added since keep their
+// defaults.
+StreamMeta parse_stream_meta(Seq<const std::byte> bytes);
+
 inline bool operator==(const StreamMeta& a, const StreamMeta& b) {
     if (a.id != b.id) return false;
     if (a.device_name != b.device_name) return false;
@@ -90,13 +108,80 @@ inline bool operator==(const StreamMeta& a, const StreamMeta& b) {
     if (a.intrinsics != b.intrinsics) return false;
     if (a.extrinsics != b.extrinsics) return false;
     if (a.depth_scale != b.depth_scale) return false;
+    if (a.roi_offset != b.roi_offset) return false;
     return true;
 }
 
+// what a client got of a video stream over the last window. clients
+// publish it on feedback_topic every window, also when nothing arrived,
+// the back channel the server adapts the encoders of the stream to the
+// link with. the server binds it, so any number of clients connect.
+struct StreamFeedback {
+    StreamId id;
+    uint32_t window_ms = 0;
+
+    uint32_t num_received = 0;
+    uint64_t num_received_bytes = 0;
+
+    // sequence ids that never arrived, ie lost on the way or dropped
+    // by the server
+    uint32_t num_missed = 0;
+
+    // received but not decoded, because the decoder waited for a
+    // keyframe or failed
+    uint32_t num_not_decoded = 0;
+
+    // from receiving a packet to having it decoded
+    uint32_t mean_decode_latency_us = 0;
+    uint32_t max_decode_latency_us = 0;
+};
+
+constexpr std::string_view feedback_topic = "realsense_feedback";
+
+// of one stage of the server over a stats window
+struct StageLatency {
+    uint32_t p50_us = 0;
+    uint32_t p99_us = 0;
+    uint32_t max_us = 0;
+};
+
+// what the server did with the frames of a stream over the last
+// window. the server publishes them on stats_topic.
+struct StreamStats {
+    StreamId id;
+    uint32_t window_ms = 0;
+
+    // handed over by the sensor callback, and of those dropped because
+    // the encoder of the stream was behind, or by the rate control of
+    // the video encoder
+    uint32_t num_frames = 0;
+    uint32_t num_dropped = 0;
+
+    uint32_t num_encoded = 0;
+
+    // messages, which batch the motion samples
+    uint32_t num_published = 0;
+    uint64_t num_published_bytes = 0;
+
+    // frames waiting to be encoded, now and at most over the window
+    uint16_t queue_size = 0;
+    uint16_t max_queue_size = 0;
+    uint16_t queue_capacity = 0;
+
+    StageLatency queue;    // sensor callback to encode start
+    StageLatency encode;   // encode start to end
+    StageLatency publish;  // encode end to handed to the publisher
+    StageLatency total;    // sensor callback to handed to the publisher
+};
+
+constexpr std::string_view stats_topic = "realsense_stats";
+
 std::ostream& operator<<(std::ostream& os, const StreamMeta& streamMeta);
 
 std::ostream& operator<<(std::ostream& os, const StreamId& streamId);
 
+std::ostream& operator<<(std::ostream& os, const StreamStats& stats);
+
 std::ostream& operator<<(std::ostream& os, const Intrinsics& intrinsics);
 
 }  // namespace realsense_streaming
@@ -8,6 +8,12 @@
 namespace axby {
 namespace realsense_streaming {
 
+// colored pointcloud of a depth frame, in the color camera frame
+void make_rgb_pointcloud(const client::ColorData& color,
+                         const client::DepthData& depth,
+                         FastResizableVector<float>& xyzs_out,
+                         FastResizableVector<uint8_t>& rgbs_out);
+
 class PointCloudJob {
    public:
     PointCloudJob(std::shared_ptr<SimpleThreadPool> thread_pool);
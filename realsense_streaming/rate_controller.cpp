@@ -0,0 +1,75 @@
+#include "rate_controller.h"
+
+#include <algorithm>
+
+#include "debug/check.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+RateController::RateController(unsigned int initial_bitrate,
+                               const RateControllerOptions& options)
+    : options_(options) {
+    CHECK_LE(options_.min_bitrate, options_.max_bitrate);
+    CHECK_GT(options_.min_keyframe_period, 0);
+    CHECK_LE(options_.min_keyframe_period, options_.max_keyframe_period);
+    control_.bitrate = std::clamp(initial_bitrate, options_.min_bitrate,
+                                  options_.max_bitrate);
+    control_.keyframe_period = options_.max_keyframe_period;
+}
+
+bool RateController::update(const StreamFeedback& feedback, uint64_t now_us) {
+    if (feedback.window_ms == 0) return false;
+    const double window_sec = feedback.window_ms / 1e3;
+    const RateControl previous = control_;
+    control_.force_keyframe = false;
+
+    const bool lost = feedback.num_missed > 0;
+    const bool behind =
+        feedback.mean_decode_latency_us > options_.max_decode_latency_us;
+    // the client published on its timer but nothing got through, the
+    // link is stalled. whatever was lost is counted once it recovers.
+    const bool stalled = feedback.num_received == 0;
+    if (lost || behind || stalled) {
+        const bool holding =
+            last_decrease_us_ &&
+            now_us < *last_decrease_us_ + options_.decrease_hold_sec * 1e6;
+        if (!holding) {
+            control_.bitrate = std::max<unsigned int>(
+                control_.bitrate * options_.bitrate_decrease_factor,
+                options_.min_bitrate);
+            last_decrease_us_ = now_us;
+        }
+    } else {
+        control_.bitrate = std::min<unsigned int>(
+            control_.bitrate + options_.bitrate_increase_per_sec * window_sec,
+            options_.max_bitrate);
+    }
+
+    if (lost) {
+        control_.keyframe_period = options_.min_keyframe_period;
+
+        // the client waits for a keyframe after a loss. don't send
+        // them more often than the shortest keyframe interval though,
+        // keyframes are what congests the link the most.
+        if (!last_forced_keyframe_us_ ||
+            now_us >= *last_forced_keyframe_us_ +
+                          options_.min_keyframe_period * 1e6) {
+            control_.force_keyframe = true;
+            last_forced_keyframe_us_ = now_us;
+        }
+    } else {
+        // grows back to the max over a few seconds of clean feedback
+        control_.keyframe_period = std::min(
+            control_.keyframe_period +
+                options_.min_keyframe_period * window_sec,
+            options_.max_keyframe_period);
+    }
+
+    return control_.bitrate != previous.bitrate ||
+           control_.keyframe_period != previous.keyframe_period ||
+           control_.force_keyframe;
+}
+
+}  // namespace realsense_streaming
+}  // namespace axby
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "messages.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+struct RateControllerOptions {
+    // bounds of the color bitrate, kbps
+    unsigned int min_bitrate = 64;
+    unsigned int max_bitrate = 2000;
+
+    // additive increase per second of feedback without congestion,
+    // and multiplicative decrease on congestion
+    double bitrate_increase_per_sec = 100;
+    double bitrate_decrease_factor = 0.7;
+
+    // a loss is usually reported in a few windows in a row, which
+    // should only back off once
+    double decrease_hold_sec = 1.0;
+
+    // a stream whose client takes longer than this to decode is
+    // treated as congested, since its queue grows
+    uint32_t max_decode_latency_us = 100000;
+
+    // bounds of the keyframe interval, seconds. on loss the interval
+    // drops to the min so the client resyncs sooner, and grows back
+    // to the max while the link is clean.
+    double min_keyframe_period = 0.5;
+    double max_keyframe_period = 2.0;
+};
+
+struct RateControl {
+    unsigned int bitrate = 0;  // kbps, only used by color streams
+    double keyframe_period = 0;
+
+    // the client lost its reference frames, so waiting for the next
+    // periodic keyframe would stall the stream
+    bool force_keyframe = false;
+};
+
+// additive increase, multiplicative decrease of the bitrate of a
+// stream from the StreamFeedback of its client, and the same for its
+// keyframe interval. not thread safe.
+class RateController {
+   public:
+    RateController(unsigned int initial_bitrate,
+                   const RateControllerOptions& options);
+
+    // returns whether the control changed, in which case it should be
+    // applied to the encoder. now_us is the process time.
+    bool update(const StreamFeedback& feedback, uint64_t now_us);
+
+    const RateControl& get_control() const { return control_; }
+
+   private:
+    const RateControllerOptions options_;
+    RateControl control_;
+
+    std::optional<uint64_t> last_decrease_us_;
+    std::optional<uint64_t> last_forced_keyframe_us_;
+};
+
+}  // namespace realsense_streaming
+}  // namespace axby
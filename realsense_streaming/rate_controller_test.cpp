@@ -0,0 +1,138 @@
+#include "realsense_streaming/rate_controller.h"
+
+#include "gtest/gtest.h"
+
+using namespace axby;
+using namespace realsense_streaming;
+
+namespace {
+
+StreamFeedback make_clean_feedback() {
+    StreamFeedback feedback;
+    feedback.window_ms = 500;
+    feedback.num_received = 15;
+    feedback.mean_decode_latency_us = 5000;
+    return feedback;
+}
+
+StreamFeedback make_lossy_feedback() {
+    StreamFeedback feedback = make_clean_feedback();
+    feedback.num_missed = 3;
+    return feedback;
+}
+
+}  // namespace
+
+TEST(RateController, initial_bitrate_is_clamped) {
+    RateControllerOptions options;
+    options.min_bitrate = 100;
+    options.max_bitrate = 1000;
+    EXPECT_EQ(RateController(10, options).get_control().bitrate, 100);
+    EXPECT_EQ(RateController(5000, options).get_control().bitrate, 1000);
+    EXPECT_EQ(RateController(500, options).get_control().keyframe_period,
+              options.max_keyframe_period);
+}
+
+TEST(RateController, clean_feedback_increases_to_max) {
+    RateControllerOptions options;
+    options.max_bitrate = 1000;
+    options.bitrate_increase_per_sec = 100;
+    RateController controller(500, options);
+
+    uint64_t now_us = 0;
+    EXPECT_TRUE(controller.update(make_clean_feedback(), now_us));
+    EXPECT_EQ(controller.get_control().bitrate, 550);
+    EXPECT_FALSE(controller.get_control().force_keyframe);
+
+    for (int i = 0; i < 100; ++i) {
+        now_us += 500000;
+        controller.update(make_clean_feedback(), now_us);
+    }
+    EXPECT_EQ(controller.get_control().bitrate, 1000);
+    EXPECT_FALSE(controller.update(make_clean_feedback(), now_us + 500000));
+}
+
+TEST(RateController, loss_decreases_once_per_hold) {
+    RateControllerOptions options;
+    options.bitrate_decrease_factor = 0.5;
+    options.decrease_hold_sec = 1.0;
+    RateController controller(1000, options);
+
+    EXPECT_TRUE(controller.update(make_lossy_feedback(), 0));
+    EXPECT_EQ(controller.get_control().bitrate, 500);
+
+    // still the same loss
+    controller.update(make_lossy_feedback(), 500000);
+    EXPECT_EQ(controller.get_control().bitrate, 500);
+
+    controller.update(make_lossy_feedback(), 1000000);
+    EXPECT_EQ(controller.get_control().bitrate, 250);
+
+    for (int i = 0; i < 20; ++i) {
+        controller.update(make_lossy_feedback(), 1000000 * (i + 2));
+    }
+    EXPECT_EQ(controller.get_control().bitrate, options.min_bitrate);
+}
+
+TEST(RateController, slow_decoding_decreases_without_keyframes) {
+    RateControllerOptions options;
+    RateController controller(1000, options);
+
+    StreamFeedback feedback = make_clean_feedback();
+    feedback.mean_decode_latency_us = options.max_decode_latency_us + 1;
+    EXPECT_TRUE(controller.update(feedback, 0));
+    EXPECT_LT(controller.get_control().bitrate, 1000);
+    EXPECT_FALSE(controller.get_control().force_keyframe);
+    EXPECT_EQ(controller.get_control().keyframe_period,
+              options.max_keyframe_period);
+}
+
+TEST(RateController, stalled_window_decreases) {
+    RateControllerOptions options;
+    RateController controller(1000, options);
+
+    StreamFeedback feedback;
+    feedback.window_ms = 500;
+    EXPECT_TRUE(controller.update(feedback, 0));
+    EXPECT_LT(controller.get_control().bitrate, 1000);
+    EXPECT_FALSE(controller.get_control().force_keyframe);
+}
+
+TEST(RateController, loss_forces_keyframes_and_shortens_interval) {
+    RateControllerOptions options;
+    options.min_keyframe_period = 0.5;
+    options.max_keyframe_period = 2.0;
+    RateController controller(1000, options);
+
+    controller.update(make_lossy_feedback(), 0);
+    EXPECT_TRUE(controller.get_control().force_keyframe);
+    EXPECT_EQ(controller.get_control().keyframe_period, 0.5);
+
+    // not more often than the shortest interval
+    controller.update(make_lossy_feedback(), 200000);
+    EXPECT_FALSE(controller.get_control().force_keyframe);
+    controller.update(make_lossy_feedback(), 500000);
+    EXPECT_TRUE(controller.get_control().force_keyframe);
+
+    // grows back while the link is clean
+    uint64_t now_us = 500000;
+    for (int i = 0; i < 4; ++i) {
+        now_us += 500000;
+        controller.update(make_clean_feedback(), now_us);
+        EXPECT_FALSE(controller.get_control().force_keyframe);
+    }
+    EXPECT_DOUBLE_EQ(controller.get_control().keyframe_period, 1.5);
+    for (int i = 0; i < 10; ++i) {
+        now_us += 500000;
+        controller.update(make_clean_feedback(), now_us);
+    }
+    EXPECT_EQ(controller.get_control().keyframe_period, 2.0);
+}
+
+TEST(RateController, empty_window_is_ignored) {
+    RateController controller(1000, {});
+    StreamFeedback feedback = make_lossy_feedback();
+    feedback.window_ms = 0;
+    EXPECT_FALSE(controller.update(feedback, 0));
+    EXPECT_EQ(controller.get_control().bitrate, 1000);
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "messages.h"
 
 namespace axby {
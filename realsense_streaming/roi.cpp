@@ -0,0 +1,134 @@
+#include "roi.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "debug/check.h"
+#include "debug/log.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+namespace {
+
+constexpr float min_z = 1e-3;
+
+// [begin, end) of a frame of size, shrunk to pairs of pixels, which
+// may leave it empty
+std::pair<int, int> clip_to_pairs(int begin, int end, int size) {
+    begin = std::clamp(begin, 0, size) & ~1;
+    end = std::clamp(end, 0, size);
+    if ((end - begin) % 2) {
+        end = end < size ? end + 1 : end - 1;
+    }
+    return {begin, end};
+}
+
+// the bounding rectangle of the box, unclipped. nullopt if the box is
+// behind the camera.
+std::optional<RoiRect> project_box(const Roi& roi,
+                                   const StreamMeta& stream_meta) {
+    // tx_device_sensor is rigid, p_sensor = R^T * (p_device - t)
+    const auto& tx = stream_meta.extrinsics;
+    const Intrinsics& intrinsics = stream_meta.intrinsics;
+    float min_u = INFINITY;
+    float max_u = -INFINITY;
+    float min_v = INFINITY;
+    float max_v = -INFINITY;
+    int num_behind = 0;
+    for (int corner = 0; corner < 8; ++corner) {
+        std::array<float, 3> p_device;
+        for (int i = 0; i < 3; ++i) {
+            p_device[i] =
+                (corner >> i) & 1 ? roi.box_max[i] : roi.box_min[i];
+            p_device[i] -= tx[12 + i];
+        }
+        std::array<float, 3> p;
+        for (int i = 0; i < 3; ++i) {
+            p[i] = tx[4 * i] * p_device[0] + tx[4 * i + 1] * p_device[1] +
+                   tx[4 * i + 2] * p_device[2];
+        }
+        if (p[2] < min_z) {
+            ++num_behind;
+            continue;
+        }
+        const float u = intrinsics.fx * p[0] / p[2] + intrinsics.ppx;
+        const float v = intrinsics.fy * p[1] / p[2] + intrinsics.ppy;
+        min_u = std::min(min_u, u);
+        max_u = std::max(max_u, u);
+        min_v = std::min(min_v, v);
+        max_v = std::max(max_v, v);
+    }
+    if (num_behind == 8) return std::nullopt;
+    if (num_behind > 0) {
+        // the box reaches behind the camera, where its projection
+        // wraps around, so keep the whole view
+        return RoiRect{.x = 0,
+                       .y = 0,
+                       .width = intrinsics.width,
+                       .height = intrinsics.height};
+    }
+    // pixel i covers [i - 0.5, i + 0.5)
+    const int x = int(std::floor(min_u + 0.5f));
+    const int y = int(std::floor(min_v + 0.5f));
+    return RoiRect{.x = x,
+                   .y = y,
+                   .width = int(std::floor(max_u + 0.5f)) + 1 - x,
+                   .height = int(std::floor(max_v + 0.5f)) + 1 - y};
+}
+
+}  // namespace
+
+std::optional<RoiRect> get_roi_rect(const Roi& roi,
+                                    const StreamMeta& stream_meta) {
+    const Intrinsics& intrinsics = stream_meta.intrinsics;
+    std::optional<RoiRect> rect;
+    if (roi.width > 0 && roi.height > 0) {
+        rect = RoiRect{
+            .x = roi.x, .y = roi.y, .width = roi.width, .height = roi.height};
+    } else if (roi.box_min[0] < roi.box_max[0] &&
+               roi.box_min[1] < roi.box_max[1] &&
+               roi.box_min[2] < roi.box_max[2]) {
+        rect = project_box(roi, stream_meta);
+        if (!rect) {
+            LOG(WARNING) << "The roi box is behind " << stream_meta.id
+                         << ", streaming all of it";
+            return std::nullopt;
+        }
+    } else {
+        return std::nullopt;
+    }
+
+    const auto [x_begin, x_end] =
+        clip_to_pairs(rect->x, rect->x + rect->width, intrinsics.width);
+    const auto [y_begin, y_end] =
+        clip_to_pairs(rect->y, rect->y + rect->height, intrinsics.height);
+    if (x_end <= x_begin || y_end <= y_begin) {
+        LOG(WARNING) << "The roi is outside of " << stream_meta.id
+                     << ", streaming all of it";
+        return std::nullopt;
+    }
+    if (x_end - x_begin == intrinsics.width &&
+        y_end - y_begin == intrinsics.height) {
+        return std::nullopt;
+    }
+    return RoiRect{.x = x_begin,
+                   .y = y_begin,
+                   .width = x_end - x_begin,
+                   .height = y_end - y_begin};
+}
+
+Intrinsics crop_intrinsics(const Intrinsics& intrinsics, const RoiRect& rect) {
+    CHECK(rect.x >= 0 && rect.y >= 0 &&
+          rect.x + rect.width <= intrinsics.width &&
+          rect.y + rect.height <= intrinsics.height);
+    Intrinsics result = intrinsics;
+    result.width = rect.width;
+    result.height = rect.height;
+    result.ppx -= rect.x;
+    result.ppy -= rect.y;
+    return result;
+}
+
+}  // namespace realsense_streaming
+}  // namespace axby
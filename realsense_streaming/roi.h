@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <optional>
+
+#include "messages.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+// the part of a camera's view a stream is cropped to before it is
+// encoded, so its bandwidth and decode cost scale with the part
+struct Roi {
+    // pixels of the stream, used if width and height are > 0
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    // else an axis aligned box in the frame of the device, ie of the
+    // color camera, in meters, used if it isn't empty. the stream gets
+    // the bounding rectangle of the box seen through its intrinsics.
+    std::array<float, 3> box_min = {0, 0, 0};
+    std::array<float, 3> box_max = {0, 0, 0};
+};
+
+struct RoiRect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// of the roi in the frames of the stream, clipped to them and to pairs
+// of pixels, for 4:2:0 and yuyv. nullopt if it covers the frames, ie
+// there is nothing to crop, or there is no roi.
+std::optional<RoiRect> get_roi_rect(const Roi& roi,
+                                    const StreamMeta& stream_meta);
+
+// of frames cropped to rect, whose principal point moves with it, so
+// the pixels deproject to the same rays as before
+Intrinsics crop_intrinsics(const Intrinsics& intrinsics, const RoiRect& rect);
+
+}  // namespace realsense_streaming
+}  // namespace axby
@@ -0,0 +1,111 @@
+#include "realsense_streaming/roi.h"
+
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using namespace axby;
+using namespace realsense_streaming;
+
+namespace {
+
+StreamMeta make_stream_meta() {
+    StreamMeta stream_meta;
+    stream_meta.id.type = StreamType::DEPTH;
+    stream_meta.intrinsics = {.width = 320,
+                              .height = 240,
+                              .ppx = 159.5,
+                              .ppy = 119.5,
+                              .fx = 100,
+                              .fy = 100};
+    for (int i = 0; i < 4; ++i) stream_meta.extrinsics[5 * i] = 1;
+    return stream_meta;
+}
+
+}  // namespace
+
+TEST(RoiTest, PixelRectIsClippedToPairs) {
+    const StreamMeta stream_meta = make_stream_meta();
+    const auto rect = get_roi_rect(
+        {.x = 11, .y = -10, .width = 100, .height = 50}, stream_meta);
+    ASSERT_TRUE(rect);
+    EXPECT_EQ(rect->x, 10);
+    EXPECT_EQ(rect->y, 0);
+    EXPECT_EQ(rect->width, 102);
+    EXPECT_EQ(rect->height, 40);
+
+    EXPECT_FALSE(get_roi_rect({}, stream_meta));
+    EXPECT_FALSE(get_roi_rect({.width = 320, .height = 240}, stream_meta));
+    EXPECT_FALSE(get_roi_rect({.x = 400, .width = 10, .height = 10},
+                              stream_meta));
+}
+
+TEST(RoiTest, BoxIsProjected) {
+    StreamMeta stream_meta = make_stream_meta();
+    const Roi roi{.box_min = {-0.5, -0.5, 1}, .box_max = {0.5, 0.5, 2}};
+    auto rect = get_roi_rect(roi, stream_meta);
+    ASSERT_TRUE(rect);
+    EXPECT_EQ(rect->x, 110);
+    EXPECT_EQ(rect->width, 102);
+    EXPECT_EQ(rect->y, 70);
+    EXPECT_EQ(rect->height, 102);
+
+    // a sensor 0.5m to the right of the device sees the box 50px to
+    // the left
+    stream_meta.extrinsics[12] = 0.5;
+    rect = get_roi_rect(roi, stream_meta);
+    ASSERT_TRUE(rect);
+    EXPECT_EQ(rect->x, 60);
+
+    EXPECT_FALSE(get_roi_rect(
+        {.box_min = {-0.5, -0.5, -2}, .box_max = {0.5, 0.5, -1}},
+        stream_meta));
+}
+
+TEST(RoiTest, CropKeepsRays) {
+    const Intrinsics intrinsics = make_stream_meta().intrinsics;
+    const RoiRect rect{.x = 10, .y = 20, .width = 100, .height = 50};
+    const Intrinsics cropped = crop_intrinsics(intrinsics, rect);
+    EXPECT_EQ(cropped.width, 100);
+    EXPECT_EQ(cropped.height, 50);
+    // pixel 30,40 of the frame is 20,20 of the crop
+    EXPECT_FLOAT_EQ((30 - intrinsics.ppx) / intrinsics.fx,
+                    (20 - cropped.ppx) / cropped.fx);
+    EXPECT_FLOAT_EQ((40 - intrinsics.ppy) / intrinsics.fy,
+                    (20 - cropped.ppy) / cropped.fy);
+}
+
+TEST(RoiTest, StreamMetaOfVersion0HasNoRoiOffset) {
+    StreamMeta stream_meta = make_stream_meta();
+    stream_meta.roi_offset = {10, 20};
+    const auto bytes = std::as_bytes(std::span(&stream_meta, 1));
+
+    EXPECT_EQ(parse_stream_meta(bytes), stream_meta);
+
+    // a recording of before roi_offset
+    const StreamMeta old_stream_meta = parse_stream_meta(
+        bytes.first(offsetof(StreamMeta, roi_offset)));
+    EXPECT_EQ(old_stream_meta.intrinsics, stream_meta.intrinsics);
+    EXPECT_EQ(old_stream_meta.depth_scale, stream_meta.depth_scale);
+    EXPECT_EQ(old_stream_meta.roi_offset, (std::array<int32_t, 2>{0, 0}));
+}
+
+TEST(RoiTest, StreamMetaOfVersion0IgnoresPadding) {
+    const StreamMeta stream_meta = make_stream_meta();
+    constexpr size_t version_0_size = offsetof(StreamMeta, roi_offset);
+
+    // StreamId::preview was padding in version 0, which a sender may
+    // have left uninitialized
+    std::vector<std::byte> bytes(version_0_size, std::byte{0xab});
+    std::memcpy(bytes.data(), &stream_meta, version_0_size);
+    bytes[offsetof(StreamMeta, id) + offsetof(StreamId, preview)] =
+        std::byte{0xab};
+
+    const StreamMeta old_stream_meta = parse_stream_meta(bytes);
+    EXPECT_FALSE(old_stream_meta.id.preview);
+    EXPECT_EQ(old_stream_meta.id, stream_meta.id);
+    EXPECT_EQ(old_stream_meta.intrinsics, stream_meta.intrinsics);
+}
@@ -1,349 +1,165 @@
 #include <librealsense2/h/rs_option.h>
 #include <librealsense2/h/rs_sensor.h>
 #include <librealsense2/h/rs_types.h>
-#include <yuv_rgb.h>
 
 #include <librealsense2/hpp/rs_frame.hpp>
 #include <librealsense2/hpp/rs_pipeline.hpp>
 #include <librealsense2/rs.hpp>
-#include <magic_enum.hpp>
+#include <iostream>
 #include <map>
-#include <mutex>
+#include <memory>
 #include <optional>
-#include <thread>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
-#include "absl/strings/str_format.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
 #include "app/flag.h"
 #include "app/main.h"
 #include "app/pubsub.h"
 #include "app/stop_all.h"
 #include "app/timing.h"
-#include "concurrency/ring_buffer.h"
 #include "debug/log.h"
-#include "fast_resizable_vector/fast_resizable_vector.h"
+#include "encode_pipeline.h"
 #include "math/spatial.h"
 #include "network_config/config.h"
+#include "synthetic_device.h"
 #include "time_sync/time_sync.h"
 #include "util.h"
-#include "wrappers/vpx.h"
 
 APP_FLAG(bool, verbose, false, "verbose mode");
 APP_FLAG(int,
          color_bitrate,
          72,
-         "kbps target for the color video stream compression");
+         "kbps target for the color video stream compression. with client "
+         "feedback, see realsense_feedback in the network config, it is the "
+         "initial target");
+APP_FLAG(int, min_color_bitrate, 64, "kbps, lower bound of the adaptation");
+APP_FLAG(int, max_color_bitrate, 2000, "kbps, upper bound of the adaptation");
 APP_FLAG(std::string, color_size, "small", "small=640x480, large=1280x720");
 APP_FLAG(int,
          color_fps,
          30,
          "each resolution supports different fps, 30 is common");
+APP_FLAG(std::string,
+         color_format,
+         "rgb8",
+         "rgb8 or yuyv. yuyv is what the camera sends, which is cheaper to "
+         "encode");
 APP_FLAG(std::string, depth_size, "small", "small=640x480, large=1280x720");
 APP_FLAG(int,
          depth_fps,
          30,
          "each resolution supports different fps, 30 is common");
 
-APP_FLAG(std::string, config_name, "local", "network config name.");
+APP_FLAG(double, depth_min, 0, "meters, closer depth is dropped if > 0");
+APP_FLAG(double, depth_max, 0, "meters, farther depth is dropped if > 0");
+APP_FLAG(int,
+         depth_decimation,
+         1,
+         "publish depth at 1/n of the resolution, averaging n x n blocks");
+APP_FLAG(double,
+         depth_spatial_delta,
+         0,
+         "meters, if > 0 depth is smoothed with the neighbours within this "
+         "distance, which keeps edges");
+APP_FLAG(double,
+         depth_temporal_alpha,
+         0,
+         "if > 0, weight of a new depth frame in smoothing over frames. see "
+         "//realsense_streaming:depth_filter_benchmark");
+APP_FLAG(int,
+         depth_hole_persistence,
+         0,
+         "frames a pixel that lost its depth keeps its last value, with "
+         "--depth_temporal_alpha");
+
+APP_FLAG(std::string,
+         color_roi,
+         "",
+         "x,y,width,height in pixels, crop the color streams to it");
+APP_FLAG(std::string,
+         depth_roi,
+         "",
+         "x,y,width,height in pixels, crop the depth streams to it");
+APP_FLAG(std::string,
+         roi_box,
+         "",
+         "min_x,min_y,min_z,max_x,max_y,max_z in meters, in the frame of the "
+         "color camera, crop the color and depth streams to what they see of "
+         "it, unless --color_roi or --depth_roi");
 
-using namespace axby;
-using namespace realsense_streaming;
+APP_FLAG(int,
+         preview_width,
+         0,
+         "if > 0, also publish every color and depth stream downscaled to "
+         "this width under realsense_preview/, eg 160 for thumbnails");
+APP_FLAG(int, preview_bitrate, 24, "kbps target of the color previews");
 
-std::mutex report_mutex_;
-bool verbose_ = false;
-FrequencyCalculator bandwidth_report_;
+APP_FLAG(int,
+         num_encode_threads,
+         0,
+         "threads shared by the stream encoders, all cores if 0");
 
-std::string get_topic(const StreamId& stream_id) {
-    if (stream_id.type == StreamType::COLOR) {
-        return absl::StrFormat("realsense/color/%s/%d",
-                               std::string(stream_id.serial_number),
-                               stream_id.index);
-    }
-    if (stream_id.type == StreamType::DEPTH) {
-        return absl::StrFormat("realsense/depth/%s/%d",
-                               std::string(stream_id.serial_number),
-                               stream_id.index);
-    }
-    if (stream_id.type == StreamType::GYRO) {
-        return absl::StrFormat("realsense/gyro/%s/%d",
-                               std::string(stream_id.serial_number),
-                               stream_id.index);
-    }
-    if (stream_id.type == StreamType::ACCEL) {
-        return absl::StrFormat("realsense/accel/%s/%d",
-                               std::string(stream_id.serial_number),
-                               stream_id.index);
-    }
-    LOG(FATAL) << "Unhandled stream type "
-               << magic_enum::enum_name(stream_id.type);
-    return "";
-    // unreachable not supported by gcc11
-    // std::unreachable();
-}
+APP_FLAG(int,
+         color_encoder_threads,
+         0,
+         "threads per vp9 encoder, the cores split between the color streams "
+         "if 0. see //wrappers:vpx_encoder_benchmark");
 
-struct FrameData {
-    int uid = 0;
-    uint64_t creation_timestamp_us = 0;
-    rs2::frame frame;
-};
-
-struct MotionEncoder {
-    uint64_t sequence_id = 0;
-    FastResizableVector<uint64_t> timestamps_us;
-    FastResizableVector<float> xyzs;
-};
-
-std::mutex _color_ring_buffer_mutex;
-RingBuffer<FrameData, 10> _color_ring_buffer;
-void process_color_frames(
-    const absl::flat_hash_map<int, StreamMeta>& uid_to_stream_meta,
-    const absl::flat_hash_map<int, std::string>& uid_to_topic,
-    absl::flat_hash_map<int, ColorEncoder>& uid_to_color_encoder,
-    absl::flat_hash_map<int, FrequencyCalculator>& uid_to_fps_report) {
-    while (!should_stop_all()) {
-        FrameData frame_data;
-        if (!_color_ring_buffer.move_read(frame_data, /*blocking=*/true))
-            return;
-
-        const auto& frame = frame_data.frame;
-        const int uid = frame_data.uid;
-        const auto creation_timestamp_us = frame_data.creation_timestamp_us;
-
-        const StreamMeta& stream_meta = uid_to_stream_meta.at(uid);
-        const auto& topic = uid_to_topic.at(uid);
-        ColorEncoder& encoder = uid_to_color_encoder.at(uid);
-
-        // unpack encoder variables
-        auto& encoder_image_buffer = encoder.buffer;
-        auto& video_encoder = encoder.encoder;
-        const auto sequence_id = encoder.sequence_id++;
-        auto& keyframe_period = encoder.keyframe_period;
-
-        // encode this packet
-        const auto width = stream_meta.intrinsics.width;
-        const auto height = stream_meta.intrinsics.height;
-        CHECK(encoder_image_buffer->d_w == width);
-        CHECK(encoder_image_buffer->d_h == height);
-        CHECK(encoder_image_buffer->fmt == VPX_IMG_FMT_I420);
-
-        const uint8_t* rs_data = (const uint8_t*)frame.get_data();
-        const size_t rs_data_size = frame.get_data_size();
-
-        if (stream_meta.format == StreamFormat::RGB8) {
-            auto video_frame = frame.as<rs2::video_frame>();
-            const int actual_width = video_frame.get_width();
-            const int actual_height = video_frame.get_height();
-            CHECK(actual_width == width)
-                << "expected " << width << "and got " << actual_width;
-            CHECK(actual_height == height)
-                << "expected " << height << " and got " << actual_height;
-
-            CHECK(rs_data_size == width * height * 3)
-                << "rs_data_size was " << rs_data_size << " and expected "
-                << width * height * 3;  // 3 bytes per pixel
-            // convert rgb8 into I420
-            rgb24_yuv420_sseu(
-                width, height, rs_data,
-                /*rgb_stride=*/3 * width,
-                encoder_image_buffer->planes[VPX_PLANE_Y],
-                encoder_image_buffer->planes[VPX_PLANE_U],
-                encoder_image_buffer->planes[VPX_PLANE_V],
-                encoder_image_buffer->stride[VPX_PLANE_Y],
-                /*uv_stride=*/
-                encoder_image_buffer
-                    ->stride[VPX_PLANE_U], /*u stride == v_stride*/
-                YCBCR_601);
-        } else {
-            LOG(FATAL) << "Unsupported image format "
-                       << magic_enum::enum_name(stream_meta.format);
-            // todo: support realsense YUV by direct copying
-            // into vpx frame?
-        }
+APP_FLAG(int,
+         synthetic_cameras,
+         0,
+         "stream this many rendered cameras instead of the connected "
+         "realsense cameras, eg to run without any");
+APP_FLAG(double,
+         synthetic_motion,
+         1.0,
+         "speed of the scene of the synthetic cameras, 0 for a static scene");
 
-        vpx_codec_iter_t iter = nullptr;
-        const vpx_codec_cx_pkt_t* pkt = nullptr;
-
-        // copied from google udpsample project
-        const unsigned int RECOVERY_FLAGS[] = {
-            0,                   //   NORMAL,
-            VPX_EFLAG_FORCE_KF,  //   KEY,
-            VP8_EFLAG_FORCE_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_REF_LAST |
-                VP8_EFLAG_NO_REF_ARF,  //   GOLD = 2,
-            VP8_EFLAG_FORCE_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_REF_LAST |
-                VP8_EFLAG_NO_REF_GF  //   ALTREF = 3
-        };
-        // const int NORMAL = 0;
-        const int KEY = 1;
-        // const int GOLD = 2;
-        // const int ALTREF = 3;
-
-        int flags = 0;
-        const bool using_keyframe = keyframe_period.should_act();
-        if (using_keyframe) {
-            flags = RECOVERY_FLAGS[KEY];
-            LOG_IF(INFO, verbose_)
-                << "Sending color keyframe for " << stream_meta.id;
-        }
+APP_FLAG(std::string, config_name, "local", "network config name.");
 
-        // Quality arguments
-        // - VPX_DL_REALTIME
-        // - VPX_DL_GOOD_QUALITY
-        // - VPX_DL_BEST_QUALITY
-        const vpx_codec_err_t res =
-            vpx_codec_encode(video_encoder.get(), encoder_image_buffer.get(),
-                             /*pts=*/sequence_id,
-                             /*duration=*/1,
-                             /*flags=*/flags, VPX_DL_REALTIME);
-
-        CHECK(res == VPX_CODEC_OK) << vpx_codec_error(video_encoder.get());
-
-        while ((pkt = vpx_codec_get_cx_data(video_encoder.get(), &iter)) !=
-               nullptr) {
-            if (pkt->kind != VPX_CODEC_CX_FRAME_PKT) {
-                // the other packet kinds are irrelevant
-                // VPX_CODEC_CX_FRAME_PKT: Compressed video
-                // VPX_CODEC_STATS_PKT: Two-pass statistics
-                // VPX_CODEC_FPMB_STATS_PKT: first pass mb
-                // statistics VPX_CODEC_PSNR_PKT: PSNR statistics
-                // VPX_CODEC_CUSTOM_PKT = 256:  Algorithm extensions
-                continue;
-            }
+using namespace axby;
+using namespace realsense_streaming;
 
-            // found the first VPX_CODEC_CX_FRAME_PKT
-            break;
-        }
+namespace {
 
-        // we break out of the previous loop since it seems like in realtime
-        // mode, every frame corresponds to exactly one packet. if the CHECK
-        // below triggers, it means the assumption is violated and we update the
-        // code to keep a vector of serialized messages
-        {
-            const vpx_codec_cx_pkt_t* next_pkt = nullptr;
-            next_pkt = vpx_codec_get_cx_data(video_encoder.get(), &iter);
-            CHECK(next_pkt == nullptr);
+template <typename T>
+std::vector<T> parse_list(const std::string& flag, size_t size) {
+    std::vector<T> values;
+    for (const auto& part : absl::StrSplit(flag, ',')) {
+        T value;
+        bool ok = false;
+        if constexpr (std::is_floating_point_v<T>) {
+            ok = absl::SimpleAtof(part, &value);
+        } else {
+            ok = absl::SimpleAtoi(part, &value);
         }
-
-        pubsub::MessageFrames message_frames;
-        message_frames.add_simple(creation_timestamp_us);
-        message_frames.add_simple(sequence_id);
-        message_frames.add_simple(stream_meta);
-        message_frames.add_bytes(pkt);
-        const size_t frame_size = message_frames.size();
-
-        pubsub::publish_frames(topic, 0, std::move(message_frames),
-                               using_keyframe);
-
-        std::lock_guard<std::mutex> lock(report_mutex_);
-        uid_to_fps_report.at(frame_data.uid).count();
-        bandwidth_report_.count(frame_size);
+        CHECK(ok) << "Bad number " << part << " in " << flag;
+        values.push_back(value);
     }
+    CHECK_EQ(values.size(), size) << "Expected " << size << " values in "
+                                  << flag;
+    return values;
 }
 
-std::mutex _depth_ring_buffer_mutex;
-RingBuffer<FrameData, 10> _depth_ring_buffer;
-void process_depth_frames(
-    const absl::flat_hash_map<int, StreamMeta>& uid_to_stream_meta,
-    const absl::flat_hash_map<int, std::string>& uid_to_topic,
-    absl::flat_hash_map<int, DepthEncoder>& uid_to_depth_encoder,
-    absl::flat_hash_map<int, FrequencyCalculator>& uid_to_fps_report) {
-    while (!should_stop_all()) {
-        FrameData frame_data;
-        if (!_depth_ring_buffer.move_read(frame_data, /*blocking=*/true))
-            return;
-
-        const StreamMeta& stream_meta = uid_to_stream_meta.at(frame_data.uid);
-        const auto& topic = uid_to_topic.at(frame_data.uid);
-        const auto creation_timestamp_us = frame_data.creation_timestamp_us;
-        auto& encoder = uid_to_depth_encoder.at(frame_data.uid);
-        auto& depth_encoder = encoder.encoder;
-        const auto sequence_id = encoder.sequence_id++;
-        auto& buffer = encoder.buffer;
-        auto& keyframe_period = encoder.keyframe_period;
-
-        bool request_keyframe = keyframe_period.should_act();
-        const int width = stream_meta.intrinsics.width;
-        const int height = stream_meta.intrinsics.height;
-
-        const int expected_data_size = width * height * sizeof(uint16_t);
-        LOG_IF(INFO, expected_data_size != frame_data.frame.get_data_size())
-            << "Expected data size " << expected_data_size << ", actual "
-            << frame_data.frame.get_data_size();
-
-        depth_encoder.Compress(width, height,
-                               (uint16_t*)frame_data.frame.get_data(), buffer,
-                               request_keyframe);
-
-        const bool have_keyframe =
-            zdepth::IsKeyFrame(buffer.data(), buffer.size());
-        if (request_keyframe) {
-            // sanity check
-            CHECK(have_keyframe);
-        }
-
-        pubsub::MessageFrames message_frames;
-        message_frames.add_simple(creation_timestamp_us);
-        message_frames.add_simple(sequence_id);
-        message_frames.add_simple(stream_meta);
-        message_frames.add_bytes(buffer);
-        const size_t message_size = message_frames.size();
-
-        pubsub::publish_frames(topic, 0, std::move(message_frames),
-                               have_keyframe);
-
-        std::lock_guard<std::mutex> lock(report_mutex_);
-        uid_to_fps_report.at(frame_data.uid).count();
-        bandwidth_report_.count(message_size);
+Roi parse_roi(const std::string& rect_flag, const std::string& box_flag) {
+    Roi roi;
+    if (!rect_flag.empty()) {
+        const auto rect = parse_list<int>(rect_flag, 4);
+        roi.x = rect[0];
+        roi.y = rect[1];
+        roi.width = rect[2];
+        roi.height = rect[3];
+    } else if (!box_flag.empty()) {
+        const auto box = parse_list<float>(box_flag, 6);
+        roi.box_min = {box[0], box[1], box[2]};
+        roi.box_max = {box[3], box[4], box[5]};
     }
+    return roi;
 }
 
-std::mutex _motion_ring_buffer_mutex;
-RingBuffer<FrameData, 100> _motion_ring_buffer;
-void process_motion_frames(
-    const absl::flat_hash_map<int, std::string>& uid_to_topic,
-    const absl::flat_hash_map<int, StreamMeta>& uid_to_stream_meta,
-    absl::flat_hash_map<int, MotionEncoder>& uid_to_motion_encoder,
-    absl::flat_hash_map<int, FrequencyCalculator>& uid_to_fps_report) {
-    while (!should_stop_all()) {
-        FrameData frame_data;
-        if (!_motion_ring_buffer.move_read(frame_data, /*blocking=*/true))
-            return;
-
-        const auto& topic = uid_to_topic.at(frame_data.uid);
-        const auto& stream_meta = uid_to_stream_meta.at(frame_data.uid);
-        const auto creation_timestamp_us = frame_data.creation_timestamp_us;
-        const rs2_vector motion_data =
-            frame_data.frame.as<rs2::motion_frame>().get_motion_data();
-
-        auto& motion_encoder = uid_to_motion_encoder.at(frame_data.uid);
-        motion_encoder.timestamps_us.push_back(creation_timestamp_us);
-        motion_encoder.xyzs.push_back(motion_data.x);
-        motion_encoder.xyzs.push_back(motion_data.y);
-        motion_encoder.xyzs.push_back(motion_data.z);
-
-        size_t message_frames_size = 0;
-        const auto first_timestamp_us = motion_encoder.timestamps_us.front();
-        if (creation_timestamp_us > first_timestamp_us + 1e6 * 0.033) {
-            pubsub::MessageFrames message_frames;
-            message_frames.add_simple(motion_encoder.sequence_id++);
-            message_frames.add_simple(stream_meta);
-            message_frames.add_bytes(
-                reinterpret_span<std::byte>(motion_encoder.timestamps_us));
-            message_frames.add_bytes(
-                reinterpret_span<std::byte>(motion_encoder.xyzs));
-            message_frames_size = message_frames.size();
-            pubsub::publish_frames(topic, 0, std::move(message_frames));
-
-            motion_encoder.timestamps_us.clear();
-            motion_encoder.xyzs.clear();
-        }
-
-        std::lock_guard<std::mutex> lock(report_mutex_);
-        uid_to_fps_report.at(frame_data.uid).count();
-        if (message_frames_size) {
-            bandwidth_report_.count(message_frames_size);
-        }
-    }
-}
+}  // namespace
 
 int main(int argc, char* argv[]) {
     __APP_MAIN_INIT__;
@@ -351,13 +167,29 @@ int main(int argc, char* argv[]) {
     APP_UNPACK_FLAG(config_name);
     APP_UNPACK_FLAG(color_size);
     APP_UNPACK_FLAG(color_bitrate);
+    APP_UNPACK_FLAG(min_color_bitrate);
+    APP_UNPACK_FLAG(max_color_bitrate);
     APP_UNPACK_FLAG(color_fps);
+    APP_UNPACK_FLAG(color_format);
     APP_UNPACK_FLAG(depth_size);
     APP_UNPACK_FLAG(depth_fps);
+    APP_UNPACK_FLAG(depth_min);
+    APP_UNPACK_FLAG(depth_max);
+    APP_UNPACK_FLAG(depth_decimation);
+    APP_UNPACK_FLAG(depth_spatial_delta);
+    APP_UNPACK_FLAG(depth_temporal_alpha);
+    APP_UNPACK_FLAG(depth_hole_persistence);
+    APP_UNPACK_FLAG(color_roi);
+    APP_UNPACK_FLAG(depth_roi);
+    APP_UNPACK_FLAG(roi_box);
+    APP_UNPACK_FLAG(preview_width);
+    APP_UNPACK_FLAG(preview_bitrate);
+    APP_UNPACK_FLAG(num_encode_threads);
+    APP_UNPACK_FLAG(color_encoder_threads);
+    APP_UNPACK_FLAG(synthetic_cameras);
+    APP_UNPACK_FLAG(synthetic_motion);
     APP_UNPACK_FLAG(verbose);
 
-    verbose_ = verbose;
-
     pubsub::init();
 
     network_config::Config network_config{config_name};
@@ -367,6 +199,15 @@ int main(int argc, char* argv[]) {
     CHECK(!network_config.get("realsense").bind.empty());    
     pubsub::bind(network_config.get("realsense").bind);
 
+    // clients that connect to realsense_feedback report what they get
+    // of each stream, which the encoders adapt to
+    pubsub::SubscriberBuffer feedback_buffer;
+    const auto feedback_config = network_config.get("realsense_feedback");
+    if (!feedback_config.bind.empty()) {
+        pubsub::bind_subscriber(feedback_config.bind);
+        pubsub::subscribe(feedback_topic, &feedback_buffer);
+    }
+
     DesiredSettings settings;
     settings.color_fps = color_fps;
     settings.depth_fps = depth_fps;
@@ -379,6 +220,13 @@ int main(int argc, char* argv[]) {
     } else {
         LOG(FATAL) << "Unsupported color size " << color_size;
     }
+    if (color_format == "rgb8") {
+        settings.color_format = StreamFormat::RGB8;
+    } else if (color_format == "yuyv") {
+        settings.color_format = StreamFormat::YUYV;
+    } else {
+        LOG(FATAL) << "Unsupported color format " << color_format;
+    }
     if (depth_size == "small") {
         settings.depth_height = 480;
         settings.depth_width = 640;
@@ -389,7 +237,16 @@ int main(int argc, char* argv[]) {
         LOG(FATAL) << "Unsupported depth size " << depth_size;
     }
 
-    auto configs = get_device_configurations(settings);
+    std::unique_ptr<SyntheticCameras> synthetic;
+    std::vector<DeviceConfiguration> configs;
+    if (synthetic_cameras > 0) {
+        synthetic = std::make_unique<SyntheticCameras>(
+            settings, SyntheticCameraOptions{.num_cameras = synthetic_cameras,
+                                             .motion = synthetic_motion});
+        configs = synthetic->get_device_configurations();
+    } else {
+        configs = get_device_configurations(settings);
+    }
 
     // build a lookup of stream metas by stream profile uid this is
     // used in the frame callback to quickly associate a frame back to
@@ -406,72 +263,35 @@ int main(int argc, char* argv[]) {
             config.gyro_stream_meta;
     }
 
-    // create topics for each stream
-    absl::flat_hash_map<int, std::string> uid_to_topic;
-    for (const auto& [uid, stream_meta] : uid_to_stream_meta) {
-        uid_to_topic[uid] = get_topic(stream_meta.id);
-    }
-
-    // initialize encoders for streams which need to be compressed
-    absl::flat_hash_map<int, ColorEncoder> uid_to_color_encoder;
-    absl::flat_hash_map<int, DepthEncoder> uid_to_depth_encoder;
-    absl::flat_hash_map<int, MotionEncoder> uid_to_motion_encoder;
-    int bitrate = color_bitrate * 1000;  // bits per sec
-    for (auto& [uid, stream_meta] : uid_to_stream_meta) {
-        if (stream_meta.is_color()) {
-            CHECK(!uid_to_color_encoder.count(uid));
-            uid_to_color_encoder[uid] = ColorEncoder(
-                stream_meta.intrinsics.width, stream_meta.intrinsics.height,
-                settings.color_fps, bitrate);
-        }
-        if (stream_meta.is_depth()) {
-            CHECK(!uid_to_depth_encoder.count(uid));
-            uid_to_depth_encoder[uid] = DepthEncoder();
-        }
-        if (stream_meta.is_accel() || stream_meta.is_gyro()) {
-            CHECK(!uid_to_motion_encoder.count(uid));
-            uid_to_motion_encoder[uid] = {};
-        }
-    }
-
-    // set phases of the encoders so that they don't all make
-    // keyframes at the same time
-    const auto num_color_encoders = uid_to_color_encoder.size();
-    int color_encoder_idx = 0;
-    double color_encoder_base_phase = 0;
-    for (auto& [uid, encoder] : uid_to_color_encoder) {
-        const double phase = color_encoder_idx *
-                             encoder.keyframe_period.get_period() /
-                             num_color_encoders;
-        if (color_encoder_idx == 1) {
-            // save the base phase so we can use it during the depth
-            // encoder phase calcuation
-            color_encoder_base_phase = phase;
-        }
-        encoder.keyframe_period.set_phase(phase);
-        ++color_encoder_idx;
-    }
-    const auto num_depth_encoders = uid_to_depth_encoder.size();
-    int depth_encoder_idx = 0;
-    for (auto& [uid, encoder] : uid_to_depth_encoder) {
-        double phase = depth_encoder_idx *
-                       encoder.keyframe_period.get_period() /
-                       num_depth_encoders;
-        // perturb the phase so it doesn't line up with the color encoder phase
-        phase += color_encoder_base_phase / 2;
-        encoder.keyframe_period.set_phase(phase);
-        ++depth_encoder_idx;
-    }
+    EncodePipeline encode_pipeline(
+        uid_to_stream_meta,
+        {.color_fps = settings.color_fps,
+         .color_bitrate = (unsigned int)color_bitrate,
+         .rate_control = {.min_bitrate = (unsigned int)min_color_bitrate,
+                          .max_bitrate = (unsigned int)max_color_bitrate},
+         .depth_filter = {.min_depth = float(depth_min),
+                          .max_depth = float(depth_max),
+                          .decimation = depth_decimation,
+                          .spatial_delta = float(depth_spatial_delta),
+                          .temporal_alpha = float(depth_temporal_alpha),
+                          .hole_persistence = depth_hole_persistence},
+         .color_roi = parse_roi(color_roi, roi_box),
+         .depth_roi = parse_roi(depth_roi, roi_box),
+         .preview_width = preview_width,
+         .preview_bitrate = (unsigned int)preview_bitrate,
+         .color_encoder_threads = color_encoder_threads,
+         .num_threads = num_encode_threads,
+         .verbose = verbose});
 
     std::vector<OpenSensor> open_sensors;
     for (const DeviceConfiguration& config : configs) {
 // windows version of realsense2 needs to be updated and
 // doesn't have get_description()
 #ifndef _WIN32
-        LOG_IF(INFO, verbose_)
+        LOG_IF(INFO, verbose)
             << "Opening device " << config.device.get_description();
 #endif
-        LOG_IF(INFO, verbose_)
+        LOG_IF(INFO, verbose)
             << "\tThere are " << config.sensors.size() << " sensors";
         const auto sensor_idx_to_profiles =
             config.make_sensor_idx_to_profiles();
@@ -479,105 +299,65 @@ int main(int argc, char* argv[]) {
              ++sensor_idx) {
             rs2::sensor sensor = config.sensors[sensor_idx];
             const auto& profiles = sensor_idx_to_profiles.at(sensor_idx);
-            LOG_IF(INFO, verbose_)
+            LOG_IF(INFO, verbose)
                 << "\tOpening sensor " << sensor.get_info(RS2_CAMERA_INFO_NAME)
                 << " (" << profiles.size() << " profiles)";
             for (rs2::stream_profile profile : profiles) {
-                LOG_IF(INFO, verbose_) << "\t\t" << profile.unique_id();
+                LOG_IF(INFO, verbose) << "\t\t" << profile.unique_id();
             }
             open_sensors.emplace_back(sensor, profiles);
         }
     }
 
-    // start all sensors. the callback takes the frame and writes it
-    // into one of three ring buffers. each ring buffer is polled by
-    // its own thread.
+    // start all sensors. the callback hands the frame to the encode
+    // pipeline, which compresses and publishes it on a worker thread.
     for (auto& open_sensor : open_sensors) {
-        open_sensor.start([&uid_to_stream_meta](rs2::frame frame) {
+        open_sensor.start([&encode_pipeline](rs2::frame frame) {
             const int uid = get_profile_uid_from_frame(frame.get());
-            const auto& stream_meta = uid_to_stream_meta.at(uid);
-            const auto creation_timestamp_us = get_process_time_us();
-
-            if (stream_meta.id.type == StreamType::COLOR) {
-                std::lock_guard<std::mutex> lock{_color_ring_buffer_mutex};
-                _color_ring_buffer.move_write(
-                    {.uid = uid,
-                     .creation_timestamp_us = creation_timestamp_us,
-                     .frame = std::move(frame)});
-            }
-            if (stream_meta.id.type == StreamType::DEPTH) {
-                std::lock_guard<std::mutex> lock{_depth_ring_buffer_mutex};
-                _depth_ring_buffer.move_write(
-                    {.uid = uid,
-                     .creation_timestamp_us = creation_timestamp_us,
-                     .frame = std::move(frame)});
-            }
-            if (stream_meta.id.type == StreamType::ACCEL ||
-                stream_meta.id.type == StreamType::GYRO) {
-                std::lock_guard<std::mutex> lock{_motion_ring_buffer_mutex};
-                _motion_ring_buffer.move_write(
-                    {.uid = uid,
-                     .creation_timestamp_us = creation_timestamp_us,
-                     .frame = std::move(frame)});
-            }
+            encode_pipeline.push(
+                {.uid = uid,
+                 .creation_timestamp_us = get_process_time_us(),
+                 .frame = std::move(frame)});
         });
     }
 
-    absl::flat_hash_map<int, FrequencyCalculator> uid_to_fps_report;
-    for (const auto& [uid, _] : uid_to_stream_meta) {
-        uid_to_fps_report[uid];
-    }
-
-    on_stop_all([&]() {
-        _color_ring_buffer.stop();
-        _depth_ring_buffer.stop();
-        _motion_ring_buffer.stop();
-    });
-
-    // these threads constantly poll the ring buffers and then process
-    // and publish the results
-    std::thread process_color_frames_thread([&]() {
-        process_color_frames(uid_to_stream_meta, uid_to_topic,
-                             uid_to_color_encoder, uid_to_fps_report);
-    });
-
-    std::thread process_depth_frames_thread([&]() {
-        process_depth_frames(uid_to_stream_meta, uid_to_topic,
-                             uid_to_depth_encoder, uid_to_fps_report);
-    });
-
-    std::thread process_motion_frames_thread([&]() {
-        process_motion_frames(uid_to_topic, uid_to_stream_meta,
-                              uid_to_motion_encoder, uid_to_fps_report);
-    });
+    if (synthetic) synthetic->start();
 
     LOG(INFO) << "Press ctrl+c to exit...";
     ActionPeriod fps_report_period(5.0);
+    ActionPeriod stats_period(1.0);
+    std::vector<StreamStats> latest_stats;
     while (!should_stop_all()) {
-        // wake-up once in a while to check the stop_all flag and to
-        // print fps statistics
+        // wake-up once in a while to check the stop_all flag, to
+        // apply client feedback, to publish stage latencies and drops
+        // and to print fps statistics
         sleep_ms(250);
 
+        pubsub::Message message;
+        while (feedback_buffer.move_read(message, /*blocking=*/false)) {
+            encode_pipeline.apply_feedback(
+                message.get_simple<StreamFeedback>(0));
+        }
+
+        if (stats_period.should_act()) {
+            latest_stats = encode_pipeline.take_stats();
+            for (const StreamStats& stats : latest_stats) {
+                pubsub::publish_simple(stats_topic, 0, stats);
+            }
+        }
+
         if (fps_report_period.should_act()) {
-            std::lock_guard<std::mutex> lock(report_mutex_);
-            std::cout << "\r\n";
-            std::cout << "Bandwidth " << bandwidth_report_.get_frequency() / 1e6
-                      << "MB/sec \n";
-            for (const auto& [uid, stream_meta] : uid_to_stream_meta) {
-                if (!uid_to_fps_report.count(uid)) {
-                    std::cout << stream_meta.id << "[ NONE ]\n";
-                } else {
-                    std::cout << stream_meta.id << "["
-                              << uid_to_fps_report.at(uid).get_frequency()
-                              << " fps ]\n, ";
-                }
+            encode_pipeline.print_report(std::cout);
+            for (const StreamStats& stats : latest_stats) {
+                std::cout << stats << "\n";
             }
         }
     }
 
-    process_color_frames_thread.join();
-    process_motion_frames_thread.join();
-    process_depth_frames_thread.join();
+    if (synthetic) synthetic->stop();
+
+    // publishing has to end before pubsub is cleaned up
+    encode_pipeline.stop();
 
     time_sync::cleanup();
     pubsub::cleanup();
@@ -0,0 +1,323 @@
+#include "synthetic_device.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "absl/strings/str_format.h"
+#include "app/timing.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "math/spatial.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+namespace {
+
+constexpr float depth_scale = 0.001;
+
+// where the depth camera is in the color camera frame, about where
+// it is on a d435
+constexpr std::array<float, 3> depth_origin = {-0.015f, 0, 0};
+
+// a d435 sees about 87 degrees wide in depth and 69 in color
+Intrinsics make_intrinsics(int width, int height, double fov_deg) {
+    const float f = 0.5 * width / std::tan(0.5 * fov_deg * M_PI / 180);
+    return {.width = width,
+            .height = height,
+            .ppx = 0.5f * width,
+            .ppy = 0.5f * height,
+            .fx = f,
+            .fy = f};
+}
+
+rs2_intrinsics to_rs_intrinsics(const Intrinsics& intrinsics) {
+    rs2_intrinsics result = {};
+    result.width = intrinsics.width;
+    result.height = intrinsics.height;
+    result.ppx = intrinsics.ppx;
+    result.ppy = intrinsics.ppy;
+    result.fx = intrinsics.fx;
+    result.fy = intrinsics.fy;
+    result.model = RS2_DISTORTION_NONE;
+    return result;
+}
+
+rs2_extrinsics make_extrinsics(const std::array<float, 3>& translation) {
+    rs2_extrinsics result = {
+        .rotation = {1, 0, 0, 0, 1, 0, 0, 0, 1},
+        .translation = {translation[0], translation[1], translation[2]}};
+    return result;
+}
+
+// bt.601 limited range, like the camera and the encoder use. each
+// pair of pixels shares the average of their chroma.
+void rgb_to_yuyv(int width, int height, const uint8_t* rgb, uint8_t* yuyv) {
+    const auto luma = [](const uint8_t* p) {
+        return 16 + (65.481f * p[0] + 128.553f * p[1] + 24.966f * p[2]) / 255;
+    };
+    for (int i = 0; i < width * height; i += 2) {
+        const uint8_t* p0 = rgb + 3 * i;
+        const uint8_t* p1 = p0 + 3;
+        const float r = 0.5f * (p0[0] + p1[0]);
+        const float g = 0.5f * (p0[1] + p1[1]);
+        const float b = 0.5f * (p0[2] + p1[2]);
+        uint8_t* out = yuyv + 2 * i;
+        out[0] = uint8_t(luma(p0) + 0.5f);
+        out[1] = uint8_t(128 + (-37.797f * r - 74.203f * g + 112 * b) / 255 +
+                         0.5f);
+        out[2] = uint8_t(luma(p1) + 0.5f);
+        out[3] = uint8_t(128 + (112 * r - 93.786f * g - 18.214f * b) / 255 +
+                         0.5f);
+    }
+}
+
+StreamMeta make_stream_meta(StreamType type,
+                            StreamFormat format,
+                            int fps,
+                            const std::string& serial_number,
+                            const rs2::stream_profile& profile) {
+    StreamMeta stream_meta;
+    stream_meta.id.index = profile.stream_index();
+    stream_meta.id.type = type;
+    stream_meta.id.serial_number = serial_number;
+    stream_meta.device_name = "Synthetic D435";
+    stream_meta.format = format;
+    stream_meta.fps = fps;
+    return stream_meta;
+}
+
+}  // namespace
+
+SyntheticCameras::SyntheticCameras(const DesiredSettings& settings,
+                                   const SyntheticCameraOptions& options) {
+    CHECK_GT(options.num_cameras, 0);
+    const bool color_yuyv = settings.color_format == StreamFormat::YUYV;
+    CHECK(color_yuyv || settings.color_format == StreamFormat::RGB8)
+        << "Unsupported color format";
+
+    // profile uids are unique within the process
+    int uid = 1000;
+    for (int camera_idx = 0; camera_idx < options.num_cameras; ++camera_idx) {
+        auto camera = std::make_unique<Camera>();
+        camera->scene =
+            std::make_unique<SyntheticScene>(options.motion, camera_idx);
+
+        const std::string serial_number =
+            absl::StrFormat("synthetic%d", camera_idx);
+        rs2::software_device& device = camera->device;
+        device.register_info(RS2_CAMERA_INFO_NAME, "Synthetic D435");
+        device.register_info(RS2_CAMERA_INFO_SERIAL_NUMBER, serial_number);
+
+        camera->depth_sensor = device.add_sensor("Stereo Module");
+        camera->color_sensor = device.add_sensor("RGB Camera");
+        camera->motion_sensor = device.add_sensor("Motion Module");
+        camera->depth_sensor.add_read_only_option(RS2_OPTION_DEPTH_UNITS,
+                                                  depth_scale);
+
+        DeviceConfiguration config;
+        config.device = device;
+        config.sensors = {camera->depth_sensor, camera->color_sensor,
+                          camera->motion_sensor};
+        config.depth_sensor_idx = 0;
+        config.color_sensor_idx = 1;
+        config.accel_sensor_idx = 2;
+        config.gyro_sensor_idx = 2;
+        config.depth_scale = depth_scale;
+
+        const Intrinsics depth_intrinsics = make_intrinsics(
+            settings.depth_width, settings.depth_height, /*fov_deg=*/87);
+        config.depth_profile = camera->depth_sensor.add_video_stream(
+            {.type = RS2_STREAM_DEPTH,
+             .index = 0,
+             .uid = uid++,
+             .width = settings.depth_width,
+             .height = settings.depth_height,
+             .fps = settings.depth_fps,
+             .bpp = sizeof(uint16_t),
+             .fmt = RS2_FORMAT_Z16,
+             .intrinsics = to_rs_intrinsics(depth_intrinsics)},
+            /*is_default=*/true);
+
+        const Intrinsics color_intrinsics = make_intrinsics(
+            settings.color_width, settings.color_height, /*fov_deg=*/69);
+        config.color_profile = camera->color_sensor.add_video_stream(
+            {.type = RS2_STREAM_COLOR,
+             .index = 0,
+             .uid = uid++,
+             .width = settings.color_width,
+             .height = settings.color_height,
+             .fps = settings.color_fps,
+             .bpp = color_yuyv ? 2 : 3,
+             .fmt = rs_from_stream_format(settings.color_format),
+             .intrinsics = to_rs_intrinsics(color_intrinsics)},
+            /*is_default=*/true);
+
+        config.accel_profile = camera->motion_sensor.add_motion_stream(
+            {.type = RS2_STREAM_ACCEL,
+             .index = 0,
+             .uid = uid++,
+             .fps = settings.accel_fps,
+             .fmt = RS2_FORMAT_MOTION_XYZ32F},
+            /*is_default=*/true);
+        config.gyro_profile = camera->motion_sensor.add_motion_stream(
+            {.type = RS2_STREAM_GYRO,
+             .index = 0,
+             .uid = uid++,
+             .fps = settings.gyro_fps,
+             .fmt = RS2_FORMAT_MOTION_XYZ32F},
+            /*is_default=*/true);
+
+        // the color camera is the base, like for the real cameras
+        const rs2_extrinsics depth_to_color = make_extrinsics(depth_origin);
+        const rs2_extrinsics identity = make_extrinsics({0, 0, 0});
+        config.depth_profile.register_extrinsics_to(config.color_profile,
+                                                    depth_to_color);
+        config.accel_profile.register_extrinsics_to(config.color_profile,
+                                                    identity);
+        config.gyro_profile.register_extrinsics_to(config.color_profile,
+                                                   identity);
+
+        config.depth_stream_meta =
+            make_stream_meta(StreamType::DEPTH, StreamFormat::Z16,
+                             settings.depth_fps, serial_number,
+                             config.depth_profile);
+        config.depth_stream_meta.intrinsics = depth_intrinsics;
+        config.depth_stream_meta.depth_scale = depth_scale;
+        config.color_stream_meta =
+            make_stream_meta(StreamType::COLOR, settings.color_format,
+                             settings.color_fps, serial_number,
+                             config.color_profile);
+        config.color_stream_meta.intrinsics = color_intrinsics;
+        config.accel_stream_meta = make_stream_meta(
+            StreamType::ACCEL, StreamFormat::MOTION_XYZ32F, settings.accel_fps,
+            serial_number, config.accel_profile);
+        config.gyro_stream_meta = make_stream_meta(
+            StreamType::GYRO, StreamFormat::MOTION_XYZ32F, settings.gyro_fps,
+            serial_number, config.gyro_profile);
+
+        tx_from_rot_trans(depth_to_color.rotation, depth_to_color.translation,
+                          /*out=*/config.depth_stream_meta.extrinsics);
+        tx_from_rot_trans(identity.rotation, identity.translation,
+                          /*out=*/config.color_stream_meta.extrinsics);
+        tx_from_rot_trans(identity.rotation, identity.translation,
+                          /*out=*/config.accel_stream_meta.extrinsics);
+        tx_from_rot_trans(identity.rotation, identity.translation,
+                          /*out=*/config.gyro_stream_meta.extrinsics);
+
+        LOG(INFO) << "Created synthetic camera " << serial_number;
+        configs_.push_back(config);
+        cameras_.push_back(std::move(camera));
+    }
+}
+
+SyntheticCameras::~SyntheticCameras() { stop(); }
+
+void SyntheticCameras::start() {
+    for (size_t i = 0; i < cameras_.size(); ++i) {
+        Camera& camera = *cameras_[i];
+        CHECK(!camera.thread.joinable());
+        camera.thread = std::thread{
+            [this, &camera, &config = configs_[i]]() {
+                run_camera(camera, config);
+            }};
+    }
+}
+
+void SyntheticCameras::stop() {
+    stopped_ = true;
+    for (auto& camera : cameras_) {
+        if (camera->thread.joinable()) camera->thread.join();
+    }
+}
+
+void SyntheticCameras::run_camera(Camera& camera,
+                                  const DeviceConfiguration& config) {
+    struct Stream {
+        const StreamMeta* stream_meta = nullptr;
+        double period_s = 0;
+        double next_due_s = 0;
+        int frame_number = 0;
+    };
+    std::vector<Stream> streams;
+    for (const StreamMeta* stream_meta :
+         {&config.depth_stream_meta, &config.color_stream_meta,
+          &config.accel_stream_meta, &config.gyro_stream_meta}) {
+        CHECK_GT(stream_meta->fps, 0);
+        streams.push_back(
+            {.stream_meta = stream_meta, .period_s = 1.0 / stream_meta->fps});
+    }
+
+    const uint64_t start_us = get_process_time_us();
+    while (!stopped_) {
+        // produce the frame that is due next
+        Stream& stream = *std::min_element(
+            streams.begin(), streams.end(), [](const auto& a, const auto& b) {
+                return a.next_due_s < b.next_due_s;
+            });
+        const double time_s = stream.next_due_s;
+        stream.next_due_s += stream.period_s;
+        const int frame_number = stream.frame_number++;
+
+        const uint64_t due_us = start_us + uint64_t(time_s * 1e6);
+        const uint64_t now_us = get_process_time_us();
+        if (due_us > now_us) sleep_us(due_us - now_us);
+
+        const StreamMeta& stream_meta = *stream.stream_meta;
+        const Intrinsics& intrinsics = stream_meta.intrinsics;
+        const double timestamp_ms = time_s * 1e3;
+        if (stream_meta.is_depth()) {
+            auto* pixels = new uint16_t[intrinsics.width * intrinsics.height];
+            camera.scene->render_depth(time_s, intrinsics, depth_scale,
+                                       depth_origin, pixels);
+            camera.depth_sensor.on_video_frame(
+                {.pixels = pixels,
+                 .deleter = [](void* p) { delete[] (uint16_t*)p; },
+                 .stride = int(intrinsics.width * sizeof(uint16_t)),
+                 .bpp = sizeof(uint16_t),
+                 .timestamp = timestamp_ms,
+                 .domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK,
+                 .frame_number = frame_number,
+                 .profile = config.depth_profile.get(),
+                 .depth_units = depth_scale});
+        } else if (stream_meta.is_color()) {
+            const int num_pixels = intrinsics.width * intrinsics.height;
+            auto* pixels = new uint8_t[num_pixels * 3];
+            camera.scene->render_color(time_s, intrinsics, pixels);
+            int bpp = 3;
+            if (stream_meta.format == StreamFormat::YUYV) {
+                auto* yuyv = new uint8_t[num_pixels * 2];
+                rgb_to_yuyv(intrinsics.width, intrinsics.height, pixels, yuyv);
+                delete[] pixels;
+                pixels = yuyv;
+                bpp = 2;
+            }
+            camera.color_sensor.on_video_frame(
+                {.pixels = pixels,
+                 .deleter = [](void* p) { delete[] (uint8_t*)p; },
+                 .stride = intrinsics.width * bpp,
+                 .bpp = bpp,
+                 .timestamp = timestamp_ms,
+                 .domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK,
+                 .frame_number = frame_number,
+                 .profile = config.color_profile.get()});
+        } else {
+            const auto xyz = stream_meta.is_accel()
+                                 ? camera.scene->get_accel(time_s)
+                                 : camera.scene->get_gyro(time_s);
+            auto* data = new float[3]{xyz[0], xyz[1], xyz[2]};
+            const auto& profile = stream_meta.is_accel() ? config.accel_profile
+                                                         : config.gyro_profile;
+            camera.motion_sensor.on_motion_frame(
+                {.data = data,
+                 .deleter = [](void* p) { delete[] (float*)p; },
+                 .timestamp = timestamp_ms,
+                 .domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK,
+                 .frame_number = frame_number,
+                 .profile = profile.get()});
+        }
+    }
+}
+
+}  // namespace realsense_streaming
+}  // namespace axby
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <librealsense2/hpp/rs_internal.hpp>
+#include <librealsense2/rs.hpp>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "synthetic_scene.h"
+#include "util.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+struct SyntheticCameraOptions {
+    int num_cameras = 1;
+
+    // speed of the scene, 0 for a static scene
+    double motion = 1;
+};
+
+// stands in for realsense cameras, eg to run the server on machines
+// without any. every camera is an rs2::software_device with a depth,
+// color and motion sensor, configured like get_device_configurations
+// configures a real camera, so the sensors are opened and started
+// the same way and their frames are real rs2::frames. the frames are
+// rendered from a SyntheticScene in real time.
+class SyntheticCameras {
+   public:
+    SyntheticCameras(const DesiredSettings& settings,
+                     const SyntheticCameraOptions& options);
+
+    // stops
+    ~SyntheticCameras();
+
+    SyntheticCameras(const SyntheticCameras&) = delete;
+    SyntheticCameras& operator=(const SyntheticCameras&) = delete;
+
+    // of the synthetic cameras, like get_device_configurations()
+    const std::vector<DeviceConfiguration>& get_device_configurations()
+        const {
+        return configs_;
+    }
+
+    // starts rendering frames into the sensors, which should be
+    // started by then. a thread per camera.
+    void start();
+
+    // call before the sensors are stopped
+    void stop();
+
+   private:
+    struct Camera {
+        rs2::software_device device;
+        rs2::software_sensor depth_sensor;
+        rs2::software_sensor color_sensor;
+        rs2::software_sensor motion_sensor;
+        std::unique_ptr<SyntheticScene> scene;
+        std::thread thread;
+    };
+
+    void run_camera(Camera& camera, const DeviceConfiguration& config);
+
+    std::vector<std::unique_ptr<Camera>> cameras_;
+    std::vector<DeviceConfiguration> configs_;
+    std::atomic<bool> stopped_ = false;
+};
+
+}  // namespace realsense_streaming
+}  // namespace axby
@@ -0,0 +1,181 @@
+#include "synthetic_scene.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace axby {
+namespace realsense_streaming {
+
+namespace {
+
+constexpr float max_depth_m = 6;
+constexpr double gravity = 9.81;
+
+// cheap deterministic per pixel noise
+uint32_t hash(uint32_t x, uint32_t y, uint32_t z) {
+    uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ z * 0xcb1ab31fu;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    return h ^ (h >> 15);
+}
+
+float dot(const std::array<float, 3>& a, const std::array<float, 3>& b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+}  // namespace
+
+SyntheticScene::SyntheticScene(double motion, int seed) : motion_(motion) {
+    wall_z_ = 3 + 0.25f * (seed % 4);
+    floor_y_ = 1.2f - 0.1f * (seed % 3);
+    ball_phase_ = seed * 1.3;
+}
+
+std::array<float, 3> SyntheticScene::get_ball_center(double time_s) const {
+    const double angle = 0.8 * motion_ * time_s + ball_phase_;
+    return {float(0.6 * std::sin(angle)), float(0.2 * std::cos(2 * angle)),
+            float(1.8 + 0.5 * std::cos(angle))};
+}
+
+SyntheticScene::Hit SyntheticScene::trace(
+    const std::array<float, 3>& origin,
+    const std::array<float, 3>& direction,
+    const std::array<float, 3>& ball_center) const {
+    Hit hit;
+    hit.t = max_depth_m;
+
+    // direction z is 1, so t is the z distance
+    const float wall_t = wall_z_ - origin[2];
+    if (wall_t > 0 && wall_t < hit.t) {
+        hit.surface = Hit::WALL;
+        hit.t = wall_t;
+        hit.normal = {0, 0, -1};
+    }
+    if (direction[1] > 0) {
+        const float floor_t = (floor_y_ - origin[1]) / direction[1];
+        if (floor_t > 0 && floor_t < hit.t) {
+            hit.surface = Hit::FLOOR;
+            hit.t = floor_t;
+            hit.normal = {0, -1, 0};
+        }
+    }
+
+    const std::array<float, 3> oc = {origin[0] - ball_center[0],
+                                     origin[1] - ball_center[1],
+                                     origin[2] - ball_center[2]};
+    const float a = dot(direction, direction);
+    const float b = dot(oc, direction);
+    const float c = dot(oc, oc) - ball_radius_ * ball_radius_;
+    const float discriminant = b * b - a * c;
+    if (discriminant >= 0) {
+        const float ball_t = (-b - std::sqrt(discriminant)) / a;
+        if (ball_t > 0 && ball_t < hit.t) {
+            hit.surface = Hit::BALL;
+            hit.t = ball_t;
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        hit.point[i] = origin[i] + hit.t * direction[i];
+    }
+    if (hit.surface == Hit::BALL) {
+        for (int i = 0; i < 3; ++i) {
+            hit.normal[i] = (hit.point[i] - ball_center[i]) / ball_radius_;
+        }
+    }
+    return hit;
+}
+
+void SyntheticScene::render_depth(double time_s,
+                                  const Intrinsics& intrinsics,
+                                  float depth_scale,
+                                  const std::array<float, 3>& origin,
+                                  uint16_t* out) const {
+    const auto ball_center = get_ball_center(time_s);
+    const uint32_t frame_idx = uint32_t(time_s * 1000);
+
+    // the stereo sensor has no depth where the left imager sees what
+    // the right one doesn't
+    const int invalid_band = intrinsics.width / 20;
+
+    for (int y = 0; y < intrinsics.height; ++y) {
+        uint16_t* row = out + y * intrinsics.width;
+        const float dy = (y - intrinsics.ppy) / intrinsics.fy;
+        for (int x = 0; x < intrinsics.width; ++x) {
+            if (x < invalid_band) {
+                row[x] = 0;
+                continue;
+            }
+            const float dx = (x - intrinsics.ppx) / intrinsics.fx;
+            const Hit hit = trace(origin, {dx, dy, 1}, ball_center);
+
+            // stereo error grows with the square of the distance, and
+            // a few pixels drop out
+            const uint32_t noise = hash(x, y, frame_idx);
+            if (hit.surface == Hit::NONE || noise % 97 == 0) {
+                row[x] = 0;
+                continue;
+            }
+            const float error = hit.t * hit.t * 0.002f *
+                                (int((noise >> 8) % 201) - 100) / 100.0f;
+            row[x] = uint16_t(
+                std::clamp((hit.t + error) / depth_scale, 0.0f, 65535.0f));
+        }
+    }
+}
+
+void SyntheticScene::render_color(double time_s,
+                                  const Intrinsics& intrinsics,
+                                  uint8_t* out) const {
+    const auto ball_center = get_ball_center(time_s);
+    const std::array<float, 3> light = {-0.4f, -0.8f, -0.45f};
+
+    for (int y = 0; y < intrinsics.height; ++y) {
+        uint8_t* row = out + y * intrinsics.width * 3;
+        const float dy = (y - intrinsics.ppy) / intrinsics.fy;
+        for (int x = 0; x < intrinsics.width; ++x) {
+            const float dx = (x - intrinsics.ppx) / intrinsics.fx;
+            const Hit hit = trace({0, 0, 0}, {dx, dy, 1}, ball_center);
+
+            std::array<float, 3> rgb = {150, 180, 220};
+            if (hit.surface == Hit::WALL || hit.surface == Hit::FLOOR) {
+                // 25cm tiles
+                const float u = hit.point[0];
+                const float v =
+                    hit.surface == Hit::WALL ? hit.point[1] : hit.point[2];
+                const bool dark =
+                    (int(std::floor(u * 4)) + int(std::floor(v * 4))) & 1;
+                const float shade = dark ? 0.6f : 1.0f;
+                rgb = hit.surface == Hit::WALL
+                          ? std::array<float, 3>{200 * shade, 190 * shade,
+                                                 170 * shade}
+                          : std::array<float, 3>{90 * shade, 140 * shade,
+                                                 80 * shade};
+            } else if (hit.surface == Hit::BALL) {
+                const float lambert = std::max(dot(hit.normal, light), 0.0f);
+                const float shade = 0.25f + 0.75f * lambert;
+                rgb = {230 * shade, 40 * shade, 30 * shade};
+            }
+            for (int c = 0; c < 3; ++c) {
+                row[3 * x + c] = uint8_t(rgb[c]);
+            }
+        }
+    }
+}
+
+std::array<float, 3> SyntheticScene::get_accel(double time_s) const {
+    // at rest the accelerometer reads the push against gravity, which
+    // is up, along -y
+    const double shake = 0.3 * motion_ * std::sin(2 * M_PI * 1.7 * time_s);
+    return {float(shake), float(-gravity + 0.5 * shake), float(0.2 * shake)};
+}
+
+std::array<float, 3> SyntheticScene::get_gyro(double time_s) const {
+    const double shake = 0.05 * motion_;
+    return {float(shake * std::sin(2 * M_PI * 0.9 * time_s)),
+            float(shake * std::cos(2 * M_PI * 1.3 * time_s)),
+            float(0.5 * shake * std::sin(2 * M_PI * 0.4 * time_s))};
+}
+
+}  // namespace realsense_streaming
+}  // namespace axby
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "messages.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+// a deterministic scene to run and benchmark the realsense pipeline
+// without cameras: a textured back wall and floor, and a ball that
+// orbits in front of them while the camera shakes a little. frames
+// only depend on the time and the camera, so runs are reproducible.
+//
+// points are in the frame of the color camera, x right, y down and z
+// forward, like realsense.
+class SyntheticScene {
+   public:
+    // motion scales the speed of the ball and the shake of the camera,
+    // 0 for a static scene. the seed varies the layout, eg per camera.
+    explicit SyntheticScene(double motion = 1, int seed = 0);
+
+    // z depth in units of depth_scale meters, 0 where there is no
+    // depth, including a band on the left like the stereo sensor
+    // has. origin is where the depth camera is in the color camera
+    // frame. out is width * height.
+    void render_depth(double time_s,
+                      const Intrinsics& intrinsics,
+                      float depth_scale,
+                      const std::array<float, 3>& origin,
+                      uint16_t* out) const;
+
+    // rgb8, width * height * 3
+    void render_color(double time_s,
+                      const Intrinsics& intrinsics,
+                      uint8_t* out) const;
+
+    // what the imu of the camera reads, m/s^2 and rad/s
+    std::array<float, 3> get_accel(double time_s) const;
+    std::array<float, 3> get_gyro(double time_s) const;
+
+   private:
+    struct Hit {
+        enum Surface { NONE, WALL, FLOOR, BALL } surface = NONE;
+        float t = 0;  // along the ray, whose z is 1
+        std::array<float, 3> point = {0};
+        std::array<float, 3> normal = {0};
+    };
+
+    std::array<float, 3> get_ball_center(double time_s) const;
+    Hit trace(const std::array<float, 3>& origin,
+              const std::array<float, 3>& direction,
+              const std::array<float, 3>& ball_center) const;
+
+    double motion_ = 1;
+    float wall_z_ = 3;
+    float floor_y_ = 1.2;
+    float ball_radius_ = 0.25;
+    double ball_phase_ = 0;
+};
+
+}  // namespace realsense_streaming
+}  // namespace axby
@@ -15,12 +15,25 @@
 namespace axby {
 namespace realsense_streaming {
 
+namespace {
+
+// software sensors, eg of the synthetic cameras, have no serial number
+std::string describe_sensor(const rs2::sensor& sensor) {
+    std::string description = sensor.get_info(RS2_CAMERA_INFO_NAME);
+    if (sensor.supports(RS2_CAMERA_INFO_SERIAL_NUMBER)) {
+        description += ", ";
+        description += sensor.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+    }
+    return description;
+}
+
+}  // namespace
+
 OpenSensor::OpenSensor(rs2::sensor sensor,
                        const std::vector<rs2::stream_profile>& profiles) {
     sensor_ = sensor;
     CHECK(sensor_);
-    LOG(INFO) << "Opening sensor " << sensor_.get_info(RS2_CAMERA_INFO_NAME)
-              << ", " << sensor_.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+    LOG(INFO) << "Opening sensor " << describe_sensor(sensor_);
     sensor_.open(profiles);
 }
 
@@ -39,8 +52,7 @@ OpenSensor::OpenSensor(OpenSensor&& other) noexcept {
 
 OpenSensor::~OpenSensor() {
     if (sensor_) {
-        LOG(INFO) << "Closing sensor " << sensor_.get_info(RS2_CAMERA_INFO_NAME)
-                  << ", " << sensor_.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+        LOG(INFO) << "Closing sensor " << describe_sensor(sensor_);
         if (started_) {
             sensor_.stop();
         }
@@ -91,7 +103,8 @@ std::vector<DeviceConfiguration> get_device_configurations(
             for (rs2::stream_profile stream_profile :
                  sensor.get_stream_profiles()) {
                 const bool is_color_candidate =
-                    (stream_profile.format() == RS2_FORMAT_RGB8) &&
+                    (stream_profile.format() ==
+                     rs_from_stream_format(desired.color_format)) &&
                     (stream_profile.stream_type() == RS2_STREAM_COLOR);
 
                 const bool is_depth_candidate =
@@ -311,9 +324,10 @@ int get_profile_uid_from_frame(const rs2_frame* f) {
 }
 
 ColorEncoder::ColorEncoder(unsigned int width, unsigned int height, int fps,
-                           unsigned int bitrate, bool lossless) {
-    encoder =
-        init_vpx_encoder(/*profile=*/0, width, height, fps, bitrate, lossless);
+                           unsigned int bitrate, bool lossless,
+                           const VpxEncoderPreset& preset) {
+    encoder = init_vpx_encoder(/*profile=*/0, width, height, fps, bitrate,
+                               lossless, preset);
     buffer = init_vpx_img(VPX_IMG_FMT_I420, width, height, /*align=*/0);
 };
 
@@ -12,6 +12,7 @@
 
 #include "app/timing.h"
 #include "messages.h"
+#include "wrappers/vpx.h"
 
 namespace axby {
 namespace realsense_streaming {
@@ -34,6 +35,7 @@ inline StreamFormat rs_to_stream_format(rs2_format format) {
     if (format == RS2_FORMAT_Z16) return StreamFormat::Z16;
     if (format == RS2_FORMAT_RGB8) return StreamFormat::RGB8;
     if (format == RS2_FORMAT_MOTION_XYZ32F) return StreamFormat::MOTION_XYZ32F;
+    if (format == RS2_FORMAT_YUYV) return StreamFormat::YUYV;
     return StreamFormat::INVALID;  // todo
 };
 
@@ -41,6 +43,7 @@ inline rs2_format rs_from_stream_format(StreamFormat format) {
     if (format == StreamFormat::Z16) return RS2_FORMAT_Z16;
     if (format == StreamFormat::RGB8) return RS2_FORMAT_RGB8;
     if (format == StreamFormat::MOTION_XYZ32F) return RS2_FORMAT_MOTION_XYZ32F;
+    if (format == StreamFormat::YUYV) return RS2_FORMAT_YUYV;
     return RS2_FORMAT_ANY;  // todo
 };
 
@@ -99,6 +102,10 @@ struct DesiredSettings {
     int color_height = 480;
     int color_fps = 30;
 
+    // RGB8, or YUYV, which the camera sends natively and the encoder
+    // takes with a cheaper conversion
+    StreamFormat color_format = StreamFormat::RGB8;
+
     int depth_width = 640;
     int depth_height = 480;
     int depth_fps = 30;
@@ -117,10 +124,14 @@ struct ColorEncoder {
     ColorEncoder(unsigned int width,
                  unsigned int height,
                  int fps,
-                 unsigned int bitrate,
-                 bool lossless = false);
+                 unsigned int bitrate,  // kbps
+                 bool lossless = false,
+                 const VpxEncoderPreset& preset = {});
 
+    // of the published packets, while num_frames, the pts, also
+    // counts the frames the rate control dropped
     uint64_t sequence_id = 0;
+    uint64_t num_frames = 0;
 
     std::shared_ptr<vpx_codec_ctx_t> encoder = nullptr;
     std::shared_ptr<vpx_image_t> buffer = nullptr;
@@ -23,6 +23,10 @@
 #include "wrappers/imgui.h"
 
 APP_FLAG(std::string, config_name, "local", "network config name");
+APP_FLAG(bool,
+         preview,
+         false,
+         "show the preview streams of the server, see its --preview_width");
 
 using namespace axby;
 namespace rss = realsense_streaming;
@@ -150,12 +154,13 @@ int main(int argc, char* argv[]) {
     __APP_MAIN_INIT__;
 
     APP_UNPACK_FLAG(config_name);
+    APP_UNPACK_FLAG(preview);
 
     pubsub::init();
 
     network_config::Config network_config{config_name};
     time_sync::init(network_config);
-    rss::client::init(network_config);
+    rss::client::init(network_config, {.preview = preview});
 
     gui_init("Realsense Stream Viewer");
     viewer::init();
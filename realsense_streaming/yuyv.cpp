@@ -0,0 +1,183 @@
+#include "yuyv.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "debug/check.h"
+
+namespace axby {
+namespace realsense_streaming {
+
+namespace {
+
+// pixels [x, width) of a pair of rows. y1 is null for the last row of
+// an odd height, whose chroma is then its own.
+void repack_rows_scalar(int x,
+                        int width,
+                        const uint8_t* yuyv0,
+                        const uint8_t* yuyv1,
+                        uint8_t* y0,
+                        uint8_t* y1,
+                        uint8_t* u,
+                        uint8_t* v) {
+    for (; x < width; x += 2) {
+        const uint8_t* p0 = yuyv0 + 2 * x;
+        const uint8_t* p1 = yuyv1 + 2 * x;
+        y0[x] = p0[0];
+        y0[x + 1] = p0[2];
+        if (y1) {
+            y1[x] = p1[0];
+            y1[x + 1] = p1[2];
+        }
+        u[x / 2] = (p0[1] + p1[1] + 1) >> 1;
+        v[x / 2] = (p0[3] + p1[3] + 1) >> 1;
+    }
+}
+
+#if defined(__AVX2__)
+
+// packs the low bytes of the 16 bit lanes of a and b, in order
+__m256i pack_low_bytes(__m256i a, __m256i b) {
+    const __m256i low_bytes = _mm256_set1_epi16(0x00ff);
+    const __m256i packed = _mm256_packus_epi16(_mm256_and_si256(a, low_bytes),
+                                               _mm256_and_si256(b, low_bytes));
+    // packus works per 128 bit lane
+    return _mm256_permute4x64_epi64(packed, 0xd8);
+}
+
+__m256i pack_high_bytes(__m256i a, __m256i b) {
+    const __m256i packed = _mm256_packus_epi16(_mm256_srli_epi16(a, 8),
+                                               _mm256_srli_epi16(b, 8));
+    return _mm256_permute4x64_epi64(packed, 0xd8);
+}
+
+// returns the first pixel left for the scalar loop
+int repack_rows_simd(int width,
+                     const uint8_t* yuyv0,
+                     const uint8_t* yuyv1,
+                     uint8_t* y0,
+                     uint8_t* y1,
+                     uint8_t* u,
+                     uint8_t* v) {
+    int x = 0;
+    for (; x + 64 <= width; x += 64) {
+        __m256i a[4];
+        __m256i b[4];
+        for (int i = 0; i < 4; ++i) {
+            a[i] = _mm256_loadu_si256((const __m256i*)(yuyv0 + 2 * x + 32 * i));
+            b[i] = _mm256_loadu_si256((const __m256i*)(yuyv1 + 2 * x + 32 * i));
+        }
+        _mm256_storeu_si256((__m256i*)(y0 + x), pack_low_bytes(a[0], a[1]));
+        _mm256_storeu_si256((__m256i*)(y0 + x + 32),
+                            pack_low_bytes(a[2], a[3]));
+        if (y1) {
+            _mm256_storeu_si256((__m256i*)(y1 + x),
+                                pack_low_bytes(b[0], b[1]));
+            _mm256_storeu_si256((__m256i*)(y1 + x + 32),
+                                pack_low_bytes(b[2], b[3]));
+        }
+
+        // uvuv.. of 32 pixels each, averaged over the rows
+        const __m256i uv0 = _mm256_avg_epu8(pack_high_bytes(a[0], a[1]),
+                                            pack_high_bytes(b[0], b[1]));
+        const __m256i uv1 = _mm256_avg_epu8(pack_high_bytes(a[2], a[3]),
+                                            pack_high_bytes(b[2], b[3]));
+        _mm256_storeu_si256((__m256i*)(u + x / 2), pack_low_bytes(uv0, uv1));
+        _mm256_storeu_si256((__m256i*)(v + x / 2), pack_high_bytes(uv0, uv1));
+    }
+    return x;
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+__m128i pack_low_bytes(__m128i a, __m128i b) {
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    return _mm_packus_epi16(_mm_and_si128(a, low_bytes),
+                            _mm_and_si128(b, low_bytes));
+}
+
+__m128i pack_high_bytes(__m128i a, __m128i b) {
+    return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+// returns the first pixel left for the scalar loop
+int repack_rows_simd(int width,
+                     const uint8_t* yuyv0,
+                     const uint8_t* yuyv1,
+                     uint8_t* y0,
+                     uint8_t* y1,
+                     uint8_t* u,
+                     uint8_t* v) {
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m128i a[4];
+        __m128i b[4];
+        for (int i = 0; i < 4; ++i) {
+            a[i] = _mm_loadu_si128((const __m128i*)(yuyv0 + 2 * x + 16 * i));
+            b[i] = _mm_loadu_si128((const __m128i*)(yuyv1 + 2 * x + 16 * i));
+        }
+        _mm_storeu_si128((__m128i*)(y0 + x), pack_low_bytes(a[0], a[1]));
+        _mm_storeu_si128((__m128i*)(y0 + x + 16), pack_low_bytes(a[2], a[3]));
+        if (y1) {
+            _mm_storeu_si128((__m128i*)(y1 + x), pack_low_bytes(b[0], b[1]));
+            _mm_storeu_si128((__m128i*)(y1 + x + 16),
+                             pack_low_bytes(b[2], b[3]));
+        }
+
+        // uvuv.. of 16 pixels each, averaged over the rows
+        const __m128i uv0 = _mm_avg_epu8(pack_high_bytes(a[0], a[1]),
+                                         pack_high_bytes(b[0], b[1]));
+        const __m128i uv1 = _mm_avg_epu8(pack_high_bytes(a[2], a[3]),
+                                         pack_high_bytes(b[2], b[3]));
+        _mm_storeu_si128((__m128i*)(u + x / 2), pack_low_bytes(uv0, uv1));
+        _mm_storeu_si128((__m128i*)(v + x / 2), pack_high_bytes(uv0, uv1));
+    }
+    return x;
+}
+
+#else
+
+int repack_rows_simd(int width,
+                     const uint8_t* yuyv0,
+                     const uint8_t* yuyv1,
+                     uint8_t* y0,
+                     uint8_t* y1,
+                     uint8_t* u,
+                     uint8_t* v) {
+    return 0;
+}
+
+#endif
+
+}  // namespace
+
+void yuyv_to_i420(int width,
+                  int height,
+                  const uint8_t* yuyv,
+                  int yuyv_stride,
+                  uint8_t* y,
+                  uint8_t* u,
+                  uint8_t* v,
+                  int y_stride,
+                  int uv_stride) {
+    CHECK_EQ(width % 2, 0) << "yuyv pixels come in pairs";
+    for (int row = 0; row < height; row += 2) {
+        const uint8_t* yuyv0 = yuyv + row * yuyv_stride;
+        uint8_t* y0 = y + row * y_stride;
+        const bool have_pair = row + 1 < height;
+        const uint8_t* yuyv1 = have_pair ? yuyv0 + yuyv_stride : yuyv0;
+        uint8_t* y1 = have_pair ? y0 + y_stride : nullptr;
+        uint8_t* u_row = u + row / 2 * uv_stride;
+        uint8_t* v_row = v + row / 2 * uv_stride;
+
+        const int x =
+            repack_rows_simd(width, yuyv0, yuyv1, y0, y1, u_row, v_row);
+        repack_rows_scalar(x, width, yuyv0, yuyv1, y0, y1, u_row, v_row);
+    }
+}
+
+}  // namespace realsense_streaming
+}  // namespace axby
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+namespace axby {
+namespace realsense_streaming {
+
+// repacks yuyv, the packed 4:2:2 format the rgb camera sends natively,
+// into planar 4:2:0, eg straight into the planes of a vpx_image_t.
+// chroma is averaged over each pair of rows. width has to be even.
+// uses avx2 when compiled for it, else sse2 on x86.
+void yuyv_to_i420(int width,
+                  int height,
+                  const uint8_t* yuyv,
+                  int yuyv_stride,
+                  uint8_t* y,
+                  uint8_t* u,
+                  uint8_t* v,
+                  int y_stride,
+                  int uv_stride);
+
+}  // namespace realsense_streaming
+}  // namespace axby
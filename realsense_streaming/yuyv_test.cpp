@@ -0,0 +1,71 @@
+#include "realsense_streaming/yuyv.h"
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using namespace axby;
+using namespace realsense_streaming;
+
+namespace {
+
+struct Planes {
+    Planes(int width, int height, int padding)
+        : y_stride(width + padding), uv_stride(width / 2 + padding) {
+        y.resize(y_stride * height);
+        u.resize(uv_stride * ((height + 1) / 2));
+        v.resize(uv_stride * ((height + 1) / 2));
+    }
+
+    int y_stride = 0;
+    int uv_stride = 0;
+    std::vector<uint8_t> y;
+    std::vector<uint8_t> u;
+    std::vector<uint8_t> v;
+};
+
+void check_repack(int width, int height, int padding) {
+    std::mt19937 rng(width * 1000 + height);
+    const int yuyv_stride = 2 * width + padding;
+    std::vector<uint8_t> yuyv(yuyv_stride * height);
+    for (auto& byte : yuyv) byte = rng();
+
+    Planes planes(width, height, padding);
+    yuyv_to_i420(width, height, yuyv.data(), yuyv_stride, planes.y.data(),
+                 planes.u.data(), planes.v.data(), planes.y_stride,
+                 planes.uv_stride);
+
+    for (int row = 0; row < height; ++row) {
+        for (int x = 0; x < width; ++x) {
+            ASSERT_EQ(planes.y[row * planes.y_stride + x],
+                      yuyv[row * yuyv_stride + 2 * x])
+                << width << "x" << height << " at " << x << "," << row;
+        }
+    }
+    for (int row = 0; row < height; row += 2) {
+        const int next_row = std::min(row + 1, height - 1);
+        for (int x = 0; x < width; x += 2) {
+            const uint8_t* p0 = &yuyv[row * yuyv_stride + 2 * x];
+            const uint8_t* p1 = &yuyv[next_row * yuyv_stride + 2 * x];
+            const int uv_idx = row / 2 * planes.uv_stride + x / 2;
+            ASSERT_EQ(planes.u[uv_idx], (p0[1] + p1[1] + 1) / 2)
+                << width << "x" << height << " at " << x << "," << row;
+            ASSERT_EQ(planes.v[uv_idx], (p0[3] + p1[3] + 1) / 2)
+                << width << "x" << height << " at " << x << "," << row;
+        }
+    }
+}
+
+}  // namespace
+
+TEST(Yuyv, to_i420) { check_repack(640, 480, /*padding=*/0); }
+
+TEST(Yuyv, to_i420_with_tails_and_padding) {
+    for (int width : {2, 30, 32, 66, 126, 130, 1280}) {
+        for (int height : {1, 2, 5}) {
+            check_repack(width, height, /*padding=*/0);
+            check_repack(width, height, /*padding=*/7);
+        }
+    }
+}
@@ -82,12 +82,6 @@
 namespace axby {
 namespace time_sync {
 
-struct TimeSyncState {
-    int64_t offset_estimate_us;
-    uint64_t observed_round_trip_time_us;
-    uint64_t min_round_trip_time_us;
-};
-
 std::atomic<bool> got_first_sync_message_ = false;
 std::atomic<int64_t> offset_estimate_us_ = 0;
 std::atomic<uint64_t> min_round_trip_time_us_ = UINT64_MAX;
@@ -9,6 +9,14 @@
 namespace axby {
 namespace time_sync {
 
+// published on topic "time_sync" by each synced process, and recorded
+// into its logs
+struct TimeSyncState {
+    int64_t offset_estimate_us;  // time server time - process time
+    uint64_t observed_round_trip_time_us;
+    uint64_t min_round_trip_time_us;
+};
+
 struct Options {
     double window_duration_sec;
     int blast_size = 20;
@@ -35,17 +35,19 @@ DuckDbResult::DuckDbResult(duckdb_connection con, const char* sql) {
 };
 
 DuckDbResult::~DuckDbResult() {
-    if (fetched_any_ && bool(chunk_)) {
-        duckdb_destroy_data_chunk(&chunk_);
-    }
+    chunk_owner_.reset();
     duckdb_destroy_result(&result_);
 }
 bool DuckDbResult::fetch_chunk() {
-    if (fetched_any_) {
-        // release previous chunk
-        duckdb_destroy_data_chunk(&chunk_);
-    }
+    // release previous chunk, unless it is still shared
+    chunk_owner_.reset();
     chunk_ = duckdb_fetch_chunk(result_);
+    if (chunk_) {
+        chunk_owner_ = std::shared_ptr<_duckdb_data_chunk>(
+            chunk_, [](duckdb_data_chunk chunk) {
+                duckdb_destroy_data_chunk(&chunk);
+            });
+    }
     fetched_any_ = true;
 
     return !is_done();
@@ -95,6 +97,33 @@ void DuckDbPreparedStatement::bind_param_string(const char* param_name,
         prepared_statement_);
 }
 
+void DuckDbPreparedStatement::bind_param_string_list(
+    const char* param_name, std::span<const std::string> values) {
+    idx_t idx = 0;
+    DUCKDB_CHECKED_PREPARE(
+        duckdb_bind_parameter_index(prepared_statement_, &idx, param_name),
+        prepared_statement_);
+
+    // the C API rejects a null values pointer, even for an empty list
+    std::vector<duckdb_value> items;
+    items.reserve(values.size() + 1);
+    for (const auto& value : values) {
+        items.push_back(
+            duckdb_create_varchar_length(value.data(), value.size()));
+    }
+    duckdb_logical_type varchar_type =
+        duckdb_create_logical_type(DUCKDB_TYPE_VARCHAR);
+    duckdb_value list =
+        duckdb_create_list_value(varchar_type, items.data(), items.size());
+    CHECK(list != nullptr);
+    DUCKDB_CHECKED_PREPARE(duckdb_bind_value(prepared_statement_, idx, list),
+                           prepared_statement_);
+
+    duckdb_destroy_value(&list);
+    duckdb_destroy_logical_type(&varchar_type);
+    for (auto& item : items) duckdb_destroy_value(&item);
+}
+
 void DuckDbPreparedStatement::execute() {
     CHECK(!result_.has_value());
 
@@ -105,6 +134,28 @@ void DuckDbPreparedStatement::execute() {
     result_.emplace(result);
 }
 
+void DuckDbPreparedStatement::execute_streaming() {
+    CHECK(!result_.has_value());
+
+    duckdb_pending_result pending;
+    if (duckdb_pending_prepared_streaming(prepared_statement_, &pending) ==
+        DuckDBError) {
+        LOG(FATAL) << duckdb_pending_error(pending);
+    }
+
+    duckdb_result result;
+    DUCKDB_CHECKED_QUERY(duckdb_execute_pending(pending, &result), &result);
+    duckdb_destroy_pending(&pending);
+
+    result_.emplace(result);
+}
+
+void DuckDbPreparedStatement::reset() {
+    result_.reset();
+    DUCKDB_CHECKED_PREPARE(duckdb_clear_bindings(prepared_statement_),
+                           prepared_statement_);
+}
+
 DuckDbResult& DuckDbPreparedStatement::result() {
     CHECK(result_.has_value());
     return *result_;
@@ -1,7 +1,11 @@
 #pragma once
 
 #include <duckdb.h>
+#include <memory>
 #include <optional>
+#include <span>
+#include <string>
+#include <vector>
 
 #include <cstdint>
 #include <string_view>
@@ -128,10 +132,15 @@ class DuckDbResult {
     // get num rows of the current chunk
     idx_t get_num_rows();
 
+    // keeps the current chunk alive past the next fetch_chunk() and
+    // past the result, for pointing into its data without copying
+    std::shared_ptr<const void> share_chunk() const { return chunk_owner_; }
+
    private:
     bool fetched_any_ = false;
     duckdb_result result_;
-    duckdb_data_chunk chunk_;
+    duckdb_data_chunk chunk_ = nullptr;
+    std::shared_ptr<_duckdb_data_chunk> chunk_owner_;
 };
 
 // RAII Helper
@@ -160,8 +169,20 @@ class DuckDbPreparedStatement {
 
     void bind_param_uint64(const char* param_name, uint64_t value);
     void bind_param_string(const char* param_name, std::string_view value);
+    // binds a varchar[], eg for list_contains($param, column)
+    void bind_param_string_list(const char* param_name,
+                                std::span<const std::string> values);
     void execute();
 
+    // like execute(), but the result is produced incrementally as
+    // chunks are fetched instead of being materialized up front. use
+    // for large scans that are consumed as they go.
+    void execute_streaming();
+
+    // releases the result and clears bound parameters, so the
+    // statement can be bound and executed again without re-preparing
+    void reset();
+
     // must call execute() first before accessing result
     DuckDbResult& result();
 
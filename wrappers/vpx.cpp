@@ -1,8 +1,11 @@
+#include "wrappers/vpx.h"
+
 #include <vpx/vp8cx.h>
 #include <vpx/vp8dx.h>
 #include <vpx/vpx_decoder.h>
 #include <vpx/vpx_encoder.h>
 
+#include <algorithm>
 #include <memory>
 
 #include "debug/log.h"
@@ -11,12 +14,48 @@ void log_vpx_error(vpx_codec_ctx_t* ctx) {
     LOG(ERROR) << "vpx error " << vpx_codec_error(ctx);
 }
 
-std::shared_ptr<vpx_codec_ctx_t> init_vpx_encoder(unsigned int profile,
-                                                  unsigned int width,
-                                                  unsigned int height,
-                                                  int fps,
-                                                  unsigned int bitrate,
-                                                  bool lossless) {
+VpxEncoderPreset get_vpx_encoder_preset(unsigned int width, int num_threads) {
+    VpxEncoderPreset preset;
+
+    // vp9 tile columns are at least 256 pixels wide, so 640 wide frames
+    // get 2 and 1280 wide frames 4
+    int max_log2_tile_columns = 0;
+    while ((width >> (max_log2_tile_columns + 1)) >= 256) {
+        ++max_log2_tile_columns;
+    }
+
+    // a tile column per thread. tiles cost a little compression, so
+    // there are no more tile columns than threads.
+    num_threads = std::max(num_threads, 1);
+    preset.log2_tile_columns = 0;
+    while (preset.log2_tile_columns < max_log2_tile_columns &&
+           (2 << preset.log2_tile_columns) <= num_threads) {
+        ++preset.log2_tile_columns;
+    }
+
+    // threads beyond the tile columns only help with row based
+    // multithreading. it encodes the rows of 64 pixel superblocks of a
+    // tile as a wavefront, where a row trails the row above by two
+    // superblocks, so a tile keeps about half its width in superblocks
+    // busy.
+    const int num_tile_columns = 1 << preset.log2_tile_columns;
+    const int num_superblock_columns = (width + 63) / 64;
+    const int max_rows_per_tile =
+        std::max(num_superblock_columns / num_tile_columns / 2, 1);
+    preset.threads =
+        std::min(num_threads, num_tile_columns * max_rows_per_tile);
+    preset.row_mt = int(preset.threads) > num_tile_columns;
+    return preset;
+}
+
+std::shared_ptr<vpx_codec_ctx_t> init_vpx_encoder(
+    unsigned int profile,
+    unsigned int width,
+    unsigned int height,
+    int fps,
+    unsigned int bitrate,
+    bool lossless,
+    const VpxEncoderPreset& preset) {
     vpx_codec_iface_t* iface = &vpx_codec_vp9_cx_algo;
 
     vpx_codec_enc_cfg_t cfg;
@@ -44,7 +83,7 @@ std::shared_ptr<vpx_codec_ctx_t> init_vpx_encoder(unsigned int profile,
     cfg.g_error_resilient = 1;
     cfg.kf_mode = VPX_KF_DISABLED;
     cfg.kf_max_dist = 300;
-    cfg.g_threads = 2;
+    cfg.g_threads = preset.threads;
     cfg.rc_resize_allowed = 0;
     cfg.rc_target_bitrate = bitrate;
 
@@ -61,11 +100,13 @@ std::shared_ptr<vpx_codec_ctx_t> init_vpx_encoder(unsigned int profile,
     }
 
     // Options copied and pasted from Google's udpsample project
-    vpx_codec_control(encoder.get(), VP8E_SET_CPUUSED, 8);
+    vpx_codec_control(encoder.get(), VP8E_SET_CPUUSED, preset.cpu_used);
     vpx_codec_control(encoder.get(), VP8E_SET_STATIC_THRESHOLD, 1200);
     vpx_codec_control(encoder.get(), VP8E_SET_ENABLEAUTOALTREF, 0);
     vpx_codec_control(encoder.get(), VP9E_SET_AQ_MODE, 3);
-    vpx_codec_control(encoder.get(), VP9E_SET_TILE_COLUMNS, 2);
+    vpx_codec_control(encoder.get(), VP9E_SET_TILE_COLUMNS,
+                      preset.log2_tile_columns);
+    vpx_codec_control(encoder.get(), VP9E_SET_ROW_MT, preset.row_mt ? 1 : 0);
     vpx_codec_control(encoder.get(), VP9E_SET_FRAME_PARALLEL_DECODING, 1);
     vpx_codec_control(encoder.get(), VP8E_SET_ENABLEAUTOALTREF, 0);
     vpx_codec_control(encoder.get(), VP8E_SET_GF_CBR_BOOST_PCT, 200);
@@ -77,6 +118,17 @@ std::shared_ptr<vpx_codec_ctx_t> init_vpx_encoder(unsigned int profile,
     return encoder;
 }
 
+bool set_vpx_encoder_bitrate(vpx_codec_ctx_t* encoder, unsigned int bitrate) {
+    vpx_codec_enc_cfg_t cfg = *encoder->config.enc;
+    if (cfg.rc_target_bitrate == bitrate) return true;
+    cfg.rc_target_bitrate = bitrate;
+    if (vpx_codec_enc_config_set(encoder, &cfg) != VPX_CODEC_OK) {
+        log_vpx_error(encoder);
+        return false;
+    }
+    return true;
+}
+
 std::shared_ptr<vpx_codec_ctx> init_vpx_decoder() {
     vpx_codec_iface_t* iface = &vpx_codec_vp9_dx_algo;
     vpx_codec_dec_cfg_t cfg = {0};
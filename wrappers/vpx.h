@@ -11,12 +11,41 @@ inline std::span<const std::byte> to_span(const vpx_codec_cx_pkt_t* pkt) {
     return {(const std::byte*)pkt->data.frame.buf, pkt->data.frame.sz};
 }
 
-std::shared_ptr<vpx_codec_ctx> init_vpx_encoder(unsigned int profile,
-                                                unsigned int width,
-                                                unsigned int height,
-                                                int fps,
-                                                unsigned int bitrate,
-                                                bool lossless);
+// how the vp9 encoder spreads the work of a frame across threads. the
+// defaults are the settings the encoder always had.
+struct VpxEncoderPreset {
+    unsigned int threads = 2;
+
+    // log2 of the number of tile columns. tiles are encoded in
+    // parallel, but a tile has to be at least 256 pixels wide.
+    int log2_tile_columns = 2;
+
+    // lets more threads than tile columns work on a frame, by
+    // encoding rows of superblocks in a wavefront
+    bool row_mt = false;
+
+    // speed versus quality, 8 is the fastest realtime setting
+    int cpu_used = 8;
+};
+
+// the preset that encodes frames of this width fastest with up to
+// num_threads threads. threads that would have no tile column or
+// superblock row to work on are left out.
+VpxEncoderPreset get_vpx_encoder_preset(unsigned int width, int num_threads);
+
+// bitrate is in kbps, like rc_target_bitrate
+std::shared_ptr<vpx_codec_ctx> init_vpx_encoder(
+    unsigned int profile,
+    unsigned int width,
+    unsigned int height,
+    int fps,
+    unsigned int bitrate,
+    bool lossless,
+    const VpxEncoderPreset& preset = {});
+
+// changes the target bitrate, in kbps, of a running encoder. takes
+// effect from the next frame. returns false if the encoder refused.
+bool set_vpx_encoder_bitrate(vpx_codec_ctx_t* encoder, unsigned int bitrate);
 
 std::shared_ptr<vpx_codec_ctx> init_vpx_decoder();
 
@@ -0,0 +1,223 @@
+// measures the time to encode a frame with the vp9 encoder of the
+// realsense server, over a sweep of resolutions and thread counts, so
+// the latency optimal --color_encoder_threads of a machine can be
+// picked. the frames are a synthetic textured scene that pans, with a
+// little sensor noise, and a keyframe every 2s like the server. eg
+//   bazel run -c opt //wrappers:vpx_encoder_benchmark --
+//   --sizes=1280x720 --threads=1,2,4,8
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "app/flag.h"
+#include "app/main.h"
+#include "debug/check.h"
+#include "debug/log.h"
+#include "math/latency_histogram.h"
+#include "wrappers/vpx.h"
+
+APP_FLAG(std::string, sizes, "640x480,1280x720", "comma separated wxh");
+APP_FLAG(std::string,
+         threads,
+         "1,2,4,0",
+         "comma separated threads per encoder, 0 for all cores");
+APP_FLAG(int, num_frames, 300, "frames encoded per run");
+APP_FLAG(int, fps, 30, "");
+APP_FLAG(int, bitrate, 72, "kbps target, like --color_bitrate of the server");
+APP_FLAG(int, cpu_used, 8, "vp9 speed setting");
+
+using namespace axby;
+
+namespace {
+
+struct Size {
+    unsigned int width = 0;
+    unsigned int height = 0;
+};
+
+struct EncoderOptions {
+    int num_frames = 0;
+    int fps = 0;
+    unsigned int bitrate = 0;  // kbps
+    int cpu_used = 0;
+};
+
+struct BenchmarkResult {
+    Size size;
+    int requested_threads = 0;
+    VpxEncoderPreset preset;
+    LatencyHistogram encode_time_us;
+    uint64_t num_bytes = 0;
+};
+
+// a texture of blobs, panned and shaded a little differently per
+// frame, which is roughly how a static scene looks to a hand held
+// camera
+class SceneGenerator {
+   public:
+    SceneGenerator(unsigned int width, unsigned int height)
+        : width_(width), height_(height) {
+        std::mt19937 rng(0);
+        texture_.resize(texture_size_ * texture_size_);
+        for (int y = 0; y < texture_size_; ++y) {
+            for (int x = 0; x < texture_size_; ++x) {
+                const double v = 128 + 60 * std::sin(x * 0.05) *
+                                           std::cos(y * 0.07) +
+                                 40 * std::sin((x + y) * 0.013);
+                texture_[y * texture_size_ + x] = uint8_t(v + rng() % 16);
+            }
+        }
+    }
+
+    void fill(int frame_idx, vpx_image_t& image) {
+        const int offset_x = frame_idx * 3;
+        const int offset_y = frame_idx;
+        for (unsigned int y = 0; y < height_; ++y) {
+            uint8_t* row = image.planes[VPX_PLANE_Y] +
+                           y * image.stride[VPX_PLANE_Y];
+            const uint8_t* texture_row =
+                &texture_[((y + offset_y) % texture_size_) * texture_size_];
+            for (unsigned int x = 0; x < width_; ++x) {
+                const int noise = int(rng_() % 5) - 2;
+                row[x] = uint8_t(std::clamp(
+                    texture_row[(x + offset_x) % texture_size_] + noise, 0,
+                    255));
+            }
+        }
+        for (int plane : {VPX_PLANE_U, VPX_PLANE_V}) {
+            for (unsigned int y = 0; y < (height_ + 1) / 2; ++y) {
+                uint8_t* row = image.planes[plane] + y * image.stride[plane];
+                for (unsigned int x = 0; x < (width_ + 1) / 2; ++x) {
+                    row[x] = uint8_t(128 + ((x + y + frame_idx) >> 4) % 32);
+                }
+            }
+        }
+    }
+
+   private:
+    static constexpr int texture_size_ = 1024;
+    unsigned int width_ = 0;
+    unsigned int height_ = 0;
+    std::vector<uint8_t> texture_;
+    std::mt19937 rng_{1};
+};
+
+BenchmarkResult run_benchmark(const Size& size,
+                              int num_threads,
+                              const EncoderOptions& options) {
+    BenchmarkResult result;
+    result.size = size;
+    result.requested_threads = num_threads;
+    if (num_threads <= 0) {
+        num_threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+    }
+    result.preset = get_vpx_encoder_preset(size.width, num_threads);
+    result.preset.cpu_used = options.cpu_used;
+
+    auto encoder = init_vpx_encoder(/*profile=*/0, size.width, size.height,
+                                    options.fps, options.bitrate,
+                                    /*lossless=*/false,
+                                    result.preset);
+    CHECK(encoder) << "Could not create the encoder";
+    auto image =
+        init_vpx_img(VPX_IMG_FMT_I420, size.width, size.height, /*align=*/0);
+
+    SceneGenerator scene(size.width, size.height);
+    const int keyframe_interval = 2 * options.fps;
+    for (int frame_idx = 0; frame_idx < options.num_frames; ++frame_idx) {
+        scene.fill(frame_idx, *image);
+        const int flags =
+            frame_idx % keyframe_interval == 0 ? VPX_EFLAG_FORCE_KF : 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        CHECK(vpx_codec_encode(encoder.get(), image.get(), /*pts=*/frame_idx,
+                               /*duration=*/1, flags,
+                               VPX_DL_REALTIME) == VPX_CODEC_OK)
+            << vpx_codec_error(encoder.get());
+        vpx_codec_iter_t iter = nullptr;
+        while (const vpx_codec_cx_pkt_t* pkt =
+                   vpx_codec_get_cx_data(encoder.get(), &iter)) {
+            if (pkt->kind == VPX_CODEC_CX_FRAME_PKT) {
+                result.num_bytes += pkt->data.frame.sz;
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+        result.encode_time_us.record(
+            std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+                .count());
+    }
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    __APP_MAIN_INIT__;
+
+    APP_UNPACK_FLAG(sizes);
+    APP_UNPACK_FLAG(threads);
+    APP_UNPACK_FLAG(num_frames);
+    APP_UNPACK_FLAG(fps);
+    APP_UNPACK_FLAG(bitrate);
+    APP_UNPACK_FLAG(cpu_used);
+
+    CHECK_GT(num_frames, 0);
+    CHECK_GT(fps, 0);
+
+    std::vector<Size> parsed_sizes;
+    for (const auto& size : absl::StrSplit(sizes, ',')) {
+        std::vector<std::string> wh = absl::StrSplit(size, 'x');
+        Size parsed;
+        CHECK(wh.size() == 2 && absl::SimpleAtoi(wh[0], &parsed.width) &&
+              absl::SimpleAtoi(wh[1], &parsed.height))
+            << "Bad size " << size;
+        parsed_sizes.push_back(parsed);
+    }
+    std::vector<int> parsed_threads;
+    for (const auto& num_threads : absl::StrSplit(threads, ',')) {
+        int parsed = 0;
+        CHECK(absl::SimpleAtoi(num_threads, &parsed))
+            << "Bad thread count " << num_threads;
+        parsed_threads.push_back(parsed);
+    }
+
+    const EncoderOptions options{.num_frames = num_frames,
+                                 .fps = fps,
+                                 .bitrate = (unsigned int)bitrate,
+                                 .cpu_used = cpu_used};
+    std::vector<BenchmarkResult> results;
+    for (const auto& size : parsed_sizes) {
+        for (const int num_threads : parsed_threads) {
+            LOG(INFO) << "Encoding " << num_frames << " frames of "
+                      << size.width << "x" << size.height << " with "
+                      << num_threads << " threads";
+            results.push_back(run_benchmark(size, num_threads, options));
+        }
+    }
+
+    LOG(INFO) << absl::StrFormat("%-10s %8s %8s %6s %7s %9s %9s %9s %8s",
+                                 "size", "threads", "encoder", "tiles",
+                                 "row_mt", "mean ms", "p50 ms", "p99 ms",
+                                 "kbps");
+    for (const auto& result : results) {
+        const auto& time_us = result.encode_time_us;
+        const double kbps =
+            result.num_bytes * 8 / (double(num_frames) / fps) / 1000;
+        LOG(INFO) << absl::StrFormat(
+            "%-10s %8d %8d %6d %7d %9.2f %9.2f %9.2f %8.0f",
+            absl::StrFormat("%dx%d", result.size.width, result.size.height),
+            result.requested_threads, result.preset.threads,
+            1 << result.preset.log2_tile_columns, result.preset.row_mt,
+            time_us.get_mean() / 1e3, time_us.get_quantile(0.5) / 1e3,
+            time_us.get_quantile(0.99) / 1e3, kbps);
+    }
+    return 0;
+}